@@ -0,0 +1,209 @@
+#include <AF_HAL/sim_hal.h>
+#include <AF_Context/AF_Context.h>
+#include <AF_Scheduler/AF_Scheduler.h>
+
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Simulation farm: every variant flies in its own vehicle context, and a pool of host
+// threads advances them a slice at a time on their own virtual clocks, see sim_hal.h
+
+namespace AF_HAL {
+
+    namespace sim {
+
+        /// @brief one variant's flight, from its first slice to its score
+        struct Farm_Job {
+            uint32_t variant;
+            /// made on the first slice, so only the vehicles in flight take up memory
+            AF_Context* context;
+            AF_Sim_Farm_Vehicle* vehicle;
+            /// how far the vehicle has flown, in microseconds of its own clock
+            uint32_t flown_us;
+        };
+
+        /// @brief a worker's jobs. the worker takes from the back, where it just put the
+        ///        vehicle it's flying, and other workers steal from the front, where the
+        ///        vehicles nobody has started wait.
+        class Farm_Queue {
+
+            public:
+
+                void push(Farm_Job* job) {
+                    std::lock_guard<std::mutex> guard(_lock);
+                    _jobs.push_back(job);
+                }
+
+                Farm_Job* pop(void) {
+                    std::lock_guard<std::mutex> guard(_lock);
+                    if (_jobs.empty()) return nullptr;
+                    Farm_Job* job = _jobs.back();
+                    _jobs.pop_back();
+                    return job;
+                }
+
+                Farm_Job* steal(void) {
+                    std::lock_guard<std::mutex> guard(_lock);
+                    if (_jobs.empty()) return nullptr;
+                    Farm_Job* job = _jobs.front();
+                    _jobs.pop_front();
+                    return job;
+                }
+
+            private:
+
+                std::mutex _lock;
+                std::deque<Farm_Job*> _jobs;
+
+        };
+
+        /// @brief what a farm run shares between the workers
+        struct Farm_Run {
+            af_sim_farm_factory_t factory;
+            const AF_Sim_Farm_Variant* variants;
+            uint32_t duration_us;
+            float* scores;
+            std::vector<Farm_Queue> queues;
+            /// variants not scored yet
+            std::atomic<uint32_t> remaining;
+            std::atomic<uint32_t> steals;
+
+            Farm_Run(uint8_t threads) : queues(threads), remaining(0), steals(0) {}
+        };
+
+        /// @brief flies a vehicle for a slice
+        /// @return true once the flight is over and scored
+        static bool _farm_slice(Farm_Run& run, Farm_Job& job) {
+            if (job.context == nullptr) {
+                job.context = new AF_Context();
+                AF_Context_Scope scope(*job.context);
+                job.vehicle = run.factory();
+                job.vehicle->setup(run.variants[job.variant]);
+            }
+
+            AF_Context_Scope scope(*job.context);
+            uint32_t slice = run.duration_us - job.flown_us;
+            if (slice > AF_SIM_FARM_SLICE_US) slice = AF_SIM_FARM_SLICE_US;
+            uint32_t end = AF_HAL::micros() + slice;
+            AF_Scheduler* scheduler = AF_Scheduler::get_instance();
+            while (!AF_HAL::time_reached(AF_HAL::micros(), end)) scheduler->tick();
+            job.flown_us += slice;
+            if (job.flown_us < run.duration_us) return false;
+
+            run.scores[job.variant] = job.vehicle->score();
+            delete job.vehicle;
+            job.vehicle = nullptr;
+            return true;
+        }
+
+        /// @brief flies vehicles until every variant is scored
+        static void _farm_worker(Farm_Run& run, uint8_t self) {
+            uint8_t workers = run.queues.size();
+            while (run.remaining.load() > 0) {
+                Farm_Job* job = run.queues[self].pop();
+                for (uint8_t n = 1; job == nullptr && n < workers; n++) {
+                    job = run.queues[(self + n) % workers].steal();
+                    if (job != nullptr) run.steals++;
+                }
+                if (job == nullptr) {
+                    // the last vehicles are in flight on other workers
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                if (!_farm_slice(run, *job)) {
+                    run.queues[self].push(job);
+                    continue;
+                }
+                // the context goes once the scope inside _farm_slice() has been left
+                delete job->context;
+                job->context = nullptr;
+                run.remaining--;
+            }
+        }
+
+        /// @brief draws a number in [0, 1) for the batch's conditions
+        static float _farm_draw(uint32_t& rng) {
+            // xorshift, so a seed repeats a batch on any host
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            return (rng >> 8) / 16777216.0f;
+        }
+
+        /// @brief gets a point on a gain's sweep
+        static float _farm_step(float min, float max, uint8_t step, uint8_t steps) {
+            return steps > 1 ? min + (max - min) * step / (steps - 1) : min;
+        }
+
+        uint32_t farm_batch(const AF_Sim_Farm_Batch& batch, AF_Sim_Farm_Variant* variants, uint32_t max) {
+            uint32_t rng = batch.seed != 0 ? batch.seed : 1;
+            uint32_t count = 0;
+            for (uint8_t p = 0; p < batch.steps; p++) {
+                for (uint8_t i = 0; i < batch.steps; i++) {
+                    for (uint8_t d = 0; d < batch.steps; d++) {
+                        for (uint16_t t = 0; t < batch.trials; t++) {
+                            if (count == max) return count;
+                            AF_Sim_Farm_Variant& variant = variants[count++];
+                            variant.kp = _farm_step(batch.kp_min, batch.kp_max, p, batch.steps);
+                            variant.ki = _farm_step(batch.ki_min, batch.ki_max, i, batch.steps);
+                            variant.kd = _farm_step(batch.kd_min, batch.kd_max, d, batch.steps);
+                            variant.noise_lsb = (uint8_t)(_farm_draw(rng) * (batch.noise_lsb_max + 1));
+                            variant.wind = (2.0f * _farm_draw(rng) - 1.0f) * batch.wind_max;
+                            variant.gust = _farm_draw(rng) * batch.gust_max;
+                            variant.seed = rng;
+                        }
+                    }
+                }
+            }
+            return count;
+        }
+
+        void farm_run(af_sim_farm_factory_t factory, const AF_Sim_Farm_Variant* variants, uint32_t count,
+                      uint32_t duration_us, uint8_t threads, float* scores, AF_Sim_Farm_Report& report) {
+            report = AF_Sim_Farm_Report();
+            if (threads == 0) {
+                unsigned int cores = std::thread::hardware_concurrency();
+                threads = cores == 0 ? 1 : (cores > 255 ? 255 : cores);
+            }
+
+            Farm_Run run(threads);
+            run.factory = factory;
+            run.variants = variants;
+            run.duration_us = duration_us;
+            run.scores = scores;
+            run.remaining = count;
+
+            // each worker starts with a run of neighbouring variants, and the workers that
+            // finish first take over the rest
+            std::vector<Farm_Job> jobs(count);
+            for (uint32_t i = 0; i < count; i++) {
+                jobs[i] = { i, nullptr, nullptr, 0 };
+                run.queues[(uint64_t)i * threads / count].push(&jobs[i]);
+            }
+
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            std::vector<std::thread> workers;
+            for (uint8_t w = 0; w < threads; w++) workers.emplace_back(_farm_worker, std::ref(run), w);
+            for (std::thread& worker : workers) worker.join();
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            report.threads = threads;
+            report.steals = run.steals.load();
+            report.sim_s = (double)count * duration_us / 1e6;
+            report.wall_s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            report.best = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                if (scores[i] < scores[report.best]) report.best = i;
+            }
+            report.best_score = count > 0 ? scores[report.best] : 0;
+        }
+
+    }
+
+}
@@ -0,0 +1,843 @@
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/sim_hal.h>
+#include <AF_HAL/serial_hal.h>
+#include <AF_HAL/adc_hal.h>
+#include <AF_HAL/pin_hal.h>
+#include <AF_HAL/pwm_hal.h>
+#include <AF_HAL/rcin_hal.h>
+#include <AF_HAL/twi_hal.h>
+#include <AF_HAL/spi_hal.h>
+#include <AF_HAL/eeprom_hal.h>
+#include <AF_Profiler/AF_Profiler.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Host (Linux) HAL for running AutoFlight in simulator mode (no hardware)
+
+// the serial buffers are the same size as the largest AVR configuration
+#define SIM_SERIAL_RX_BUF_SIZE 128
+#define SIM_SERIAL_TX_BUF_SIZE 128
+// how often the serial ports are serviced, in simulator microseconds. at 115200 baud
+// this is about one byte, and it keeps syscalls out of the virtual clock's fast path.
+#define SIM_SERIAL_POLL_US 100
+/// the size of the simulated EEPROM, the same as the 2560's
+#define SIM_EEPROM_SIZE 4096
+
+namespace AF_HAL {
+
+    namespace sim {
+
+        /// @brief everything one simulated board holds, see board_create()
+        struct AF_Sim_Board {
+            /// the clock mode
+            AF_Sim_Clock_Mode _clock_mode = AF_SIM_CLOCK_REALTIME;
+            /// host monotonic time at init, so the realtime clock starts near 0 like the AVR
+            uint64_t _realtime_origin_ns = 0;
+            /// the virtual clock, in microseconds
+            uint64_t _virtual_now_us = 0;
+            /// how far each call to micros() advances the virtual clock
+            uint16_t _virtual_us_per_call = 1;
+            /// guards against poll() re-entering itself through micros()
+            bool _in_poll = false;
+            /// when the serial ports were last serviced
+            uint32_t _serial_last_us = 0;
+
+            /// the sensor/physics model
+            AF_Sim_Model* _model = nullptr;
+            /// how often the model is stepped
+            uint32_t _model_period_us = AF_SIM_DEFAULT_MODEL_PERIOD_US;
+            /// when the model was last stepped
+            uint32_t _model_last_us = 0;
+            /// how many times the model has been stepped
+            uint32_t _model_steps = 0;
+
+            /// the virtual analog inputs
+            uint16_t _adc[AF_SIM_ADC_CHANNELS] = {};
+            /// the virtual pwm outputs, as pulse widths in microseconds
+            uint16_t _pwm[AF_SIM_PWM_CHANNELS] = {};
+            /// the pin the ADC sequencer stand-in is converting
+            uint8_t _adc_seq_pin = 0;
+            /// when the ADC sequencer stand-in finishes its current conversion
+            uint32_t _adc_seq_done_us = 0;
+            /// whether the ADC sequencer stand-in is converting
+            bool _adc_seq_running = false;
+            /// noise added to each sequencer conversion, in counts
+            uint8_t _adc_noise_lsb = 0;
+            /// devices on the mock TWI bus
+            AF_Sim_TWI_Device* _twi_devices[AF_SIM_TWI_MAX_DEVICES] = {};
+            /// how long one byte (8 bits and the acknowledge) takes on the mock TWI bus
+            uint16_t _twi_byte_us = 23;
+            /// whether a start has been sent and no stop since
+            bool _twi_bus_owned = false;
+            /// whether the next byte written is an address
+            bool _twi_addressing = false;
+            /// the device addressed since the last start, or nullptr
+            AF_Sim_TWI_Device* _twi_device = nullptr;
+            /// whether a bus event is in flight
+            bool _twi_pending = false;
+            /// the status code the event in flight reports
+            uint8_t _twi_status = 0;
+            /// the byte the event in flight received
+            uint8_t _twi_data = 0;
+            /// when the event in flight finishes
+            uint32_t _twi_done_us = 0;
+            /// when the last event finished, while its status is being handled
+            uint32_t _twi_base_us = 0;
+            /// whether the last event's status is being handled
+            bool _twi_in_step = false;
+            /// whether the next event should fail
+            bool _twi_fault_armed = false;
+            /// how the next event should fail
+            AF_Sim_TWI_Fault _twi_fault = AF_SIM_TWI_FAULT_BUS_ERROR;
+            /// the other end of the SPI link, or nullptr for loopback
+            AF_Sim_SPI_Peer* _spi_peer = nullptr;
+            /// whether the firmware is the SPI master
+            bool _spi_master = true;
+            /// whether the master is shifting a byte
+            bool _spi_pending = false;
+            /// the byte coming back on MISO
+            uint8_t _spi_in = 0;
+            /// when the byte being shifted finishes
+            uint32_t _spi_done_us = 0;
+            /// when the last byte finished, while it's being handled
+            uint32_t _spi_base_us = 0;
+            /// whether the last byte is being handled
+            bool _spi_in_step = false;
+            /// the byte the firmware loaded as a slave
+            uint8_t _spi_slave_out = 0;
+            /// the state of the ADC sequencer stand-in's noise, so a board's noise repeats
+            uint32_t _adc_noise_rng = 1;
+            /// the pwm engine, see pwm_hal.h
+            AF_HAL::pwm::_Engine _pwm_engine;
+            /// bit n is set if pwm channel n is connected
+            uint16_t _pwm_enabled = 0;
+            /// the EEPROM. it lasts as long as the board, like a reboot with power kept on.
+            uint8_t _eeprom[SIM_EEPROM_SIZE];
+            /// whether _eeprom has been erased to 0xFF yet
+            bool _eeprom_erased = false;
+        };
+
+        /// the board code outside any context runs on
+        static AF_Sim_Board _process_board;
+        /// the board each thread is running on, see board_enter()
+        static thread_local AF_Sim_Board* _board = &_process_board;
+        /// the lock behind AF_ATOMIC_BLOCK
+        static std::recursive_mutex _atomic_lock;
+
+        /// simulated port registers, see pin_hal.h
+        volatile uint8_t _port_regs[AF_NUM_PORTS][3];
+
+        static uint64_t _host_monotonic_ns(void) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        }
+
+        /// @brief reads the full clock without advancing it or servicing the simulator
+        static uint64_t _now_us64(void) {
+            if (_board->_clock_mode == AF_SIM_CLOCK_VIRTUAL) return _board->_virtual_now_us;
+            return (_host_monotonic_ns() - _board->_realtime_origin_ns) / 1000ULL;
+        }
+
+        /// @brief reads the clock without advancing it or servicing the simulator
+        static uint32_t _now_us(void) {
+            return (uint32_t)_now_us64();
+        }
+
+        /// @brief steps the model for every period that has elapsed up to now
+        static void _step_model(uint32_t now) {
+            if (_board->_model == nullptr) {
+                _board->_model_last_us = now;
+                return;
+            }
+            while ((uint32_t)(now - _board->_model_last_us) >= _board->_model_period_us) {
+                _board->_model_last_us += _board->_model_period_us;
+                _board->_model->update(_board->_model_last_us, _board->_model_period_us, _board->_pwm, _board->_adc);
+                _board->_model_steps++;
+            }
+        }
+
+        /// @brief starts a bus event on the mock TWI bus, reporting a status when it finishes
+        /// @param status   the TWI status code to report
+        /// @param data     the received byte to report
+        /// @param extra_us clock stretching on top of the byte time
+        static void _twi_schedule(uint8_t status, uint8_t data, uint16_t extra_us) {
+            if (_board->_twi_fault_armed) {
+                _board->_twi_fault_armed = false;
+                if (_board->_twi_fault == AF_SIM_TWI_FAULT_HANG) {
+                    // nothing ever finishes, the engine has to time out
+                    _board->_twi_pending = false;
+                    return;
+                }
+                status = 0x00;
+            }
+            // events chain off the end of the last one, so the bus keeps its pace however
+            // far the clock jumps between polls
+            uint32_t base = _board->_twi_in_step ? _board->_twi_base_us : _now_us();
+            _board->_twi_status = status;
+            _board->_twi_data = data;
+            _board->_twi_done_us = base + _board->_twi_byte_us + extra_us;
+            _board->_twi_pending = true;
+        }
+
+        /// @brief finishes every mock TWI bus event that's due by now
+        static void _step_twi(uint32_t now) {
+            while (_board->_twi_pending && AF_HAL::time_reached(now, _board->_twi_done_us)) {
+                _board->_twi_pending = false;
+                _board->_twi_base_us = _board->_twi_done_us;
+                _board->_twi_in_step = true;
+                AF_HAL::twi::_on_status(_board->_twi_status, _board->_twi_data);
+                _board->_twi_in_step = false;
+            }
+        }
+
+        /// @brief finishes every SPI byte that's due by now
+        static void _step_spi(uint32_t now) {
+            while (_board->_spi_pending && AF_HAL::time_reached(now, _board->_spi_done_us)) {
+                _board->_spi_pending = false;
+                _board->_spi_base_us = _board->_spi_done_us;
+                _board->_spi_in_step = true;
+                AF_HAL::spi::_on_byte(_board->_spi_in);
+                _board->_spi_in_step = false;
+            }
+        }
+
+        /// @brief reflects output pins into the PIN registers, like the AVR does. input pins
+        ///        keep whatever level the harness drove with set_pin_input().
+        static void _step_ports(void) {
+            for (uint8_t i = 0; i < AF_NUM_PORTS; i++) {
+                uint8_t ddr = _port_regs[i][1];
+                _port_regs[i][0] = (_port_regs[i][0] & ~ddr) | (_port_regs[i][2] & ddr);
+            }
+        }
+
+        /// @brief runs the ADC sequencer stand-in for every conversion that has finished by now
+        static void _step_adc_sequencer(uint32_t now) {
+            while (_board->_adc_seq_running && AF_HAL::time_reached(now, _board->_adc_seq_done_us)) {
+                int16_t raw = _board->_adc_seq_pin < AF_SIM_ADC_CHANNELS ? _board->_adc[_board->_adc_seq_pin] : 0;
+                if (_board->_adc_noise_lsb > 0) {
+                    // xorshift, so each board's noise repeats whatever else runs alongside it
+                    uint32_t& rng = _board->_adc_noise_rng;
+                    rng ^= rng << 13;
+                    rng ^= rng >> 17;
+                    rng ^= rng << 5;
+                    raw += (rng % (2 * _board->_adc_noise_lsb + 1)) - _board->_adc_noise_lsb;
+                }
+                raw = raw < 0 ? 0 : (raw > 1023 ? 1023 : raw);
+                _board->_adc_seq_pin = AF_HAL::adc::_on_conversion(raw);
+                _board->_adc_seq_done_us += AF_SIM_ADC_CONVERSION_US;
+            }
+        }
+
+        void set_clock_mode(AF_Sim_Clock_Mode mode, uint16_t us_per_call) {
+            // carry the current time over, so the clock never jumps backwards
+            uint64_t now = _now_us64();
+            _board->_virtual_now_us = now;
+            _board->_realtime_origin_ns = _host_monotonic_ns() - (uint64_t)now * 1000ULL;
+            _board->_clock_mode = mode;
+            _board->_virtual_us_per_call = us_per_call;
+            if (_board == &_process_board && mode == AF_SIM_CLOCK_VIRTUAL) _blackbox_clock(us_per_call, (uint32_t)now);
+        }
+
+        AF_Sim_Clock_Mode get_clock_mode(void) {
+            return _board->_clock_mode;
+        }
+
+        void advance(uint32_t us) {
+            if (_board->_clock_mode != AF_SIM_CLOCK_VIRTUAL) return;
+            _board->_virtual_now_us += us;
+            poll();
+        }
+
+        void set_model(AF_Sim_Model* model, uint32_t period_us) {
+            _board->_model = model;
+            _board->_model_period_us = period_us > 0 ? period_us : AF_SIM_DEFAULT_MODEL_PERIOD_US;
+            _board->_model_last_us = _now_us();
+        }
+
+        void poll(void) {
+            if (_board->_in_poll) return;
+            _board->_in_poll = true;
+
+            uint32_t now = _now_us();
+
+            // the model runs first, so the blackbox sees the inputs the firmware is about to read
+            _step_model(now);
+            if (_board == &_process_board) _blackbox_poll(now, _board->_adc);
+
+            // the serial ports belong to the process, not to any context's board
+            if (_board == &_process_board && (uint32_t)(now - _board->_serial_last_us) >= SIM_SERIAL_POLL_US) {
+                _board->_serial_last_us = now;
+                AF_HAL::hwserial::SerialInterface0._poll();
+                AF_HAL::hwserial::SerialInterface1._poll();
+                AF_HAL::hwserial::SerialInterface2._poll();
+                AF_HAL::hwserial::SerialInterface3._poll();
+            }
+
+            _step_adc_sequencer(now);
+            _step_twi(now);
+            _step_spi(now);
+            // the port registers belong to the process too (see AF_Context.h), and contexts poll
+            // from several threads at once
+            if (_board == &_process_board) _step_ports();
+
+            _board->_in_poll = false;
+        }
+
+        uint16_t get_pwm(uint8_t channel) {
+            return channel < AF_SIM_PWM_CHANNELS ? _board->_pwm[channel] : 0;
+        }
+
+        void set_adc(uint8_t channel, uint16_t value) {
+            if (channel < AF_SIM_ADC_CHANNELS) _board->_adc[channel] = value > 1023 ? 1023 : value;
+        }
+
+        void set_pin_input(uint8_t port_idx, uint8_t bit, bool level) {
+            if (port_idx >= AF_NUM_PORTS || bit > 7) return;
+            if (level) _port_regs[port_idx][0] |= (1 << bit); else _port_regs[port_idx][0] &= ~(1 << bit);
+        }
+
+        void set_adc_noise(uint8_t lsb) {
+            _board->_adc_noise_lsb = lsb;
+        }
+
+        uint32_t get_model_steps(void) {
+            return _board->_model_steps;
+        }
+
+        bool twi_attach(AF_Sim_TWI_Device* device) {
+            int8_t free_slot = -1;
+            for (uint8_t i = 0; i < AF_SIM_TWI_MAX_DEVICES; i++) {
+                if (_board->_twi_devices[i] == nullptr) {
+                    if (free_slot < 0) free_slot = i;
+                } else if (_board->_twi_devices[i]->get_address() == device->get_address()) {
+                    return false;
+                }
+            }
+            if (free_slot < 0) return false;
+            _board->_twi_devices[free_slot] = device;
+            return true;
+        }
+
+        void twi_detach(AF_Sim_TWI_Device* device) {
+            for (uint8_t i = 0; i < AF_SIM_TWI_MAX_DEVICES; i++) {
+                if (_board->_twi_devices[i] == device) _board->_twi_devices[i] = nullptr;
+            }
+            if (_board->_twi_device == device) _board->_twi_device = nullptr;
+        }
+
+        void twi_inject_fault(AF_Sim_TWI_Fault fault) {
+            _board->_twi_fault = fault;
+            _board->_twi_fault_armed = true;
+        }
+
+        void spi_set_peer(AF_Sim_SPI_Peer* peer) {
+            _board->_spi_peer = peer;
+        }
+
+        void spi_clock_frame(const uint8_t* mosi, uint8_t* miso, uint8_t len) {
+            if (_board->_spi_master) return;
+            AF_HAL::spi::_on_select(true);
+            for (uint8_t i = 0; i < len; i++) {
+                // full duplex: the firmware's loaded byte goes out as the master's comes in
+                miso[i] = _board->_spi_slave_out;
+                AF_HAL::spi::_on_byte(mosi[i]);
+            }
+            AF_HAL::spi::_on_select(false);
+        }
+
+        void feed_ppm(const uint16_t* widths_us, uint8_t n) {
+            for (uint8_t i = 0; i < n; i++) AF_HAL::rcin::_ppm_push(widths_us[i] * AF_RCIN_PPM_TICKS_PER_US);
+        }
+
+        AF_Sim_Board* board_create(void) {
+            AF_Sim_Board* board = new AF_Sim_Board();
+            board->_clock_mode = AF_SIM_CLOCK_VIRTUAL;
+            return board;
+        }
+
+        void board_destroy(AF_Sim_Board* board) {
+            if (board != &_process_board) delete board;
+        }
+
+        AF_Sim_Board* board_enter(AF_Sim_Board* board) {
+            AF_Sim_Board* previous = _board;
+            _board = board != nullptr ? board : &_process_board;
+            return previous;
+        }
+
+    } // namespace sim
+
+    void _atomic_enter(void) {
+        sim::_atomic_lock.lock();
+    }
+
+    void _atomic_exit(void) {
+        sim::_atomic_lock.unlock();
+    }
+
+    namespace pwm {
+
+        // the pwm engine stand-in latches pulse widths straight into the model's outputs
+
+        _Engine& _hw_engine(void) {
+            return sim::_board->_pwm_engine;
+        }
+
+        uint8_t _hw_num_channels(void) {
+            return AF_SIM_PWM_CHANNELS;
+        }
+
+        bool _hw_init(AF_PWM_Mode mode, uint16_t top) {
+            // outputs are pulse widths, so the mode and period don't matter
+            (void)mode;
+            (void)top;
+            sim::_board->_pwm_enabled = 0;
+            for (uint8_t i = 0; i < AF_SIM_PWM_CHANNELS; i++) sim::_board->_pwm[i] = 0;
+            return true;
+        }
+
+        void _hw_enable(uint8_t channel, bool enable) {
+            if (enable) {
+                sim::_board->_pwm_enabled |= (1 << channel);
+            } else {
+                sim::_board->_pwm_enabled &= ~(1 << channel);
+                sim::_board->_pwm[channel] = 0;
+            }
+        }
+
+        bool _hw_commit(AF_PWM_Mode mode, const uint16_t* ticks, uint16_t enabled_mask) {
+            (void)mode;
+            for (uint8_t i = 0; i < AF_SIM_PWM_CHANNELS; i++) {
+                if (enabled_mask & (1 << i)) sim::_board->_pwm[i] = ticks[i] / AF_PWM_TICKS_PER_US;
+            }
+            if (sim::_board == &sim::_process_board) sim::_blackbox_output(sim::_now_us(), enabled_mask, sim::_board->_pwm);
+            return true;
+        }
+
+    }
+
+    namespace twi {
+
+        // the mock bus answers each command with the status code the AVR's TWI would report,
+        // see sim::_step_twi()
+
+        void _hw_init(uint32_t freq_hz) {
+            uint32_t byte_us = (9UL * 1000000UL) / (freq_hz > 0 ? freq_hz : AF_TWI_DEFAULT_FREQ_HZ);
+            sim::_board->_twi_byte_us = byte_us > 0 ? byte_us : 1;
+            _hw_recover();
+        }
+
+        void _hw_start(void) {
+            sim::_board->_twi_addressing = true;
+            sim::_board->_twi_device = nullptr;
+            // start, or repeated start if the bus is already ours
+            sim::_twi_schedule(sim::_board->_twi_bus_owned ? 0x10 : 0x08, 0, 0);
+            sim::_board->_twi_bus_owned = true;
+        }
+
+        void _hw_write(uint8_t byte) {
+            if (sim::_board->_twi_addressing) {
+                sim::_board->_twi_addressing = false;
+                bool read = byte & 0x01;
+                for (uint8_t i = 0; i < AF_SIM_TWI_MAX_DEVICES; i++) {
+                    sim::AF_Sim_TWI_Device* device = sim::_board->_twi_devices[i];
+                    if (device != nullptr && device->get_address() == (byte >> 1) && device->on_start(read)) {
+                        sim::_board->_twi_device = device;
+                        // address acknowledged, for reading or writing
+                        sim::_twi_schedule(read ? 0x40 : 0x18, 0, device->get_latency_us());
+                        return;
+                    }
+                }
+                // nobody answered
+                sim::_twi_schedule(read ? 0x48 : 0x20, 0, 0);
+                return;
+            }
+            sim::AF_Sim_TWI_Device* device = sim::_board->_twi_device;
+            bool ack = device != nullptr && device->on_write(byte);
+            // data sent, acknowledged or not
+            sim::_twi_schedule(ack ? 0x28 : 0x30, 0, device != nullptr ? device->get_latency_us() : 0);
+        }
+
+        void _hw_read(bool ack) {
+            sim::AF_Sim_TWI_Device* device = sim::_board->_twi_device;
+            // an idle bus reads as all ones
+            uint8_t data = device != nullptr ? device->on_read() : 0xFF;
+            // data received, acknowledged or not
+            sim::_twi_schedule(ack ? 0x50 : 0x58, data, device != nullptr ? device->get_latency_us() : 0);
+        }
+
+        void _hw_stop(bool restart) {
+            sim::_board->_twi_device = nullptr;
+            sim::_board->_twi_bus_owned = false;
+            if (restart) _hw_start();
+        }
+
+        void _hw_halt(void) {
+            // drop the event in flight, the bus answers nothing until it's recovered
+            sim::_board->_twi_pending = false;
+            sim::_board->_twi_device = nullptr;
+        }
+
+        void _hw_recover(void) {
+            sim::_board->_twi_pending = false;
+            sim::_board->_twi_device = nullptr;
+            sim::_board->_twi_bus_owned = false;
+            sim::_board->_twi_addressing = false;
+        }
+
+    }
+
+    namespace spi {
+
+        // as the master, each byte finishes AF_SIM_SPI_BYTE_US after it's loaded, see
+        // sim::_step_spi(). as the slave, bytes move when the harness calls sim::spi_clock_frame().
+
+        void _hw_init(AF_SPI_Role role) {
+            sim::_board->_spi_master = role == AF_SPI_ROLE_MASTER;
+            sim::_board->_spi_pending = false;
+        }
+
+        void _hw_select(bool selected) {
+            if (sim::_board->_spi_peer != nullptr) sim::_board->_spi_peer->on_select(selected);
+        }
+
+        void _hw_write(uint8_t byte) {
+            if (!sim::_board->_spi_master) {
+                sim::_board->_spi_slave_out = byte;
+                return;
+            }
+            sim::_board->_spi_in = sim::_board->_spi_peer != nullptr ? sim::_board->_spi_peer->on_byte(byte) : byte;
+            uint32_t base = sim::_board->_spi_in_step ? sim::_board->_spi_base_us : sim::_now_us();
+            sim::_board->_spi_done_us = base + AF_SIM_SPI_BYTE_US;
+            sim::_board->_spi_pending = true;
+        }
+
+    }
+
+    namespace eeprom {
+
+        // each board has its own EEPROM, see sim::AF_Sim_Board
+
+        static void _erase_once(void) {
+            if (sim::_board->_eeprom_erased) return;
+            memset(sim::_board->_eeprom, 0xFF, SIM_EEPROM_SIZE);
+            sim::_board->_eeprom_erased = true;
+        }
+
+        uint16_t size(void) {
+            return SIM_EEPROM_SIZE;
+        }
+
+        void read(uint16_t addr, void* dest, uint16_t len) {
+            _erase_once();
+            uint8_t* out = static_cast<uint8_t*>(dest);
+            for (uint16_t i = 0; i < len; i++) {
+                out[i] = (uint32_t)addr + i < SIM_EEPROM_SIZE ? sim::_board->_eeprom[addr + i] : 0xFF;
+            }
+        }
+
+        void update(uint16_t addr, const void* src, uint16_t len) {
+            _erase_once();
+            const uint8_t* in = static_cast<const uint8_t*>(src);
+            for (uint16_t i = 0; i < len && (uint32_t)addr + i < SIM_EEPROM_SIZE; i++) {
+                sim::_board->_eeprom[addr + i] = in[i];
+            }
+        }
+
+    }
+
+    namespace adc {
+
+        // the sequencer stand-in converts on the simulator clock, see sim::poll()
+
+        void _hw_start(uint8_t pin) {
+            sim::_board->_adc_seq_pin = pin;
+            sim::_board->_adc_seq_done_us = sim::_now_us() + AF_SIM_ADC_CONVERSION_US;
+            sim::_board->_adc_seq_running = true;
+        }
+
+        void _hw_stop(void) {
+            sim::_board->_adc_seq_running = false;
+        }
+
+    }
+
+    void init() {
+
+        sim::_board->_realtime_origin_ns = sim::_host_monotonic_ns();
+
+        // a replay runs on the clock its log was recorded on, see sim::replay_start()
+        uint64_t replay_now_us;
+        uint16_t replay_us_per_call;
+        if (sim::_blackbox_replay_clock(replay_now_us, replay_us_per_call)) {
+            sim::_board->_clock_mode = sim::AF_SIM_CLOCK_VIRTUAL;
+            sim::_board->_virtual_now_us = replay_now_us;
+            sim::_board->_virtual_us_per_call = replay_us_per_call;
+        } else {
+            // AF_SIM_CLOCK=virtual runs the firmware faster than real time
+            const char* clock = getenv("AF_SIM_CLOCK");
+            if (clock != nullptr && strcmp(clock, "virtual") == 0) {
+                sim::set_clock_mode(sim::AF_SIM_CLOCK_VIRTUAL, 1);
+            }
+        }
+
+#if defined(AF_SERIAL_ENABLED)
+        // initialize serial
+        AF_HAL::hwserial::SerialInterface0.open(BAUDR_57600);
+#endif
+
+    }
+
+    void reset() {
+        // there's nothing to reboot into, so end the process and let the harness see the failure
+        fprintf(stderr, "autoflight: system reset requested, exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t micros64(void) {
+        if (sim::_board->_clock_mode == sim::AF_SIM_CLOCK_VIRTUAL && !sim::_board->_in_poll) {
+            sim::_board->_virtual_now_us += sim::_board->_virtual_us_per_call;
+        }
+        // service the simulator on the way out, the firmware polls the clock constantly
+        sim::poll();
+        return sim::_now_us64();
+    }
+
+    uint32_t micros(void) {
+        return (uint32_t)micros64();
+    }
+
+    uint32_t cycles(void) {
+        // in realtime mode, use the host clock's resolution rather than a multiple of micros
+        if (sim::_board->_clock_mode == sim::AF_SIM_CLOCK_REALTIME) {
+            return (uint32_t)(((sim::_host_monotonic_ns() - sim::_board->_realtime_origin_ns) * AF_CYCLES_PER_US) / 1000ULL);
+        }
+        return (uint32_t)(micros64() * AF_CYCLES_PER_US);
+    }
+
+    uint32_t _capture_cycles(uint16_t ticks) {
+        // there are no capture ISRs on the simulator, edges are fed with sim::feed_ppm()
+        return ((cycles() & 0xFFFF0000UL) | ticks);
+    }
+
+    namespace io {
+
+        uint16_t aread(uint8_t pin) {
+            return pin < AF_SIM_ADC_CHANNELS ? sim::_board->_adc[pin] : 0;
+        }
+
+        // dread, dwrite and pmode are table driven, see AF_HAL/pin_hal.cpp
+        // awrite and pwmwrite drive the pwm engine, see AF_HAL/pwm_hal.cpp
+    }
+
+}
+
+// --- simulated serial interfaces ---
+
+// the same point as the boards' write, see AF_HAL/serial_hal.cpp
+AF_PROFILE_POINT(_prof_write, "serial.write");
+
+AF_SerialInterface::AF_SerialInterface(utilbuf::ring_buffer* buffer, utilbuf::ring_buffer* tx_buffer, uint8_t port): Stream(buffer) {
+    _tx = tx_buffer;
+    _port = port;
+    _fd = -1;
+    _listen_fd = -1;
+}
+
+AF_SerialInterface::~AF_SerialInterface() {
+    close();
+}
+
+void AF_SerialInterface::open(uint32_t baud_rate, uint8_t config) {
+
+    // bytes move as fast as the host takes them, there's no line to clock
+    (void)baud_rate;
+    (void)config;
+
+    char env_name[20];
+    snprintf(env_name, sizeof(env_name), "AF_SIM_SERIAL%u", _port);
+    const char* backing = getenv(env_name);
+
+    if (backing != nullptr && strncmp(backing, "unix:", 5) == 0) {
+        // listen on a unix socket, the peer is accepted in _poll()
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, backing + 5, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+
+        _listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (_listen_fd < 0 || bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listen_fd, 1) < 0) {
+            fprintf(stderr, "autoflight: serial%u: can't listen on %s: %s\n", _port, addr.sun_path, strerror(errno));
+            close();
+            return;
+        }
+        fprintf(stderr, "autoflight: serial%u listening on %s\n", _port, addr.sun_path);
+        return;
+    }
+
+    // default to a pseudo-terminal
+    _fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (_fd < 0 || grantpt(_fd) < 0 || unlockpt(_fd) < 0) {
+        fprintf(stderr, "autoflight: serial%u: can't open a pty: %s\n", _port, strerror(errno));
+        close();
+        return;
+    }
+
+    const char* slave_name = ptsname(_fd);
+    int slave_fd = ::open(slave_name, O_RDWR | O_NOCTTY);
+    if (slave_fd >= 0) {
+        // pass bytes through untouched, like a real uart. the settings outlive the fd, and
+        // closing it lets _poll() see when nothing is attached.
+        struct termios tio;
+        tcgetattr(slave_fd, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave_fd, TCSANOW, &tio);
+        ::close(slave_fd);
+    }
+
+    char link_name[40];
+    snprintf(link_name, sizeof(link_name), "/tmp/autoflight-serial%u", _port);
+    unlink(link_name);
+    if (symlink(slave_name, link_name) < 0) link_name[0] = '\0';
+
+    fprintf(stderr, "autoflight: serial%u on %s %s\n", _port, slave_name, link_name);
+}
+
+size_t AF_SerialInterface::close(void) {
+    if (_fd >= 0) ::close(_fd);
+    if (_listen_fd >= 0) ::close(_listen_fd);
+    _fd = -1;
+    _listen_fd = -1;
+    // return the number of bytes in the buffer at the time of closing
+    return flush();
+}
+
+size_t AF_SerialInterface::write(uint8_t byte) {
+    // wait a bounded time for room in the outbound buffer, polling drains it. put() drops
+    // the byte if there's still none.
+    uint32_t deadline = AF_HAL::micros() + AF_SERIAL_WRITE_TIMEOUT_US;
+    while (_tx->space() == 0 && !AF_HAL::time_reached(AF_HAL::micros(), deadline)) _poll();
+    return _tx->put(byte) ? 1 : 0;
+}
+
+size_t AF_SerialInterface::write(const uint8_t* bytes, size_t size) {
+    // includes any time spent waiting for room
+    AF_PROFILE_SCOPE(_prof_write);
+
+    size_t written = 0;
+    uint32_t deadline = AF_HAL::micros() + AF_SERIAL_WRITE_TIMEOUT_US;
+
+    // copy into the outbound buffer as space becomes available
+    while (written < size) {
+        utilbuf::ring_idx_t room = _tx->space();
+        if (room == 0) {
+            if (AF_HAL::time_reached(AF_HAL::micros(), deadline)) break;
+            _poll();
+            continue;
+        }
+        written += _tx->write(bytes + written, room < size - written ? room : size - written);
+    }
+
+    // out of time, count the rest as dropped, see the board's write()
+    if (written < size) _tx->note_dropped(size - written);
+
+    return written;
+}
+
+utilbuf::ring_idx_t AF_SerialInterface::reserve(utilbuf::span spans[2]) {
+    return _tx->reserve(spans);
+}
+
+void AF_SerialInterface::commit(utilbuf::ring_idx_t n) {
+    _tx->commit(n);
+}
+
+void AF_SerialInterface::_poll(void) {
+
+    // a replay feeds the port from its log instead
+    if (AF_HAL::sim::_blackbox_serial(_port, _buffer, _tx)) return;
+
+    // accept a peer on the unix socket, one at a time
+    if (_listen_fd >= 0 && _fd < 0) {
+        _fd = accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+        if (_fd < 0) return;
+    }
+    if (_fd < 0) return;
+
+    utilbuf::span spans[2];
+
+    // inbound: read straight into the free space of the stream buffer
+    if (_buffer->reserve(spans) > 0) {
+        ssize_t got = ::read(_fd, spans[0].data, spans[0].len);
+        if (got > 0 && got == spans[0].len && spans[1].len > 0) {
+            ssize_t more = ::read(_fd, spans[1].data, spans[1].len);
+            if (more > 0) got += more;
+        }
+        if (got > 0) {
+            _buffer->commit(got);
+            AF_HAL::sim::_blackbox_serial_in(_port, AF_HAL::sim::_now_us(), spans, got);
+        } else if (got == 0 && _listen_fd >= 0) {
+            // the socket peer went away, wait for the next one
+            ::close(_fd);
+            _fd = -1;
+            return;
+        } else if (got < 0 && errno == EIO) {
+            // nothing is attached to the pty, so the bytes go nowhere, just like an unplugged
+            // uart. the pty would otherwise hold them for whoever attaches next.
+            _tx->clear();
+            return;
+        }
+    }
+
+    // outbound: write straight out of the outbound buffer
+    if (_tx->read_spans(spans) > 0) {
+        ssize_t sent = ::write(_fd, spans[0].data, spans[0].len);
+        if (sent > 0 && sent == spans[0].len && spans[1].len > 0) {
+            ssize_t more = ::write(_fd, spans[1].data, spans[1].len);
+            if (more > 0) sent += more;
+        }
+        if (sent > 0) {
+            _tx->consume(sent);
+        } else if (sent < 0 && errno == EIO) {
+            // the pty's reader went away
+            _tx->clear();
+        }
+    }
+}
+
+namespace AF_HAL {
+
+    namespace hwserial {
+
+        using namespace utilbuf;
+
+        static static_ring_buffer<SIM_SERIAL_RX_BUF_SIZE> serial_rx_buf_0;
+        static static_ring_buffer<SIM_SERIAL_TX_BUF_SIZE> serial_tx_buf_0;
+        AF_SerialInterface SerialInterface0(&serial_rx_buf_0, &serial_tx_buf_0, 0);
+
+        static static_ring_buffer<SIM_SERIAL_RX_BUF_SIZE> serial_rx_buf_1;
+        static static_ring_buffer<SIM_SERIAL_TX_BUF_SIZE> serial_tx_buf_1;
+        AF_SerialInterface SerialInterface1(&serial_rx_buf_1, &serial_tx_buf_1, 1);
+
+        static static_ring_buffer<SIM_SERIAL_RX_BUF_SIZE> serial_rx_buf_2;
+        static static_ring_buffer<SIM_SERIAL_TX_BUF_SIZE> serial_tx_buf_2;
+        AF_SerialInterface SerialInterface2(&serial_rx_buf_2, &serial_tx_buf_2, 2);
+
+        static static_ring_buffer<SIM_SERIAL_RX_BUF_SIZE> serial_rx_buf_3;
+        static static_ring_buffer<SIM_SERIAL_TX_BUF_SIZE> serial_tx_buf_3;
+        AF_SerialInterface SerialInterface3(&serial_rx_buf_3, &serial_tx_buf_3, 3);
+
+    } // namespace hwserial
+
+}   // namespace AF_HAL
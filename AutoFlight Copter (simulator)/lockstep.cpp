@@ -0,0 +1,266 @@
+#include <AF_HAL/sim_hal.h>
+#include <AF_Lockstep/AF_Lockstep.h>
+#include <AF_GCS/AF_GCS.h>
+
+#include <time.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Lockstep harness for the simulator: each controller is a host thread with its own
+// AF_Lockstep, and digests travel between them as encoded frames, see sim_hal.h
+
+static_assert(AF_SIM_LOCKSTEP_MAX_NODES == AF_LOCKSTEP_MAX_NODES, "the harness runs as many controllers as the lockstep does");
+
+namespace AF_HAL {
+
+    namespace sim {
+
+        /// @brief the bytes on their way to one controller
+        struct Lockstep_Inbox {
+            std::mutex lock;
+            std::vector<uint8_t> bytes;
+        };
+
+        /// @brief holds every controller at the start of a tick until they all get there,
+        ///        which is what keeps their ticks aligned
+        class Lockstep_Barrier {
+
+            public:
+
+                Lockstep_Barrier(uint8_t count) : _count(count) {}
+
+                void wait(void) {
+                    std::unique_lock<std::mutex> guard(_lock);
+                    uint32_t generation = _generation;
+                    if (++_waiting == _count) {
+                        _waiting = 0;
+                        _generation++;
+                        _cv.notify_all();
+                        return;
+                    }
+                    _cv.wait(guard, [&] { return _generation != generation; });
+                }
+
+            private:
+
+                std::mutex _lock;
+                std::condition_variable _cv;
+                uint8_t _count;
+                uint8_t _waiting = 0;
+                uint32_t _generation = 0;
+
+        };
+
+        /// @brief what one lockstep run shares between the controller threads
+        struct Lockstep_Run {
+            uint8_t nodes;
+            af_sim_lockstep_control_t control;
+            uint32_t ticks;
+            uint32_t period_us;
+            const AF_Sim_Lockstep_Fault* faults;
+            uint8_t count;
+
+            Lockstep_Barrier barrier;
+            Lockstep_Inbox inbox[AF_SIM_LOCKSTEP_MAX_NODES];
+
+            /// each controller's masks and controller after every tick, ticks * nodes
+            std::vector<uint8_t> masked;
+            std::vector<uint8_t> controller;
+
+            // per controller, written only by its own thread
+            uint64_t vote_ns_sum[AF_SIM_LOCKSTEP_MAX_NODES] = {};
+            uint32_t vote_ns_max[AF_SIM_LOCKSTEP_MAX_NODES] = {};
+            uint32_t votes[AF_SIM_LOCKSTEP_MAX_NODES] = {};
+            uint32_t timeouts[AF_SIM_LOCKSTEP_MAX_NODES] = {};
+            uint32_t disagreements[AF_SIM_LOCKSTEP_MAX_NODES] = {};
+            uint32_t link_bytes[AF_SIM_LOCKSTEP_MAX_NODES] = {};
+
+            Lockstep_Run(uint8_t n) : barrier(n) {}
+        };
+
+        static uint64_t _lockstep_now_ns(void) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        }
+
+        /// @brief gets the fault a controller has on a tick
+        /// @return the fault, or nullptr if the controller is healthy
+        static const AF_Sim_Lockstep_Fault* _lockstep_fault(const Lockstep_Run& run, uint8_t node, uint32_t tick) {
+            for (uint8_t i = 0; i < run.count; i++) {
+                const AF_Sim_Lockstep_Fault& fault = run.faults[i];
+                if (fault.node == node && tick >= fault.from_tick && tick <= fault.to_tick) return &fault;
+            }
+            return nullptr;
+        }
+
+        /// @brief frames a digest and delivers it to every other controller
+        /// @return the number of bytes each controller was sent
+        static uint8_t _lockstep_send(Lockstep_Run& run, uint8_t node, uint8_t seq, const uint8_t* payload) {
+            uint8_t encoded[AF_GCS_MAX_ENCODED_LEN];
+            utilbuf::span spans[2] = { { encoded, AF_GCS_MAX_ENCODED_LEN }, { encoded, 0 } };
+            AF_GCS_Frame_Writer writer(spans, AF_GCS_MAX_ENCODED_LEN);
+            AF_GCS_Frame_Header header = { AF_GCS_MSG_LOCKSTEP, AF_GCS_PRIORITY_CRITICAL, seq, AF_LOCKSTEP_DIGEST_LEN };
+            writer.put(reinterpret_cast<const uint8_t*>(&header), AF_GCS_HEADER_LEN);
+            writer.put(payload, AF_LOCKSTEP_DIGEST_LEN);
+            uint8_t n = writer.finish();
+
+            for (uint8_t other = 0; other < run.nodes; other++) {
+                if (other == node) continue;
+                std::lock_guard<std::mutex> guard(run.inbox[other].lock);
+                run.inbox[other].bytes.insert(run.inbox[other].bytes.end(), encoded, encoded + n);
+            }
+            return n;
+        }
+
+        /// @brief decodes whatever has arrived for a controller and hands it the digests
+        static void _lockstep_receive(Lockstep_Run& run, uint8_t node, AF_GCS_Decoder& decoder, AF_Lockstep& lockstep) {
+            std::vector<uint8_t> bytes;
+            {
+                std::lock_guard<std::mutex> guard(run.inbox[node].lock);
+                bytes.swap(run.inbox[node].bytes);
+            }
+            for (uint8_t byte : bytes) {
+                if (decoder.feed(byte) && decoder.get_header()->type == AF_GCS_MSG_LOCKSTEP) {
+                    lockstep.on_digest(decoder.get_payload(), decoder.get_header()->len);
+                }
+            }
+        }
+
+        /// @brief one controller's thread
+        static void _lockstep_node(Lockstep_Run& run, uint8_t node) {
+            AF_Lockstep lockstep(node, run.nodes);
+            AF_GCS_Decoder decoder;
+            uint16_t outputs[AF_SIM_PWM_CHANNELS];
+            uint8_t payload[AF_LOCKSTEP_DIGEST_LEN];
+            uint8_t seq = 0;
+
+            for (uint32_t tick = 0; tick < run.ticks; tick++) {
+                run.barrier.wait();
+                uint64_t start_ns = _lockstep_now_ns();
+                uint64_t deadline_ns = start_ns + (uint64_t)run.period_us * 1000ULL;
+
+                uint8_t count = run.control(tick, outputs);
+                const AF_Sim_Lockstep_Fault* fault = _lockstep_fault(run, node, tick);
+                if (fault != nullptr && fault->kind == AF_SIM_LOCKSTEP_CORRUPT && count > 0) {
+                    outputs[tick % count] ^= 0x0004;
+                }
+
+                lockstep.submit(tick, outputs, count, payload);
+                uint64_t submitted_ns = _lockstep_now_ns();
+                bool late = fault != nullptr && fault->kind == AF_SIM_LOCKSTEP_LATE;
+                if (fault == nullptr || fault->kind == AF_SIM_LOCKSTEP_CORRUPT) {
+                    run.link_bytes[node] += _lockstep_send(run, node, seq++, payload);
+                }
+
+                // vote as soon as every digest is in, or once the period is up
+                bool complete = false;
+                while (true) {
+                    _lockstep_receive(run, node, decoder, lockstep);
+                    complete = lockstep.is_complete(tick);
+                    if (complete || _lockstep_now_ns() >= deadline_ns) break;
+                    std::this_thread::yield();
+                }
+                uint64_t voted_ns = _lockstep_now_ns();
+                AF_Lockstep_Result result = lockstep.vote(tick);
+
+                if (complete) {
+                    uint32_t ns = (uint32_t)(voted_ns - submitted_ns);
+                    run.vote_ns_sum[node] += ns;
+                    if (ns > run.vote_ns_max[node]) run.vote_ns_max[node] = ns;
+                    run.votes[node]++;
+                } else {
+                    run.timeouts[node]++;
+                }
+                if (result == AF_LOCKSTEP_DISAGREE) run.disagreements[node]++;
+
+                // a late controller's digest only goes out after the others have given up on
+                // it, a quarter period past the deadline so it never wins the race to the vote
+                if (late) {
+                    uint64_t late_ns = deadline_ns + (uint64_t)run.period_us * 250ULL;
+                    while (_lockstep_now_ns() < late_ns) std::this_thread::yield();
+                    run.link_bytes[node] += _lockstep_send(run, node, seq++, payload);
+                }
+
+                uint8_t masked = 0;
+                for (uint8_t n = 0; n < run.nodes; n++) {
+                    if (lockstep.is_masked(n)) masked |= (1 << n);
+                }
+                run.masked[tick * run.nodes + node] = masked;
+                run.controller[tick * run.nodes + node] = lockstep.get_controller();
+            }
+        }
+
+        void lockstep_run(uint8_t nodes, af_sim_lockstep_control_t control, uint32_t ticks, uint32_t period_us,
+                          const AF_Sim_Lockstep_Fault* faults, uint8_t count, AF_Sim_Lockstep_Report& report) {
+            report = AF_Sim_Lockstep_Report();
+            if (nodes < 2) nodes = 2;
+            if (nodes > AF_SIM_LOCKSTEP_MAX_NODES) nodes = AF_SIM_LOCKSTEP_MAX_NODES;
+            if (ticks == 0) return;
+
+            Lockstep_Run run(nodes);
+            run.nodes = nodes;
+            run.control = control;
+            run.ticks = ticks;
+            run.period_us = period_us;
+            run.faults = faults;
+            run.count = count;
+            run.masked.assign(ticks * nodes, 0);
+            run.controller.assign(ticks * nodes, 0);
+
+            std::vector<std::thread> threads;
+            for (uint8_t n = 0; n < nodes; n++) threads.emplace_back(_lockstep_node, std::ref(run), n);
+            for (std::thread& thread : threads) thread.join();
+
+            // how long each fault took to be masked by every controller that was healthy
+            for (uint8_t i = 0; i < count; i++) {
+                const AF_Sim_Lockstep_Fault& fault = faults[i];
+                if (fault.node >= nodes || fault.from_tick >= ticks) continue;
+                bool detected = false;
+                for (uint32_t tick = fault.from_tick; tick <= fault.to_tick && tick < ticks && !detected; tick++) {
+                    bool all = true;
+                    for (uint8_t n = 0; n < nodes; n++) {
+                        if (_lockstep_fault(run, n, tick) != nullptr) continue;
+                        if (!(run.masked[tick * nodes + n] & (1 << fault.node))) all = false;
+                    }
+                    if (all) {
+                        detected = true;
+                        if (tick - fault.from_tick > report.detect_ticks_max) report.detect_ticks_max = tick - fault.from_tick;
+                    }
+                }
+                if (!detected) report.undetected++;
+            }
+
+            // outputs are only bad where a controller drives them while computing wrong ones.
+            // the vote for a tick happens before its outputs are driven, so the controller
+            // chosen by that vote is the one that drives them.
+            for (uint32_t tick = 0; tick < ticks; tick++) {
+                for (uint8_t n = 0; n < nodes; n++) {
+                    if (run.controller[tick * nodes + n] != n) continue;
+                    const AF_Sim_Lockstep_Fault* fault = _lockstep_fault(run, n, tick);
+                    if (fault != nullptr && fault->kind == AF_SIM_LOCKSTEP_CORRUPT) report.bad_output_ticks++;
+                }
+            }
+
+            uint64_t vote_ns_sum = 0;
+            uint32_t votes = 0;
+            uint32_t link_bytes = 0;
+            for (uint8_t n = 0; n < nodes; n++) {
+                vote_ns_sum += run.vote_ns_sum[n];
+                votes += run.votes[n];
+                if (run.vote_ns_max[n] / 1000 > report.vote_us_max) report.vote_us_max = run.vote_ns_max[n] / 1000;
+                report.vote_timeouts += run.timeouts[n];
+                report.disagreements += run.disagreements[n];
+                if (run.link_bytes[n] > link_bytes) link_bytes = run.link_bytes[n];
+            }
+            report.vote_us_avg = votes > 0 ? (uint32_t)(vote_ns_sum / votes / 1000) : 0;
+            // the healthiest controller sent a digest every tick
+            report.link_bytes_per_tick = (uint16_t)((link_bytes + ticks / 2) / ticks);
+            report.link_bytes_per_s = period_us > 0 ? (uint32_t)((uint64_t)link_bytes * 1000000ULL / ((uint64_t)ticks * period_us)) : 0;
+        }
+
+    }
+
+}
@@ -0,0 +1,404 @@
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/sim_hal.h>
+#include <util.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+/// the record kinds, see record_start()
+#define BLACKBOX_CLOCK 0
+#define BLACKBOX_ADC 1
+#define BLACKBOX_SERIAL 2
+#define BLACKBOX_OUTPUT 3
+/// the log format's version
+#define BLACKBOX_VERSION 1
+/// the bytes before each record's payload: the kind and the clock
+#define BLACKBOX_RECORD_HEADER_LEN 5
+/// the serial ports the blackbox covers
+#define BLACKBOX_SERIAL_PORTS 4
+/// how long past the log's end a replay waits for commands still due, in simulator microseconds
+#define BLACKBOX_REPLAY_GRACE_US 100000UL
+/// how much of the log is held before it's written out
+#define BLACKBOX_RECORD_BUF_LEN 4096
+/// the longest record: a header, then a serial record's port, count and 255 bytes
+#define BLACKBOX_RECORD_MAX_LEN (BLACKBOX_RECORD_HEADER_LEN + 2 + 255)
+
+// Blackbox for the simulator: records what the process's board feeds the firmware and what
+// the firmware commands, and replays it, see sim_hal.h
+
+namespace AF_HAL {
+
+    namespace sim {
+
+        /// the log being recorded, or -1
+        static int _record_fd = -1;
+        /// the records not written out yet. the log keeps its own buffer rather than stdio's,
+        /// so a signal handler can write it out, see _record_on_signal().
+        static uint8_t _record_buf[BLACKBOX_RECORD_BUF_LEN];
+        /// the bytes in the buffer, including a record still being put together
+        static size_t _record_len = 0;
+        /// the bytes of whole records in the buffer, all a signal handler writes out
+        static volatile sig_atomic_t _record_done = 0;
+        /// the analog inputs as last recorded
+        static uint16_t _record_adc[AF_SIM_ADC_CHANNELS];
+
+        /// the log being replayed
+        static std::vector<uint8_t> _replay_log;
+        /// whether the replay is feeding inputs and checking commands
+        static bool _replaying = false;
+        static af_sim_replay_done_t _replay_done = nullptr;
+        /// the next record to feed, skipping commands
+        static size_t _replay_input = 0;
+        /// the next command to check, skipping inputs
+        static size_t _replay_output = 0;
+        /// serial bytes fed but not yet taken in by their port
+        static std::vector<uint8_t> _replay_serial[BLACKBOX_SERIAL_PORTS];
+        static AF_Sim_Replay_Report _replay_report;
+        /// the host clock when the replay started
+        static struct timespec _replay_started;
+
+        static void _put16(uint8_t* out, uint16_t value) {
+            out[0] = value & 0xFF;
+            out[1] = value >> 8;
+        }
+
+        static uint16_t _get16(const uint8_t* in) {
+            return in[0] | ((uint16_t)in[1] << 8);
+        }
+
+        static uint32_t _get32(const uint8_t* in) {
+            return in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+        }
+
+        /// @brief writes bytes to the log's file, with nothing but write() so a signal handler
+        ///        can use it
+        static void _record_write(const uint8_t* bytes, size_t len) {
+            while (len > 0) {
+                ssize_t n = ::write(_record_fd, bytes, len);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return;
+                bytes += n;
+                len -= n;
+            }
+        }
+
+        /// @brief writes the whole records out, with the signals that write them out held off
+        static void _record_flush(void) {
+            sigset_t block, previous;
+            sigemptyset(&block);
+            sigaddset(&block, SIGINT);
+            sigaddset(&block, SIGTERM);
+            sigprocmask(SIG_BLOCK, &block, &previous);
+            _record_write(_record_buf, _record_done);
+            memmove(_record_buf, _record_buf + _record_done, _record_len - _record_done);
+            _record_len -= _record_done;
+            _record_done = 0;
+            sigprocmask(SIG_SETMASK, &previous, nullptr);
+        }
+
+        /// @brief writes out the log's whole records and ends the process the way the signal
+        ///        would have, so a run stopped with Ctrl-C keeps its log up to the last record
+        static void _record_on_signal(int sig) {
+            if (_record_fd >= 0) {
+                _record_write(_record_buf, _record_done);
+                ::close(_record_fd);
+                _record_fd = -1;
+            }
+            signal(sig, SIG_DFL);
+            raise(sig);
+        }
+
+        /// @brief adds bytes to the record being put together
+        static void _record_put(const void* bytes, size_t len) {
+            memcpy(_record_buf + _record_len, bytes, len);
+            _record_len += len;
+        }
+
+        /// @brief marks the record put together as whole, and writes the buffer out once
+        ///        another record might not fit
+        static void _record_end(void) {
+            // the record's bytes are in before a signal handler can see them counted
+            std::atomic_signal_fence(std::memory_order_release);
+            _record_done = _record_len;
+            if (_record_len > BLACKBOX_RECORD_BUF_LEN - BLACKBOX_RECORD_MAX_LEN) _record_flush();
+        }
+
+        /// @brief starts a record with its header
+        static void _record_header(uint8_t kind, uint32_t now) {
+            uint8_t header[BLACKBOX_RECORD_HEADER_LEN] = {
+                kind, (uint8_t)(now & 0xFF), (uint8_t)((now >> 8) & 0xFF), (uint8_t)((now >> 16) & 0xFF), (uint8_t)(now >> 24)
+            };
+            _record_put(header, BLACKBOX_RECORD_HEADER_LEN);
+        }
+
+        /// @brief gets the length of the record at an offset in the replayed log
+        /// @return the length, or 0 if it's cut off or unknown
+        static size_t _replay_record_len(size_t at) {
+            size_t left = _replay_log.size() - at;
+            if (left < BLACKBOX_RECORD_HEADER_LEN) return 0;
+            const uint8_t* payload = &_replay_log[at + BLACKBOX_RECORD_HEADER_LEN];
+            left -= BLACKBOX_RECORD_HEADER_LEN;
+            size_t len;
+            switch (_replay_log[at]) {
+                case BLACKBOX_CLOCK:
+                    len = 2;
+                    break;
+                case BLACKBOX_ADC:
+                    len = 3;
+                    break;
+                case BLACKBOX_SERIAL:
+                    len = left >= 2 ? 2 + payload[1] : 2;
+                    break;
+                case BLACKBOX_OUTPUT: {
+                    if (left < 2) return 0;
+                    uint16_t mask = _get16(payload);
+                    len = 2;
+                    for (uint8_t i = 0; i < 16; i++) {
+                        if (mask & (1 << i)) len += 2;
+                    }
+                    break;
+                }
+                default:
+                    return 0;
+            }
+            return len <= left ? BLACKBOX_RECORD_HEADER_LEN + len : 0;
+        }
+
+        /// @brief moves past records until one of the kind wanted (or any input), or the end
+        /// @return the offset of the record, or the log's size at the end
+        static size_t _replay_seek(size_t at, bool outputs) {
+            while (at < _replay_log.size()) {
+                size_t len = _replay_record_len(at);
+                if (len == 0) return _replay_log.size();
+                uint8_t kind = _replay_log[at];
+                if (outputs ? kind == BLACKBOX_OUTPUT : (kind == BLACKBOX_ADC || kind == BLACKBOX_SERIAL)) return at;
+                at += len;
+            }
+            return at;
+        }
+
+        /// @brief ends the replay and hands over the report
+        static void _replay_finish(void) {
+            _replaying = false;
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            _replay_report.wall_s = (now.tv_sec - _replay_started.tv_sec) + (now.tv_nsec - _replay_started.tv_nsec) / 1e9;
+            if (_replay_done != nullptr) _replay_done(_replay_report);
+        }
+
+        bool record_start(const char* path) {
+            record_stop();
+            _record_fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (_record_fd < 0) return false;
+            const uint8_t header[5] = { 'A', 'F', 'B', 'B', BLACKBOX_VERSION };
+            _record_put(header, sizeof(header));
+            _record_end();
+            memset(_record_adc, 0, sizeof(_record_adc));
+
+            // the log is finished however the process ends: exit() from anywhere, or Ctrl-C
+            static bool hooked = false;
+            if (!hooked) {
+                hooked = true;
+                atexit(record_stop);
+                struct sigaction action;
+                memset(&action, 0, sizeof(action));
+                action.sa_handler = _record_on_signal;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGINT, &action, nullptr);
+                sigaction(SIGTERM, &action, nullptr);
+            }
+            return true;
+        }
+
+        void record_stop(void) {
+            if (_record_fd < 0) return;
+            _record_flush();
+            // a record cut off partway can't be, but don't leave it for the next log
+            _record_len = 0;
+            ::close(_record_fd);
+            _record_fd = -1;
+        }
+
+        bool replay_start(const char* path, af_sim_replay_done_t done) {
+            FILE* file = fopen(path, "rb");
+            if (file == nullptr) return false;
+            _replay_log.clear();
+            uint8_t chunk[4096];
+            size_t got;
+            while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) _replay_log.insert(_replay_log.end(), chunk, chunk + got);
+            fclose(file);
+            if (_replay_log.size() < 5 || memcmp(&_replay_log[0], "AFBB", 4) != 0 || _replay_log[4] != BLACKBOX_VERSION) return false;
+
+            _replay_report = AF_Sim_Replay_Report();
+            // the log covers up to its last record
+            for (size_t at = 5, len; (len = _replay_record_len(at)) > 0; at += len) {
+                _replay_report.log_us = _get32(&_replay_log[at + 1]);
+            }
+            for (uint8_t p = 0; p < BLACKBOX_SERIAL_PORTS; p++) _replay_serial[p].clear();
+            _replay_input = _replay_seek(5, false);
+            _replay_output = _replay_seek(5, true);
+            _replay_done = done;
+            _replaying = true;
+            clock_gettime(CLOCK_MONOTONIC, &_replay_started);
+            return true;
+        }
+
+        void _blackbox_clock(uint16_t us_per_call, uint32_t now) {
+            if (_record_fd < 0) return;
+            _record_header(BLACKBOX_CLOCK, now);
+            uint8_t payload[2];
+            _put16(payload, us_per_call);
+            _record_put(payload, sizeof(payload));
+            _record_end();
+        }
+
+        bool _blackbox_replay_clock(uint64_t& now_us, uint16_t& us_per_call) {
+            if (!_replaying) return false;
+            // a log recorded in realtime has no clock record, it replays from 0 a microsecond a call
+            now_us = 0;
+            us_per_call = 1;
+            for (size_t at = 5, len; (len = _replay_record_len(at)) > 0; at += len) {
+                if (_replay_log[at] != BLACKBOX_CLOCK) continue;
+                now_us = _get32(&_replay_log[at + 1]);
+                us_per_call = _get16(&_replay_log[at + BLACKBOX_RECORD_HEADER_LEN]);
+                break;
+            }
+            return true;
+        }
+
+        void _blackbox_poll(uint32_t now, uint16_t* adc) {
+            // fed first, so a log recorded while replaying has the inputs the firmware saw
+            if (_replaying) {
+                while (_replay_input < _replay_log.size() && AF_HAL::time_reached(now, _get32(&_replay_log[_replay_input + 1]))) {
+                    const uint8_t* payload = &_replay_log[_replay_input + BLACKBOX_RECORD_HEADER_LEN];
+                    if (_replay_log[_replay_input] == BLACKBOX_ADC) {
+                        if (payload[0] < AF_SIM_ADC_CHANNELS) adc[payload[0]] = _get16(payload + 1);
+                    } else if (payload[0] < BLACKBOX_SERIAL_PORTS) {
+                        _replay_serial[payload[0]].insert(_replay_serial[payload[0]].end(), payload + 2, payload + 2 + payload[1]);
+                    }
+                    _replay_report.inputs++;
+                    _replay_input = _replay_seek(_replay_input + _replay_record_len(_replay_input), false);
+                }
+            }
+
+            if (_record_fd >= 0) {
+                for (uint8_t i = 0; i < AF_SIM_ADC_CHANNELS; i++) {
+                    if (adc[i] == _record_adc[i]) continue;
+                    _record_adc[i] = adc[i];
+                    _record_header(BLACKBOX_ADC, now);
+                    uint8_t payload[3] = { i };
+                    _put16(payload + 1, adc[i]);
+                    _record_put(payload, sizeof(payload));
+                    _record_end();
+                }
+            }
+
+            // the replay is over once the log's inputs are in and its time is up
+            if (!_replaying || _replay_input < _replay_log.size() || !AF_HAL::time_reached(now, _replay_report.log_us)) return;
+            if (_replay_output < _replay_log.size()) {
+                // the log has commands the replay hasn't made
+                if (!AF_HAL::time_reached(now, _replay_report.log_us + BLACKBOX_REPLAY_GRACE_US)) return;
+                const uint8_t* payload = &_replay_log[_replay_output + BLACKBOX_RECORD_HEADER_LEN];
+                _replay_report.diverged = true;
+                _replay_report.diverged_at_us = now;
+                _replay_report.recorded_at_us = _get32(&_replay_log[_replay_output + 1]);
+                _replay_report.expected_mask = _get16(payload);
+                for (uint8_t i = 0, n = 0; i < AF_SIM_PWM_CHANNELS; i++) {
+                    if (_replay_report.expected_mask & (1 << i)) _replay_report.expected[i] = _get16(payload + 2 + 2 * n++);
+                }
+            }
+            _replay_finish();
+        }
+
+        bool _blackbox_serial(uint8_t port, utilbuf::ring_buffer* rx, utilbuf::ring_buffer* tx) {
+            if (!_replaying || port >= BLACKBOX_SERIAL_PORTS) return false;
+            tx->clear();
+            std::vector<uint8_t>& pending = _replay_serial[port];
+            utilbuf::span spans[2];
+            size_t n = rx->reserve(spans);
+            if (n > pending.size()) n = pending.size();
+            size_t first = n < spans[0].len ? n : spans[0].len;
+            memcpy(spans[0].data, pending.data(), first);
+            memcpy(spans[1].data, pending.data() + first, n - first);
+            rx->commit(n);
+            pending.erase(pending.begin(), pending.begin() + n);
+            return true;
+        }
+
+        void _blackbox_serial_in(uint8_t port, uint32_t now, const utilbuf::span* spans, uint16_t count) {
+            if (_record_fd < 0) return;
+            uint16_t first = count < spans[0].len ? count : spans[0].len;
+            // a record carries up to 255 bytes
+            for (uint16_t done = 0; done < count; ) {
+                uint8_t n = count - done > 255 ? 255 : count - done;
+                _record_header(BLACKBOX_SERIAL, now);
+                uint8_t payload[2] = { port, n };
+                _record_put(payload, sizeof(payload));
+                for (uint8_t i = 0; i < n; i++, done++) {
+                    uint8_t byte = done < first ? spans[0].data[done] : spans[1].data[done - first];
+                    _record_put(&byte, 1);
+                }
+                _record_end();
+            }
+        }
+
+        void _blackbox_output(uint32_t now, uint16_t mask, const uint16_t* widths) {
+            if (_record_fd >= 0) {
+                _record_header(BLACKBOX_OUTPUT, now);
+                uint8_t payload[2];
+                _put16(payload, mask);
+                _record_put(payload, sizeof(payload));
+                for (uint8_t i = 0; i < AF_SIM_PWM_CHANNELS; i++) {
+                    if (!(mask & (1 << i))) continue;
+                    _put16(payload, widths[i]);
+                    _record_put(payload, sizeof(payload));
+                }
+                _record_end();
+            }
+
+            // commands after the log's last one can't be checked
+            if (!_replaying || _replay_output >= _replay_log.size()) return;
+            const uint8_t* record = &_replay_log[_replay_output];
+            uint32_t recorded_at = _get32(record + 1);
+            uint16_t expected_mask = _get16(record + BLACKBOX_RECORD_HEADER_LEN);
+            uint16_t expected[AF_SIM_PWM_CHANNELS] = {};
+            for (uint8_t i = 0, n = 0; i < AF_SIM_PWM_CHANNELS; i++) {
+                if (expected_mask & (1 << i)) expected[i] = _get16(record + BLACKBOX_RECORD_HEADER_LEN + 2 + 2 * n++);
+            }
+
+            bool match = expected_mask == mask;
+            for (uint8_t i = 0; match && i < AF_SIM_PWM_CHANNELS; i++) {
+                if ((mask & (1 << i)) && widths[i] != expected[i]) match = false;
+            }
+            if (!match) {
+                _replay_report.diverged = true;
+                _replay_report.diverged_at_us = now;
+                _replay_report.recorded_at_us = recorded_at;
+                _replay_report.expected_mask = expected_mask;
+                _replay_report.actual_mask = mask;
+                for (uint8_t i = 0; i < AF_SIM_PWM_CHANNELS; i++) {
+                    _replay_report.expected[i] = expected[i];
+                    _replay_report.actual[i] = mask & (1 << i) ? widths[i] : 0;
+                }
+                _replay_finish();
+                return;
+            }
+
+            int32_t skew = AF_HAL::time_diff_us(now, recorded_at);
+            uint32_t magnitude = skew < 0 ? -skew : skew;
+            if (magnitude > _replay_report.skew_us_max) _replay_report.skew_us_max = magnitude;
+            _replay_report.outputs++;
+            _replay_output = _replay_seek(_replay_output + _replay_record_len(_replay_output), true);
+        }
+
+    }
+
+}
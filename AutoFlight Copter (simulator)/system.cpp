@@ -1,12 +1,376 @@
 #include <system.h>
 #include <AF_HAL/serial_hal.h>
+#include <AF_HAL/sim_hal.h>
+#include <AF_HAL/pwm_hal.h>
+#include <AF_Context/AF_Context.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
 // System file for running AutoFlight in simulator mode (no hardware)
 
-// enable simulator mode
-#define AF_SIMULATOR
+// simulator mode is enabled by building with AF_SIMULATOR defined (-DAF_SIMULATOR),
+// so that every translation unit picks the host HAL instead of the AVR registers.
+#if !defined(AF_SIMULATOR)
+    #error "the simulator target must be built with -DAF_SIMULATOR"
+#endif
+
+/// how long the firmware flies the rig, in microseconds, or 0 to leave the HAL to the harness
+static uint32_t _rig_flight_us = 0;
+/// whether a blackbox log is being replayed into the firmware
+static bool _replaying = false;
+
+static void _rig_fly(void);
+
+namespace af_system {
+
+    void init_subsystems(void) {
+        if (_rig_flight_us > 0) _rig_fly();
+    }
+
+    void init_deferred(void) {
+    }
+
+}
+
+/// @brief stands in for the control tasks in the lockstep demo: four motor outputs that
+///        sweep through the throttle range, worked out in integers like the real mixer
+static uint8_t _lockstep_demo_control(uint32_t tick, uint16_t* outputs) {
+    for (uint8_t i = 0; i < 4; i++) {
+        uint32_t phase = (tick * (3 + i) + i * 250) % 2000;
+        outputs[i] = 1000 + (uint16_t)(phase < 1000 ? phase : 2000 - phase);
+    }
+    return 4;
+}
+
+/// @brief runs controllers in lockstep with a scripted set of faults and prints what was
+///        measured, see sim::lockstep_run()
+static int _lockstep_demo(uint8_t nodes) {
+    if (nodes != 2) nodes = 3;
+    const AF_HAL::sim::AF_Sim_Lockstep_Fault faults[] = {
+        { (uint8_t)(nodes - 1), 200, 209, AF_HAL::sim::AF_SIM_LOCKSTEP_CORRUPT },
+        { 1, 600, 700, AF_HAL::sim::AF_SIM_LOCKSTEP_SILENT },
+        { (uint8_t)(nodes - 1), 1000, 1005, AF_HAL::sim::AF_SIM_LOCKSTEP_LATE },
+        { 0, 1400, 1400, AF_HAL::sim::AF_SIM_LOCKSTEP_CORRUPT },
+    };
+    AF_HAL::sim::AF_Sim_Lockstep_Report report;
+    AF_HAL::sim::lockstep_run(nodes, _lockstep_demo_control, 2000, 2500, faults, sizeof(faults) / sizeof(faults[0]), report);
+
+    printf("lockstep: %u controllers, 2000 ticks at 400 Hz\n", nodes);
+    printf("  detection: %lu ticks at most, %u faults never masked\n", (unsigned long)report.detect_ticks_max, report.undetected);
+    printf("  bad outputs driven: %lu controller ticks\n", (unsigned long)report.bad_output_ticks);
+    printf("  disagreements: %lu\n", (unsigned long)report.disagreements);
+    printf("  vote latency: %lu us avg, %lu us max, %lu votes waited out the period\n",
+           (unsigned long)report.vote_us_avg, (unsigned long)report.vote_us_max, (unsigned long)report.vote_timeouts);
+    printf("  link: %u bytes/tick, %lu bytes/s per controller\n", report.link_bytes_per_tick, (unsigned long)report.link_bytes_per_s);
+    return 0;
+}
+
+/// @brief runs the time sync between a master and clients with the given clock skews, over
+///        a link like the GCS link at 57600 baud, and prints what was measured, see
+///        sim::timesync_run()
+static int _timesync_demo(const char* skews) {
+    AF_HAL::sim::AF_Sim_TimeSync_Node clients[8];
+    uint8_t count = 0;
+    const char* p = skews;
+    while (*p != '\0' && count < 8) {
+        char* end;
+        long skew = strtol(p, &end, 10);
+        if (end == p) break;
+        clients[count].skew_ppm = (int32_t)skew;
+        clients[count].start_us = 0x9E3779B9UL * (count + 1);
+        count++;
+        p = *end == ',' ? end + 1 : end;
+    }
+    if (count == 0) {
+        fprintf(stderr, "AF_SIM_TIMESYNC: expected clock skews in ppm, i.e. 100,-2500\n");
+        return 1;
+    }
+
+    const AF_HAL::sim::AF_Sim_TimeSync_Node master = { 0, 12345 };
+    // a 14 byte payload framed is about 21 bytes, 3.6 ms at 57600 baud. tasks pick frames up
+    // within a millisecond, and now and then one waits behind a queue of telemetry.
+    const AF_HAL::sim::AF_Sim_TimeSync_Link link = { 3600, 1000, 10, 10000 };
+    AF_HAL::sim::AF_Sim_TimeSync_Report report;
+    AF_HAL::sim::timesync_run(master, clients, count, link, 120000000UL, 1, report);
+
+    printf("timesync: %u clients, 120 s\n", count);
+    printf("  synced after %lu us\n", (unsigned long)report.sync_us);
+    printf("  error: %lu us max, %lu us once settled, %lu us rms\n",
+           (unsigned long)report.max_error_us, (unsigned long)report.settled_error_us, (unsigned long)report.rms_error_us);
+    printf("  bound: %lu us max, %lu of %lu checks over the bound\n", (unsigned long)report.max_bound_us,
+           (unsigned long)report.bound_violations, (unsigned long)report.checks);
+    printf("  drift: %lu ppb off at most\n", (unsigned long)report.max_drift_error_ppb);
+    return 0;
+}
+
+/// @brief the attitude the rig is asked to hold, in degrees: steps of +/-10 degrees, every 2 s
+static float _rig_setpoint_deg(uint32_t now_us) {
+    static const float steps[3] = { 10.0f, -10.0f, 0.0f };
+    return steps[(now_us / 2000000UL) % 3];
+}
+
+/// @brief one axis of a copter on a test rig: two motors pushing against each other, in wind.
+///        the angle and the rate come back on analog inputs 0 and 1, with noise.
+class Rig_Model: public AF_HAL::sim::AF_Sim_Model {
+
+    public:
+
+        Rig_Model(const AF_HAL::sim::AF_Sim_Farm_Variant& variant) :
+            _noise_lsb(variant.noise_lsb), _wind(variant.wind), _gust(variant.gust), _rng(variant.seed != 0 ? variant.seed : 1) {}
+
+        void update(uint32_t now_us, uint32_t dt_us, const uint16_t* pwm, uint16_t* adc) override {
+            float dt = dt_us * 1e-6f;
+            // gusts wander towards a new strength every step
+            _gust_now += (_draw() * _gust - _gust_now) * 0.01f;
+            float thrust = pwm[0] > 0 && pwm[1] > 0 ? 2.0f * ((int16_t)pwm[0] - (int16_t)pwm[1]) : 0;
+            float accel = thrust - 0.5f * _rate + _wind + _gust_now;
+            _rate += accel * dt;
+            _angle += _rate * dt;
+            if (_angle > 90) { _angle = 90; _rate = 0; }
+            if (_angle < -90) { _angle = -90; _rate = 0; }
+
+            adc[0] = _encode(512 + _angle * 5);
+            adc[1] = _encode(512 + _rate * 0.5f);
+
+            float error = _angle - _rig_setpoint_deg(now_us);
+            _error_sq += error * error;
+            _steps++;
+        }
+
+        /// @brief gets the rms angle error so far, in degrees
+        float get_rms_error(void) const { return _steps > 0 ? sqrtf(_error_sq / _steps) : 0; }
+
+    private:
+
+        /// @brief draws a number in [-1, 1)
+        float _draw(void) {
+            _rng ^= _rng << 13;
+            _rng ^= _rng >> 17;
+            _rng ^= _rng << 5;
+            return (_rng >> 8) / 8388608.0f - 1.0f;
+        }
+
+        uint16_t _encode(float counts) {
+            counts += _noise_lsb * _draw();
+            return counts < 0 ? 0 : (counts > 1023 ? 1023 : (uint16_t)counts);
+        }
+
+        uint8_t _noise_lsb;
+        float _wind;
+        float _gust;
+        float _gust_now = 0;
+        uint32_t _rng;
+        float _angle = 0;
+        float _rate = 0;
+        float _error_sq = 0;
+        uint32_t _steps = 0;
+
+};
+
+/// @brief a vehicle for the farm: the rig, held by a PID loop at 400 Hz with its gains in
+///        variables, so each context has its own
+class Rig_Vehicle: public AF_HAL::sim::AF_Sim_Farm_Vehicle {
+
+    public:
+
+        Rig_Vehicle() :
+            _kp("rig.kp", 0, AF_VAR_FLAG_READABLE_BY_GCS | AF_VAR_FLAG_WRITABLE_BY_GCS),
+            _ki("rig.ki", 0, AF_VAR_FLAG_READABLE_BY_GCS | AF_VAR_FLAG_WRITABLE_BY_GCS),
+            _kd("rig.kd", 0, AF_VAR_FLAG_READABLE_BY_GCS | AF_VAR_FLAG_WRITABLE_BY_GCS) {}
+
+        ~Rig_Vehicle() {
+            AF_HAL::sim::set_model(nullptr);
+            delete _model;
+        }
+
+        void setup(const AF_HAL::sim::AF_Sim_Farm_Variant& variant) override {
+            install_model(variant);
+            AF_Context::current()->set_user(this);
+            start(variant);
+        }
+
+        /// @brief puts the rig on the board, which a replay leaves out
+        void install_model(const AF_HAL::sim::AF_Sim_Farm_Variant& variant) {
+            _model = new Rig_Model(variant);
+            AF_HAL::sim::set_model(_model);
+        }
+
+        /// @brief sets the gains and starts the control task
+        void start(const AF_HAL::sim::AF_Sim_Farm_Variant& variant) {
+            _kp = variant.kp;
+            _ki = variant.ki;
+            _kd = variant.kd;
+            AF_HAL::pwm::init(AF_PWM_MODE_STANDARD, 400);
+            AF_HAL::pwm::enable(0);
+            AF_HAL::pwm::enable(1);
+            AF_SCHEDULER_RECURRING_TASK(_control, 50, 400);
+        }
+
+        float score(void) override {
+            return _model != nullptr ? _model->get_rms_error() : 0;
+        }
+
+        /// the rig flown by the firmware itself, outside any context
+        static Rig_Vehicle* process_rig;
+
+    private:
+
+        /// @brief the control task
+        static void _control(void) {
+            AF_Context* context = AF_Context::current();
+            Rig_Vehicle* rig = context != nullptr ? static_cast<Rig_Vehicle*>(context->get_user()) : process_rig;
+            float angle = ((int16_t)AF_HAL::io::aread(0) - 512) / 5.0f;
+            float rate = ((int16_t)AF_HAL::io::aread(1) - 512) / 0.5f;
+            float error = _rig_setpoint_deg(AF_HAL::micros()) - angle;
+            rig->_integral += error / 400.0f;
+            float out = rig->_kp * error + rig->_ki * rig->_integral - rig->_kd * rate;
+            if (out > 400) out = 400;
+            if (out < -400) out = -400;
+            AF_HAL::pwm::set(0, 1500 + (int16_t)out);
+            AF_HAL::pwm::set(1, 1500 - (int16_t)out);
+            AF_HAL::pwm::commit();
+        }
+
+        AF_Float _kp;
+        AF_Float _ki;
+        AF_Float _kd;
+        float _integral = 0;
+        Rig_Model* _model = nullptr;
+
+};
+
+Rig_Vehicle* Rig_Vehicle::process_rig = nullptr;
+
+static AF_HAL::sim::AF_Sim_Farm_Vehicle* _rig_factory(void) {
+    return new Rig_Vehicle();
+}
+
+/// @brief ends the rig's flight, and with it the recording
+static void _rig_watch(void) {
+    // a replay runs this too, reading the clock as often as the recording did
+    if (!AF_HAL::time_reached(AF_HAL::micros(), _rig_flight_us) || _replaying) return;
+    AF_HAL::sim::record_stop();
+    printf("rig: flew %.1f s, %.2f deg rms\n", _rig_flight_us / 1e6, Rig_Vehicle::process_rig->score());
+    exit(EXIT_SUCCESS);
+}
+
+/// @brief flies the rig on the process's board with a fixed tuning in gusty wind. a replay
+///        leaves the rig itself out: the log feeds the inputs it gave when recorded.
+static void _rig_fly(void) {
+    AF_HAL::sim::AF_Sim_Farm_Variant variant = { 10.0f, 1.0f, 0.4f, 2, 20.0f, 50.0f, 1 };
+    Rig_Vehicle::process_rig = new Rig_Vehicle();
+    if (!_replaying) Rig_Vehicle::process_rig->install_model(variant);
+    Rig_Vehicle::process_rig->start(variant);
+    AF_SCHEDULER_RECURRING_TASK(_rig_watch, 10, 10);
+}
+
+/// @brief prints what a replay found and ends the process, failing on a divergence
+static void _replay_done(const AF_HAL::sim::AF_Sim_Replay_Report& report) {
+    printf("replay: %lu inputs fed, %lu commands matched, %lu us skew at most\n", (unsigned long)report.inputs,
+           (unsigned long)report.outputs, (unsigned long)report.skew_us_max);
+    if (!report.diverged) {
+        printf("  %.1f s of log in %.2f s, %.0fx real time\n", report.log_us / 1e6, report.wall_s, report.log_us / 1e6 / report.wall_s);
+        exit(EXIT_SUCCESS);
+    }
+
+    printf("  diverged at %lu us (logged at %lu us)\n", (unsigned long)report.diverged_at_us, (unsigned long)report.recorded_at_us);
+    for (uint8_t i = 0; i < AF_SIM_PWM_CHANNELS; i++) {
+        if (!((report.expected_mask | report.actual_mask) & (1 << i))) continue;
+        printf("    channel %u: logged %u us, got %u us\n", i, report.expected[i], report.actual[i]);
+    }
+    exit(EXIT_FAILURE);
+}
+
+/// @brief flies a Monte Carlo batch of rig tunings on the farm and prints what was measured,
+///        see sim::farm_run()
+static int _farm_demo(uint8_t threads) {
+    AF_HAL::sim::AF_Sim_Farm_Batch batch = {};
+    batch.kp_min = 2;
+    batch.kp_max = 20;
+    batch.ki_min = 0;
+    batch.ki_max = 4;
+    batch.kd_min = 0.1f;
+    batch.kd_max = 1.0f;
+    batch.steps = 4;
+    batch.trials = 4;
+    batch.noise_lsb_max = 4;
+    batch.wind_max = 100;
+    batch.gust_max = 200;
+    batch.seed = 1;
+
+    static AF_HAL::sim::AF_Sim_Farm_Variant variants[256];
+    static float scores[256];
+    uint32_t count = AF_HAL::sim::farm_batch(batch, variants, 256);
+    AF_HAL::sim::AF_Sim_Farm_Report report;
+    AF_HAL::sim::farm_run(_rig_factory, variants, count, 6000000UL, threads, scores, report);
+
+    // a tuning is only as good as its worst trial
+    uint32_t best = 0;
+    float best_worst = 1e9f;
+    for (uint32_t g = 0; g < count; g += batch.trials) {
+        float worst = 0;
+        for (uint16_t t = 0; t < batch.trials; t++) {
+            if (scores[g + t] > worst) worst = scores[g + t];
+        }
+        if (worst < best_worst) {
+            best_worst = worst;
+            best = g;
+        }
+    }
+
+    printf("farm: %lu variants, 6 s each, %u workers\n", (unsigned long)count, report.threads);
+    printf("  %.0f s flown in %.2f s, %.0fx real time, %lu slices stolen\n",
+           report.sim_s, report.wall_s, report.sim_s / report.wall_s, (unsigned long)report.steals);
+    printf("  best trial: %.2f deg rms (kp %.2f ki %.2f kd %.2f)\n", report.best_score,
+           variants[report.best].kp, variants[report.best].ki, variants[report.best].kd);
+    printf("  best tuning: %.2f deg rms at worst (kp %.2f ki %.2f kd %.2f)\n", best_worst,
+           variants[best].kp, variants[best].ki, variants[best].kd);
+    return 0;
+}
+
+int main() {
+    // AF_SIM_LOCKSTEP=2 or 3 runs the lockstep demo instead of the firmware
+    const char* lockstep = getenv("AF_SIM_LOCKSTEP");
+    if (lockstep != nullptr) {
+        return _lockstep_demo((uint8_t)atoi(lockstep));
+    }
+
+    // AF_SIM_TIMESYNC=<skew ppm>[,...] runs the time sync demo, a client per skew
+    const char* timesync = getenv("AF_SIM_TIMESYNC");
+    if (timesync != nullptr) {
+        return _timesync_demo(timesync);
+    }
+
+    // AF_SIM_FARM=<workers> flies the farm demo, 0 for one worker per core
+    const char* farm = getenv("AF_SIM_FARM");
+    if (farm != nullptr) {
+        return _farm_demo((uint8_t)atoi(farm));
+    }
+
+    // AF_SIM_RIG=<seconds> has the firmware fly the rig, then exit
+    const char* rig = getenv("AF_SIM_RIG");
+    if (rig != nullptr) _rig_flight_us = (uint32_t)(atof(rig) * 1e6);
+
+    // AF_SIM_RECORD=<path> records a blackbox log of the flight
+    const char* record = getenv("AF_SIM_RECORD");
+    if (record != nullptr && !AF_HAL::sim::record_start(record)) {
+        fprintf(stderr, "AF_SIM_RECORD: can't write %s\n", record);
+        return 1;
+    }
+
+    // AF_SIM_REPLAY=<path> replays a blackbox log and checks the commands against it
+    const char* replay = getenv("AF_SIM_REPLAY");
+    if (replay != nullptr) {
+        if (!AF_HAL::sim::replay_start(replay, _replay_done)) {
+            fprintf(stderr, "AF_SIM_REPLAY: can't read %s\n", replay);
+            return 1;
+        }
+        _replaying = true;
+    }
 
-void main() {
     // initialize the system
     af_system::start();
-}
\ No newline at end of file
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <AF_HAL/sim_hal.h>
+#include <AF_Context/AF_Context.h>
+#include <AF_TimeSync/AF_TimeSync.h>
+
+#include <math.h>
+
+/// how often the harness compares the clocks, in microseconds of true time
+#define SIM_TIMESYNC_CHECK_US 1000
+/// how long after its first sync a client's error counts as settled, long enough for the
+/// line through its exchanges to span a few windows
+#define SIM_TIMESYNC_SETTLE_US 20000000ULL
+
+// Time sync harness for the simulator: the master and each client keep their own skewed
+// virtual clock, all driven from one true time, see sim_hal.h
+
+namespace AF_HAL {
+
+    namespace sim {
+
+        /// @brief gets a processor's clock at a true time
+        static uint32_t _timesync_clock(const AF_Sim_TimeSync_Node& node, uint64_t true_us) {
+            int64_t skew = (int64_t)true_us * node.skew_ppm / 1000000LL;
+            return node.start_us + (uint32_t)(true_us + skew);
+        }
+
+        /// @brief makes one processor's side of the sync in its own context, so its sync_*
+        ///        variables register there and go with it
+        static AF_TimeSync* _timesync_make(AF_Context& context, AF_TimeSync_Role role) {
+            AF_Context_Scope scope(context);
+            return new AF_TimeSync(role);
+        }
+
+        /// @brief picks how long a payload takes to cross the link
+        static uint32_t _timesync_delay(const AF_Sim_TimeSync_Link& link, uint32_t& rng) {
+            // xorshift, so a seed repeats a run on any host
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            uint32_t delay = link.delay_us;
+            if (link.jitter_us > 0) delay += rng % (link.jitter_us + 1);
+            if ((rng >> 8) % 100 < link.queued_pct) delay += link.queued_us;
+            return delay;
+        }
+
+        void timesync_run(const AF_Sim_TimeSync_Node& master, const AF_Sim_TimeSync_Node* clients, uint8_t count,
+                          const AF_Sim_TimeSync_Link& link, uint32_t duration_us, uint32_t seed, AF_Sim_TimeSync_Report& report) {
+            report = AF_Sim_TimeSync_Report();
+            uint32_t rng = seed != 0 ? seed : 1;
+            double sum_sq = 0;
+
+            for (uint8_t c = 0; c < count; c++) {
+                const AF_Sim_TimeSync_Node& client = clients[c];
+                AF_Context master_context, client_context;
+                AF_TimeSync& master_sync = *_timesync_make(master_context, AF_TIMESYNC_MASTER);
+                AF_TimeSync& client_sync = *_timesync_make(client_context, AF_TIMESYNC_CLIENT);
+
+                // a reply on its way back, as the client's clock will read when it lands
+                uint8_t reply[AF_TIMESYNC_PAYLOAD_LEN];
+                bool in_flight = false;
+                uint64_t reply_at = 0;
+                // the clients don't ask in step with each other
+                uint64_t next_request = (uint64_t)c * AF_TIMESYNC_INTERVAL_US / (count + 1);
+                bool synced = false;
+                uint64_t synced_at = 0;
+
+                for (uint64_t now = 0; now <= duration_us; now += SIM_TIMESYNC_CHECK_US) {
+                    while (next_request <= now) {
+                        uint8_t request[AF_TIMESYNC_PAYLOAD_LEN];
+                        client_sync.make_request(_timesync_clock(client, next_request), request);
+                        uint64_t arrives = next_request + _timesync_delay(link, rng);
+                        in_flight = master_sync.on_payload(request, AF_TIMESYNC_PAYLOAD_LEN, _timesync_clock(master, arrives), reply);
+                        reply_at = arrives + _timesync_delay(link, rng);
+                        next_request += AF_TIMESYNC_INTERVAL_US;
+                    }
+                    if (in_flight && reply_at <= now) {
+                        client_sync.on_payload(reply, AF_TIMESYNC_PAYLOAD_LEN, _timesync_clock(client, reply_at), nullptr);
+                        in_flight = false;
+                    }
+
+                    uint32_t local = _timesync_clock(client, now);
+                    uint32_t bound = client_sync.get_error_us(local);
+                    if (bound == 0xFFFFFFFFUL) continue;
+                    if (!synced) {
+                        synced = true;
+                        synced_at = now;
+                        if (now > report.sync_us) report.sync_us = (uint32_t)now;
+                    }
+
+                    int32_t error = (int32_t)(client_sync.to_shared(local) - _timesync_clock(master, now));
+                    uint32_t magnitude = error < 0 ? -error : error;
+                    if (magnitude > report.max_error_us) report.max_error_us = magnitude;
+                    if (now >= synced_at + SIM_TIMESYNC_SETTLE_US && magnitude > report.settled_error_us) {
+                        report.settled_error_us = magnitude;
+                    }
+                    if (bound > report.max_bound_us) report.max_bound_us = bound;
+                    if (magnitude > bound) report.bound_violations++;
+                    sum_sq += (double)magnitude * magnitude;
+                    report.checks++;
+                }
+
+                // the master's clock ticks (1 + m) for every (1 + c) of the client's
+                double true_ppb = ((1.0 + master.skew_ppm * 1e-6) / (1.0 + client.skew_ppm * 1e-6) - 1.0) * 1e9;
+                uint32_t drift_error = (uint32_t)fabs(client_sync.get_drift_ppb() - true_ppb);
+                if (drift_error > report.max_drift_error_ppb) report.max_drift_error_ppb = drift_error;
+
+                // before the contexts, whose storage their variables are in
+                delete &master_sync;
+                delete &client_sync;
+            }
+
+            report.rms_error_us = report.checks > 0 ? (uint32_t)sqrt(sum_sq / report.checks) : 0;
+        }
+
+    }
+
+}
@@ -1,8 +1,66 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "AF_HAL/system_hal.h"
+#include "AF_HAL/adc_hal.h"
+#include "AF_HAL/pwm_hal.h"
+#include "AF_HAL/pin_hal.h"
+#include "AF_HAL/twi_hal.h"
+#include "AF_HAL/spi_hal.h"
+#include "AF_HAL/eeprom_hal.h"
+#include <avr/eeprom.h>
+#include <util/delay.h>
+
+#if F_CPU != 16000000UL
+    #error "the system clock assumes a 16 MHz cpu clock"
+#endif
+
+// the system clock is a 16-bit timer counting cpu cycles, extended in software by its
+// overflow interrupt. it runs from the undivided clock, so the prescaler halt the pwm
+// engine uses to synchronize timers 1, 3 and 4 never stops it.
+#if defined(__AVR_ATmega2560__)
+    #define CLOCK_TCCRA     TCCR5A
+    #define CLOCK_TCCRB     TCCR5B
+    #define CLOCK_TCNT      TCNT5
+    #define CLOCK_TIFR      TIFR5
+    #define CLOCK_TIMSK     TIMSK5
+    #define CLOCK_TOV       TOV5
+    #define CLOCK_TOIE      TOIE5
+    #define CLOCK_CS0       CS50
+    #define CLOCK_OVF_vect  TIMER5_OVF_vect
+    #define CLOCK_OCRA      OCR5A
+    #define CLOCK_OCFA      OCF5A
+    #define CLOCK_OCIEA     OCIE5A
+    #define CLOCK_COMPA_vect TIMER5_COMPA_vect
+#elif defined(__AVR_ATmega328P__)
+    #define CLOCK_TCCRA     TCCR1A
+    #define CLOCK_TCCRB     TCCR1B
+    #define CLOCK_TCNT      TCNT1
+    #define CLOCK_TIFR      TIFR1
+    #define CLOCK_TIMSK     TIMSK1
+    #define CLOCK_TOV       TOV1
+    #define CLOCK_TOIE      TOIE1
+    #define CLOCK_CS0       CS10
+    #define CLOCK_OVF_vect  TIMER1_OVF_vect
+    #define CLOCK_OCRA      OCR1A
+    #define CLOCK_OCFA      OCF1A
+    #define CLOCK_OCIEA     OCIE1A
+    #define CLOCK_COMPA_vect TIMER1_COMPA_vect
+#else
+    #error "AutoFlight has no system clock for this hardware"
+#endif
 
 void AF_HAL::init() {
-    
+
+    // start the system clock: normal mode, clk/1, interrupt on overflow
+    AF_ATOMIC_BLOCK {
+        CLOCK_TCCRA = 0;
+        CLOCK_TCCRB = (1 << CLOCK_CS0);
+        CLOCK_TCNT = 0;
+        CLOCK_TIFR = (1 << CLOCK_TOV);
+        CLOCK_TIMSK |= (1 << CLOCK_TOIE);
+    }
+    sei();
+
 #if defined(AF_SERIAL_ENABLED)
     // initialize serial
     AF_HAL::hwserial::SerialInterface0.open(BAUDR_57600);
@@ -11,41 +69,435 @@ void AF_HAL::init() {
 };
 
 namespace AF_HAL {
-    namespace io {
 
-        uint16_t aread(int pin) {
-            ADMUX = (1 << REFS0) | (pin & 0x07); // select the pin and set reference voltage to AVCC
-            ADCSRA |= (1 << ADSC);               // start the conversion
-            while (ADCSRA & (1 << ADSC));        // wait for the conversion to finish
-            return ADCW;                         // return the result
+    /// clock timer overflows, each one 65536 cycles (4096 us)
+    static volatile uint32_t _clock_overflows = 0;
+    /// clock timer overflows past 32 bits, so micros64() doesn't roll over for 36,000 years
+    static volatile uint16_t _clock_overflows_hi = 0;
+
+    /// the clock timer rolled over
+    ISR(CLOCK_OVF_vect) {
+        if (++_clock_overflows == 0) _clock_overflows_hi++;
+    }
+
+    /// @brief reads the clock timer and its overflow count as one consistent value
+    /// @param ticks set to the timer value
+    /// @param overflows set to the overflow count
+    /// @param overflows_hi set to the overflow count past 32 bits
+    static inline void _clock_read(uint16_t& ticks, uint32_t& overflows, uint16_t& overflows_hi) {
+        AF_ATOMIC_BLOCK {
+            ticks = CLOCK_TCNT;
+            overflows = _clock_overflows;
+            overflows_hi = _clock_overflows_hi;
+            // the timer may have rolled over since interrupts were disabled. if the count we read
+            // is small, it was read after the rollover, so count the overflow the ISR hasn't seen yet.
+            if ((CLOCK_TIFR & (1 << CLOCK_TOV)) && ticks < 0x8000) {
+                if (++overflows == 0) overflows_hi++;
+            }
+        }
+    }
+
+    uint32_t micros(void) {
+        uint16_t ticks;
+        uint32_t overflows;
+        uint16_t overflows_hi;
+        _clock_read(ticks, overflows, overflows_hi);
+        // 16 cycles per microsecond, so each overflow is 4096 us and the low 32 bits of
+        // micros64() are the low 20 bits of the overflow count above the top 12 bits of the timer
+        return (overflows << 12) | (ticks >> 4);
+    }
+
+    uint64_t micros64(void) {
+        uint16_t ticks;
+        uint32_t overflows;
+        uint16_t overflows_hi;
+        _clock_read(ticks, overflows, overflows_hi);
+        return (((uint64_t)overflows_hi << 48) | ((uint64_t)overflows << 16) | ticks) >> 4;
+    }
+
+    uint32_t cycles(void) {
+        uint16_t ticks;
+        uint32_t overflows;
+        uint16_t overflows_hi;
+        _clock_read(ticks, overflows, overflows_hi);
+        return (overflows << 16) | ticks;
+    }
+
+    uint32_t _capture_cycles(uint16_t ticks) {
+        uint32_t overflows = _clock_overflows;
+        // captures take priority over the overflow interrupt, so an overflow that's still
+        // pending happened after a capture made late in the timer's count, or before an early one
+        if ((CLOCK_TIFR & (1 << CLOCK_TOV)) && ticks < 0x8000) overflows++;
+        return (overflows << 16) | ticks;
+    }
+
+    /// @brief points the ADC multiplexer at a pin, with AVCC as the reference
+    static inline void _adc_select(uint8_t pin) {
+        ADMUX = (1 << REFS0) | (pin & 0x07);
+#if defined(MUX5)
+        // pins 8-15 on the 2560 are selected with MUX5 in ADCSRB
+        if (pin & 0x08) ADCSRB |= (1 << MUX5); else ADCSRB &= ~(1 << MUX5);
+#endif
+    }
+
+    namespace adc {
+
+        void _hw_start(uint8_t pin) {
+            _adc_select(pin);
+            // enable the ADC (prescaler 128, 125 kHz at 16 MHz) and the complete interrupt, then start
+            ADCSRA = (1 << ADEN) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0) | (1 << ADSC);
+        }
+
+        void _hw_stop(void) {
+            // leave the ADC enabled for aread(), but stop taking interrupts
+            ADCSRA &= ~(1 << ADIE);
+        }
+
+    }
+
+    namespace pwm {
+
+#if defined(__AVR_ATmega2560__)
+
+        /// the number of pwm channels (timers 1, 3 and 4, three outputs each)
+        #define PWM_NUM_CHANNELS 9
+
+        /// compare register for each channel
+        static volatile uint16_t* const _ocr[PWM_NUM_CHANNELS] = {
+            &OCR1A, &OCR1B, &OCR1C, &OCR3A, &OCR3B, &OCR3C, &OCR4A, &OCR4B, &OCR4C
+        };
+        /// control register A for each channel, holding its compare output mode bits
+        static volatile uint8_t* const _tccra[PWM_NUM_CHANNELS] = {
+            &TCCR1A, &TCCR1A, &TCCR1A, &TCCR3A, &TCCR3A, &TCCR3A, &TCCR4A, &TCCR4A, &TCCR4A
         };
-        
-        void awrite(int pin, int value) {
-            // write to an analog pin
-            // the atmega2560 does not have a DAC, so we cannot directly write an analog value
+        /// control register C for each channel, holding its force output compare bit
+        static volatile uint8_t* const _tccrc[PWM_NUM_CHANNELS] = {
+            &TCCR1C, &TCCR1C, &TCCR1C, &TCCR3C, &TCCR3C, &TCCR3C, &TCCR4C, &TCCR4C, &TCCR4C
         };
-        
-        bool dread(uint8_t pin) {
-            return (PINB & (1 << pin)) ? IO_LOGICAL_1 : IO_LOGICAL_0; // mask the PINB register to get the value of the pin
+        /// the high compare output mode bit of each channel (COMnx0 is the bit below it)
+        static const uint8_t _com1_bit[PWM_NUM_CHANNELS] = {
+            COM1A1, COM1B1, COM1C1, COM3A1, COM3B1, COM3C1, COM4A1, COM4B1, COM4C1
         };
-        
-        void dwrite(int pin, int value) {
+        /// the force output compare bit of each channel
+        static const uint8_t _foc_bit[PWM_NUM_CHANNELS] = {
+            FOC1A, FOC1B, FOC1C, FOC3A, FOC3B, FOC3C, FOC4A, FOC4B, FOC4C
+        };
+        /// the digital pin of each channel
+        static const uint8_t _pin[PWM_NUM_CHANNELS] = AF_PWM_CHANNEL_PINS;
+
+        /// in oneshot mode, when the longest pulse of the last commit ends, in ticks
+        static uint16_t _oneshot_end = 0;
+
+        /// @brief holds the shared prescaler in reset, halting timers 1, 3 and 4 so they can be
+        ///        changed together. the system clock runs from the undivided clock, which the
+        ///        prescaler reset doesn't touch.
+        static inline void _timers_halt(void) { GTCCR = (1 << TSM) | (1 << PSRSYNC); }
+
+        /// @brief releases the prescaler, so timers 1, 3 and 4 resume on the same clock edge
+        static inline void _timers_release(void) { GTCCR = 0; }
+
+        uint8_t _hw_num_channels(void) {
+            return PWM_NUM_CHANNELS;
+        }
+
+        bool _hw_init(AF_PWM_Mode mode, uint16_t top) {
+            AF_ATOMIC_BLOCK {
+                _timers_halt();
+                if (mode == AF_PWM_MODE_STANDARD) {
+                    // fast pwm with ICRn as TOP (mode 14), clk/8. OCRnx is double buffered
+                    // by the timer and only takes effect at BOTTOM.
+                    TCCR1A = (1 << WGM11); TCCR1B = (1 << WGM13) | (1 << WGM12) | (1 << CS11);
+                    TCCR3A = (1 << WGM31); TCCR3B = (1 << WGM33) | (1 << WGM32) | (1 << CS31);
+                    TCCR4A = (1 << WGM41); TCCR4B = (1 << WGM43) | (1 << WGM42) | (1 << CS41);
+                    ICR1 = top; ICR3 = top; ICR4 = top;
+                } else {
+                    // normal mode, clk/8. pulses are started by forcing the outputs high
+                    // and ended by a clear-on-compare-match.
+                    TCCR1A = 0; TCCR1B = (1 << CS11);
+                    TCCR3A = 0; TCCR3B = (1 << CS31);
+                    TCCR4A = 0; TCCR4B = (1 << CS41);
+                }
+                TCNT1 = 0; TCNT3 = 0; TCNT4 = 0;
+                _timers_release();
+            }
+            _oneshot_end = 0;
+            return true;
+        }
+
+        void _hw_enable(uint8_t channel, bool enable) {
+            io::pmode(_pin[channel], IO_MODE_OUTPUT);
+            AF_ATOMIC_BLOCK {
+                if (enable) {
+                    // non-inverting in standard mode, clear on match in oneshot mode
+                    *_tccra[channel] = (*_tccra[channel] & ~(1 << (_com1_bit[channel] - 1))) | (1 << _com1_bit[channel]);
+                } else {
+                    *_tccra[channel] &= ~((1 << _com1_bit[channel]) | (1 << (_com1_bit[channel] - 1)));
+                    io::dwrite(_pin[channel], IO_LOGICAL_0);
+                }
+            }
+        }
+
+        bool _hw_commit(AF_PWM_Mode mode, const uint16_t* ticks, uint16_t enabled_mask) {
+
+            if (mode == AF_PWM_MODE_STANDARD) {
+                // hold the timers for the few cycles it takes to write every compare
+                // register, so they all latch at the same BOTTOM
+                AF_ATOMIC_BLOCK {
+                    _timers_halt();
+                    for (uint8_t i = 0; i < PWM_NUM_CHANNELS; i++) {
+                        if (enabled_mask & (1 << i)) *_ocr[i] = ticks[i];
+                    }
+                    _timers_release();
+                }
+                return true;
+            }
+
+            // oneshot: don't cut the last pulses short
+            if (TCNT1 < _oneshot_end && !(TIFR1 & (1 << TOV1))) return false;
+
+            uint16_t longest = 0;
+            AF_ATOMIC_BLOCK {
+                _timers_halt();
+                TCNT1 = 0; TCNT3 = 0; TCNT4 = 0;
+                TIFR1 = (1 << TOV1);
+                for (uint8_t i = 0; i < PWM_NUM_CHANNELS; i++) {
+                    if (!(enabled_mask & (1 << i))) continue;
+                    uint8_t com1 = (1 << _com1_bit[i]);
+                    uint8_t com0 = (1 << (_com1_bit[i] - 1));
+                    *_ocr[i] = ticks[i];
+                    // set on match + force: drives the output high now
+                    *_tccra[i] |= com1 | com0;
+                    *_tccrc[i] = (1 << _foc_bit[i]);
+                    // clear on match: ends the pulse when the counter reaches OCRnx
+                    *_tccra[i] &= ~com0;
+                    if (ticks[i] > longest) longest = ticks[i];
+                }
+                _timers_release();
+            }
+            _oneshot_end = longest;
+            return true;
+        }
+
+#else
+
+        // the only 16-bit timer belongs to the system clock, so there are no pwm channels
+
+        uint8_t _hw_num_channels(void) { return 0; }
+        bool _hw_init(AF_PWM_Mode mode, uint16_t top) { return false; }
+        void _hw_enable(uint8_t channel, bool enable) {}
+        bool _hw_commit(AF_PWM_Mode mode, const uint16_t* ticks, uint16_t enabled_mask) { return false; }
+
+#endif
+
+    }
+
+    namespace twi {
+
 #if defined(__AVR_ATmega2560__)
-            // 
+        typedef pins::D20 _sda;
+        typedef pins::D21 _scl;
+#elif defined(__AVR_ATmega328P__)
+        typedef pins::A4 _sda;
+        typedef pins::A5 _scl;
+#endif
+
+        /// the control bits every command keeps set: the peripheral and its interrupt
+        #define TWI_CR_BASE ((1 << TWEN) | (1 << TWIE))
+
+        void _hw_init(uint32_t freq_hz) {
+            // prescaler 1, SCL = F_CPU / (16 + 2 * TWBR)
+            TWSR = 0;
+            TWBR = (uint8_t)(((F_CPU / freq_hz) - 16) / 2);
+            TWCR = (1 << TWEN);
+        }
+
+        void _hw_start(void) {
+            TWCR = TWI_CR_BASE | (1 << TWINT) | (1 << TWSTA);
+        }
+
+        void _hw_write(uint8_t byte) {
+            TWDR = byte;
+            TWCR = TWI_CR_BASE | (1 << TWINT);
+        }
+
+        void _hw_read(bool ack) {
+            TWCR = TWI_CR_BASE | (1 << TWINT) | (ack ? (1 << TWEA) : 0);
+        }
+
+        void _hw_stop(bool restart) {
+            // with both set the peripheral sends the stop, then the start
+            TWCR = TWI_CR_BASE | (1 << TWINT) | (1 << TWSTO) | (restart ? (1 << TWSTA) : 0);
+        }
+
+        void _hw_halt(void) {
+            // switching the peripheral off releases the pins and leaves TWINT pending
+            TWCR = 0;
+        }
+
+        void _hw_recover(void) {
+            // take the pins back from the peripheral
+            TWCR = 0;
+            _sda::mode(IO_MODE_INPUT_PULLUP);
+            _scl::set();
+            _scl::mode(IO_MODE_OUTPUT);
 
+            // a device stuck mid-byte lets go of SDA within 9 clocks
+            for (uint8_t i = 0; i < 9 && !_sda::read(); i++) {
+                _scl::clear();
+                _delay_us(5);
+                _scl::set();
+                _delay_us(5);
+            }
+
+            // stop condition: SDA rises while SCL is high
+            _scl::clear();
+            _sda::clear();
+            _sda::mode(IO_MODE_OUTPUT);
+            _delay_us(5);
+            _scl::set();
+            _delay_us(5);
+            _sda::mode(IO_MODE_INPUT_PULLUP);
+            _delay_us(5);
+
+            // hand the pins back, the bit rate register kept its setting
+            _scl::mode(IO_MODE_INPUT_PULLUP);
+            TWCR = (1 << TWEN);
+        }
+
+    }
+
+    /// a bus event finished: move the transaction in progress along
+    ISR(TWI_vect) {
+        twi::_on_status(TWSR & 0xF8, TWDR);
+    }
+
+    namespace spi {
 
+#if defined(__AVR_ATmega2560__)
+        typedef pins::D53 _ss;
+        typedef pins::D52 _sck;
+        typedef pins::D51 _mosi;
+        typedef pins::D50 _miso;
+        /// the pin change interrupt bit of SS (PCINT0)
+        #define SPI_SS_PCINT 0
 #elif defined(__AVR_ATmega328P__)
-            // ATmega328P only has 8 digital pins, so we just manipulate PORTB
-            if (value) {
-                PORTB |= (1 << pin); // set the pin high
+        typedef pins::D10 _ss;
+        typedef pins::D13 _sck;
+        typedef pins::D11 _mosi;
+        typedef pins::D12 _miso;
+        /// the pin change interrupt bit of SS (PCINT2)
+        #define SPI_SS_PCINT 2
+#endif
+
+        /// how long the master holds each byte back, so the slave's ISR has loaded its reply
+        #define SPI_SLAVE_TURNAROUND_US 2
+
+        /// whether this end drives the clock
+        static bool _master = true;
+        /// the byte the master loads once the turnaround is over
+        static volatile uint8_t _next = 0;
+
+        void _hw_init(AF_SPI_Role role) {
+            _master = role == AF_SPI_ROLE_MASTER;
+            if (_master) {
+                _ss::set();
+                _ss::mode(IO_MODE_OUTPUT);
+                _sck::mode(IO_MODE_OUTPUT);
+                _mosi::mode(IO_MODE_OUTPUT);
+                _miso::mode(IO_MODE_INPUT);
+                // mode 0, msb first, fosc/16
+                SPCR = (1 << SPE) | (1 << SPIE) | (1 << MSTR) | (1 << SPR0);
             } else {
-                PORTB &= ~(1 << pin); // set the pin low
+                _ss::mode(IO_MODE_INPUT_PULLUP);
+                _sck::mode(IO_MODE_INPUT);
+                _mosi::mode(IO_MODE_INPUT);
+                _miso::mode(IO_MODE_OUTPUT);
+                SPCR = (1 << SPE) | (1 << SPIE);
+                // frame boundaries come from the SS edges
+                PCMSK0 |= (1 << SPI_SS_PCINT);
+                PCIFR = (1 << PCIF0);
+                PCICR |= (1 << PCIE0);
             }
-#endif
-        };
-    
-        void mode(int pin, int mode) {
-            // set the mode of a pin
+            SPSR = 0;
+        }
+
+        void _hw_select(bool selected) {
+            _ss::write(!selected);
+        }
+
+        void _hw_write(uint8_t byte) {
+            if (!_master) {
+                SPDR = byte;
+                return;
+            }
+            // rather than wait out the turnaround here, with every other interrupt held off,
+            // let the clock timer's compare interrupt load the byte when it's over
+            _next = byte;
+            AF_ATOMIC_BLOCK {
+                CLOCK_OCRA = CLOCK_TCNT + SPI_SLAVE_TURNAROUND_US * AF_CYCLES_PER_US;
+                CLOCK_TIFR = (1 << CLOCK_OCFA);
+                CLOCK_TIMSK |= (1 << CLOCK_OCIEA);
+            }
+        }
+
+    }
+
+    /// a byte finished shifting
+    ISR(SPI_STC_vect) {
+        spi::_on_byte(SPDR);
+    }
+
+    /// the master's turnaround is over: start the next byte
+    ISR(CLOCK_COMPA_vect) {
+        CLOCK_TIMSK &= ~(1 << CLOCK_OCIEA);
+        SPDR = spi::_next;
+    }
+
+    /// SS changed on the slave. SS is the only pin enabled on this pin change interrupt.
+    ISR(PCINT0_vect) {
+        spi::_on_select(!spi::_ss::read());
+    }
+
+    /// conversion complete: hand the result to the sequencer and start the next conversion
+    ISR(ADC_vect) {
+        uint8_t next = adc::_on_conversion(ADCW);
+        if (!adc::is_running()) return;
+        _adc_select(next);
+        ADCSRA |= (1 << ADSC);
+    }
+
+    namespace eeprom {
+
+        uint16_t size(void) {
+            return E2END + 1;
+        }
+
+        void read(uint16_t addr, void* dest, uint16_t len) {
+            uint8_t* out = static_cast<uint8_t*>(dest);
+            for (uint16_t i = 0; i < len; i++) {
+                out[i] = (uint32_t)addr + i <= E2END ? eeprom_read_byte((const uint8_t*)(addr + i)) : 0xFF;
+            }
+        }
+
+        void update(uint16_t addr, const void* src, uint16_t len) {
+            const uint8_t* in = static_cast<const uint8_t*>(src);
+            for (uint16_t i = 0; i < len && (uint32_t)addr + i <= E2END; i++) {
+                eeprom_update_byte((uint8_t*)(addr + i), in[i]);
+            }
+        }
+
+    }
+
+    namespace io {
+
+        uint16_t aread(uint8_t pin) {
+            _adc_select(pin);                    // select the pin and set reference voltage to AVCC
+            ADCSRA |= (1 << ADSC);               // start the conversion
+            while (ADCSRA & (1 << ADSC));        // wait for the conversion to finish
+            return ADCW;                         // return the result
         };
+
+        // dread, dwrite and pmode are table driven, see AF_HAL/pin_hal.cpp
+        // awrite and pwmwrite drive the pwm engine, see AF_HAL/pwm_hal.cpp
     }
 }
\ No newline at end of file
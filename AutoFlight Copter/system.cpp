@@ -1,5 +1,7 @@
 #include <system.h>
 #include <AF_HAL/serial_hal.h>
+#include <AF_Logger/AF_Logger.h>
+#include <AF_Memory/AF_Memory.h>
 
 // System file for running AutoFlight on an ATmega2560 
 
@@ -9,11 +11,26 @@
 // define the chip clock speed
 #define F_CPU 16000000UL
 
-// entry point for the program
-void main() {
-    // initialize the system
-    af_system::start();
+namespace af_system {
+
+    void init_subsystems(void) {
+        // sensors, the control loop and the outputs go here. the control loop calls
+        // af_system::notify_control_output() after each output.
+    }
 
-    AF_HAL::hwserial::SerialInterface0.open(BAUDR_57600);
+    void init_deferred(void) {
+        // the GCS link, and the housekeeping tasks behind it
+        AF_HAL::hwserial::SerialInterface0.open(BAUDR_57600);
+        af_gcs::init(&AF_HAL::hwserial::SerialInterface0, BAUDR_57600);
+        AF_SCHEDULER_RECURRING_TASK(af_gcs::update, 200, 100);
+        AF_SCHEDULER_RECURRING_TASK(af_logger::update, 200, 50);
+        AF_SCHEDULER_RECURRING_TASK(af_mem::update, 1000, 1);
+    }
 
-}
\ No newline at end of file
+}
+
+// entry point for the program
+int main() {
+    // initialize the system, never returns
+    af_system::start();
+}
@@ -0,0 +1,42 @@
+#include "AF_Context.h"
+
+#if defined(AF_SIMULATOR)
+
+#include <AF_Variable/AF_Variable.h>
+#include <AF_Scheduler/AF_Scheduler.h>
+#include <AF_GCS/AF_GCS.h>
+#include <AF_Memory/AF_Memory.h>
+
+thread_local AF_Context* AF_Context::_current = nullptr;
+
+AF_Context::AF_Context(void) {
+    _variables = new (AF_MEM_TAG_CONTEXT) AF_Variable_Storage();
+    _board = AF_HAL::sim::board_create();
+}
+
+AF_Context::~AF_Context() {
+    // the links and the scheduler hold variables, and find the context they were made in
+    // through the current one
+    {
+        AF_Context_Scope scope(*this);
+        af_mem::destroy(_gcs, AF_MEM_TAG_GCS);
+        af_mem::destroy(_scheduler, AF_MEM_TAG_SCHEDULER);
+        _gcs = nullptr;
+        _scheduler = nullptr;
+    }
+    af_mem::destroy(_variables, AF_MEM_TAG_CONTEXT);
+    AF_HAL::sim::board_destroy(_board);
+}
+
+AF_Context_Scope::AF_Context_Scope(AF_Context& context) {
+    _previous = AF_Context::_current;
+    _previous_board = AF_HAL::sim::board_enter(context._board);
+    AF_Context::_current = &context;
+}
+
+AF_Context_Scope::~AF_Context_Scope() {
+    AF_Context::_current = _previous;
+    AF_HAL::sim::board_enter(_previous_board);
+}
+
+#endif // AF_SIMULATOR
@@ -0,0 +1,117 @@
+#ifndef AF_CONTEXT_H_
+#define AF_CONTEXT_H_
+
+/// @file   AF_Context.h
+/// @brief  lets the host run many vehicles in one process, each with its own copy of the
+///         firmware's singletons. on the AVR there's one vehicle per chip and none of this is
+///         built.
+///
+/// a context holds what would otherwise be one per process:
+///  - the variable storage (AF_Variable_Storage::get_instance())
+///  - the scheduler (AF_Scheduler::get_instance())
+///  - the GCS (AF_GCS::get_singleton()), the first link created in the context
+///  - the list of topics (AF_Topic_Base::find())
+///  - the simulated board: its clock, model, analog inputs, pwm outputs, EEPROM and pwm
+///    engine (see sim_hal.h)
+///
+/// code runs in a context while an AF_Context_Scope for it is alive on the same thread. a
+/// context isn't tied to a thread: it can be entered on one, left, then entered on another,
+/// as long as it's only entered on one at a time. outside any context, the process-wide
+/// instances are used, as before.
+///
+/// what's built before main() stays process-wide: variables and topics defined at file scope
+/// register with the process-wide instances, so they're shared by every context, which is
+/// fine for diagnostics and wrong for state. the pins, the ADC sequencer, RC input, TWI, SPI
+/// and the serial ports are process-wide too, so only code outside any context can use them.
+/// AF_ATOMIC_BLOCK holds a process-wide lock on the host, so the logger and the other
+/// structures it guards stay consistent across threads.
+///
+/// everything made in a context (tasks, variables, topics, links) has to be made again in the
+/// next: give each vehicle a setup function that runs inside its context.
+
+#if defined(AF_SIMULATOR)
+
+#include <stdint.h>
+#include <AF_HAL/sim_hal.h>
+
+class AF_Variable_Storage;
+class AF_Scheduler;
+class AF_GCS;
+class AF_Topic_Base;
+
+/// @brief one vehicle's copy of the firmware's singletons
+class AF_Context {
+
+    public:
+
+        /// @brief makes a context with an empty variable storage, no scheduler or GCS yet,
+        ///        and a fresh board on a virtual clock at 0
+        AF_Context(void);
+
+        /// @brief destroys the GCS and the scheduler (with its tasks), then the variable
+        ///        storage and the board. anything else made in the context has to be gone
+        ///        by now.
+        ~AF_Context();
+
+        AF_Context(const AF_Context&) = delete;
+        AF_Context& operator=(const AF_Context&) = delete;
+
+        /// @brief gets the context running on this thread
+        /// @return the context, or nullptr outside any context
+        static AF_Context* current(void) { return _current; }
+
+        /// @brief gets the context's variable storage
+        AF_Variable_Storage* get_variables(void) const { return _variables; }
+
+        /// @brief gets the context's board, see sim_hal.h
+        AF_HAL::sim::AF_Sim_Board* get_board(void) const { return _board; }
+
+        /// @brief sets the vehicle's own state. tasks take no arguments, so ones that keep
+        ///        state per vehicle find it with AF_Context::current()->get_user().
+        void set_user(void* user) { _user = user; }
+        void* get_user(void) const { return _user; }
+
+    private:
+
+        /// the context running on each thread
+        static thread_local AF_Context* _current;
+
+        AF_Variable_Storage* _variables;
+        /// made by the first AF_Scheduler::get_instance() in the context
+        AF_Scheduler* _scheduler = nullptr;
+        /// the first link made in the context
+        AF_GCS* _gcs = nullptr;
+        /// the head of the list of topics made in the context
+        AF_Topic_Base* _topics = nullptr;
+        AF_HAL::sim::AF_Sim_Board* _board;
+        void* _user = nullptr;
+
+        friend class AF_Context_Scope;
+        friend class AF_Scheduler;
+        friend class AF_GCS;
+        friend class AF_Topic_Base;
+
+};
+
+/// @brief runs the code on this thread in a context for as long as it's alive, then goes
+///        back to whichever context was running before. scopes nest.
+class AF_Context_Scope {
+
+    public:
+
+        AF_Context_Scope(AF_Context& context);
+        ~AF_Context_Scope();
+
+        AF_Context_Scope(const AF_Context_Scope&) = delete;
+        AF_Context_Scope& operator=(const AF_Context_Scope&) = delete;
+
+    private:
+
+        AF_Context* _previous;
+        AF_HAL::sim::AF_Sim_Board* _previous_board;
+
+};
+
+#endif // AF_SIMULATOR
+
+#endif // AF_CONTEXT_H_
@@ -1,3 +1,193 @@
 #include "AF_GCS.h"
-#include <util/crc16.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_Memory/AF_Memory.h>
+#include <AF_Lockstep/AF_Lockstep.h>
 
+static_assert(AF_GCS_QUEUE_LEN > 0 && AF_GCS_QUEUE_LEN < AF_GCS_QUEUE_NONE, "queue slots are indexed by a byte");
+
+/// the budget is kept in millionths of a byte, so it can be topped up every microsecond
+#define GCS_BUDGET_SCALE 1000000UL
+
+AF_GCS* AF_GCS::_instance = nullptr;
+
+AF_GCS::AF_GCS(Stream* port, uint32_t baud) : _port(port) {
+    // the first link is the GCS, any others go to telemetry endpoints
+#if defined(AF_SIMULATOR)
+    AF_Context* context = AF_Context::current();
+    if (context != nullptr) {
+        if (context->_gcs == nullptr) context->_gcs = this;
+    } else
+#endif
+    if (_instance == nullptr) _instance = this;
+
+    // a start bit, 8 data bits and a stop bit for every byte
+    _bytes_per_s = baud / 10;
+    _streams.set_link_rate(_bytes_per_s);
+    _budget_at = AF_HAL::micros();
+
+    for (uint8_t p = 0; p < AF_GCS_PRIORITY_COUNT; p++) {
+        _queue_head[p] = AF_GCS_QUEUE_NONE;
+        _queue_tail[p] = AF_GCS_QUEUE_NONE;
+    }
+    for (uint8_t i = 0; i < AF_GCS_QUEUE_LEN; i++) {
+        _queue[i].next = i + 1 < AF_GCS_QUEUE_LEN ? i + 1 : AF_GCS_QUEUE_NONE;
+    }
+    _free = 0;
+}
+
+void AF_GCS::_pop(uint8_t priority) {
+    uint8_t slot = _queue_head[priority];
+    _queue_head[priority] = _queue[slot].next;
+    if (_queue_head[priority] == AF_GCS_QUEUE_NONE) _queue_tail[priority] = AF_GCS_QUEUE_NONE;
+    _queue[slot].next = _free;
+    _free = slot;
+}
+
+uint8_t AF_GCS::_write_frame(const Queued_Frame& frame) {
+    // encode straight into the TX buffer. nothing goes out until commit(), so a frame
+    // that turns out not to fit is simply never committed.
+    utilbuf::span spans[2];
+    utilbuf::ring_idx_t room = _port->reserve(spans);
+    AF_GCS_Frame_Writer writer(spans, room);
+
+    AF_GCS_Frame_Header header = { frame.type, frame.info, _seq, frame.len };
+    writer.put(reinterpret_cast<const uint8_t*>(&header), AF_GCS_HEADER_LEN);
+    writer.put(frame.payload, frame.len);
+
+    utilbuf::ring_idx_t n = writer.finish();
+    if (n == 0) return 0;
+    _port->commit(n);
+    _seq++;
+    return n;
+}
+
+bool AF_GCS::send(af_gcs_msg_type type, af_gcs_comp_group group, af_gcs_priority priority,
+                  const AF_GCS_Chunk* chunks, uint8_t count) {
+
+    uint16_t len = 0;
+    for (uint8_t i = 0; i < count; i++) len += chunks[i].len;
+    if (len > AF_GCS_MAX_PAYLOAD) return false;
+
+    if (_free == AF_GCS_QUEUE_NONE) {
+        // make room by dropping the oldest frame of the lowest priority waiting, unless
+        // everything waiting is more important than this frame
+        uint8_t lowest = 0;
+        while (_queue_head[lowest] == AF_GCS_QUEUE_NONE) lowest++;
+        if (lowest > priority) {
+            if (_frames_dropped[priority] != 0xFFFF) _frames_dropped[priority]++;
+            return false;
+        }
+        _pop(lowest);
+        if (_frames_dropped[lowest] != 0xFFFF) _frames_dropped[lowest]++;
+    }
+
+    uint8_t slot = _free;
+    Queued_Frame& frame = _queue[slot];
+    _free = frame.next;
+
+    frame.type = type;
+    frame.info = (uint8_t)((group << 4) | (priority & 0x0F));
+    frame.len = len;
+    frame.next = AF_GCS_QUEUE_NONE;
+    uint8_t* at = frame.payload;
+    for (uint8_t i = 0; i < count; i++) {
+        memcpy(at, chunks[i].data, chunks[i].len);
+        at += chunks[i].len;
+    }
+
+    if (_queue_tail[priority] == AF_GCS_QUEUE_NONE) {
+        _queue_head[priority] = slot;
+    } else {
+        _queue[_queue_tail[priority]].next = slot;
+    }
+    _queue_tail[priority] = slot;
+    return true;
+}
+
+bool AF_GCS::send_message(const AF_GCS_Message& msg) {
+    uint8_t name_len = msg.comp_name_len < AF_GCS_COMPONENT_NAME_MAX_LEN ? msg.comp_name_len : AF_GCS_COMPONENT_NAME_MAX_LEN;
+    uint8_t message_len = msg.message_len < AF_GCS_MESSAGE_MAX_LEN ? msg.message_len : AF_GCS_MESSAGE_MAX_LEN;
+
+    // payload: the name length, the name, then the message
+    AF_GCS_Chunk chunks[3] = {
+        { &name_len, 1 },
+        { reinterpret_cast<const uint8_t*>(msg.comp_name), name_len },
+        { reinterpret_cast<const uint8_t*>(msg.message), message_len }
+    };
+    return send(AF_GCS_MSG_TEXT, msg.group, msg.priority, chunks, 3);
+}
+
+bool AF_GCS::receive(void) {
+    if (!_decoder.feed(_port)) return false;
+    const AF_GCS_Frame_Header* header = _decoder.get_header();
+    switch (header->type) {
+        case AF_GCS_MSG_SUBSCRIBE:
+            _streams.subscribe(_decoder.get_payload(), header->len);
+            break;
+        case AF_GCS_MSG_REQUEST:
+            _requests.on_request(*this, header, _decoder.get_payload());
+            break;
+        case AF_GCS_MSG_ACK:
+            _requests.on_ack(_decoder.get_payload(), header->len);
+            break;
+        case AF_GCS_MSG_LOCKSTEP:
+            if (_lockstep != nullptr) _lockstep->on_digest(_decoder.get_payload(), header->len);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+void AF_GCS::update(void) {
+
+    uint32_t now = AF_HAL::micros();
+    _requests.update(*this, now);
+    _streams.update(*this, now);
+
+    // top up the budget for the time since the last update, without letting it build up
+    // past one burst while the link is quiet
+    const uint32_t max_budget = AF_GCS_BUDGET_BURST * GCS_BUDGET_SCALE;
+    uint32_t elapsed = now - _budget_at;
+    _budget_at = now;
+    if (elapsed > max_budget / _bytes_per_s) elapsed = max_budget / _bytes_per_s;
+    _budget += elapsed * _bytes_per_s;
+    if (_budget > max_budget) _budget = max_budget;
+
+    for (int8_t p = AF_GCS_PRIORITY_COUNT - 1; p >= 0; p--) {
+        while (_queue_head[p] != AF_GCS_QUEUE_NONE) {
+            const Queued_Frame& frame = _queue[_queue_head[p]];
+
+            // frames never reach 254 bytes, so COBS adds one byte at most
+            uint32_t cost = (uint32_t)(frame.len + AF_GCS_FRAME_OVERHEAD) * GCS_BUDGET_SCALE;
+            // don't let lower priority frames jump ahead while this one waits
+            if (_budget < cost) return;
+
+            uint8_t n = _write_frame(frame);
+            if (n == 0) return;
+
+            _budget -= (uint32_t)n * GCS_BUDGET_SCALE;
+            _frames_sent++;
+            _payload_bytes_sent += frame.len;
+            _pop(p);
+        }
+    }
+}
+
+uint8_t AF_GCS::get_queued(void) const {
+    uint8_t queued = AF_GCS_QUEUE_LEN;
+    for (uint8_t slot = _free; slot != AF_GCS_QUEUE_NONE; slot = _queue[slot].next) queued--;
+    return queued;
+}
+
+namespace af_gcs {
+
+    AF_GCS * init(Stream* port, uint32_t baud) {
+        return new (AF_MEM_TAG_GCS) AF_GCS(port, baud);
+    }
+
+    void update(void) {
+        if (AF_GCS::get_singleton() != nullptr) AF_GCS::get_singleton()->update();
+    }
+
+};
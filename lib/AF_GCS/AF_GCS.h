@@ -2,7 +2,17 @@
 #define AF_GCS_H_
 
 /// @file   AF_GCS.h
-/// @brief  provides an interface for communicating with the ground control system
+/// @brief  provides an interface for communicating with the ground control system,
+///         over the wire protocol in AF_GCS_Protocol.h
+
+#include <stdint.h>
+#include <string.h>
+#include <util.h>
+#include "AF_GCS_Protocol.h"
+#include "AF_GCS_Streams.h"
+#include "AF_GCS_Requests.h"
+#include <AF_Logger/AF_Logger.h>
+#include <AF_Context/AF_Context.h>
 
 #define AF_GCS_COMPONENT_NAME_MAX_LEN 8
 #define AF_GCS_MESSAGE_MAX_LEN 32
@@ -26,68 +36,282 @@ enum af_gcs_priority {
     AF_GCS_PRIORITY_CRITICAL
 };
 
-typedef struct {
-    const uint8_t START_BYTE = 0xFF;
+/// the number of priority levels
+#define AF_GCS_PRIORITY_COUNT (AF_GCS_PRIORITY_CRITICAL + 1)
+
+/// how many frames can wait in the outbound queue. each costs AF_GCS_MAX_PAYLOAD + 4 bytes of
+/// ram, so the 328P, with 2 kB in all, gets a shorter queue.
+#ifndef AF_GCS_QUEUE_LEN
+#if defined(__AVR_ATmega328P__)
+#define AF_GCS_QUEUE_LEN 3
+#else
+#define AF_GCS_QUEUE_LEN 8
+#endif
+#endif
+/// the most the link budget can build up while the queue is idle, in bytes. caps the burst
+/// that goes out at once when messages arrive after a quiet spell.
+#define AF_GCS_BUDGET_BURST (2 * AF_GCS_MAX_ENCODED_LEN)
+/// marks the end of a queue FIFO
+#define AF_GCS_QUEUE_NONE 0xFF
+
+/// @brief a text message from a component
+struct AF_GCS_Message {
     af_gcs_priority priority;
     af_gcs_comp_group group;
     uint8_t comp_name_len;
-    char * comp_name;
+    const char * comp_name;
     uint8_t message_len;
-    char * message;
-    uint8_t crc;
+    const char * message;
+};
 
-} AF_GCS_Message;
+/// @brief a piece of a frame's payload, so a payload can be gathered from several places
+///        without copying it together first
+struct AF_GCS_Chunk {
+    const uint8_t* data;
+    uint8_t len;
+};
+
+class AF_Lockstep;
 
+/// @brief sends and receives frames over the GCS link.
+///
+/// outbound frames wait in a fixed queue, one FIFO per priority, and are sent highest priority
+/// first as the link budget allows. the budget is the link's byte rate (baud / 10), so the
+/// queue, not the serial TX buffer, is where frames wait on a saturated link, and a WARN only
+/// ever waits behind higher priority frames and the one frame already on the wire. when the
+/// queue is full the oldest frame of the lowest priority waiting is dropped, as long as it isn't
+/// more important than the new one.
+///
+/// the first link created is the GCS, see get_singleton(). further links (i.e. to telemetry
+/// endpoints) speak the same protocol and carry their own subscriptions.
 class AF_GCS {
 
     private:
 
-            /// inbound queue, messages are prioritized
-            // std::vector<AF_GCS_Message> gcs_ib_queue;
+            /// @brief a frame waiting to be sent
+            struct Queued_Frame {
+                /// what the payload holds
+                uint8_t type;
+                /// the sending component group in the high nibble, the priority in the low nibble
+                uint8_t info;
+                /// the length of the payload
+                uint8_t len;
+                /// the next frame in the same FIFO, or AF_GCS_QUEUE_NONE
+                uint8_t next;
+                uint8_t payload[AF_GCS_MAX_PAYLOAD];
+            };
 
             /// singleton instance of the GCS
             static AF_GCS * _instance;
+
+            /// the serial port the GCS link runs over
+            Stream* _port;
+            /// decodes inbound frames
+            AF_GCS_Decoder _decoder;
+            /// the telemetry streams subscribed on this link
+            AF_GCS_Streams _streams;
+            /// the requests in flight on this link
+            AF_GCS_Requests _requests;
+            /// takes the lockstep digests that arrive on this link, if any
+            AF_Lockstep* _lockstep = nullptr;
+            /// the sequence number of the next frame sent
+            uint8_t _seq = 0;
+
+            /// the outbound queue's storage
+            Queued_Frame _queue[AF_GCS_QUEUE_LEN];
+            /// the oldest frame of each priority, or AF_GCS_QUEUE_NONE
+            uint8_t _queue_head[AF_GCS_PRIORITY_COUNT];
+            /// the newest frame of each priority, or AF_GCS_QUEUE_NONE
+            uint8_t _queue_tail[AF_GCS_PRIORITY_COUNT];
+            /// unused slots, linked through next
+            uint8_t _free;
+
+            /// the link's byte rate
+            uint32_t _bytes_per_s;
+            /// bytes that can be sent now, in millionths of a byte
+            uint32_t _budget = 0;
+            /// when the budget was last topped up, in system microseconds
+            uint32_t _budget_at;
+
+            /// frames sent
+            uint16_t _frames_sent = 0;
+            /// frames dropped from the queue under pressure, by priority
+            uint16_t _frames_dropped[AF_GCS_PRIORITY_COUNT] = {};
+            /// payload bytes sent, the useful part of the link's throughput
+            uint32_t _payload_bytes_sent = 0;
+
+            /// @brief removes and frees the oldest frame of a priority
+            void _pop(uint8_t priority);
+
+            /// @brief encodes a frame straight into the port's TX buffer
+            /// @return the number of bytes written, or 0 if there wasn't room
+            uint8_t _write_frame(const Queued_Frame& frame);
     
     public:
         
-        AF_GCS() {
-            // verify that this is the only instance of the GCS
-            if (_instance != nullptr) {
-                // TODO: give error
-            }
-
-            _instance = this;
-        }
+        /// @param port the serial port the GCS link runs over, already opened
+        /// @param baud the baud rate the port was opened at, which sets the link budget
+        AF_GCS(Stream* port, uint32_t baud);
 
+        /// @brief gets the first link created, or on the host the first created in the
+        ///        current context (see AF_Context.h)
         static AF_GCS * get_singleton(void) {
+#if defined(AF_SIMULATOR)
+            AF_Context* context = AF_Context::current();
+            if (context != nullptr) return context->_gcs;
+#endif
             return _instance;
         }
 
+        /// @brief queues a frame to send. never waits: if the queue is full and every frame in
+        ///        it is more important, the new frame is dropped.
+        /// @param type     what the payload holds
+        /// @param group    the sending component group
+        /// @param priority the priority of the frame
+        /// @param chunks   the pieces of the payload, in order
+        /// @param count    the number of pieces
+        /// @return true if the frame was queued, false if it was too long or was dropped
+        bool send(af_gcs_msg_type type, af_gcs_comp_group group, af_gcs_priority priority,
+                  const AF_GCS_Chunk* chunks, uint8_t count);
+
+        /// @brief see send(), for a payload in one piece
+        bool send(af_gcs_msg_type type, af_gcs_comp_group group, af_gcs_priority priority,
+                  const uint8_t* payload, uint8_t len) {
+            AF_GCS_Chunk chunk = { payload, len };
+            return send(type, group, priority, &chunk, 1);
+        }
+
+        /// @brief queues a text message. the component name and message are truncated to
+        ///        AF_GCS_COMPONENT_NAME_MAX_LEN and AF_GCS_MESSAGE_MAX_LEN.
+        bool send_message(const AF_GCS_Message& msg);
+
+        /// @brief sends requests again that are due, queues the telemetry streams that are due,
+        ///        then sends queued frames, highest
+        ///        priority first, as far as the link budget and the serial TX buffer allow.
+        ///        register as a scheduler task (see af_gcs::update()), running at least as
+        ///        often as a full TX buffer drains and as the fastest stream.
+        void update(void);
+
+        /// @brief decodes whatever has arrived on the port, stopping after a frame.
+        ///        subscriptions, requests, acks and lockstep digests are handled here, other
+        ///        frames are left to the caller.
+        /// @return true if a frame was decoded, see get_decoder()
+        bool receive(void);
+
+        /// @brief gets the telemetry streams subscribed on this link
+        AF_GCS_Streams& get_streams(void) { return _streams; }
+
+        /// @brief sends a request, see AF_GCS_Requests::request()
+        bool request(uint8_t command, const uint8_t* data, uint8_t len, af_gcs_priority priority,
+                     af_gcs_response_cb_t callback, void* context = nullptr) {
+            return _requests.request(*this, command, data, len, priority, callback, context);
+        }
+
+        /// @brief gets the requests in flight on this link
+        AF_GCS_Requests& get_requests(void) { return _requests; }
+
+        /// @brief hands the lockstep digests (AF_GCS_MSG_LOCKSTEP) that arrive on this link to
+        ///        a controller's lockstep, see AF_Lockstep.h
+        /// @param lockstep the lockstep, or nullptr to leave the digests to the caller
+        void set_lockstep(AF_Lockstep* lockstep) { _lockstep = lockstep; }
+
+        /// @brief gets the decoder, which holds the last frame received
+        const AF_GCS_Decoder& get_decoder(void) const { return _decoder; }
+
+        /// @brief gets the number of frames waiting in the queue
+        uint8_t get_queued(void) const;
+
+        /// @brief gets the number of frames sent, rolls over to 0 safely
+        uint16_t get_frames_sent(void) const { return _frames_sent; }
+
+        /// @brief gets the number of frames of a priority dropped from the queue under
+        ///        pressure, saturates at 0xFFFF
+        uint16_t get_frames_dropped(af_gcs_priority priority) const { return _frames_dropped[priority]; }
+
+        /// @brief gets the number of payload bytes sent, rolls over to 0 safely.
+        ///        sample it twice to measure the link's useful throughput.
+        uint32_t get_payload_bytes_sent(void) const { return _payload_bytes_sent; }
 
 };
 
-namespace af_gcs {
+/// @brief sends log records over a GCS link, at the record's level as the frame's priority,
+///        so they queue behind anything more important
+class AF_GCS_Log_Sink: public AF_Log_Sink {
+
+    public:
+
+        /// @param link the link to send on
+        AF_GCS_Log_Sink(AF_GCS* link) : _link(link) {}
+
+        bool write(uint8_t level, const uint8_t* record, uint8_t len) override {
+            return _link->send(AF_GCS_MSG_LOG, AF_GCS_COMP_SYSTEM, (af_gcs_priority)level, record, len);
+        }
+
+    private:
+
+        AF_GCS* _link;
 
-    static AF_GCS* _instance = nullptr;
+};
+
+namespace af_gcs {
 
     /// initializes the GCS
-    AF_GCS * init() {
-        return new AF_GCS();
+    /// @param port the serial port the GCS link runs over, already opened
+    /// @param baud the baud rate the port was opened at
+    /// @return the link, or nullptr if the heap ran out
+    AF_GCS * init(Stream* port, uint32_t baud);
+
+    /// updates the GCS link, register as a scheduler task
+    void update(void);
+
+};
+
+namespace af_gcs {
+
+    /// @brief works out the id of an interned message, see utilintern::id()
+    constexpr uint16_t intern(const char* comp_name, const char* msg) {
+        return utilintern::id(comp_name, msg);
+    }
+
+    /// @brief queues an interned message on the GCS link. see GCS_EMIT.
+    /// @param id       the message id
+    /// @param group    the sending component group
+    /// @param priority the priority of the message
+    /// @param args     the message's arguments, sent as their bytes in memory
+    /// @return true if the message was queued, false if the GCS isn't initialized or it was dropped
+    template <typename... Args>
+    bool emit(uint16_t id, af_gcs_comp_group group, af_gcs_priority priority, const Args&... args) {
+        AF_GCS* gcs = AF_GCS::get_singleton();
+        if (gcs == nullptr) return false;
+        uint8_t id_bytes[2] = { (uint8_t)(id & 0xFF), (uint8_t)(id >> 8) };
+        AF_GCS_Chunk chunks[] = { { id_bytes, 2 }, { reinterpret_cast<const uint8_t*>(&args), sizeof(Args) }... };
+        return gcs->send(AF_GCS_MSG_ID, group, priority, chunks, sizeof...(Args) + 1);
     }
 
 };
 
-/// convienence macro for building a GCS message
-#define GCS_BUILD_MESSAGE(_group, _comp_name, _priority, _msg) AF_GCS_Message { .priority = _priority, .group = _group, .comp_name_len = strlen(_comp_name), .comp_name = _comp_name, .message_len = strlen(_msg), .message = _msg }
+/// the id of an interned message, worked out at compile time. the strings never reach the vehicle.
+#define AF_GCS_ID(_comp_name, _msg) (utilintern::constant<af_gcs::intern(_comp_name, _msg)>::value)
+
+/// convienence macro for building a GCS text message, for text only known at runtime
+
+#define GCS_BUILD_MESSAGE(_group, _comp_name, _priority, _msg) AF_GCS_Message { .priority = _priority, .group = _group, .comp_name_len = (uint8_t)strlen(_comp_name), .comp_name = _comp_name, .message_len = (uint8_t)strlen(_msg), .message = _msg }
 
-/// convienence macro for emitting a GCS message
-#define GCS_EMIT(_group, _comp_name, _priority, _msg)
-/// convienence macro for emitting a GCS message and waiting for an response
+/// convienence macro for emitting a GCS message. does nothing until the GCS is initialized.
 ///
-/// - scheduler will halt the running task until a response is received
+/// _comp_name and _msg must be string literals. they're interned at compile time, so only a
+/// 2 byte id goes on the wire, followed by any extra arguments (numbers or packed structs),
+/// i.e. GCS_EMIT(AF_GCS_COMP_SENSOR, "baro", AF_GCS_PRIORITY_WARN, "reading out of range", pressure).
+/// tools/gcs_dictionary.py finds every GCS_EMIT in the source and writes the dictionary the
+/// ground station uses to turn ids back into text.
+#define GCS_EMIT(_group, _comp_name, _priority, _msg, ...) \
+    af_gcs::emit(AF_GCS_ID(_comp_name, _msg), _group, _priority, ##__VA_ARGS__)
+/// convienence macro for sending a request to the GCS that has to be acked. never waits:
+/// _callback is called with the result once the GCS acks the request or it times out.
 ///
-/// _comp is the component to send the message from
-/// _priority is the priority of the message
-#define GCS_WAIT_FOR_ACK(_comp, _priority, _msg) ;
+/// _command is the command, _data and _len its data
+/// _priority is the priority of the request
+#define GCS_REQUEST(_command, _data, _len, _priority, _callback, _context) \
+    (AF_GCS::get_singleton() != nullptr && AF_GCS::get_singleton()->request(_command, _data, _len, _priority, _callback, _context))
 
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "AF_GCS_Protocol.h"
+
+// --- AF_GCS_Frame_Writer ---
+
+AF_GCS_Frame_Writer::AF_GCS_Frame_Writer(const utilbuf::span spans[2], utilbuf::ring_idx_t room) {
+    _spans[0] = spans[0];
+    _spans[1] = spans[1];
+    _room = room;
+    // leave a gap for the first block's code byte
+    _code_idx = 0;
+    _len = 1;
+    _code = 1;
+    _crc = utilcrc::CRC16_INIT;
+}
+
+void AF_GCS_Frame_Writer::_end_block(void) {
+    if (_code_idx < _room) *_at(_code_idx) = _code;
+    _code_idx = _len;
+    _emit(0);
+    _code = 1;
+}
+
+void AF_GCS_Frame_Writer::put(uint8_t byte) {
+    _crc = utilcrc::crc16_update(_crc, byte);
+    if (byte == 0) {
+        // the zero is implied by where the block ends
+        _end_block();
+        return;
+    }
+    _emit(byte);
+    // a block holds at most 254 bytes
+    if (++_code == 0xFF) _end_block();
+}
+
+utilbuf::ring_idx_t AF_GCS_Frame_Writer::finish(void) {
+    uint16_t crc = _crc;
+    put(crc & 0xFF);
+    put(crc >> 8);
+    if (_code_idx < _room) *_at(_code_idx) = _code;
+    _emit(AF_GCS_DELIMITER);
+    return _len <= _room ? _len : 0;
+}
+
+// --- AF_GCS_Decoder ---
+
+bool AF_GCS_Decoder::_check(void) {
+    // a frame has to end on a block boundary, hold a header and a CRC, and agree with its header
+    if (_overflow || _block_left != 0 || _len < AF_GCS_HEADER_LEN + AF_GCS_CRC_LEN) return false;
+    uint8_t payload_len = _len - AF_GCS_HEADER_LEN - AF_GCS_CRC_LEN;
+    if (get_header()->len != payload_len) return false;
+    uint16_t crc = _buf[_len - 2] | ((uint16_t)_buf[_len - 1] << 8);
+    return utilcrc::crc16(_buf, _len - AF_GCS_CRC_LEN) == crc;
+}
+
+bool AF_GCS_Decoder::feed(uint8_t byte) {
+
+    if (byte == AF_GCS_DELIMITER) {
+        bool ok = false;
+        // back-to-back delimiters are just idle line, not bad frames
+        if (_len > 0 || _code != 0) {
+            ok = _check();
+            if (ok) _frames_good++; else _frames_bad++;
+        }
+        _len = 0;
+        _block_left = 0;
+        _code = 0;
+        _overflow = false;
+        return ok;
+    }
+
+    if (_block_left == 0) {
+        // a code byte. the block before it ended in a zero, unless it was a full block.
+        if (_code != 0 && _code != 0xFF) {
+            if (_len < sizeof(_buf)) _buf[_len++] = 0; else _overflow = true;
+        }
+        _code = byte;
+        _block_left = byte - 1;
+        return false;
+    }
+
+    if (_len < sizeof(_buf)) _buf[_len++] = byte; else _overflow = true;
+    _block_left--;
+    return false;
+}
+
+bool AF_GCS_Decoder::feed(Stream* stream) {
+    utilbuf::span spans[2];
+    stream->read_spans(spans);
+
+    // decode in place, then release everything that was looked at in one go
+    utilbuf::ring_idx_t used = 0;
+    for (uint8_t s = 0; s < 2; s++) {
+        for (utilbuf::ring_idx_t i = 0; i < spans[s].len; i++) {
+            used++;
+            if (feed(spans[s].data[i])) {
+                stream->consume(used);
+                return true;
+            }
+        }
+    }
+    stream->consume(used);
+    return false;
+}
@@ -0,0 +1,183 @@
+#ifndef AF_GCS_PROTOCOL_H_
+#define AF_GCS_PROTOCOL_H_
+
+/// @file   AF_GCS_Protocol.h
+/// @brief  the GCS wire protocol. each frame is a header, a payload and a CRC-16, COBS
+///         encoded so the only zero byte on the wire is the delimiter after each frame.
+///         a corrupt byte costs at most the frame it's in: the decoder drops the frame when
+///         the CRC fails and picks up again at the next delimiter.
+///
+/// on the wire (before COBS): type, group << 4 | priority, sequence number, payload length,
+/// the payload, then the CRC-16/CCITT-FALSE of all of that, low byte first.
+///
+/// every frame costs AF_GCS_FRAME_OVERHEAD bytes on top of its payload (header, CRC, one COBS
+/// code byte, delimiter). frames never reach 254 bytes, so COBS never adds more than one byte.
+/// useful payload at 57600 baud (5760 bytes/s on the wire):
+///
+///     payload (bytes)     efficiency      payload (bytes/s)
+///           8                50%              2880
+///          16                67%              3840
+///          32                80%              4608
+///          48                86%              4937
+///
+/// so batch small values into fewer, larger frames where latency allows.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <util.h>
+
+/// the most payload a frame can carry. an encoded frame always fits an empty serial TX buffer.
+#define AF_GCS_MAX_PAYLOAD 48
+/// the length of the frame header, in bytes
+#define AF_GCS_HEADER_LEN 4
+/// the length of the frame CRC, in bytes
+#define AF_GCS_CRC_LEN 2
+/// bytes on the wire for every frame on top of its payload
+#define AF_GCS_FRAME_OVERHEAD (AF_GCS_HEADER_LEN + AF_GCS_CRC_LEN + 2)
+/// the longest a frame can be on the wire
+#define AF_GCS_MAX_ENCODED_LEN (AF_GCS_MAX_PAYLOAD + AF_GCS_FRAME_OVERHEAD)
+/// the frame delimiter
+#define AF_GCS_DELIMITER 0x00
+
+/// @brief what a frame's payload holds
+enum af_gcs_msg_type: uint8_t {
+    /// a text message from a component, see AF_GCS_Message
+    AF_GCS_MSG_TEXT = 0,
+    /// a request for a telemetry stream, see AF_GCS_Streams.h
+    AF_GCS_MSG_SUBSCRIBE,
+    /// a telemetry stream's values, see AF_GCS_Streams.h
+    AF_GCS_MSG_STREAM,
+    /// an interned message: its id (2 bytes, low byte first), then its arguments. see GCS_EMIT
+    AF_GCS_MSG_ID,
+    /// a request that has to be acked, see AF_GCS_Requests.h
+    AF_GCS_MSG_REQUEST,
+    /// the ack to a request, see AF_GCS_Requests.h
+    AF_GCS_MSG_ACK,
+    /// a log record, see AF_Logger.h
+    AF_GCS_MSG_LOG,
+    /// a controller's output digest for one control tick, see AF_Lockstep.h
+    AF_GCS_MSG_LOCKSTEP,
+    /// a sample of a topic forwarded from another processor, see AF_Topic_Bridge.h
+    AF_GCS_MSG_TOPIC,
+    /// a time sync request or reply between processors, see AF_TimeSync.h
+    AF_GCS_MSG_TIMESYNC
+};
+
+/// @brief the header at the start of every frame
+struct AF_GCS_Frame_Header {
+    /// what the payload holds, see af_gcs_msg_type
+    uint8_t type;
+    /// the sending component group in the high nibble, the priority in the low nibble
+    uint8_t info;
+    /// incremented for every frame sent, so the other end can spot lost frames
+    uint8_t seq;
+    /// the length of the payload
+    uint8_t len;
+};
+
+static_assert(sizeof(AF_GCS_Frame_Header) == AF_GCS_HEADER_LEN, "the frame header must be packed");
+
+/// @brief COBS-encodes a frame straight into space reserved in a ring buffer (see
+///        Stream::reserve()), so there's no staging buffer between the caller's data and the
+///        wire. each block's code byte is left as a gap and filled in once the block ends.
+class AF_GCS_Frame_Writer {
+
+    public:
+
+        /// @param spans the reserved space
+        /// @param room  the number of bytes reserved
+        AF_GCS_Frame_Writer(const utilbuf::span spans[2], utilbuf::ring_idx_t room);
+
+        /// @brief adds a byte of the header or payload
+        void put(uint8_t byte);
+
+        /// @brief adds bytes of the header or payload
+        void put(const uint8_t* data, uint8_t len) {
+            for (uint8_t i = 0; i < len; i++) put(data[i]);
+        }
+
+        /// @brief adds the CRC and the delimiter
+        /// @return the number of bytes to commit, or 0 if the frame didn't fit in the reserved space
+        utilbuf::ring_idx_t finish(void);
+
+    private:
+
+        /// @brief gets a byte of the reserved space, by its position in the frame
+        inline uint8_t* _at(uint8_t idx) {
+            return idx < _spans[0].len ? &_spans[0].data[idx] : &_spans[1].data[idx - _spans[0].len];
+        }
+
+        /// @brief appends a byte to the encoded frame, if there's room
+        inline void _emit(uint8_t byte) {
+            if (_len < _room) *_at(_len) = byte;
+            _len++;
+        }
+
+        /// @brief fills in the code byte of the current block and leaves a gap for the next one
+        void _end_block(void);
+
+        /// the reserved space
+        utilbuf::span _spans[2];
+        /// the number of bytes reserved
+        uint8_t _room;
+        /// the length of the encoded frame so far
+        uint8_t _len;
+        /// where the current block's code byte goes
+        uint8_t _code_idx;
+        /// the current block's code byte: one more than the bytes in the block so far
+        uint8_t _code;
+        /// the CRC of the frame so far
+        uint16_t _crc;
+
+};
+
+/// @brief decodes frames one byte at a time as they arrive
+class AF_GCS_Decoder {
+
+    public:
+
+        /// @brief decodes a byte
+        /// @return true if the byte finished a valid frame, which stays readable until the next call
+        bool feed(uint8_t byte);
+
+        /// @brief decodes bytes straight out of a stream's buffer, stopping after a valid frame
+        /// @return true if a valid frame was decoded, which stays readable until the next call
+        bool feed(Stream* stream);
+
+        /// @brief gets the header of the last frame decoded
+        const AF_GCS_Frame_Header* get_header(void) const {
+            return reinterpret_cast<const AF_GCS_Frame_Header*>(_buf);
+        }
+
+        /// @brief gets the payload of the last frame decoded
+        const uint8_t* get_payload(void) const { return _buf + AF_GCS_HEADER_LEN; }
+
+        /// @brief gets the number of valid frames decoded, rolls over to 0 safely
+        uint16_t get_frames_good(void) const { return _frames_good; }
+
+        /// @brief gets the number of frames thrown away as corrupt, rolls over to 0 safely
+        uint16_t get_frames_bad(void) const { return _frames_bad; }
+
+    private:
+
+        /// @brief checks the frame that just ended
+        bool _check(void);
+
+        /// the decoded frame: header, payload and CRC
+        uint8_t _buf[AF_GCS_HEADER_LEN + AF_GCS_MAX_PAYLOAD + AF_GCS_CRC_LEN];
+        /// how many bytes of the frame have been decoded
+        uint8_t _len = 0;
+        /// how many data bytes are left in the current block, 0 if the next byte is a code byte
+        uint8_t _block_left = 0;
+        /// the code byte of the current block, or 0 at the start of a frame
+        uint8_t _code = 0;
+        /// set when the frame outgrew the buffer, so it's dropped at the delimiter
+        bool _overflow = false;
+        /// valid frames decoded
+        uint16_t _frames_good = 0;
+        /// frames thrown away
+        uint16_t _frames_bad = 0;
+
+};
+
+#endif // AF_GCS_PROTOCOL_H_
@@ -0,0 +1,174 @@
+#include "AF_GCS_Requests.h"
+#include "AF_GCS.h"
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/eeprom_hal.h>
+#include <AF_Variable/AF_Variable.h>
+
+/// how long the last request took to be acked, including any retries
+static AF_UInt32 _var_rtt_us("gcs_rtt_us", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+/// the longest a request has taken to be acked
+static AF_UInt32 _var_rtt_max_us("gcs_rtt_max_us", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+/// requests sent again because no ack came back in time
+static AF_UInt16 _var_retries("gcs_retries", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+/// requests that ran out of retries
+static AF_UInt16 _var_timeouts("gcs_timeouts", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+
+bool AF_GCS_Requests::request(AF_GCS& link, uint8_t command, const uint8_t* data, uint8_t len, uint8_t priority,
+                              af_gcs_response_cb_t callback, void* context) {
+    if (len > AF_GCS_REQUEST_MAX_DATA) return false;
+
+    Pending* pending = nullptr;
+    for (uint8_t i = 0; i < AF_GCS_MAX_REQUESTS; i++) {
+        if (!_pending[i].active) {
+            if (pending == nullptr) pending = &_pending[i];
+        } else if ((uint8_t)(_next_id - _pending[i].id) >= AF_GCS_REQUEST_HISTORY) {
+            // the other end only remembers the last few ids, so a request further back could
+            // be run twice if it's sent again
+            return false;
+        }
+    }
+    if (pending == nullptr) return false;
+
+    if (_session == 0) _session = _new_session();
+
+    uint32_t now = AF_HAL::micros();
+    pending->active = true;
+    pending->id = _next_id++;
+    pending->command = command;
+    pending->len = len;
+    pending->priority = priority;
+    pending->retries_left = AF_GCS_REQUEST_RETRIES;
+    pending->backoff_us = AF_GCS_REQUEST_TIMEOUT_US;
+    pending->first_sent_at = now;
+    pending->next_at = now + AF_GCS_REQUEST_TIMEOUT_US;
+    pending->callback = callback;
+    pending->context = context;
+    if (len > 0) memcpy(pending->data, data, len);
+
+    _send(link, *pending);
+    return true;
+}
+
+uint16_t AF_GCS_Requests::_new_session(void) {
+    // a boot can take the same path to its first request as the last one did, e.g. from a
+    // scheduled task on the virtual clock, so the cycle count alone can repeat. the low byte
+    // is a count kept in EEPROM, so a session never matches the one before it.
+    uint16_t count;
+    AF_HAL::eeprom::read(AF_GCS_SESSION_COUNT_ADDR, &count, 2);
+    count++;
+    AF_HAL::eeprom::update(AF_GCS_SESSION_COUNT_ADDR, &count, 2);
+
+    // the cycle count still tells apart sessions from before and after the EEPROM is erased
+    uint32_t cycles = AF_HAL::cycles();
+    uint8_t mix = (uint8_t)(cycles ^ (cycles >> 8) ^ (cycles >> 16) ^ (cycles >> 24));
+    uint16_t session = (uint16_t)((mix << 8) | (count & 0xFF));
+    return session == 0 ? 1 : session;
+}
+
+void AF_GCS_Requests::_send(AF_GCS& link, const Pending& pending) {
+    uint8_t head[4] = { (uint8_t)(_session & 0xFF), (uint8_t)(_session >> 8), pending.id, pending.command };
+    AF_GCS_Chunk chunks[2] = { { head, 4 }, { pending.data, pending.len } };
+    // if the queue drops it, it goes again when the ack doesn't come
+    link.send(AF_GCS_MSG_REQUEST, AF_GCS_COMP_SYSTEM, (af_gcs_priority)pending.priority, chunks, 2);
+}
+
+void AF_GCS_Requests::_send_ack(AF_GCS& link, const Acked& ack, uint8_t priority) {
+    uint8_t head[4] = { (uint8_t)(_peer_session & 0xFF), (uint8_t)(_peer_session >> 8), ack.id, ack.status };
+    AF_GCS_Chunk chunks[2] = { { head, 4 }, { ack.data, ack.len } };
+    link.send(AF_GCS_MSG_ACK, AF_GCS_COMP_SYSTEM, (af_gcs_priority)priority, chunks, 2);
+}
+
+void AF_GCS_Requests::on_request(AF_GCS& link, const AF_GCS_Frame_Header* header, const uint8_t* payload) {
+    if (header->len < 4) return;
+    uint16_t session = payload[0] | ((uint16_t)payload[1] << 8);
+    uint8_t id = payload[2];
+    // ack at the priority the request came in at
+    uint8_t priority = header->info & 0x0F;
+
+    // the other end rebooted and started its ids again, so nothing remembered is a repeat
+    if (session != _peer_session) {
+        _peer_session = session;
+        _history_len = 0;
+    }
+
+    // a repeat, because the ack was lost: ack it again, but don't run it again
+    for (uint8_t i = 0; i < _history_len; i++) {
+        if (_history[i].id == id) {
+            _send_ack(link, _history[i], priority);
+            return;
+        }
+    }
+
+    // forget the oldest id. not the oldest arrival: a request whose first send was lost can
+    // arrive after newer ones, and the newest ids are the ones the sender can still repeat.
+    uint8_t slot = _history_len;
+    if (_history_len < AF_GCS_REQUEST_HISTORY) {
+        _history_len++;
+    } else {
+        slot = 0;
+        for (uint8_t i = 1; i < AF_GCS_REQUEST_HISTORY; i++) {
+            if ((int8_t)(id - _history[i].id) > (int8_t)(id - _history[slot].id)) slot = i;
+        }
+    }
+    Acked& ack = _history[slot];
+
+    ack.id = id;
+    ack.len = 0;
+    ack.status = _handler != nullptr
+        ? _handler(payload[3], payload + 4, header->len - 4, ack.data, ack.len)
+        : AF_GCS_REQUEST_UNKNOWN;
+    if (ack.len > AF_GCS_RESPONSE_MAX_DATA) ack.len = AF_GCS_RESPONSE_MAX_DATA;
+    _send_ack(link, ack, priority);
+}
+
+void AF_GCS_Requests::on_ack(const uint8_t* payload, uint8_t len) {
+    if (len < 4) return;
+    // an ack to a request from before this end rebooted
+    if ((payload[0] | ((uint16_t)payload[1] << 8)) != _session) return;
+    for (uint8_t i = 0; i < AF_GCS_MAX_REQUESTS; i++) {
+        Pending& pending = _pending[i];
+        if (!pending.active || pending.id != payload[2]) continue;
+
+        uint32_t rtt = AF_HAL::micros() - pending.first_sent_at;
+        _var_rtt_us = rtt;
+        if (rtt > _var_rtt_max_us.get()) _var_rtt_max_us = rtt;
+
+        // free the slot before the callback, so it can send the next request
+        pending.active = false;
+        if (pending.callback != nullptr) {
+            pending.callback((AF_GCS_Request_Status)payload[3], payload + 4, len - 4, pending.context);
+        }
+        return;
+    }
+    // an ack for a request that's already finished, i.e. the ack to a retry
+}
+
+void AF_GCS_Requests::update(AF_GCS& link, uint32_t now) {
+    for (uint8_t i = 0; i < AF_GCS_MAX_REQUESTS; i++) {
+        Pending& pending = _pending[i];
+        if (!pending.active || !AF_HAL::time_reached(now, pending.next_at)) continue;
+
+        if (pending.retries_left == 0) {
+            _var_timeouts = _var_timeouts.get() + 1;
+            pending.active = false;
+            if (pending.callback != nullptr) pending.callback(AF_GCS_REQUEST_TIMEOUT, nullptr, 0, pending.context);
+            continue;
+        }
+
+        // back off, so a saturated link isn't loaded up with more copies of the same request
+        pending.retries_left--;
+        pending.backoff_us *= 2;
+        if (pending.backoff_us > AF_GCS_REQUEST_MAX_BACKOFF_US) pending.backoff_us = AF_GCS_REQUEST_MAX_BACKOFF_US;
+        pending.next_at = now + pending.backoff_us;
+        _var_retries = _var_retries.get() + 1;
+        _send(link, pending);
+    }
+}
+
+uint8_t AF_GCS_Requests::get_pending(void) const {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < AF_GCS_MAX_REQUESTS; i++) {
+        if (_pending[i].active) count++;
+    }
+    return count;
+}
@@ -0,0 +1,176 @@
+#ifndef AF_GCS_REQUESTS_H_
+#define AF_GCS_REQUESTS_H_
+
+/// @file   AF_GCS_Requests.h
+/// @brief  reliable requests over a GCS link, for commands like arming, mode changes and
+///         parameter writes. a request is sent again with backoff until the other end acks
+///         it or it runs out of retries, and the result comes back through a callback, so
+///         nothing ever waits on the link.
+///
+/// request payload (AF_GCS_MSG_REQUEST): session (2 bytes, low byte first), request id,
+/// command, then the command's data.
+/// ack payload (AF_GCS_MSG_ACK): the request's session and id, the status, then any response data.
+///
+/// request ids are picked by the sender, in order. the receiver remembers the acks it sent for
+/// the AF_GCS_REQUEST_HISTORY newest request ids, so a request that's sent again because its ack was
+/// lost is acked again without running the command twice. the sender never lets a request fall
+/// further behind than that, so every repeat is one the receiver remembers.
+///
+/// ids start again from 0 when the sender reboots, so every request also carries the sender's
+/// session, picked afresh each boot from a count kept in EEPROM (at AF_GCS_SESSION_COUNT_ADDR),
+/// so it differs from the last boot's even when the boot runs exactly as the last one did. a request from a new session is never taken for a repeat:
+/// the receiver forgets its history when the session changes. acks carry the session back, so
+/// an ack meant for the sender's last boot doesn't finish a request with the same id.
+///
+/// round trip and retry counters, summed over every link, are exposed to the GCS as the
+/// variables gcs_rtt_us, gcs_rtt_max_us, gcs_retries and gcs_timeouts.
+
+#include <stdint.h>
+#include "AF_GCS_Protocol.h"
+
+/// where in EEPROM the count of sessions started is kept, 2 bytes
+#ifndef AF_GCS_SESSION_COUNT_ADDR
+#define AF_GCS_SESSION_COUNT_ADDR 0
+#endif
+
+/// how many requests a link can have waiting for an ack at once
+#define AF_GCS_MAX_REQUESTS 4
+/// the most data a request can carry
+#define AF_GCS_REQUEST_MAX_DATA (AF_GCS_MAX_PAYLOAD - 4)
+/// the most data an ack can carry
+#define AF_GCS_RESPONSE_MAX_DATA 16
+/// how many inbound requests' acks are remembered, to ack repeats without running them again
+#define AF_GCS_REQUEST_HISTORY 4
+/// how long to wait for the first ack before sending again, in microseconds
+#define AF_GCS_REQUEST_TIMEOUT_US 200000UL
+/// how many times a request is sent again before giving up
+#define AF_GCS_REQUEST_RETRIES 3
+/// the longest wait between attempts, the wait doubles after every attempt up to this
+#define AF_GCS_REQUEST_MAX_BACKOFF_US 2000000UL
+
+/// @brief the result of a request
+enum AF_GCS_Request_Status: uint8_t {
+    /// the other end ran the command
+    AF_GCS_REQUEST_OK = 0,
+    /// the other end refused the command (i.e. arming while not ready)
+    AF_GCS_REQUEST_REJECTED,
+    /// the other end doesn't know the command
+    AF_GCS_REQUEST_UNKNOWN,
+    /// no ack came back before the retries ran out
+    AF_GCS_REQUEST_TIMEOUT
+};
+
+/// @brief called when a request is acked or times out
+/// @param status   the result
+/// @param response the response data from the ack
+/// @param len      the length of the response data, 0 on timeout
+/// @param context  the context passed to request()
+typedef void (*af_gcs_response_cb_t)(AF_GCS_Request_Status status, const uint8_t* response, uint8_t len, void* context);
+
+/// @brief runs a command the other end requested
+/// @param command      the command
+/// @param data         the command's data
+/// @param len          the length of the command's data
+/// @param response     where to put any response data, AF_GCS_RESPONSE_MAX_DATA bytes
+/// @param response_len set to the length of the response data, starts at 0
+/// @return the status to ack with
+typedef AF_GCS_Request_Status (*af_gcs_request_handler_t)(uint8_t command, const uint8_t* data, uint8_t len,
+                                                          uint8_t* response, uint8_t& response_len);
+
+class AF_GCS;
+
+/// @brief the requests in flight in both directions on one GCS link
+class AF_GCS_Requests {
+
+    public:
+
+        /// @brief sends a request, and keeps sending it until it's acked or times out
+        /// @param link     the link to send on
+        /// @param command  the command
+        /// @param data     the command's data
+        /// @param len      the length of the data, up to AF_GCS_REQUEST_MAX_DATA
+        /// @param priority the priority of the request and its retries
+        /// @param callback called with the result, may be nullptr
+        /// @param context  passed to the callback
+        /// @return true if the request was sent, false if the data was too long, too many
+        ///         requests are waiting already, or a request AF_GCS_REQUEST_HISTORY back is
+        ///         still waiting
+        bool request(AF_GCS& link, uint8_t command, const uint8_t* data, uint8_t len, uint8_t priority,
+                     af_gcs_response_cb_t callback, void* context);
+
+        /// @brief sets what runs the commands the other end requests. with no handler every
+        ///        command is acked with AF_GCS_REQUEST_UNKNOWN.
+        void set_handler(af_gcs_request_handler_t handler) { _handler = handler; }
+
+        /// @brief handles an inbound request frame: runs it (unless it's a repeat) and acks it
+        void on_request(AF_GCS& link, const AF_GCS_Frame_Header* header, const uint8_t* payload);
+
+        /// @brief handles an inbound ack frame: finishes the request it acks
+        void on_ack(const uint8_t* payload, uint8_t len);
+
+        /// @brief sends requests again that are due, and times out those out of retries
+        /// @param link the link to send on
+        /// @param now  the system clock, in microseconds
+        void update(AF_GCS& link, uint32_t now);
+
+        /// @brief gets the number of requests waiting for an ack
+        uint8_t get_pending(void) const;
+
+    private:
+
+        /// @brief a request waiting for an ack
+        struct Pending {
+            /// whether the slot is in use
+            bool active;
+            uint8_t id;
+            uint8_t command;
+            uint8_t len;
+            uint8_t priority;
+            /// sends left before giving up
+            uint8_t retries_left;
+            /// how long to wait for an ack to the last send
+            uint32_t backoff_us;
+            /// when the request was first sent, for the round trip time
+            uint32_t first_sent_at;
+            /// when to send again, or give up
+            uint32_t next_at;
+            af_gcs_response_cb_t callback;
+            void* context;
+            uint8_t data[AF_GCS_REQUEST_MAX_DATA];
+        };
+
+        /// @brief an ack sent for an inbound request
+        struct Acked {
+            uint8_t id;
+            uint8_t status;
+            uint8_t len;
+            uint8_t data[AF_GCS_RESPONSE_MAX_DATA];
+        };
+
+        /// @brief picks this boot's session, see the top of the file
+        uint16_t _new_session(void);
+
+        /// @brief sends a pending request
+        void _send(AF_GCS& link, const Pending& pending);
+
+        /// @brief sends an ack
+        void _send_ack(AF_GCS& link, const Acked& ack, uint8_t priority);
+
+        Pending _pending[AF_GCS_MAX_REQUESTS] = {};
+        /// the id of the next request sent
+        uint8_t _next_id = 0;
+        /// this boot's session, or 0 until the first request is sent
+        uint16_t _session = 0;
+
+        /// acks sent for the inbound requests with the newest ids
+        Acked _history[AF_GCS_REQUEST_HISTORY] = {};
+        /// how many entries of _history are in use
+        uint8_t _history_len = 0;
+        /// the session the requests in _history came from
+        uint16_t _peer_session = 0;
+
+        af_gcs_request_handler_t _handler = nullptr;
+
+};
+
+#endif // AF_GCS_REQUESTS_H_
@@ -0,0 +1,110 @@
+#include "AF_GCS_Streams.h"
+#include "AF_GCS.h"
+#include <AF_HAL/AF_HAL.h>
+
+bool AF_GCS_Streams::subscribe(uint8_t id, const uint16_t* indices, uint8_t count, uint16_t rate_hz) {
+
+    Stream_Sub* sub = nullptr;
+    Stream_Sub* free_sub = nullptr;
+    for (uint8_t i = 0; i < AF_GCS_MAX_STREAMS; i++) {
+        if (_subs[i].count == 0) {
+            if (free_sub == nullptr) free_sub = &_subs[i];
+        } else if (_subs[i].id == id) {
+            sub = &_subs[i];
+        }
+    }
+
+    if (rate_hz == 0 || count == 0) {
+        if (sub != nullptr) {
+            sub->count = 0;
+            _rescale();
+        }
+        return true;
+    }
+
+    if (count > AF_GCS_STREAM_MAX_VARS) return false;
+    if (sub == nullptr) sub = free_sub;
+    if (sub == nullptr) return false;
+
+    // resolve everything before touching the slot, so a bad request leaves the old stream running
+    AF_Variable* vars[AF_GCS_STREAM_MAX_VARS];
+    uint8_t len = 1;
+    for (uint8_t i = 0; i < count; i++) {
+        vars[i] = AF_Variable_Storage::get_instance()->get_variable_at(indices[i]);
+        if (vars[i] == nullptr || !vars[i]->is_readable_by_gcs()) return false;
+        len += vars[i]->get_size();
+        if (len > AF_GCS_MAX_PAYLOAD) return false;
+    }
+
+    sub->id = id;
+    sub->count = count;
+    sub->len = len;
+    sub->rate_hz = rate_hz;
+    memcpy(sub->vars, vars, count * sizeof(AF_Variable*));
+    sub->next_at = AF_HAL::micros();
+    _rescale();
+    return true;
+}
+
+bool AF_GCS_Streams::subscribe(const uint8_t* payload, uint8_t len) {
+    if (len < 3 || (len - 3) % 2 != 0) return false;
+    uint8_t count = (len - 3) / 2;
+    if (count > AF_GCS_STREAM_MAX_VARS) return false;
+
+    uint16_t rate_hz = payload[1] | ((uint16_t)payload[2] << 8);
+    uint16_t indices[AF_GCS_STREAM_MAX_VARS];
+    for (uint8_t i = 0; i < count; i++) {
+        indices[i] = payload[3 + 2 * i] | ((uint16_t)payload[4 + 2 * i] << 8);
+    }
+    return subscribe(payload[0], indices, count, rate_hz);
+}
+
+void AF_GCS_Streams::set_link_rate(uint32_t bytes_per_s) {
+    _budget_bytes_per_s = bytes_per_s * AF_GCS_STREAM_SHARE_PCT / 100;
+    _rescale();
+}
+
+void AF_GCS_Streams::_rescale(void) {
+
+    // what every stream would cost at the rate it asked for
+    float demand = 0;
+    for (uint8_t i = 0; i < AF_GCS_MAX_STREAMS; i++) {
+        if (_subs[i].count == 0) continue;
+        demand += (float)_subs[i].rate_hz * (_subs[i].len + AF_GCS_FRAME_OVERHEAD);
+    }
+
+    // slow every stream by the same factor if that's more than the link can carry
+    float scale = 1.0f;
+    if (demand > _budget_bytes_per_s && _budget_bytes_per_s > 0) scale = demand / _budget_bytes_per_s;
+
+    for (uint8_t i = 0; i < AF_GCS_MAX_STREAMS; i++) {
+        if (_subs[i].count == 0) continue;
+        _subs[i].interval_us = (uint32_t)(1000000.0f * scale / _subs[i].rate_hz);
+    }
+}
+
+void AF_GCS_Streams::update(AF_GCS& link, uint32_t now) {
+    for (uint8_t i = 0; i < AF_GCS_MAX_STREAMS; i++) {
+        Stream_Sub& sub = _subs[i];
+        if (sub.count == 0 || !AF_HAL::time_reached(now, sub.next_at)) continue;
+
+        // gather the values straight from the variables, the queue packs them into the frame
+        AF_GCS_Chunk chunks[AF_GCS_STREAM_MAX_VARS + 1];
+        chunks[0] = { &sub.id, 1 };
+        for (uint8_t v = 0; v < sub.count; v++) {
+            chunks[v + 1] = { static_cast<const uint8_t*>(sub.vars[v]->get_data()), sub.vars[v]->get_size() };
+        }
+        link.send(AF_GCS_MSG_STREAM, AF_GCS_COMP_TELEMETRY, AF_GCS_PRIORITY_INFO, chunks, sub.count + 1);
+
+        // keep to the stream's period, but don't try to catch up after falling behind
+        sub.next_at += sub.interval_us;
+        if (AF_HAL::time_reached(now, sub.next_at)) sub.next_at = now + sub.interval_us;
+    }
+}
+
+uint32_t AF_GCS_Streams::get_rate_mhz(uint8_t id) const {
+    for (uint8_t i = 0; i < AF_GCS_MAX_STREAMS; i++) {
+        if (_subs[i].count != 0 && _subs[i].id == id) return 1000000000UL / _subs[i].interval_us;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef AF_GCS_STREAMS_H_
+#define AF_GCS_STREAMS_H_
+
+/// @file   AF_GCS_Streams.h
+/// @brief  telemetry streams that the other end of a GCS link subscribes to. the GCS (or a
+///         telemetry endpoint, like a 328P on its own link) picks the variables it wants by
+///         index and the rate it wants them at, and each stream goes out as one packed frame
+///         per period.
+///
+/// subscribe payload (AF_GCS_MSG_SUBSCRIBE): stream id, rate in Hz (2 bytes, low byte first),
+/// then the index of each variable (2 bytes each, low byte first). a rate of 0 unsubscribes.
+///
+/// stream payload (AF_GCS_MSG_STREAM): stream id, then the value of each variable in the
+/// order subscribed, in the vehicle's byte order, with no padding. the subscriber knows each
+/// variable's type, so it can unpack the values.
+///
+/// streams share AF_GCS_STREAM_SHARE_PCT of the link budget. when the streams ask for more,
+/// every stream's rate is scaled down by the same factor, so each keeps its share of the
+/// link relative to the others.
+
+#include <stdint.h>
+#include <AF_Variable/AF_Variable.h>
+#include "AF_GCS_Protocol.h"
+
+/// how many streams a link can carry at once
+#define AF_GCS_MAX_STREAMS 4
+/// how many variables a stream can carry
+#define AF_GCS_STREAM_MAX_VARS 12
+/// the percentage of the link budget streams can use, the rest is left for messages
+#define AF_GCS_STREAM_SHARE_PCT 80
+
+class AF_GCS;
+
+/// @brief the telemetry streams subscribed on one GCS link
+class AF_GCS_Streams {
+
+    public:
+
+        /// @brief subscribes a stream, replacing any stream with the same id
+        /// @param id      the stream id, chosen by the subscriber
+        /// @param indices the indices of the variables to stream
+        /// @param count   the number of variables
+        /// @param rate_hz how often to send the stream, or 0 to unsubscribe
+        /// @return true if the stream was subscribed (or unsubscribed), false if a variable
+        ///         doesn't exist or isn't readable by the GCS, the values don't fit in a frame,
+        ///         or every stream is taken
+        bool subscribe(uint8_t id, const uint16_t* indices, uint8_t count, uint16_t rate_hz);
+
+        /// @brief subscribes a stream from an AF_GCS_MSG_SUBSCRIBE payload
+        /// @return see subscribe(), also false if the payload is malformed
+        bool subscribe(const uint8_t* payload, uint8_t len);
+
+        /// @brief sets the link budget the streams share, and rescales their rates to fit it
+        /// @param bytes_per_s the link's byte rate
+        void set_link_rate(uint32_t bytes_per_s);
+
+        /// @brief queues a frame on the link for every stream that's due
+        /// @param link the link to send on
+        /// @param now  the system clock, in microseconds
+        void update(AF_GCS& link, uint32_t now);
+
+        /// @brief gets how often a stream is actually sent, after scaling to fit the link
+        /// @return the rate in mHz, or 0 if there's no such stream
+        uint32_t get_rate_mhz(uint8_t id) const;
+
+    private:
+
+        /// @brief a subscribed stream
+        struct Stream_Sub {
+            /// the stream id, chosen by the subscriber
+            uint8_t id;
+            /// the number of variables, 0 if the slot is free
+            uint8_t count;
+            /// the length of the stream's payload
+            uint8_t len;
+            /// how often the subscriber asked for the stream
+            uint16_t rate_hz;
+            /// how long between frames, after scaling to fit the link
+            uint32_t interval_us;
+            /// when the next frame is due, in system microseconds
+            uint32_t next_at;
+            /// the variables, resolved when subscribed
+            AF_Variable* vars[AF_GCS_STREAM_MAX_VARS];
+        };
+
+        /// @brief works out every stream's interval from its rate and the link budget
+        void _rescale(void);
+
+        Stream_Sub _subs[AF_GCS_MAX_STREAMS] = {};
+        /// the budget streams share, in bytes per second
+        uint32_t _budget_bytes_per_s = 0;
+
+};
+
+#endif // AF_GCS_STREAMS_H_
@@ -15,22 +15,28 @@ namespace AF_HAL {
     void init();
 
     namespace io {
-        /// @brief  reads a value from an analog pin
+        /// @brief  reads a value from an analog pin. waits for the conversion to finish,
+        ///         use the sequencer in adc_hal.h to read channels without waiting.
         /// @param  pin     the pin to read from
         /// @return the value read from the pin
+        /// @warning must not be called while the sequencer is running
         uint16_t aread(uint8_t pin);
 
-        /// @brief          writes a value to an analog pin
+        /// @brief          writes a value to an analog pin, as a pwm duty cycle on the pin's
+        ///                 channel (see pwm_hal.h). the duty cycle is staged, and goes out
+        ///                 with the next pwm::commit(). pins without a channel are ignored.
         /// @param pin      the pin to write to
         /// @param value    the value to write to the pin, clamped to 0-1023
         void awrite(uint8_t pin, uint16_t value);
 
-        /// @brief          reads a value from a digital pin
+        /// @brief          reads a value from a digital pin. looks the pin up at runtime,
+        ///                 use AF_Pin (see pin_hal.h) where the pin is known at compile time.
         /// @param pin      the pin to read from
         /// @return         the value read from the pin
         bool dread(uint8_t pin);
 
-        /// @brief          writes a value to a digital pin
+        /// @brief          writes a value to a digital pin. looks the pin up at runtime,
+        ///                 use AF_Pin (see pin_hal.h) where the pin is known at compile time.
         /// @param  pin     the pin to write to
         /// @param  value   the value to write to the pin
         void dwrite(uint8_t pin, int value);
@@ -40,10 +46,11 @@ namespace AF_HAL {
         /// @param mode     the mode to set the pin to
         void pmode(uint8_t pin, int mode);
 
-        /// @brief generates a pwm signal on a pin
-        /// @param pin 
-        /// @param value    the value to write to the pin, clamped to 0-1023
-        void pwmwrite(uint8_t pin, uint16_t value);
+        /// @brief generates a pwm signal on a channel, using the engine in pwm_hal.h
+        /// @param channel  the pwm channel (see the channel table in pwm_hal.h)
+        /// @param value    the duty cycle to write to the channel, clamped to 0-1023
+        /// @note  only stages the duty cycle, it goes out at the next pwm::commit()
+        void pwmwrite(uint8_t channel, uint16_t value);
     }
 
 }
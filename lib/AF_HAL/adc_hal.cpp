@@ -0,0 +1,126 @@
+#include "adc_hal.h"
+
+namespace AF_HAL {
+
+    namespace adc {
+
+        /// the scan list
+        static AF_ADC_Channel_Config _channels[AF_ADC_MAX_CHANNELS];
+        /// how many channels are in the scan list
+        static uint8_t _count = 0;
+        /// whether the sequencer is scanning
+        static volatile bool _running = false;
+
+        /// results, double buffered. the ISR fills _results[!_front] and flips
+        /// _front when a scan finishes, so readers always see a complete scan.
+        static uint16_t _results[2][AF_ADC_MAX_CHANNELS];
+        /// the buffer holding the latest complete scan
+        static volatile uint8_t _front = 0;
+        /// the number of complete scans
+        static volatile uint16_t _scan_count = 0;
+
+        // --- ISR state ---
+
+        /// the channel being converted
+        static uint8_t _cur = 0;
+        /// conversions summed so far for the current channel
+        static uint8_t _samples = 0;
+        /// the running sum for the current channel
+        static uint16_t _sum = 0;
+
+        bool configure(const AF_ADC_Channel_Config* channels, uint8_t count) {
+            if (count == 0 || count > AF_ADC_MAX_CHANNELS) return false;
+            for (uint8_t i = 0; i < count; i++) {
+                if (channels[i].oversample_log2 > AF_ADC_MAX_OVERSAMPLE_LOG2) return false;
+                // the decimation only drops whole pairs of bits, see AF_ADC_Channel_Config
+                if (channels[i].oversample_log2 & 1) return false;
+            }
+
+            stop();
+
+            for (uint8_t i = 0; i < count; i++) {
+                _channels[i] = channels[i];
+                _results[0][i] = 0;
+                _results[1][i] = 0;
+            }
+            _count = count;
+            return true;
+        }
+
+        void start(void) {
+            if (_count == 0 || _running) return;
+            _cur = 0;
+            _samples = 0;
+            _sum = 0;
+            _running = true;
+            _hw_start(_channels[0].pin);
+        }
+
+        void stop(void) {
+            _running = false;
+            _hw_stop();
+        }
+
+        bool is_running(void) {
+            return _running;
+        }
+
+        uint16_t read(uint8_t index) {
+            if (index >= _count) return 0;
+            uint8_t front;
+            uint16_t value;
+            // the 16-bit read isn't atomic on AVR, so retry if a scan finished in the middle of it
+            do {
+                front = _front;
+                value = _results[front][index];
+            } while (front != _front);
+            return value;
+        }
+
+        uint8_t snapshot(uint16_t* out) {
+            uint8_t front;
+            do {
+                front = _front;
+                for (uint8_t i = 0; i < _count; i++) out[i] = _results[front][i];
+            } while (front != _front);
+            return _count;
+        }
+
+        uint16_t get_scan_count(void) {
+            uint16_t count;
+            do {
+                count = _scan_count;
+            } while (count != _scan_count);
+            return count;
+        }
+
+        uint8_t _on_conversion(uint16_t raw) {
+
+            const AF_ADC_Channel_Config& ch = _channels[_cur];
+
+            _sum += raw;
+            _samples++;
+
+            // keep converting the same pin until it has been oversampled
+            if (_samples < (1 << ch.oversample_log2)) return ch.pin;
+
+            // decimate and store into the back buffer
+            uint8_t back = _front ^ 1;
+            _results[back][_cur] = _sum >> (ch.oversample_log2 >> 1);
+            _sum = 0;
+            _samples = 0;
+
+            // move on to the next channel, publishing the scan after the last one
+            if (++_cur == _count) {
+                _cur = 0;
+                // every channel in the back buffer has been written this scan, so publish it
+                _front = back;
+                _scan_count++;
+            }
+
+            return _channels[_cur].pin;
+        }
+
+    }
+
+}
@@ -0,0 +1,80 @@
+#ifndef AF_HAL_ADC_HAL_H_
+#define AF_HAL_ADC_HAL_H_
+
+/// @file   adc_hal.h
+/// @brief  provides an interrupt-driven analog conversion sequencer. the sequencer scans
+///         a list of channels in the background, oversampling each one, so tasks can
+///         read the latest value of any channel without waiting on a conversion.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/// the most channels the sequencer can scan
+#define AF_ADC_MAX_CHANNELS 8
+/// the most conversions that can be summed into one result (2^6 * 1023 fits in 16 bits)
+#define AF_ADC_MAX_OVERSAMPLE_LOG2 6
+
+/// @brief configuration for one channel in the scan list
+struct AF_ADC_Channel_Config {
+    /// the analog pin to convert
+    uint8_t pin;
+    /// 2^oversample_log2 conversions are summed for each result, up to AF_ADC_MAX_OVERSAMPLE_LOG2.
+    /// the sum is decimated by 2^(oversample_log2 / 2), so every 4x oversampling
+    /// adds one bit of resolution to the result (10 + oversample_log2 / 2 bits).
+    /// must be even: an odd value would leave the result one bit wider than its resolution,
+    /// so configure() rejects it.
+    uint8_t oversample_log2;
+};
+
+namespace AF_HAL {
+
+/// @brief namespace containing the analog conversion sequencer
+namespace adc {
+
+    /// @brief sets the channels to scan. stops the sequencer if it's running.
+    /// @param channels the channels to scan, in order
+    /// @param count    how many channels there are, up to AF_ADC_MAX_CHANNELS
+    /// @return true if the configuration was accepted, false if it was invalid, i.e. a channel's
+    ///         oversample_log2 is odd or too large
+    bool configure(const AF_ADC_Channel_Config* channels, uint8_t count);
+
+    /// @brief starts scanning the configured channels in the background
+    void start(void);
+
+    /// @brief stops scanning after the conversion in progress
+    void stop(void);
+
+    /// @brief whether the sequencer is scanning
+    bool is_running(void);
+
+    /// @brief gets the latest result for a channel. never waits for a conversion.
+    /// @param index the index of the channel in the scan list
+    /// @return the latest oversampled result, or 0 before the first scan has finished
+    uint16_t read(uint8_t index);
+
+    /// @brief copies the latest results for every channel, all from the same scan
+    /// @param out where to copy the results, one per configured channel
+    /// @return the number of results copied
+    uint8_t snapshot(uint16_t* out);
+
+    /// @brief gets the number of complete scans, rolls over to 0 safely
+    uint16_t get_scan_count(void);
+
+    /// @brief accumulates a finished conversion and picks the next pin to convert.
+    ///        called from the ADC complete ISR (or the simulator's stand-in) only.
+    /// @param raw the 10-bit conversion result
+    /// @return the pin to convert next
+    uint8_t _on_conversion(uint16_t raw);
+
+    /// @brief starts the first conversion on a pin, with the complete interrupt enabled.
+    ///        implemented by the platform HAL.
+    void _hw_start(uint8_t pin);
+
+    /// @brief stops further conversions. implemented by the platform HAL.
+    void _hw_stop(void);
+
+}
+
+}
+
+#endif // AF_HAL_ADC_HAL_H_
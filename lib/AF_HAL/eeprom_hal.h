@@ -0,0 +1,37 @@
+#ifndef AF_HAL_EEPROM_HAL_H_
+#define AF_HAL_EEPROM_HAL_H_
+
+/// @file   eeprom_hal.h
+/// @brief  provides access to the on-chip EEPROM, where configuration survives a reboot.
+///         erased bytes read as 0xFF. writes wait for each byte to be programmed (about
+///         3.4 ms a byte on the AVR), so write rarely and never from the control loop.
+
+#include <stdint.h>
+
+namespace AF_HAL {
+
+/// @brief namespace containing the EEPROM functions
+namespace eeprom {
+
+    /// @brief gets the size of the EEPROM
+    /// @return the size, in bytes
+    uint16_t size(void);
+
+    /// @brief reads bytes from the EEPROM. bytes past the end read as 0xFF.
+    /// @param addr where to read from
+    /// @param dest where to put the bytes
+    /// @param len  how many bytes to read
+    void read(uint16_t addr, void* dest, uint16_t len);
+
+    /// @brief writes bytes to the EEPROM, skipping the ones that already hold the right
+    ///        value to spare the EEPROM's write endurance. bytes past the end are dropped.
+    /// @param addr where to write to
+    /// @param src  the bytes to write
+    /// @param len  how many bytes to write
+    void update(uint16_t addr, const void* src, uint16_t len);
+
+}
+
+}
+
+#endif // AF_HAL_EEPROM_HAL_H_
@@ -0,0 +1,84 @@
+#include "AF_HAL.h"
+#include "pin_hal.h"
+
+// runtime pin access for AF_HAL::io, for callers that only know the pin number at runtime.
+// prefer AF_Pin (see pin_hal.h) anywhere the pin is fixed, it's a single instruction.
+
+/// port index and bit for every pin, digital pins first and then analog pins
+static const uint8_t _pin_map[] AF_PROGMEM = {
+    AF_BOARD_DIGITAL_PINS(AF_PIN_MAP_ENTRY)
+    AF_BOARD_ANALOG_PINS(AF_PIN_MAP_ENTRY)
+};
+
+#if defined(AF_SIMULATOR)
+    #define AF_PORT_PIN_REG(_l) &AF_HAL::sim::_port_regs[AF_PORT_IDX_ ## _l][0]
+#else
+    #define AF_PORT_PIN_REG(_l) &PIN ## _l
+#endif
+
+/// the PIN register of each port, by port index. the DDR and PORT registers always
+/// follow the PIN register, so they're found at +1 and +2.
+static volatile uint8_t* const _port_pin_regs[AF_NUM_PORTS] = {
+#if defined(PORTA) || defined(AF_SIMULATOR)
+    AF_PORT_PIN_REG(A),
+#else
+    nullptr,
+#endif
+    AF_PORT_PIN_REG(B),
+    AF_PORT_PIN_REG(C),
+    AF_PORT_PIN_REG(D),
+#if defined(PORTE) || defined(AF_SIMULATOR)
+    AF_PORT_PIN_REG(E), AF_PORT_PIN_REG(F), AF_PORT_PIN_REG(G), AF_PORT_PIN_REG(H),
+    AF_PORT_PIN_REG(J), AF_PORT_PIN_REG(K), AF_PORT_PIN_REG(L),
+#else
+    nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+#endif
+};
+
+/// @brief looks up the PIN register and mask of a pin
+/// @return the PIN register, or nullptr if the pin doesn't exist
+static inline volatile uint8_t* _lookup(uint8_t pin, uint8_t& mask) {
+    if (pin >= sizeof(_pin_map)) return nullptr;
+    uint8_t entry = AF_PGM_READ_BYTE(&_pin_map[pin]);
+    mask = 1 << (entry & 0x07);
+    return _port_pin_regs[entry >> 3];
+}
+
+namespace AF_HAL {
+
+    namespace io {
+
+        bool dread(uint8_t pin) {
+            uint8_t mask;
+            volatile uint8_t* reg = _lookup(pin, mask);
+            if (reg == nullptr) return IO_LOGICAL_0;
+            return (reg[0] & mask) ? IO_LOGICAL_1 : IO_LOGICAL_0;
+        }
+
+        void dwrite(uint8_t pin, int value) {
+            uint8_t mask;
+            volatile uint8_t* reg = _lookup(pin, mask);
+            if (reg == nullptr) return;
+            // ports above the low I/O space aren't written with sbi/cbi, so guard the read-modify-write
+            AF_ATOMIC_BLOCK {
+                if (value) reg[2] |= mask; else reg[2] &= ~mask;
+            }
+        }
+
+        void pmode(uint8_t pin, int mode) {
+            uint8_t mask;
+            volatile uint8_t* reg = _lookup(pin, mask);
+            if (reg == nullptr) return;
+            AF_ATOMIC_BLOCK {
+                if (mode == IO_MODE_OUTPUT) {
+                    reg[1] |= mask;
+                } else {
+                    reg[1] &= ~mask;
+                    if (mode == IO_MODE_INPUT_PULLUP) reg[2] |= mask; else reg[2] &= ~mask;
+                }
+            }
+        }
+
+    }
+
+}
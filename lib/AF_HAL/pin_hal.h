@@ -0,0 +1,270 @@
+#ifndef AF_HAL_PIN_HAL_H_
+#define AF_HAL_PIN_HAL_H_
+
+/// @file   pin_hal.h
+/// @brief  provides compile-time digital pin access. the port and bit of an AF_Pin are
+///         template parameters, so each access compiles down to a single sbi, cbi or
+///         sbis instruction instead of a runtime lookup. also contains the board pin
+///         tables used by both AF_Pin and the runtime AF_HAL::io functions.
+
+#include "system_hal.h"
+#include <stdint.h>
+
+#if !defined(AF_SIMULATOR)
+#include <avr/io.h>
+#endif
+
+// port indices, used to pack a port and bit into one byte in the runtime pin table
+#define AF_PORT_IDX_A 0
+#define AF_PORT_IDX_B 1
+#define AF_PORT_IDX_C 2
+#define AF_PORT_IDX_D 3
+#define AF_PORT_IDX_E 4
+#define AF_PORT_IDX_F 5
+#define AF_PORT_IDX_G 6
+#define AF_PORT_IDX_H 7
+#define AF_PORT_IDX_J 8
+#define AF_PORT_IDX_K 9
+#define AF_PORT_IDX_L 10
+/// the number of port indices
+#define AF_NUM_PORTS  11
+
+#if defined(AF_SIMULATOR)
+
+namespace AF_HAL {
+    namespace sim {
+        /// simulated port registers, [port index][0 = PIN, 1 = DDR, 2 = PORT]
+        extern volatile uint8_t _port_regs[AF_NUM_PORTS][3];
+    }
+}
+
+/// macro for defining a port descriptor backed by the simulator's registers
+#define AF_DEF_IO_PORT(_l, _sbi) struct AF_Port_ ## _l { \
+        static const uint8_t idx = AF_PORT_IDX_ ## _l; \
+        static const bool atomic_bits = _sbi; \
+        static inline volatile uint8_t& pin(void) { return AF_HAL::sim::_port_regs[AF_PORT_IDX_ ## _l][0]; } \
+        static inline volatile uint8_t& ddr(void) { return AF_HAL::sim::_port_regs[AF_PORT_IDX_ ## _l][1]; } \
+        static inline volatile uint8_t& port(void) { return AF_HAL::sim::_port_regs[AF_PORT_IDX_ ## _l][2]; } \
+    };
+
+#else
+
+/// macro for defining a port descriptor.
+/// _l is the port letter
+/// _sbi is whether the port is in the low I/O space, where single bits are set and
+///      cleared atomically with sbi/cbi. ports H-L on the 2560 are not.
+#define AF_DEF_IO_PORT(_l, _sbi) struct AF_Port_ ## _l { \
+        static const uint8_t idx = AF_PORT_IDX_ ## _l; \
+        static const bool atomic_bits = _sbi; \
+        static inline volatile uint8_t& pin(void) { return PIN ## _l; } \
+        static inline volatile uint8_t& ddr(void) { return DDR ## _l; } \
+        static inline volatile uint8_t& port(void) { return PORT ## _l; } \
+    };
+
+#endif // AF_SIMULATOR
+
+#if defined(PORTA) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(A, true)
+#endif
+#if defined(PORTB) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(B, true)
+#endif
+#if defined(PORTC) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(C, true)
+#endif
+#if defined(PORTD) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(D, true)
+#endif
+#if defined(PORTE) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(E, true)
+#endif
+#if defined(PORTF) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(F, true)
+#endif
+#if defined(PORTG) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(G, true)
+#endif
+#if defined(PORTH) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(H, false)
+#endif
+#if defined(PORTJ) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(J, false)
+#endif
+#if defined(PORTK) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(K, false)
+#endif
+#if defined(PORTL) || defined(AF_SIMULATOR)
+AF_DEF_IO_PORT(L, false)
+#endif
+
+/// @brief a single digital pin, fixed at compile time
+/// @tparam P   the port descriptor, i.e. AF_Port_B
+/// @tparam BIT the bit of the pin in the port
+template <typename P, uint8_t BIT>
+struct AF_Pin {
+
+    static_assert(BIT < 8, "a port only has 8 pins");
+
+    /// the port descriptor
+    typedef P port_t;
+    /// the mask of the pin in the port registers
+    static const uint8_t mask = (1 << BIT);
+
+    /// @brief drives the pin high (sbi)
+    static inline void set(void) {
+        if (P::atomic_bits) {
+            P::port() |= mask;
+        } else {
+            AF_ATOMIC_BLOCK { P::port() |= mask; }
+        }
+    }
+
+    /// @brief drives the pin low (cbi)
+    static inline void clear(void) {
+        if (P::atomic_bits) {
+            P::port() &= ~mask;
+        } else {
+            AF_ATOMIC_BLOCK { P::port() &= ~mask; }
+        }
+    }
+
+    /// @brief drives the pin to a level
+    static inline void write(bool value) {
+        if (value) set(); else clear();
+    }
+
+    /// @brief flips the pin. writing a 1 to the PIN register toggles the output on AVR.
+    static inline void toggle(void) {
+#if defined(AF_SIMULATOR)
+        P::port() ^= mask;
+#else
+        P::pin() = mask;
+#endif
+    }
+
+    /// @brief reads the level on the pin (sbis)
+    static inline bool read(void) {
+        return (P::pin() & mask) ? IO_LOGICAL_1 : IO_LOGICAL_0;
+    }
+
+    /// @brief sets the pin to be an input, output, or input with pullup
+    /// @param mode IO_MODE_INPUT, IO_MODE_OUTPUT or IO_MODE_INPUT_PULLUP
+    static inline void mode(int mode) {
+        if (mode == IO_MODE_OUTPUT) {
+            AF_ATOMIC_BLOCK { P::ddr() |= mask; }
+        } else {
+            AF_ATOMIC_BLOCK {
+                P::ddr() &= ~mask;
+                if (mode == IO_MODE_INPUT_PULLUP) P::port() |= mask; else P::port() &= ~mask;
+            }
+        }
+    }
+
+};
+
+/// @brief several pins on the same port, updated together with one register write
+/// @tparam P    the port descriptor, i.e. AF_Port_B
+/// @tparam MASK the pins in the group
+/// @note  the update is a read-modify-write of the whole port, so it runs with interrupts
+///        disabled in case an ISR drives another pin on the same port.
+template <typename P, uint8_t MASK>
+struct AF_Pin_Group {
+
+    /// the port descriptor
+    typedef P port_t;
+    /// the mask of the pins in the port registers
+    static const uint8_t mask = MASK;
+
+    /// @brief drives every pin in the group at once
+    /// @param bits the levels, in port bit positions. bits outside the group are ignored.
+    static inline void write(uint8_t bits) {
+        AF_ATOMIC_BLOCK { P::port() = (P::port() & ~MASK) | (bits & MASK); }
+    }
+
+    /// @brief drives every pin in the group high
+    static inline void set(void) { AF_ATOMIC_BLOCK { P::port() |= MASK; } }
+
+    /// @brief drives every pin in the group low
+    static inline void clear(void) { AF_ATOMIC_BLOCK { P::port() &= ~MASK; } }
+
+    /// @brief reads every pin in the group at once
+    /// @return the levels, in port bit positions
+    static inline uint8_t read(void) { return P::pin() & MASK; }
+
+    /// @brief sets every pin in the group to be outputs
+    static inline void output(void) { AF_ATOMIC_BLOCK { P::ddr() |= MASK; } }
+
+};
+
+// --- board pin tables ---
+// each entry is _X(number, port letter, bit). the typedefs in AF_HAL::pins and the
+// runtime table used by AF_HAL::io are generated from the same list.
+
+#if defined(__AVR_ATmega2560__) || defined(AF_SIMULATOR)
+
+/// the number of digital pins on the board
+#define AF_BOARD_NUM_DIGITAL_PINS 54
+/// the number of analog pins on the board (which are also digital pins)
+#define AF_BOARD_NUM_ANALOG_PINS 16
+
+/// digital pins of the ATmega2560 (Arduino Mega numbering)
+#define AF_BOARD_DIGITAL_PINS(_X) \
+    _X(0, E, 0)  _X(1, E, 1)  _X(2, E, 4)  _X(3, E, 5)  _X(4, G, 5)  _X(5, E, 3)  \
+    _X(6, H, 3)  _X(7, H, 4)  _X(8, H, 5)  _X(9, H, 6)  _X(10, B, 4) _X(11, B, 5) \
+    _X(12, B, 6) _X(13, B, 7) _X(14, J, 1) _X(15, J, 0) _X(16, H, 1) _X(17, H, 0) \
+    _X(18, D, 3) _X(19, D, 2) _X(20, D, 1) _X(21, D, 0) _X(22, A, 0) _X(23, A, 1) \
+    _X(24, A, 2) _X(25, A, 3) _X(26, A, 4) _X(27, A, 5) _X(28, A, 6) _X(29, A, 7) \
+    _X(30, C, 7) _X(31, C, 6) _X(32, C, 5) _X(33, C, 4) _X(34, C, 3) _X(35, C, 2) \
+    _X(36, C, 1) _X(37, C, 0) _X(38, D, 7) _X(39, G, 2) _X(40, G, 1) _X(41, G, 0) \
+    _X(42, L, 7) _X(43, L, 6) _X(44, L, 5) _X(45, L, 4) _X(46, L, 3) _X(47, L, 2) \
+    _X(48, L, 1) _X(49, L, 0) _X(50, B, 3) _X(51, B, 2) _X(52, B, 1) _X(53, B, 0)
+
+/// analog pins of the ATmega2560, used as digital pins
+#define AF_BOARD_ANALOG_PINS(_X) \
+    _X(0, F, 0)  _X(1, F, 1)  _X(2, F, 2)  _X(3, F, 3)  _X(4, F, 4)  _X(5, F, 5)  \
+    _X(6, F, 6)  _X(7, F, 7)  _X(8, K, 0)  _X(9, K, 1)  _X(10, K, 2) _X(11, K, 3) \
+    _X(12, K, 4) _X(13, K, 5) _X(14, K, 6) _X(15, K, 7)
+
+#elif defined(__AVR_ATmega328P__)
+
+/// the number of digital pins on the board
+#define AF_BOARD_NUM_DIGITAL_PINS 14
+/// the number of analog pins on the board (which are also digital pins)
+#define AF_BOARD_NUM_ANALOG_PINS 6
+
+/// digital pins of the ATmega328P (Arduino Uno numbering)
+#define AF_BOARD_DIGITAL_PINS(_X) \
+    _X(0, D, 0)  _X(1, D, 1)  _X(2, D, 2)  _X(3, D, 3)  _X(4, D, 4)  _X(5, D, 5)  \
+    _X(6, D, 6)  _X(7, D, 7)  _X(8, B, 0)  _X(9, B, 1)  _X(10, B, 2) _X(11, B, 3) \
+    _X(12, B, 4) _X(13, B, 5)
+
+/// analog pins of the ATmega328P, used as digital pins
+#define AF_BOARD_ANALOG_PINS(_X) \
+    _X(0, C, 0)  _X(1, C, 1)  _X(2, C, 2)  _X(3, C, 3)  _X(4, C, 4)  _X(5, C, 5)
+
+#else
+    #error "AutoFlight has no pin table for this hardware"
+#endif
+
+/// packs a port index and bit into one byte of the runtime pin table
+#define AF_PIN_MAP_ENTRY(_n, _p, _b) (uint8_t)((AF_PORT_IDX_ ## _p << 3) | _b),
+
+namespace AF_HAL {
+
+/// @brief namespace containing the board's pins as AF_Pin types, i.e. pins::D13::toggle()
+namespace pins {
+
+#define AF_DEF_DIGITAL_PIN(_n, _p, _b) typedef AF_Pin<AF_Port_ ## _p, _b> D ## _n;
+#define AF_DEF_ANALOG_PIN(_n, _p, _b) typedef AF_Pin<AF_Port_ ## _p, _b> A ## _n;
+
+    AF_BOARD_DIGITAL_PINS(AF_DEF_DIGITAL_PIN)
+    AF_BOARD_ANALOG_PINS(AF_DEF_ANALOG_PIN)
+
+#undef AF_DEF_DIGITAL_PIN
+#undef AF_DEF_ANALOG_PIN
+
+}
+
+}
+
+#endif // AF_HAL_PIN_HAL_H_
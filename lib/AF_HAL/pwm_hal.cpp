@@ -0,0 +1,115 @@
+#include "AF_HAL.h"
+#include "pwm_hal.h"
+
+static_assert(1000000UL / AF_PWM_MAX_FREQ_HZ > AF_PWM_MAX_PULSE_US, "the fastest period must fit the longest pulse");
+
+#if defined(AF_PWM_CHANNEL_PINS)
+/// the board pin of each channel
+static const uint8_t _channel_pins[] AF_PROGMEM = AF_PWM_CHANNEL_PINS;
+#endif
+
+namespace AF_HAL {
+
+    namespace pwm {
+
+#if defined(AF_SIMULATOR)
+        // each board on the host has its own engine, see AF_Context.h
+        static inline _Engine& _engine(void) { return _hw_engine(); }
+#else
+        static _Engine _the_engine;
+        static inline _Engine& _engine(void) { return _the_engine; }
+#endif
+
+        bool init(AF_PWM_Mode mode, uint16_t freq_hz) {
+            if (mode == AF_PWM_MODE_STANDARD && (freq_hz < AF_PWM_MIN_FREQ_HZ || freq_hz > AF_PWM_MAX_FREQ_HZ)) return false;
+
+            _Engine& e = _engine();
+            e.mode = mode;
+            e.top = mode == AF_PWM_MODE_STANDARD ? (uint16_t)((1000000UL * AF_PWM_TICKS_PER_US) / freq_hz) - 1 : 0;
+            e.enabled = 0;
+            for (uint8_t i = 0; i < AF_PWM_MAX_CHANNELS; i++) e.staged[i] = 0;
+
+            e.ready = _hw_init(mode, e.top);
+            return e.ready;
+        }
+
+        uint8_t num_channels(void) {
+            return _hw_num_channels();
+        }
+
+        void enable(uint8_t channel) {
+            _Engine& e = _engine();
+            if (!e.ready || channel >= _hw_num_channels()) return;
+            e.enabled |= (1 << channel);
+            _hw_enable(channel, true);
+        }
+
+        void disable(uint8_t channel) {
+            _Engine& e = _engine();
+            if (!e.ready || channel >= _hw_num_channels()) return;
+            e.enabled &= ~(1 << channel);
+            _hw_enable(channel, false);
+        }
+
+        void set(uint8_t channel, uint16_t pulse_us) {
+            if (channel >= AF_PWM_MAX_CHANNELS) return;
+            _Engine& e = _engine();
+            if (pulse_us < AF_PWM_MIN_PULSE_US) pulse_us = AF_PWM_MIN_PULSE_US;
+            if (pulse_us > AF_PWM_MAX_PULSE_US) pulse_us = AF_PWM_MAX_PULSE_US;
+            uint16_t ticks = pulse_us * AF_PWM_TICKS_PER_US;
+            if (e.mode == AF_PWM_MODE_ONESHOT125) ticks /= AF_PWM_ONESHOT125_DIVISOR;
+            e.staged[channel] = ticks;
+        }
+
+        void set_duty(uint8_t channel, uint16_t duty) {
+            _Engine& e = _engine();
+            if (channel >= AF_PWM_MAX_CHANNELS || e.mode != AF_PWM_MODE_STANDARD) return;
+            if (duty > 1023) duty = 1023;
+            e.staged[channel] = (uint16_t)(((uint32_t)e.top * duty) / 1023);
+        }
+
+        bool commit(void) {
+            _Engine& e = _engine();
+            if (!e.ready) return false;
+            return _hw_commit(e.mode, e.staged, e.enabled);
+        }
+
+        uint16_t get_period_us(void) {
+            return (_engine().top + 1) / AF_PWM_TICKS_PER_US;
+        }
+
+        int8_t channel_for_pin(uint8_t pin) {
+#if defined(AF_PWM_CHANNEL_PINS)
+            for (uint8_t channel = 0; channel < sizeof(_channel_pins); channel++) {
+                if (AF_PGM_READ_BYTE(&_channel_pins[channel]) == pin) return channel;
+            }
+#else
+            (void)pin;
+#endif
+            return -1;
+        }
+
+    }
+
+    namespace io {
+
+        void awrite(uint8_t pin, uint16_t value) {
+            // there's no DAC on the AVR targets, so approximate it with pwm, like analogWrite()
+            // does. only stage it: commit() would also latch whatever else is staged, i.e. half
+            // of a mixer step.
+            int8_t channel = pwm::channel_for_pin(pin);
+            if (channel < 0) return;
+            if (!(pwm::_engine().enabled & (1 << channel))) pwm::enable(channel);
+            pwm::set_duty(channel, value);
+        }
+
+        void pwmwrite(uint8_t channel, uint16_t value) {
+            // only stage it, like awrite()
+            if (channel >= AF_PWM_MAX_CHANNELS) return;
+            if (!(pwm::_engine().enabled & (1 << channel))) pwm::enable(channel);
+            pwm::set_duty(channel, value);
+        }
+
+    }
+
+}
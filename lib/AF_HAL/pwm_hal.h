@@ -0,0 +1,138 @@
+#ifndef AF_HAL_PWM_HAL_H_
+#define AF_HAL_PWM_HAL_H_
+
+/// @file   pwm_hal.h
+/// @brief  provides a timer-driven pwm/servo output engine. new pulse widths are
+///         staged with set() and latched on every channel at once with commit(), so
+///         the outputs of one mixer step always go out together.
+///
+/// on the ATmega2560 the engine owns the 16-bit timers 1, 3 and 4 (9 channels):
+///
+///     channel  0    1    2    3    4    5    6    7    8
+///     output   OC1A OC1B OC1C OC3A OC3B OC3C OC4A OC4B OC4C
+///     pin      D11  D12  D13  D5   D2   D3   D6   D7   D8
+///
+/// timer 5 is left for the system clock. the ATmega328P only has one 16-bit timer,
+/// which the system clock uses, so the engine has no channels there. the simulator
+/// uses the ATmega2560's table, with three extra channels that have no pins.
+///
+/// output latency from commit() to the pulse edge:
+///  - AF_PWM_MODE_STANDARD: the new widths latch at the start of the next period
+///    (at most 1 / freq). the compare registers are double buffered by the timer, so
+///    a pulse in progress is never cut short or stretched.
+///  - AF_PWM_MODE_ONESHOT125: the pulses start immediately (a few cycles), one pulse
+///    per commit(), like the OneShot125 ESC protocol.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__AVR_ATmega2560__) || defined(AF_SIMULATOR)
+/// the board pin of each channel, in channel order, see the table above
+#define AF_PWM_CHANNEL_PINS { 11, 12, 13, 5, 2, 3, 6, 7, 8 }
+#endif
+
+/// the most channels any platform provides
+#define AF_PWM_MAX_CHANNELS 12
+/// the shortest pulse accepted by set(), in microseconds
+#define AF_PWM_MIN_PULSE_US 800
+/// the longest pulse accepted by set(), in microseconds
+#define AF_PWM_MAX_PULSE_US 2200
+/// the slowest standard pwm frequency, in Hz
+#define AF_PWM_MIN_FREQ_HZ 50
+/// the fastest standard pwm frequency, in Hz (the period must fit the longest pulse,
+/// 2222 us leaves 22 us low after a 2200 us pulse)
+#define AF_PWM_MAX_FREQ_HZ 450
+/// timer ticks per microsecond (16 MHz / 8)
+#define AF_PWM_TICKS_PER_US 2
+/// OneShot125 pulses are one eighth of the standard servo pulse
+#define AF_PWM_ONESHOT125_DIVISOR 8
+
+/// @brief how the engine generates pulses
+enum AF_PWM_Mode: uint8_t {
+    /// free-running servo pwm at 50-450 Hz
+    AF_PWM_MODE_STANDARD = 0,
+    /// one 125-250 us pulse per commit()
+    AF_PWM_MODE_ONESHOT125
+};
+
+namespace AF_HAL {
+
+/// @brief namespace containing the pwm output engine
+namespace pwm {
+
+    /// @brief sets up the timers for a pwm mode. all channels start disabled.
+    /// @param mode     how to generate pulses
+    /// @param freq_hz  the frequency for AF_PWM_MODE_STANDARD, ignored for oneshot
+    /// @return true if the mode is available, false otherwise
+    bool init(AF_PWM_Mode mode, uint16_t freq_hz = AF_PWM_MIN_FREQ_HZ);
+
+    /// @brief gets the number of channels on this platform
+    uint8_t num_channels(void);
+
+    /// @brief connects a channel to its output pin
+    void enable(uint8_t channel);
+
+    /// @brief disconnects a channel from its output pin, leaving it low
+    void disable(uint8_t channel);
+
+    /// @brief stages a pulse width for a channel. nothing changes until commit().
+    /// @param channel  the channel
+    /// @param pulse_us the pulse width as a standard servo pulse, clamped to
+    ///                 AF_PWM_MIN_PULSE_US-AF_PWM_MAX_PULSE_US. in oneshot mode the
+    ///                 pulse is scaled down by AF_PWM_ONESHOT125_DIVISOR.
+    void set(uint8_t channel, uint16_t pulse_us);
+
+    /// @brief stages a duty cycle for a channel, for non-servo loads in standard mode.
+    ///        nothing changes until commit().
+    /// @param channel  the channel
+    /// @param duty     the duty cycle, clamped to 0-1023
+    void set_duty(uint8_t channel, uint16_t duty);
+
+    /// @brief latches the staged pulse widths on every channel at once
+    /// @return true if the widths were latched. in oneshot mode, false if the previous
+    ///         pulses are still going out; the staged widths are kept for the next commit().
+    bool commit(void);
+
+    /// @brief gets the period of the standard pwm signal, in microseconds
+    uint16_t get_period_us(void);
+
+    /// @brief looks up the channel that drives a board pin
+    /// @param pin the digital pin, i.e. 11 for D11
+    /// @return the channel, or -1 if the pin has no pwm output
+    int8_t channel_for_pin(uint8_t pin);
+
+    // --- platform hooks, implemented by the platform HAL ---
+
+    /// @brief the number of channels the platform provides
+    uint8_t _hw_num_channels(void);
+    /// @brief sets up the timers. top is the period in ticks (standard mode only).
+    bool _hw_init(AF_PWM_Mode mode, uint16_t top);
+    /// @brief connects or disconnects a channel's output
+    void _hw_enable(uint8_t channel, bool enable);
+    /// @brief latches compare values, in ticks, for every enabled channel at once
+    bool _hw_commit(AF_PWM_Mode mode, const uint16_t* ticks, uint16_t enabled_mask);
+
+    /// @brief the engine's state
+    struct _Engine {
+        /// the current mode
+        AF_PWM_Mode mode = AF_PWM_MODE_STANDARD;
+        /// the period of the standard pwm signal, in ticks
+        uint16_t top = 0;
+        /// staged compare values, in ticks
+        uint16_t staged[AF_PWM_MAX_CHANNELS] = {};
+        /// bit n is set if channel n is enabled
+        uint16_t enabled = 0;
+        /// whether init() has succeeded
+        bool ready = false;
+    };
+
+#if defined(AF_SIMULATOR)
+    /// @brief gets the engine of the board the calling thread is on, see sim_hal.h
+    _Engine& _hw_engine(void);
+#endif
+
+}
+
+}
+
+#endif // AF_HAL_PWM_HAL_H_
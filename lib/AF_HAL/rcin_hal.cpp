@@ -0,0 +1,130 @@
+#include "AF_HAL.h"
+#include "rcin_hal.h"
+
+#if !defined(AF_SIMULATOR)
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#endif
+
+static_assert((AF_RCIN_PPM_QUEUE_LEN & (AF_RCIN_PPM_QUEUE_LEN - 1)) == 0, "the PPM queue length must be a power of two");
+
+namespace AF_HAL {
+
+    namespace rcin {
+
+        /// edge widths in capture ticks, written by the capture ISR and read by ppm_read()
+        static uint16_t _queue[AF_RCIN_PPM_QUEUE_LEN];
+        /// free-running write index, only written by the ISR
+        static volatile uint8_t _head = 0;
+        /// free-running read index, only written by ppm_read()
+        static volatile uint8_t _tail = 0;
+        /// edges dropped because the queue was full
+        static volatile uint16_t _overruns = 0;
+        /// the cycle count at the last edge
+        static uint32_t _last_capture = 0;
+
+        void _ppm_push(uint16_t width) {
+            uint8_t head = _head;
+            if ((uint8_t)(head - _tail) >= AF_RCIN_PPM_QUEUE_LEN) {
+                if (_overruns != 0xFFFF) _overruns++;
+                return;
+            }
+            _queue[head & (AF_RCIN_PPM_QUEUE_LEN - 1)] = width;
+            __atomic_store_n(&_head, (uint8_t)(head + 1), __ATOMIC_RELEASE);
+        }
+
+        uint8_t ppm_read(uint16_t* widths, uint8_t max) {
+            uint8_t tail = _tail;
+            uint8_t head = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+            uint8_t n = 0;
+            while (tail != head && n < max) {
+                widths[n++] = _queue[tail & (AF_RCIN_PPM_QUEUE_LEN - 1)];
+                tail++;
+            }
+            __atomic_store_n(&_tail, tail, __ATOMIC_RELEASE);
+            return n;
+        }
+
+        uint16_t ppm_overruns(void) {
+            uint16_t overruns;
+            AF_ATOMIC_BLOCK { overruns = _overruns; }
+            return overruns;
+        }
+
+#if defined(AF_SIMULATOR)
+
+        // the simulator feeds edges with sim::feed_ppm()
+
+        void ppm_start(void) {
+            _last_capture = 0;
+        }
+
+        void ppm_stop(void) {}
+
+#else
+
+        /// @brief queues the time since the last edge. the capture timer is the system clock
+        ///        (see AutoFlight Copter/hal.cpp), which wraps every 4 ms at clk/1, so the
+        ///        capture is extended to a full cycle count first.
+        static inline void _ppm_capture(uint16_t ticks) {
+            uint32_t capture = AF_HAL::_capture_cycles(ticks);
+            uint32_t width = (capture - _last_capture) / (AF_CYCLES_PER_US / AF_RCIN_PPM_TICKS_PER_US);
+            _ppm_push(width > 0xFFFF ? 0xFFFF : width);
+            _last_capture = capture;
+        }
+
+#if defined(__AVR_ATmega2560__)
+
+        void ppm_start(void) {
+            AF_ATOMIC_BLOCK {
+                // ICP5 (PL1, D48) as an input
+                DDRL &= ~(1 << PL1);
+                // capture rising edges with the noise canceler on, leaving the clock running
+                TCCR5B |= (1 << ICNC5) | (1 << ICES5);
+                _last_capture = AF_HAL::cycles();
+                TIFR5 = (1 << ICF5);
+                TIMSK5 |= (1 << ICIE5);
+            }
+        }
+
+        void ppm_stop(void) {
+            TIMSK5 &= ~(1 << ICIE5);
+        }
+
+        /// rising edge on ICP5
+        ISR(TIMER5_CAPT_vect) {
+            _ppm_capture(ICR5);
+        }
+
+#elif defined(__AVR_ATmega328P__)
+
+        void ppm_start(void) {
+            AF_ATOMIC_BLOCK {
+                // ICP1 (PB0, D8) as an input
+                DDRB &= ~(1 << PB0);
+                // capture rising edges with the noise canceler on, leaving the clock running
+                TCCR1B |= (1 << ICNC1) | (1 << ICES1);
+                _last_capture = AF_HAL::cycles();
+                TIFR1 = (1 << ICF1);
+                TIMSK1 |= (1 << ICIE1);
+            }
+        }
+
+        void ppm_stop(void) {
+            TIMSK1 &= ~(1 << ICIE1);
+        }
+
+        /// rising edge on ICP1
+        ISR(TIMER1_CAPT_vect) {
+            _ppm_capture(ICR1);
+        }
+
+#else
+    #error "AutoFlight has no PPM input capture for this hardware"
+#endif
+
+#endif // AF_SIMULATOR
+
+    }
+
+}
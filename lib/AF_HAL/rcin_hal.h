@@ -0,0 +1,48 @@
+#ifndef AF_HAL_RCIN_HAL_H_
+#define AF_HAL_RCIN_HAL_H_
+
+/// @file   rcin_hal.h
+/// @brief  provides timer input capture for PPM receivers. the capture ISR only measures
+///         the time between rising edges and queues it; decoding the frame happens in a
+///         task (see AF_RCInput), so each edge costs a handful of cycles.
+///
+/// the PPM signal goes to ICP5 (D48) on the ATmega2560, or ICP1 (D8) on the ATmega328P.
+/// these belong to the system clock's timer, so capture needs AF_HAL::init() to have run.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/// edge width units per microsecond. edges are timed with the system clock's timer and
+/// scaled down to this, so widths up to 32 ms fit the queue.
+#define AF_RCIN_PPM_TICKS_PER_US 2
+/// how many edge widths can be queued between calls to ppm_read(), about three frames of 8 channels
+#define AF_RCIN_PPM_QUEUE_LEN 32
+
+namespace AF_HAL {
+
+/// @brief namespace containing receiver input capture
+namespace rcin {
+
+    /// @brief starts capturing PPM edges
+    void ppm_start(void);
+
+    /// @brief stops capturing PPM edges
+    void ppm_stop(void);
+
+    /// @brief pops queued edge widths
+    /// @param widths where to copy the widths, in capture ticks (see AF_RCIN_PPM_TICKS_PER_US)
+    /// @param max    the most widths to copy
+    /// @return the number of widths copied
+    uint8_t ppm_read(uint16_t* widths, uint8_t max);
+
+    /// @brief gets the number of edges dropped because the queue was full, saturates at 0xFFFF
+    uint16_t ppm_overruns(void);
+
+    /// @brief queues an edge width. called from the capture ISR (or the simulator) only.
+    void _ppm_push(uint16_t width);
+
+}
+
+}
+
+#endif // AF_HAL_RCIN_HAL_H_
@@ -1,11 +1,17 @@
 #include "AF_HAL.h"
 #include "serial_hal.h"
+#include <AF_Profiler/AF_Profiler.h>
+
+// the simulator provides its own serial interfaces, see AutoFlight Copter (simulator)/hal.cpp
+#if !defined(AF_SIMULATOR)
+
+AF_PROFILE_POINT(_prof_write, "serial.write");
 
 // --- public methods ---
 
-AF_SerialInterface::AF_SerialInterface(utilbuf::stream_buffer* buffer,
+AF_SerialInterface::AF_SerialInterface(utilbuf::ring_buffer* buffer, utilbuf::ring_buffer* tx_buffer,
       volatile uint8_t *ubrrh, volatile uint8_t *ubrrl,
-      volatile uint8_t *ucsra, volatile uint8_t *ucsrb,
+      volatile uint8_t *ucsra, volatile uint8_t *ucsrb, volatile uint8_t *ucsrc,
       volatile uint8_t *udr,
       uint8_t rxen, uint8_t txen, uint8_t rxcie, uint8_t udre, uint8_t u2x): Stream(buffer) {
 
@@ -13,19 +19,21 @@ AF_SerialInterface::AF_SerialInterface(utilbuf::stream_buffer* buffer,
     _ubrrl = ubrrl;
     _ucsra = ucsra;
     _ucsrb = ucsrb;
+    _ucsrc = ucsrc;
     _udr = udr;
     _rxen = rxen;
     _txen = txen;
     _rxcie = rxcie;
     _udre = udre;
     _u2x = u2x;
+    _tx = tx_buffer;
 }
 
 AF_SerialInterface::~AF_SerialInterface() {
     close();
 }
 
-void AF_SerialInterface::open(uint32_t baud) {
+void AF_SerialInterface::open(uint32_t baud, uint8_t config) {
 
     uint16_t baud_setting;
     bool use_u2x = true;
@@ -49,8 +57,12 @@ void AF_SerialInterface::open(uint32_t baud) {
     *_ubrrh = baud_setting >> 8;
     *_ubrrl = baud_setting;
 
-    // enable the receiver and transmitter
-    *_ucsrb = (1 << _rxen) | (1 << _txen) | (1 << _rxcie) | (1 << _udre);
+    // set the frame format
+    *_ucsrc = config;
+
+    // enable the receiver and transmitter. the data register empty interrupt
+    // is only enabled while there are outbound bytes waiting (see commit()).
+    *_ucsrb = (1 << _rxen) | (1 << _txen) | (1 << _rxcie);
     
 }
 
@@ -63,26 +75,56 @@ size_t AF_SerialInterface::close(void) {
 
 size_t AF_SerialInterface::write(uint8_t byte) {
 
-    // wait for the transmit buffer to be empty
-    while (!(*_ucsra & (1 << _udre)));
+    // wait a bounded time for room in the outbound buffer, put() drops the byte if there's still none
+    uint32_t deadline = AF_HAL::micros() + AF_SERIAL_WRITE_TIMEOUT_US;
+    while (_tx->space() == 0 && !AF_HAL::time_reached(AF_HAL::micros(), deadline));
+    size_t written = _tx->put(byte) ? 1 : 0;
 
-    // write the byte to the transmit buffer
-    *_udr = byte;
+    // make sure the data register empty interrupt will pick it up
+    *_ucsrb |= (1 << _udre);
 
+    return written;
 }
 
 size_t AF_SerialInterface::write(const uint8_t* bytes, size_t size) {
-
-    // write each byte in the buffer
-    for (size_t i = 0; i < size; i++) {
-        write(bytes[i]);
+    // includes any time spent waiting for room
+    AF_PROFILE_SCOPE(_prof_write);
+
+    size_t written = 0;
+    uint32_t deadline = AF_HAL::micros() + AF_SERIAL_WRITE_TIMEOUT_US;
+
+    // copy into the outbound buffer as space becomes available
+    while (written < size) {
+        utilbuf::ring_idx_t room = _tx->space();
+        if (room == 0) {
+            if (AF_HAL::time_reached(AF_HAL::micros(), deadline)) break;
+            continue;
+        }
+        written += _tx->write(bytes + written, room < size - written ? room : size - written);
+        // start (or keep) the data register empty interrupt draining the buffer
+        *_ucsrb |= (1 << _udre);
     }
 
+    // out of time, count the rest as dropped. writing it could queue some of it as the
+    // interrupt drains the buffer, and a caller retrying what wasn't written would send it twice.
+    if (written < size) _tx->note_dropped(size - written);
+
     // return the number of bytes written
-    return size;
+    return written;
 
 }
 
+utilbuf::ring_idx_t AF_SerialInterface::reserve(utilbuf::span spans[2]) {
+    return _tx->reserve(spans);
+}
+
+void AF_SerialInterface::commit(utilbuf::ring_idx_t n) {
+    if (n == 0) return;
+    _tx->commit(n);
+    // start (or keep) the data register empty interrupt draining the buffer
+    *_ucsrb |= (1 << _udre);
+}
+
 // setup serial interfaces, based on the hardware
 
 // define the stream buffer size in bytes
@@ -92,7 +134,15 @@ size_t AF_SerialInterface::write(const uint8_t* bytes, size_t size) {
 #else
     #define SERIAL_RX_BUF_SIZE 128
     // todo: is this too much? with 4 serial ports opened, that's 512 bytes of RAM used by serial buffers...
-    // we can run some experiments to see how many bytes are being dropped (utilbuf::bytes_dropped)
+    // we can run some experiments to see how many bytes are being dropped and how full the buffers
+    // get (ring_buffer::dropped() and ring_buffer::high_water() on each port)
+#endif
+
+// outbound bytes are queued and sent by the data register empty interrupt
+#if (RAMEND < 1000)
+    #define SERIAL_TX_BUF_SIZE 32
+#else
+    #define SERIAL_TX_BUF_SIZE 64
 #endif
 
 namespace AF_HAL {
@@ -102,46 +152,63 @@ namespace AF_HAL {
         using namespace utilbuf;
 
 #if defined(EN_SERIAL_INTERFACE_0) && defined(UBRRH) && defined(UBRRL) && defined(USART_RX_vect) && defined(UDR)
-        static uint8_t serial_rx_buf_0[SERIAL_RX_BUF_SIZE] = { .size = SERIAL_RX_BUF_SIZE };
-        static AF_SerialInterface SerialInterface0(&serial_rx_buf_0, &UBRRH, &UBRRL, &UCSRA, &UCSRB, &UDR, RXEN, TXEN, RXCIE, UDRE, U2X);
+        static static_ring_buffer<SERIAL_RX_BUF_SIZE> serial_rx_buf_0;
+        static static_ring_buffer<SERIAL_TX_BUF_SIZE> serial_tx_buf_0;
+        static AF_SerialInterface SerialInterface0(&serial_rx_buf_0, &serial_tx_buf_0, &UBRRH, &UBRRL, &UCSRA, &UCSRB, &UCSRC, &UDR, RXEN, TXEN, RXCIE, UDRE, U2X);
         SIGNAL(USART_RX_vect) {
-            uint8_t c = UDR;
-            bufferput(c, &serial_rx_buf_0);
+            serial_rx_buf_0.put(UDR);
+        }
+        SIGNAL(USART_UDRE_vect) {
+            SerialInterface0._tx_udr_empty_irq();
         }
 #elif defined(EN_SERIAL_INTERFACE_0) && defined(UBRR0H) && defined(UBRR0L) && defined(USART_RX_vect) && defined(UDR0)
-        static stream_buffer serial_rx_buf_0 = { .size = SERIAL_RX_BUF_SIZE };
-        static AF_SerialInterface SerialInterface0(&serial_rx_buf_0, &UBRR0H, &UBRR0L, &UCSR0A, &UCSR0B, &UDR0, RXEN0, TXEN0, RXCIE0, UDRE0, U2X0);
+        static static_ring_buffer<SERIAL_RX_BUF_SIZE> serial_rx_buf_0;
+        static static_ring_buffer<SERIAL_TX_BUF_SIZE> serial_tx_buf_0;
+        static AF_SerialInterface SerialInterface0(&serial_rx_buf_0, &serial_tx_buf_0, &UBRR0H, &UBRR0L, &UCSR0A, &UCSR0B, &UCSR0C, &UDR0, RXEN0, TXEN0, RXCIE0, UDRE0, U2X0);
         SIGNAL(USART_RX_vect) {
-            uint8_t c = UDR0;
-            bufferput(c, &serial_rx_buf_0);
+            serial_rx_buf_0.put(UDR0);
+        }
+        SIGNAL(USART_UDRE_vect) {
+            SerialInterface0._tx_udr_empty_irq();
         }
 #else
     #error "AutoFlight does not support this hardware (at least 1 serial interface is required)"
 #endif
-#if defined(EN_SERIAL_INTERFACE_1) && defined(UBRR1H) && defined(UBRR1L) && defined(USART2_RX_vect) && defined(UDR2)
-        static uint8_t serial_rx_buf_1[SERIAL_RX_BUF_SIZE] = { .size = SERIAL_RX_BUF_SIZE };
-        static AF_SerialInterface SerialInterface1(&serial_rx_buf_1, &UBRR1H, &UBRR1L, &UCSR1A, &UCSR1B, &UDR1, RXEN1, TXEN1, RXCIE1, UDRE1, U2X1);
-        SIGNAL(USART2_RX_vect) {
-            uint8_t c = UDR1;
-            bufferput(c, &serial_rx_buf_1);
+#if defined(EN_SERIAL_INTERFACE_1) && defined(UBRR1H) && defined(UBRR1L) && defined(USART1_RX_vect) && defined(UDR1)
+        static static_ring_buffer<SERIAL_RX_BUF_SIZE> serial_rx_buf_1;
+        static static_ring_buffer<SERIAL_TX_BUF_SIZE> serial_tx_buf_1;
+        static AF_SerialInterface SerialInterface1(&serial_rx_buf_1, &serial_tx_buf_1, &UBRR1H, &UBRR1L, &UCSR1A, &UCSR1B, &UCSR1C, &UDR1, RXEN1, TXEN1, RXCIE1, UDRE1, U2X1);
+        SIGNAL(USART1_RX_vect) {
+            serial_rx_buf_1.put(UDR1);
+        }
+        SIGNAL(USART1_UDRE_vect) {
+            SerialInterface1._tx_udr_empty_irq();
         }
 #endif
-#if defined(EN_SERIAL_INTERFACE_2) && defined(UBRR2H) && defined(UBRR2L) && defined(USART3_RX_vect) && defined(UDR2)
-        static uint8_t serial_rx_buf_2[SERIAL_RX_BUF_SIZE] = { .size = SERIAL_RX_BUF_SIZE };
-        static AF_SerialInterface SerialInterface2(&serial_rx_buf_2, &UBRR2H, &UBRR2L, &UCSR2A, &UCSR2B, &UDR2, RXEN2, TXEN2, RXCIE2, UDRE2, U2X2);
-        SIGNAL(USART3_RX_vect) {
-            uint8_t c = UDR2;
-            bufferput(c, &serial_rx_buf_2);
+#if defined(EN_SERIAL_INTERFACE_2) && defined(UBRR2H) && defined(UBRR2L) && defined(USART2_RX_vect) && defined(UDR2)
+        static static_ring_buffer<SERIAL_RX_BUF_SIZE> serial_rx_buf_2;
+        static static_ring_buffer<SERIAL_TX_BUF_SIZE> serial_tx_buf_2;
+        static AF_SerialInterface SerialInterface2(&serial_rx_buf_2, &serial_tx_buf_2, &UBRR2H, &UBRR2L, &UCSR2A, &UCSR2B, &UCSR2C, &UDR2, RXEN2, TXEN2, RXCIE2, UDRE2, U2X2);
+        SIGNAL(USART2_RX_vect) {
+            serial_rx_buf_2.put(UDR2);
+        }
+        SIGNAL(USART2_UDRE_vect) {
+            SerialInterface2._tx_udr_empty_irq();
         }
 #endif
-#if defined(EN_SERIAL_INTERFACE_3) && defined(UBRR3H) && defined(UBRR3L) && defined(USART4_RX_vect) && defined(UDR3)
-        static uint8_t serial_rx_buf_3[SERIAL_RX_BUF_SIZE] = { .size = SERIAL_RX_BUF_SIZE };
-        static AF_SerialInterface SerialInterface3(&serial_rx_buf_3, &UBRR3H, &UBRR3L, &UCSR3A, &UCSR3B, &UDR3, RXEN3, TXEN3, RXCIE3, UDRE3, U2X3);
+#if defined(EN_SERIAL_INTERFACE_3) && defined(UBRR3H) && defined(UBRR3L) && defined(USART3_RX_vect) && defined(UDR3)
+        static static_ring_buffer<SERIAL_RX_BUF_SIZE> serial_rx_buf_3;
+        static static_ring_buffer<SERIAL_TX_BUF_SIZE> serial_tx_buf_3;
+        static AF_SerialInterface SerialInterface3(&serial_rx_buf_3, &serial_tx_buf_3, &UBRR3H, &UBRR3L, &UCSR3A, &UCSR3B, &UCSR3C, &UDR3, RXEN3, TXEN3, RXCIE3, UDRE3, U2X3);
         SIGNAL(USART3_RX_vect) {
-            uint8_t c = UDR3;
-            bufferput(c, &serial_rx_buf_3);
+            serial_rx_buf_3.put(UDR3);
+        }
+        SIGNAL(USART3_UDRE_vect) {
+            SerialInterface3._tx_udr_empty_irq();
         }
 #endif
     } // namespace hwserial
 
-}   // namespace AF_HAL
\ No newline at end of file
+}   // namespace AF_HAL
+
+#endif // AF_SIMULATOR
@@ -2,14 +2,17 @@
 #define SERIAL_HAL_H_
 
 /// @file serial_hal.h
-/// @brief provides an interface for interfacing with hardware serial ports on AVR hardware
+/// @brief provides an interface for interfacing with hardware serial ports on AVR hardware,
+///        or with pseudo-terminals and unix sockets standing in for them on the simulator.
 
 #include <system.h>
 #include <util.h>
 #include <stdint.h>
 #include <stdlib.h>
+#if !defined(AF_SIMULATOR)
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#endif
 
 // temporary - enable serial interface 0
 #define EN_SERIAL_INTERFACE_0
@@ -23,6 +26,71 @@
 #define BAUDR_57600 57600
 #define BAUDR_115200 115200
 
+/// how long write() waits for room in the outbound buffer before it drops what's left, in
+/// microseconds. about 23 bytes at 115200 baud. reserve() and commit() never wait.
+#ifndef AF_SERIAL_WRITE_TIMEOUT_US
+#define AF_SERIAL_WRITE_TIMEOUT_US 2000
+#endif
+
+// frame formats, as written to the control and status register C
+#define SERIAL_8N1 0x06 // 8 data bits, no parity, 1 stop bit
+#define SERIAL_8E2 0x2E // 8 data bits, even parity, 2 stop bits (SBUS)
+
+#if defined(AF_SIMULATOR)
+
+/// @brief a class standing in for a hardware serial port on the simulator. the port is
+///        backed by a pseudo-terminal, or by a unix socket when the environment variable
+///        AF_SIM_SERIAL<n> is set to "unix:<path>".
+class AF_SerialInterface: public Stream {
+
+    private:
+        utilbuf::ring_buffer* _tx; // outbound bytes, drained into the host file descriptor
+        uint8_t _port;             // the port number, used to name the pty link or socket
+        int _fd;                   // the connected file descriptor, or -1
+        int _listen_fd;            // the listening unix socket, or -1 for a pty
+
+    public:
+
+        /// @brief creates a simulated serial interface
+        /// @param buffer the buffer to use for the stream
+        /// @param tx_buffer the buffer to queue outbound bytes in
+        /// @param port the port number, i.e. 0 for SerialInterface0
+        AF_SerialInterface(utilbuf::ring_buffer* buffer, utilbuf::ring_buffer* tx_buffer, uint8_t port);
+
+        /// @brief see close()
+        ~AF_SerialInterface();
+
+        /// @brief opens the pty or unix socket backing the interface. the pty is linked
+        ///        at /tmp/autoflight-serial<n>. the baud rate and frame format are ignored.
+        /// @param baud_rate the baud rate to use
+        /// @param config the frame format, i.e. SERIAL_8N1
+        void open(uint32_t baud_rate, uint8_t config = SERIAL_8N1);
+
+        /// @brief closes the interface and clears the stream buffer
+        /// @return the number of bytes cleared from the stream buffer
+        size_t close(void);
+
+        /// @brief queues a byte to be sent, waiting up to AF_SERIAL_WRITE_TIMEOUT_US for space
+        ///        if the outbound buffer is full
+        virtual size_t write(uint8_t byte);
+        /// @brief queues bytes to be sent, waiting up to AF_SERIAL_WRITE_TIMEOUT_US for space
+        ///        if the outbound buffer is full. what doesn't fit by then is dropped.
+        virtual size_t write(const uint8_t* bytes, size_t size);
+
+        virtual utilbuf::ring_idx_t reserve(utilbuf::span spans[2]);
+        virtual void commit(utilbuf::ring_idx_t n);
+
+        /// @brief gets the number of bytes waiting to be sent
+        utilbuf::ring_idx_t tx_pending(void) const { return _tx->available(); }
+
+        /// @brief moves bytes between the host file descriptor and the stream buffers.
+        ///        called by the simulator HAL, stands in for the RX and UDRE ISRs.
+        void _poll(void);
+
+};
+
+#else
+
 /// @brief a class for interfacing with hardware serial ports on AVR hardware
 class AF_SerialInterface: public Stream {
 
@@ -31,30 +99,34 @@ class AF_SerialInterface: public Stream {
         volatile uint8_t* _ubrrl; // pointer to the baud rate register low byte
         volatile uint8_t* _ucsra; // pointer to the control and status register A
         volatile uint8_t* _ucsrb; // pointer to the control and status register B
+        volatile uint8_t* _ucsrc; // pointer to the control and status register C
         volatile uint8_t* _udr;   // pointer to the data register
         uint8_t _rxen;            // the bit to enable the receiver
         uint8_t _txen;            // the bit to enable the transmitter
         uint8_t _rxcie;           // the bit to enable the receive complete interrupt
         uint8_t _udre;            // the bit to enable the data register empty interrupt
         uint8_t _u2x;             // the bit to enable double speed mode
+        utilbuf::ring_buffer* _tx; // outbound bytes, drained by the data register empty interrupt
 
     public:
     
         /// @brief opens a serial interface on the specified pins at the specified baud rate
         /// @param buffer the buffer to use for the stream
+        /// @param tx_buffer the buffer to queue outbound bytes in
         /// @param ubrrh the pointer to the baud rate register high byte
         /// @param ubrrl the pointer to the baud rate register low byte
         /// @param ucsra the pointer to the control and status register A
         /// @param ucsrb the pointer to the control and status register B
+        /// @param ucsrc the pointer to the control and status register C
         /// @param udr the pointer to the data register
         /// @param rxen the bit to enable the receiver
         /// @param txen the bit to enable the transmitter
         /// @param rxcie the bit to enable the receive complete interrupt
         /// @param udre the bit to enable the data register empty interrupt
         /// @param u2x the bit to enable double speed mode
-        AF_SerialInterface(utilbuf::stream_buffer* buffer,
+        AF_SerialInterface(utilbuf::ring_buffer* buffer, utilbuf::ring_buffer* tx_buffer,
                            volatile uint8_t* ubrrh, volatile uint8_t* ubrrl,
-                           volatile uint8_t* ucsra, volatile uint8_t* ucsrb,
+                           volatile uint8_t* ucsra, volatile uint8_t* ucsrb, volatile uint8_t* ucsrc,
                            volatile uint8_t* udr,
                            uint8_t rxen, uint8_t txen, uint8_t rxcie, uint8_t udre, uint8_t u2x);
 
@@ -63,23 +135,54 @@ class AF_SerialInterface: public Stream {
 
         /// @brief opens the serial interface at the specified baud rate
         /// @param baud_rate the baud rate to use
-        void open(uint32_t baud_rate);
+        /// @param config the frame format, i.e. SERIAL_8N1
+        void open(uint32_t baud_rate, uint8_t config = SERIAL_8N1);
 
         /// @brief closes the serial interface, releases the pins, and clears the stream buffer
         /// @return the number of bytes cleared from the stream buffer
         size_t close(void);
 
+        /// @brief queues a byte to be sent, waiting up to AF_SERIAL_WRITE_TIMEOUT_US for space
+        ///        if the outbound buffer is full
         virtual size_t write(uint8_t byte);
+        /// @brief queues bytes to be sent, waiting up to AF_SERIAL_WRITE_TIMEOUT_US for space
+        ///        if the outbound buffer is full. what doesn't fit by then is dropped.
         virtual size_t write(const uint8_t* bytes, size_t size); 
 
+        virtual utilbuf::ring_idx_t reserve(utilbuf::span spans[2]);
+        virtual void commit(utilbuf::ring_idx_t n);
+
+        /// @brief gets the number of bytes waiting to be sent
+        utilbuf::ring_idx_t tx_pending(void) const { return _tx->available(); }
+
+        /// @brief moves the next outbound byte into the data register.
+        ///        called from the data register empty ISR only.
+        inline void _tx_udr_empty_irq(void) {
+            uint8_t c;
+            if (_tx->get(c)) {
+                *_udr = c;
+            } else {
+                // nothing left to send, so stop the interrupt until the next commit
+                *_ucsrb &= ~(1 << _udre);
+            }
+        }
            
 };
 
+#endif // AF_SIMULATOR
+
 namespace AF_HAL {
 
 /// @brief namespace containing hardware serial interfaces for interacting with the serial ports on the AVR hardware
 namespace hwserial {
 
+#if defined(AF_SIMULATOR)
+    // the simulator always provides all four interfaces
+    extern AF_SerialInterface SerialInterface0;
+    extern AF_SerialInterface SerialInterface1;
+    extern AF_SerialInterface SerialInterface2;
+    extern AF_SerialInterface SerialInterface3;
+#else
 #if defined(EN_SERIAL_INTERFACE_0) && (defined(UBRRH) || defined(UBRR0H))
     extern AF_SerialInterface SerialInterface0;
 #endif
@@ -92,6 +195,7 @@ namespace hwserial {
 #if defined(EN_SERIAL_INTERFACE_3) && defined(UBRR3H)
     extern AF_SerialInterface SerialInterface3;
 #endif
+#endif // AF_SIMULATOR
 
 }
 
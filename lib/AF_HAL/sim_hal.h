@@ -0,0 +1,554 @@
+#ifndef AF_HAL_SIM_HAL_H_
+#define AF_HAL_SIM_HAL_H_
+
+/// @file   sim_hal.h
+/// @brief  provides an interface to the host (Linux) hardware abstraction layer used
+///         by the simulator target, such as the virtual clock and the sensor/physics model.
+/// @note   only available when building with AF_SIMULATOR defined.
+
+#if defined(AF_SIMULATOR)
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace utilbuf {
+    class ring_buffer;
+    struct span;
+}
+
+/// the number of virtual analog input channels
+#define AF_SIM_ADC_CHANNELS     16
+/// the number of virtual pwm output channels
+#define AF_SIM_PWM_CHANNELS     12
+/// the default period of the sensor/physics model, in microseconds
+#define AF_SIM_DEFAULT_MODEL_PERIOD_US  1000U
+/// how long the simulated ADC sequencer takes per conversion, matching the AVR at prescaler 128
+#define AF_SIM_ADC_CONVERSION_US        104U
+/// the most devices on the mock TWI bus
+#define AF_SIM_TWI_MAX_DEVICES          8
+/// how long the SPI link stand-in takes per byte, matching the AVR master at 1 MHz with its turnaround
+#define AF_SIM_SPI_BYTE_US              12U
+/// the most controllers the lockstep harness runs, matching AF_LOCKSTEP_MAX_NODES
+#define AF_SIM_LOCKSTEP_MAX_NODES       3
+/// how far the farm runs a vehicle before letting its worker pick again, in microseconds
+#define AF_SIM_FARM_SLICE_US            100000UL
+
+namespace AF_HAL {
+
+/// @brief namespace containing controls for the host simulator
+namespace sim {
+
+    /// @brief plugin interface for sensor/physics models. the simulator hands the model
+    ///        the latest pwm outputs and the model fills in the analog inputs.
+    class AF_Sim_Model {
+
+        public:
+
+            virtual ~AF_Sim_Model() {}
+
+            /// @brief advances the model by one step
+            /// @param now_us   the simulator clock, in microseconds
+            /// @param dt_us    time since the last step, in microseconds
+            /// @param pwm      the pwm outputs, AF_SIM_PWM_CHANNELS pulse widths in microseconds
+            ///                 (0 for disabled channels), see pwm_hal.h
+            /// @param adc      the analog inputs to update, AF_SIM_ADC_CHANNELS values in 0-1023
+            virtual void update(uint32_t now_us, uint32_t dt_us, const uint16_t* pwm, uint16_t* adc) = 0;
+
+    };
+
+    /// @brief plugin interface for devices on the mock TWI bus. the mock bus runs the real
+    ///        transaction engine in twi_hal.cpp, one bus event at a time on the simulator clock.
+    class AF_Sim_TWI_Device {
+
+        public:
+
+            virtual ~AF_Sim_TWI_Device() {}
+
+            /// @brief gets the 7-bit address the device answers to
+            virtual uint8_t get_address(void) const = 0;
+
+            /// @brief gets how long the device stretches the clock on each byte, in microseconds
+            virtual uint16_t get_latency_us(void) const { return 0; }
+
+            /// @brief the master addressed the device
+            /// @param read whether the master wants to read
+            /// @return true to acknowledge, false to NACK
+            virtual bool on_start(bool read) { (void)read; return true; }
+
+            /// @brief the master wrote a byte
+            /// @return true to acknowledge, false to NACK
+            virtual bool on_write(uint8_t byte) = 0;
+
+            /// @brief the master wants a byte
+            virtual uint8_t on_read(void) = 0;
+
+    };
+
+    /// @brief a mock device with 256 registers and an auto-incrementing register pointer,
+    ///        like most I2C sensors. the first byte written after a start selects the register.
+    ///        override on_read() to model FIFO registers and the like.
+    class AF_Sim_TWI_Register_Device: public AF_Sim_TWI_Device {
+
+        public:
+
+            /// @param address    the 7-bit address
+            /// @param latency_us how long the device stretches the clock on each byte
+            AF_Sim_TWI_Register_Device(uint8_t address, uint16_t latency_us = 0) : _address(address), _latency_us(latency_us) {}
+
+            virtual uint8_t get_address(void) const { return _address; }
+            virtual uint16_t get_latency_us(void) const { return _latency_us; }
+
+            virtual bool on_start(bool read) {
+                _select = !read;
+                return true;
+            }
+
+            virtual bool on_write(uint8_t byte) {
+                if (_select) {
+                    _pointer = byte;
+                    _select = false;
+                } else {
+                    regs[_pointer++] = byte;
+                }
+                return true;
+            }
+
+            virtual uint8_t on_read(void) { return regs[_pointer++]; }
+
+            /// the register file, for the harness to fill in and check
+            uint8_t regs[256] = {};
+
+        protected:
+
+            /// the 7-bit address
+            uint8_t _address;
+            /// the clock stretch per byte, in microseconds
+            uint16_t _latency_us;
+            /// the register the next read or write goes to
+            uint8_t _pointer = 0;
+            /// whether the next written byte selects the register
+            bool _select = false;
+
+    };
+
+    /// @brief faults the mock TWI bus can inject into its next bus event
+    enum AF_Sim_TWI_Fault {
+        /// the event reports a bus error
+        AF_SIM_TWI_FAULT_BUS_ERROR = 0,
+        /// the event never finishes, like a device holding SCL low
+        AF_SIM_TWI_FAULT_HANG
+    };
+
+    /// @brief plugin interface for the other end of the SPI link, when the firmware is the
+    ///        master. without a peer the link is looped back, MOSI straight to MISO.
+    class AF_Sim_SPI_Peer {
+
+        public:
+
+            virtual ~AF_Sim_SPI_Peer() {}
+
+            /// @brief the master selected or released the peer
+            virtual void on_select(bool selected) { (void)selected; }
+
+            /// @brief the master shifted a byte
+            /// @param mosi the byte the master sent
+            /// @return the byte the peer sent back at the same time
+            virtual uint8_t on_byte(uint8_t mosi) = 0;
+
+    };
+
+    /// @brief faults the lockstep harness can inject into a controller, see lockstep_run()
+    enum AF_Sim_Lockstep_Fault_Kind {
+        /// the controller computes a wrong output, like a flipped bit in a register
+        AF_SIM_LOCKSTEP_CORRUPT = 0,
+        /// the controller's digests never reach the others, like a dead chip or a cut link
+        AF_SIM_LOCKSTEP_SILENT,
+        /// the controller's digests arrive after the control period is up
+        AF_SIM_LOCKSTEP_LATE
+    };
+
+    /// @brief a fault injected into one controller for a range of ticks
+    struct AF_Sim_Lockstep_Fault {
+        /// the controller
+        uint8_t node;
+        /// the first tick of the fault
+        uint32_t from_tick;
+        /// the last tick of the fault
+        uint32_t to_tick;
+        AF_Sim_Lockstep_Fault_Kind kind;
+    };
+
+    /// @brief what the lockstep harness measured
+    struct AF_Sim_Lockstep_Report {
+        /// the most ticks from a fault starting until every healthy controller masked the
+        /// faulty one, 0 being within the tick the fault started
+        uint32_t detect_ticks_max;
+        /// faults that weren't masked before they ended
+        uint16_t undetected;
+        /// controller ticks whose outputs came from a controller computing wrong outputs
+        uint32_t bad_output_ticks;
+        /// the longest and average time from a controller submitting its digest to voting
+        /// with every digest in, in microseconds
+        uint32_t vote_us_max;
+        uint32_t vote_us_avg;
+        /// votes that waited out the control period for a missing digest
+        uint32_t vote_timeouts;
+        /// votes without a majority, summed over the controllers
+        uint32_t disagreements;
+        /// the bytes each controller sends per tick, framed
+        uint16_t link_bytes_per_tick;
+        /// the bytes each controller sends per second at the control period
+        uint32_t link_bytes_per_s;
+    };
+
+    /// @brief the control tasks the lockstep harness runs on every controller
+    /// @param tick    the control tick, the only input, so every controller sees the same one
+    /// @param outputs where to store the outputs, up to AF_SIM_PWM_CHANNELS
+    /// @return the number of outputs
+    typedef uint8_t (*af_sim_lockstep_control_t)(uint32_t tick, uint16_t* outputs);
+
+    /// @brief runs controllers in lockstep (see AF_Lockstep.h) as host threads, one each,
+    ///        with digests going between them as real frames, and injects faults. ticks start
+    ///        together on every controller and run back to back rather than on the control
+    ///        period, which only sets how long a vote waits for a missing digest.
+    /// @param nodes      how many controllers, 2 or 3
+    /// @param control    the control tasks
+    /// @param ticks      how many ticks to run
+    /// @param period_us  the control period, in microseconds
+    /// @param faults     the faults to inject
+    /// @param count      the number of faults
+    /// @param report     filled in with what was measured
+    void lockstep_run(uint8_t nodes, af_sim_lockstep_control_t control, uint32_t ticks, uint32_t period_us,
+                      const AF_Sim_Lockstep_Fault* faults, uint8_t count, AF_Sim_Lockstep_Report& report);
+
+    /// @brief a processor in the time sync harness, see timesync_run()
+    struct AF_Sim_TimeSync_Node {
+        /// how much faster its clock runs than true time, in ppm
+        int32_t skew_ppm;
+        /// its clock when true time is 0, in microseconds
+        uint32_t start_us;
+    };
+
+    /// @brief the link between the master and each client in the time sync harness
+    struct AF_Sim_TimeSync_Link {
+        /// the shortest time a payload takes to cross the link, in microseconds
+        uint32_t delay_us;
+        /// a payload can take up to this much longer, picked at random in each direction, in microseconds
+        uint32_t jitter_us;
+        /// in how many exchanges out of 100 a payload waits behind a full frame queue
+        uint8_t queued_pct;
+        /// how much longer a payload waits when it's queued, in microseconds
+        uint32_t queued_us;
+    };
+
+    /// @brief what the time sync harness measured, over every client from its first sync
+    struct AF_Sim_TimeSync_Report {
+        /// the largest and rms difference between a client's shared clock and the master's
+        uint32_t max_error_us;
+        uint32_t rms_error_us;
+        /// the largest difference once a client has been synced for 20 s
+        uint32_t settled_error_us;
+        /// the largest bound a client reported, see AF_TimeSync::get_error_us()
+        uint32_t max_bound_us;
+        /// checks where the difference was over the bound the client reported
+        uint32_t bound_violations;
+        /// checks made
+        uint32_t checks;
+        /// the largest difference between a client's drift estimate and its true drift, in ppb
+        uint32_t max_drift_error_ppb;
+        /// how long the slowest client took to first sync, in microseconds of true time
+        uint32_t sync_us;
+    };
+
+    /// @brief runs a master and clients (see AF_TimeSync.h) on skewed virtual clocks, exchanging
+    ///        payloads over links with random delays, and compares every client's shared clock
+    ///        with the master's every millisecond of true time
+    /// @param master   the master's clock
+    /// @param clients  the clients' clocks
+    /// @param count    the number of clients
+    /// @param link     the link between the master and each client
+    /// @param duration_us how long to run, in microseconds of true time
+    /// @param seed     seeds the random delays, so a run can be repeated
+    /// @param report   filled in with what was measured
+    void timesync_run(const AF_Sim_TimeSync_Node& master, const AF_Sim_TimeSync_Node* clients, uint8_t count,
+                      const AF_Sim_TimeSync_Link& link, uint32_t duration_us, uint32_t seed, AF_Sim_TimeSync_Report& report);
+
+    /// @brief how the simulator clock advances
+    enum AF_Sim_Clock_Mode {
+        /// micros() follows the host's monotonic clock
+        AF_SIM_CLOCK_REALTIME = 0,
+        /// micros() follows a virtual clock, which runs as fast as the host can go
+        AF_SIM_CLOCK_VIRTUAL
+    };
+
+    /// @brief selects how the simulator clock advances
+    /// @param mode         the clock mode
+    /// @param us_per_call  in virtual mode, how far each call to micros() advances the clock.
+    ///                     this stands in for the time the firmware spent between calls,
+    ///                     so polling loops like the scheduler always make progress.
+    void set_clock_mode(AF_Sim_Clock_Mode mode, uint16_t us_per_call = 1);
+
+    /// @brief gets the current clock mode
+    AF_Sim_Clock_Mode get_clock_mode(void);
+
+    /// @brief advances the virtual clock, running the model for any steps that fall due.
+    ///        has no effect in realtime mode.
+    /// @param us how far to advance the clock, in microseconds
+    void advance(uint32_t us);
+
+    /// @brief installs a sensor/physics model, replacing any previous model
+    /// @param model     the model, or nullptr to leave the analog inputs alone
+    /// @param period_us how often the model is stepped, in simulator microseconds
+    void set_model(AF_Sim_Model* model, uint32_t period_us = AF_SIM_DEFAULT_MODEL_PERIOD_US);
+
+    /// @brief services the simulator: moves serial data and steps the model if it's due.
+    ///        called from micros(), so the firmware never needs to call it directly.
+    void poll(void);
+
+    /// @brief gets the pulse width last latched on a pwm channel, in microseconds
+    uint16_t get_pwm(uint8_t channel);
+
+    /// @brief sets an analog input, for harnesses without a model
+    void set_adc(uint8_t channel, uint16_t value);
+
+    /// @brief drives the level seen on an input pin
+    /// @param port_idx the port index of the pin, i.e. AF_PORT_IDX_B or AF_Pin<...>::port_t::idx
+    /// @param bit      the bit of the pin in the port
+    /// @param level    the level to drive
+    void set_pin_input(uint8_t port_idx, uint8_t bit, bool level);
+
+    /// @brief adds uniform noise of +/- lsb counts to every conversion made by the
+    ///        ADC sequencer stand-in, to exercise oversampling
+    void set_adc_noise(uint8_t lsb);
+
+    /// @brief gets the number of model steps that have run
+    uint32_t get_model_steps(void);
+
+    /// @brief connects a device to the mock TWI bus
+    /// @return true if it was connected, false if the bus is full or the address is taken
+    bool twi_attach(AF_Sim_TWI_Device* device);
+
+    /// @brief disconnects a device from the mock TWI bus
+    void twi_detach(AF_Sim_TWI_Device* device);
+
+    /// @brief makes the next event on the mock TWI bus fail, to exercise recovery
+    void twi_inject_fault(AF_Sim_TWI_Fault fault);
+
+    /// @brief connects the other end of the SPI link, see AF_Sim_SPI_Peer
+    /// @param peer the peer, or nullptr to loop the link back
+    void spi_set_peer(AF_Sim_SPI_Peer* peer);
+
+    /// @brief clocks one frame through the SPI link as its master would, when the firmware
+    ///        is the slave. the whole frame moves at once.
+    /// @param mosi the bytes to send to the firmware
+    /// @param miso where to store the bytes the firmware sent back
+    /// @param len  the number of bytes
+    void spi_clock_frame(const uint8_t* mosi, uint8_t* miso, uint8_t len);
+
+    /// @brief queues PPM edges as if they'd been captured, see rcin_hal.h. SBUS receivers
+    ///        are fed through the serial port's pty or socket instead.
+    /// @param widths_us the times between rising edges, in microseconds
+    /// @param n         the number of widths
+    void feed_ppm(const uint16_t* widths_us, uint8_t n);
+
+    /// @brief a simulated board: the clock, model, analog inputs, pwm outputs (and the pwm
+    ///        engine driving them) and EEPROM that the functions above work on. each vehicle
+    ///        context has its own (see AF_Context.h), code outside any context runs on the
+    ///        process's board. the serial ports are only serviced on the process's board.
+    struct AF_Sim_Board;
+
+    /// @brief makes a board, on a virtual clock at 0
+    AF_Sim_Board* board_create(void);
+
+    /// @brief destroys a board made with board_create()
+    void board_destroy(AF_Sim_Board* board);
+
+    /// @brief moves the calling thread onto a board. AF_Context_Scope does this, so harnesses
+    ///        don't have to.
+    /// @param board the board, or nullptr for the process's
+    /// @return the board the thread was on
+    AF_Sim_Board* board_enter(AF_Sim_Board* board);
+
+    /// @brief a tuning variant for the farm to fly, see farm_run()
+    struct AF_Sim_Farm_Variant {
+        /// the controller gains
+        float kp;
+        float ki;
+        float kd;
+        /// sensor noise, up to +/- this many counts on each analog input
+        uint8_t noise_lsb;
+        /// the steady wind, and the most gusts add to it, in whatever units the vehicle's model takes
+        float wind;
+        float gust;
+        /// seeds the noise and the gusts, so a variant flies the same every time
+        uint32_t seed;
+    };
+
+    /// @brief a Monte Carlo batch: a grid of gains, each flown in conditions drawn at random
+    struct AF_Sim_Farm_Batch {
+        /// the range of each gain, swept in steps points from min to max
+        float kp_min, kp_max;
+        float ki_min, ki_max;
+        float kd_min, kd_max;
+        uint8_t steps;
+        /// how many times each set of gains is flown, each in different conditions
+        uint16_t trials;
+        /// the conditions are drawn up to these
+        uint8_t noise_lsb_max;
+        float wind_max;
+        float gust_max;
+        /// seeds the draws
+        uint32_t seed;
+    };
+
+    /// @brief a vehicle for the farm to fly. it's made, set up, scored and destroyed inside
+    ///        its own context, so everything it makes is the vehicle's own.
+    class AF_Sim_Farm_Vehicle {
+
+        public:
+
+            virtual ~AF_Sim_Farm_Vehicle() {}
+
+            /// @brief brings up the firmware for a variant: installs a model on the board,
+            ///        registers tasks with the scheduler
+            virtual void setup(const AF_Sim_Farm_Variant& variant) = 0;
+
+            /// @brief scores the flight, once it's over
+            /// @return how badly the variant flew, lower is better
+            virtual float score(void) = 0;
+
+    };
+
+    /// @brief makes a vehicle, in the context it will fly in
+    typedef AF_Sim_Farm_Vehicle* (*af_sim_farm_factory_t)(void);
+
+    /// @brief what the farm measured
+    struct AF_Sim_Farm_Report {
+        /// how many workers flew the variants
+        uint8_t threads;
+        /// slices a worker took from another worker's queue
+        uint32_t steals;
+        /// the time flown, summed over every vehicle, in seconds
+        double sim_s;
+        /// how long the farm took on the host, in seconds
+        double wall_s;
+        /// the variant that scored best, and its score
+        uint32_t best;
+        float best_score;
+    };
+
+    /// @brief fills in the variants for a Monte Carlo batch: every point on the grid of
+    ///        gains, each with trials random draws of the conditions
+    /// @param batch    the batch
+    /// @param variants where to store the variants
+    /// @param max      the most variants to store
+    /// @return the number of variants stored
+    uint32_t farm_batch(const AF_Sim_Farm_Batch& batch, AF_Sim_Farm_Variant* variants, uint32_t max);
+
+    /// @brief flies every variant in its own context, on a pool of worker threads. each
+    ///        vehicle runs on its board's virtual clock, a slice at a time, and a worker that
+    ///        runs out of vehicles takes them from the others. the scores only depend on the
+    ///        variants, not on the number of workers or the order they run in.
+    /// @param factory     makes the vehicle for each variant
+    /// @param variants    the variants
+    /// @param count       the number of variants
+    /// @param duration_us how long to fly each variant, in microseconds of its own clock
+    /// @param threads     how many workers, 0 for one per host core
+    /// @param scores      set to each variant's score
+    /// @param report      filled in with what was measured
+    void farm_run(af_sim_farm_factory_t factory, const AF_Sim_Farm_Variant* variants, uint32_t count,
+                  uint32_t duration_us, uint8_t threads, float* scores, AF_Sim_Farm_Report& report);
+
+    /// @brief what a replay found, see replay_start()
+    struct AF_Sim_Replay_Report {
+        /// the inputs fed from the log
+        uint32_t inputs;
+        /// the actuator commands that matched the log
+        uint32_t outputs;
+        /// the furthest a command came from when the log has it, in simulator microseconds.
+        /// commands that still match but come later mean the code got slower.
+        uint32_t skew_us_max;
+        /// whether a command didn't match the log. the replay stops at the first.
+        bool diverged;
+        /// the simulator clock at the command that didn't match, and when the log has it
+        uint32_t diverged_at_us;
+        uint32_t recorded_at_us;
+        /// the channels commanded and their pulse widths in microseconds, in the log and in
+        /// the replay. no channels in the replay means the command never came.
+        uint16_t expected_mask;
+        uint16_t expected[AF_SIM_PWM_CHANNELS];
+        uint16_t actual_mask;
+        uint16_t actual[AF_SIM_PWM_CHANNELS];
+        /// how much simulator time the log covers, in microseconds
+        uint32_t log_us;
+        /// how long the replay took on the host, in seconds
+        double wall_s;
+    };
+
+    /// @brief called once a replay is over, see replay_start()
+    typedef void (*af_sim_replay_done_t)(const AF_Sim_Replay_Report& report);
+
+    /// @brief records a blackbox log of the process's board: what the firmware gets in (the
+    ///        analog inputs and the bytes arriving on the serial ports, i.e. GCS commands) and
+    ///        what it commands (every pwm commit), each stamped with the simulator clock.
+    ///        start it before af_system::start(), so the clock's setup is in the log too.
+    ///
+    /// the log: "AFBB" and a version byte, then records of a kind byte, the clock (4 bytes)
+    /// and the kind's payload, all low byte first:
+    ///  - 0, the clock went virtual: how far each micros() call advances it (2 bytes)
+    ///  - 1, an analog input changed: the channel, the value (2 bytes)
+    ///  - 2, bytes arrived on a serial port: the port, the count, the bytes
+    ///  - 3, the pwm outputs were committed: the enabled channels (2 bytes), then the pulse
+    ///    width of each in microseconds (2 bytes each)
+    /// inputs are recorded as the simulator polls, which is when they reach the firmware.
+    /// the log is finished when the process exits, and up to its last whole record when it's
+    /// stopped with SIGINT (Ctrl-C) or SIGTERM, so record_stop() is only needed to end it early.
+    /// @param path the file to write
+    /// @return false if the file can't be written
+    bool record_start(const char* path);
+
+    /// @brief finishes the log
+    void record_stop(void);
+
+    /// @brief replays a blackbox log into the process's board: the clock runs as it did when
+    ///        it was recorded, the analog inputs and serial bytes arrive when they did, and
+    ///        every pwm commit is checked against the log's. start it before
+    ///        af_system::start(), and don't install a model. the firmware's own code runs
+    ///        unmodified, as fast as the host can go.
+    ///
+    /// a log recorded on the virtual clock replays bit for bit until the code changes, so a
+    /// divergence points at the first command the change altered. a log recorded in realtime
+    /// replays on a virtual clock, where tasks run at slightly different times, so it only
+    /// matches until a control task sees a different sample: record regression logs with
+    /// AF_SIM_CLOCK=virtual.
+    /// @param path the log
+    /// @param done called when the log runs out or a command doesn't match, after which the
+    ///             firmware runs on without inputs
+    /// @return false if the log can't be read
+    bool replay_start(const char* path, af_sim_replay_done_t done);
+
+    // --- hooks into the process's board for the blackbox, see replay.cpp ---
+
+    /// @brief the clock went virtual
+    void _blackbox_clock(uint16_t us_per_call, uint32_t now);
+    /// @brief when replaying, gets the clock the log was recorded on
+    /// @return true if replaying
+    bool _blackbox_replay_clock(uint64_t& now_us, uint16_t& us_per_call);
+    /// @brief records the analog inputs that changed, or feeds the inputs that are due
+    void _blackbox_poll(uint32_t now, uint16_t* adc);
+    /// @brief when replaying, feeds a serial port the bytes that are due and throws away
+    ///        what it sent
+    /// @return true if replaying, and the port has been serviced
+    bool _blackbox_serial(uint8_t port, utilbuf::ring_buffer* rx, utilbuf::ring_buffer* tx);
+    /// @brief records bytes that arrived on a serial port
+    void _blackbox_serial_in(uint8_t port, uint32_t now, const utilbuf::span* spans, uint16_t count);
+    /// @brief records or checks a pwm commit
+    void _blackbox_output(uint32_t now, uint16_t mask, const uint16_t* widths);
+
+}
+
+}
+
+#endif // AF_SIMULATOR
+
+#endif // AF_HAL_SIM_HAL_H_
@@ -0,0 +1,240 @@
+#include "AF_HAL.h"
+#include "spi_hal.h"
+#include <string.h>
+
+static_assert(AF_SPI_FRAME_LEN <= 255, "frame positions are kept in a byte");
+
+// frame layout, see spi_hal.h
+#define SPI_IDX_SYNC    0
+#define SPI_IDX_SEQ     1
+#define SPI_IDX_LEN     2
+#define SPI_IDX_PAYLOAD 3
+#define SPI_IDX_CRC     (AF_SPI_FRAME_LEN - 1)
+
+namespace AF_HAL {
+
+    namespace spi {
+
+        /// which end of the link this is
+        static AF_SPI_Role _role = AF_SPI_ROLE_MASTER;
+
+        /// outbound frames, the ISR shifts out the front one
+        static uint8_t _tx[2][AF_SPI_FRAME_LEN];
+        /// the outbound frame being shifted out
+        static volatile uint8_t _tx_front = 0;
+        /// whether the back outbound frame is ready to swap in at the next frame boundary
+        static volatile bool _tx_staged = false;
+        /// the sequence number of the last staged frame
+        static uint8_t _tx_seq = 0;
+
+        /// inbound frames, the ISR fills the back one
+        static uint8_t _rx[2][AF_SPI_FRAME_LEN];
+        /// the latest complete inbound frame
+        static volatile uint8_t _rx_front = 0;
+        /// inbound frames completed, rolls over
+        static volatile uint8_t _rx_count = 0;
+        /// the value of _rx_count when receive() last looked
+        static uint8_t _rx_seen = 0;
+        /// the sequence number of the last frame handed to receive()
+        static uint8_t _rx_last_seq = 0;
+        /// whether _rx_last_seq holds anything yet
+        static bool _rx_have_seq = false;
+
+        /// the position in the frame being shifted
+        static volatile uint8_t _pos = 0;
+        /// whether a frame is being shifted
+        static volatile bool _busy = false;
+        /// when the master started the frame being shifted, in cycles
+        static uint32_t _frame_start_cycles = 0;
+        /// how long the last frame took, in microseconds
+        static volatile uint16_t _frame_us = 0;
+
+        /// valid frames received
+        static uint16_t _frames_good = 0;
+        /// frames thrown away, counted by the ISR and by receive()
+        static volatile uint16_t _frames_bad = 0;
+        /// frames the other side sent that were never seen
+        static uint16_t _frames_lost = 0;
+
+        /// @brief CRC-8 (polynomial 0x07), computed by tasks only, never in the ISR
+        static uint8_t _crc8(const uint8_t* data, uint8_t len) {
+            uint8_t crc = 0;
+            for (uint8_t i = 0; i < len; i++) {
+                crc ^= data[i];
+                for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+            }
+            return crc;
+        }
+
+        /// @brief builds a frame around a payload
+        static void _build(uint8_t* frame, const uint8_t* payload, uint8_t len, uint8_t seq) {
+            frame[SPI_IDX_SYNC] = AF_SPI_SYNC;
+            frame[SPI_IDX_SEQ] = seq;
+            frame[SPI_IDX_LEN] = len;
+            if (len > 0) memcpy(frame + SPI_IDX_PAYLOAD, payload, len);
+            memset(frame + SPI_IDX_PAYLOAD + len, 0, AF_SPI_MAX_PAYLOAD - len);
+            frame[SPI_IDX_CRC] = _crc8(frame, SPI_IDX_CRC);
+        }
+
+        /// @brief swaps in the staged outbound frame, if there is one, and rewinds
+        /// @return the first byte of the outbound frame
+        static uint8_t _frame_start(void) {
+            if (_tx_staged) {
+                _tx_front ^= 1;
+                _tx_staged = false;
+            }
+            _pos = 0;
+            return _tx[_tx_front][0];
+        }
+
+        /// @brief publishes the inbound frame if it arrived whole. the CRC is left to receive().
+        static void _frame_end(void) {
+            if (_pos == AF_SPI_FRAME_LEN && _rx[_rx_front ^ 1][SPI_IDX_SYNC] == AF_SPI_SYNC) {
+                _rx_front ^= 1;
+                _rx_count++;
+            } else if (_pos > 0) {
+                _frames_bad++;
+            }
+        }
+
+        void init(AF_SPI_Role role) {
+            AF_ATOMIC_BLOCK {
+                _role = role;
+                _build(_tx[0], nullptr, 0, 0);
+                _build(_tx[1], nullptr, 0, 0);
+                _tx_front = 0;
+                _tx_staged = false;
+                _tx_seq = 0;
+                memset(_rx, 0, sizeof(_rx));
+                _rx_front = 0;
+                _rx_count = 0;
+                _rx_seen = 0;
+                _rx_have_seq = false;
+                _pos = 0;
+                _busy = false;
+                _hw_init(role);
+                // the slave has to have its first byte loaded before the master starts clocking
+                if (role == AF_SPI_ROLE_SLAVE) _hw_write(_frame_start());
+            }
+        }
+
+        bool send(const uint8_t* payload, uint8_t len) {
+            if (len > AF_SPI_MAX_PAYLOAD) return false;
+            // the ISR only swaps a staged frame in, so it leaves the back frame alone until this is set again
+            _tx_staged = false;
+            _build(_tx[_tx_front ^ 1], payload, len, ++_tx_seq);
+            _tx_staged = true;
+            return true;
+        }
+
+        bool receive(uint8_t* payload, uint8_t& len) {
+            uint8_t frame[AF_SPI_FRAME_LEN];
+            uint8_t count;
+
+            // copy the front frame, again if the ISR published another one meanwhile
+            do {
+                count = _rx_count;
+                memcpy(frame, _rx[_rx_front], AF_SPI_FRAME_LEN);
+            } while (count != _rx_count);
+
+            if (count == _rx_seen) return false;
+            _rx_seen = count;
+
+            if (frame[SPI_IDX_LEN] > AF_SPI_MAX_PAYLOAD || frame[SPI_IDX_CRC] != _crc8(frame, SPI_IDX_CRC)) {
+                AF_ATOMIC_BLOCK { _frames_bad++; }
+                return false;
+            }
+
+            // the other side sends its last frame again until it stages a new one
+            uint8_t seq = frame[SPI_IDX_SEQ];
+            if (_rx_have_seq) {
+                if (seq == _rx_last_seq) return false;
+                _frames_lost += (uint8_t)(seq - _rx_last_seq - 1);
+            }
+            _rx_last_seq = seq;
+            _rx_have_seq = true;
+
+            _frames_good++;
+            len = frame[SPI_IDX_LEN];
+            memcpy(payload, frame + SPI_IDX_PAYLOAD, len);
+            return true;
+        }
+
+        bool transfer(void) {
+            if (_role != AF_SPI_ROLE_MASTER) return false;
+
+            bool started = false;
+            AF_ATOMIC_BLOCK {
+                if (!_busy) {
+                    _busy = true;
+                    _frame_start_cycles = AF_HAL::cycles();
+                    uint8_t first = _frame_start();
+                    _hw_select(true);
+                    _hw_write(first);
+                    started = true;
+                }
+            }
+            return started;
+        }
+
+        bool is_busy(void) {
+            return _busy;
+        }
+
+        uint16_t get_frame_time_us(void) {
+            uint16_t frame_us;
+            AF_ATOMIC_BLOCK { frame_us = _frame_us; }
+            return frame_us;
+        }
+
+        uint16_t get_frames_good(void) {
+            return _frames_good;
+        }
+
+        uint16_t get_frames_bad(void) {
+            uint16_t bad;
+            AF_ATOMIC_BLOCK { bad = _frames_bad; }
+            return bad;
+        }
+
+        uint16_t get_frames_lost(void) {
+            return _frames_lost;
+        }
+
+        void _on_byte(uint8_t in) {
+            uint8_t pos = _pos;
+            if (pos < AF_SPI_FRAME_LEN) _rx[_rx_front ^ 1][pos++] = in;
+            _pos = pos;
+
+            if (_role == AF_SPI_ROLE_MASTER) {
+                if (pos < AF_SPI_FRAME_LEN) {
+                    _hw_write(_tx[_tx_front][pos]);
+                } else {
+                    _hw_select(false);
+                    _frame_end();
+                    _frame_us = (AF_HAL::cycles() - _frame_start_cycles) / AF_CYCLES_PER_US;
+                    _busy = false;
+                }
+            } else {
+                // past the end of the frame, send zeros until the master lets go
+                _hw_write(pos < AF_SPI_FRAME_LEN ? _tx[_tx_front][pos] : 0);
+            }
+        }
+
+        void _on_select(bool selected) {
+            if (_role != AF_SPI_ROLE_SLAVE) return;
+            if (selected) {
+                // the first byte was loaded when the last frame ended
+                _pos = 0;
+                _busy = true;
+            } else {
+                _frame_end();
+                _busy = false;
+                // load the next frame now, there's no time for it once the master selects us
+                _hw_write(_frame_start());
+            }
+        }
+
+    }
+
+}
@@ -0,0 +1,115 @@
+#ifndef AF_HAL_SPI_HAL_H_
+#define AF_HAL_SPI_HAL_H_
+
+/// @file   spi_hal.h
+/// @brief  provides a framed, interrupt-driven SPI link between two processors (i.e. a
+///         2560 flight controller and a 328P telemetry endpoint). every transfer swaps one
+///         fixed-size frame in each direction. frames are double buffered on both sides:
+///         tasks stage and read whole frames while the SPI ISR shifts the other buffer.
+///
+/// the master selects the slave with SS for each frame, and the slave uses the SS edges
+/// to find frame boundaries, so the link can't slip out of sync.
+///
+/// frame layout: sync, sequence number, payload length, AF_SPI_MAX_PAYLOAD payload bytes
+/// (unused bytes are zero), and a CRC-8 over everything before it.
+///
+/// link targets at the default clock (SCK = F_CPU / 16, 1 MHz):
+///  - one frame moves in each direction in under AF_SPI_TARGET_FRAME_US (measure it with
+///    get_frame_time_us() on the master)
+///  - AF_SPI_TARGET_RATE_HZ frames per second, about 7 kB/s of payload in each direction
+///  - a frame staged with send() can be read on the other side within one link period plus
+///    one frame time, 4.5 ms at the target rate. from the slave it can take one more period,
+///    because the slave loads its next frame as soon as the last one ends.
+///  - the ISRs cost about 200 us of cpu per frame on the master (where a timer interrupt
+///    holds each byte back a little so the slave's ISR can keep up, without waiting in the
+///    ISR) and 130 us on the slave, about 5% and 3% of the cpu at the target rate
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/// the length of a frame on the wire, in bytes
+#define AF_SPI_FRAME_LEN 32
+/// the most payload a frame can carry, in bytes
+#define AF_SPI_MAX_PAYLOAD (AF_SPI_FRAME_LEN - 4)
+/// the first byte of every frame
+#define AF_SPI_SYNC 0xA5
+/// how often the master should call transfer(), in Hz
+#define AF_SPI_TARGET_RATE_HZ 250
+/// the longest a frame should take on the wire, in microseconds
+#define AF_SPI_TARGET_FRAME_US 500
+
+/// @brief which end of the link this processor is
+enum AF_SPI_Role: uint8_t {
+    /// drives the clock and starts each transfer
+    AF_SPI_ROLE_MASTER = 0,
+    /// answers the master
+    AF_SPI_ROLE_SLAVE
+};
+
+namespace AF_HAL {
+
+/// @brief namespace containing the inter-processor SPI link
+namespace spi {
+
+    /// @brief sets up the SPI peripheral. both sides start out sending empty frames.
+    /// @param role whether this processor is the master or the slave
+    void init(AF_SPI_Role role);
+
+    /// @brief stages a frame to send. replaces any frame staged but not yet sent,
+    ///        so the other side always gets the latest state.
+    /// @param payload the payload
+    /// @param len     the length of the payload, up to AF_SPI_MAX_PAYLOAD
+    /// @return true if the frame was staged, false if it was too long
+    bool send(const uint8_t* payload, uint8_t len);
+
+    /// @brief copies the latest frame from the other side, if there's a new one
+    /// @param payload where to copy the payload, AF_SPI_MAX_PAYLOAD bytes
+    /// @param len     set to the length of the payload
+    /// @return true if a new, valid frame was copied, false otherwise
+    bool receive(uint8_t* payload, uint8_t& len);
+
+    /// @brief swaps one frame with the slave. master only, register as a scheduler task
+    ///        at AF_SPI_TARGET_RATE_HZ.
+    /// @return true if the transfer was started, false if one is still in progress
+    bool transfer(void);
+
+    /// @brief whether a frame is being transferred
+    bool is_busy(void);
+
+    /// @brief gets how long the last frame took on the wire, in microseconds. master only.
+    uint16_t get_frame_time_us(void);
+
+    /// @brief gets the number of valid frames received, rolls over to 0 safely
+    uint16_t get_frames_good(void);
+
+    /// @brief gets the number of frames thrown away (cut short, or failed the CRC), rolls over to 0 safely
+    uint16_t get_frames_bad(void);
+
+    /// @brief gets the number of frames the other side sent that were never seen, going by
+    ///        sequence numbers. rolls over to 0 safely.
+    uint16_t get_frames_lost(void);
+
+    /// @brief takes the byte that just finished and picks the next one.
+    ///        called from the SPI ISR (or the simulator's stand-in) only.
+    /// @param in the byte received
+    void _on_byte(uint8_t in);
+
+    /// @brief the master selected or released this slave.
+    ///        called from the SS pin change ISR (or the simulator's stand-in) only.
+    void _on_select(bool selected);
+
+    /// @brief enables the peripheral and its interrupt. implemented by the platform HAL.
+    void _hw_init(AF_SPI_Role role);
+
+    /// @brief drives SS to select or release the slave. master only, implemented by the platform HAL.
+    void _hw_select(bool selected);
+
+    /// @brief loads the next byte to shift. on the master this starts the byte, on the slave it
+    ///        waits for the master's clock. implemented by the platform HAL.
+    void _hw_write(uint8_t byte);
+
+}
+
+}
+
+#endif // AF_HAL_SPI_HAL_H_
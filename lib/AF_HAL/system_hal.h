@@ -6,6 +6,39 @@
 ///         rebooting the system, and reading the system clock.
 
 #include "AF_HAL.h"
+#include <stdint.h>
+
+#if defined(AF_SIMULATOR)
+/// the simulator has no separate flash address space
+#define AF_PROGMEM
+/// reads a byte from a table declared AF_PROGMEM
+#define AF_PGM_READ_BYTE(_addr) (*(const uint8_t*)(_addr))
+/// runs the following block with interrupts disabled. the simulator has no ISRs, but vehicle
+/// contexts (see AF_Context.h) run on several host threads, so the block holds a process-wide
+/// lock instead. it's recursive, like nesting ATOMIC_BLOCKs.
+#define AF_ATOMIC_BLOCK for (AF_HAL::_Atomic_Guard _af_atomic_guard; _af_atomic_guard.once(); )
+/// avr-libc's marker for functions that never return
+#ifndef __ATTR_NORETURN__
+#define __ATTR_NORETURN__ __attribute__((__noreturn__))
+#endif
+#else
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+/// places a constant table in flash instead of RAM
+#define AF_PROGMEM PROGMEM
+/// reads a byte from a table declared AF_PROGMEM
+#define AF_PGM_READ_BYTE(_addr) pgm_read_byte(_addr)
+/// runs the following block with interrupts disabled, restoring them afterwards
+#define AF_ATOMIC_BLOCK ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+
+#if defined(AF_SIMULATOR)
+/// cpu cycles per microsecond. the simulator counts cycles of a 16 MHz AVR.
+#define AF_CYCLES_PER_US 16
+#else
+/// cpu cycles per microsecond
+#define AF_CYCLES_PER_US (F_CPU / 1000000UL)
+#endif
 
 /// @brief  pin mode for an input
 #define IO_MODE_INPUT         0x00
@@ -20,16 +53,64 @@
 
 namespace AF_HAL {
 
+#if defined(AF_SIMULATOR)
+    /// @brief  takes and releases the lock behind AF_ATOMIC_BLOCK
+    void _atomic_enter(void);
+    void _atomic_exit(void);
+
+    /// @brief  holds the lock for one pass of an AF_ATOMIC_BLOCK, however the block is left
+    class _Atomic_Guard {
+        public:
+            _Atomic_Guard() { _atomic_enter(); }
+            ~_Atomic_Guard() { _atomic_exit(); }
+            /// @brief true the first time only
+            bool once(void) { bool first = _first; _first = false; return first; }
+        private:
+            bool _first = true;
+    };
+#endif
+
     /// @brief  initializes the avr system
     void init();
 
     /// @brief  resets the avr system
     void reset();
 
-    /// @brief  reads the system clock. heads up! this value rolls over in about 71 min.
+    /// @brief  reads the system clock. heads up! this value rolls over in about 71 min,
+    ///         so compare timestamps with time_reached() and time_diff_us(), never with < or <=.
     /// @return the system clock in microseconds
     uint32_t micros(void);
 
+    /// @brief  reads the full system clock, which doesn't roll over in practice
+    /// @return the system clock in microseconds
+    uint64_t micros64(void);
+
+    /// @brief  reads the cpu cycle counter, for profiling. rolls over in about 268 s at 16 MHz,
+    ///         which is fine for measuring anything shorter than that with unsigned subtraction.
+    /// @return the number of cpu cycles since the clock started (see AF_CYCLES_PER_US)
+    uint32_t cycles(void);
+
+    /// @brief  extends a 16-bit capture of the clock timer to a full cycle count.
+    ///         called from capture ISRs only (see rcin_hal.cpp), with interrupts disabled.
+    /// @param  ticks the captured timer value
+    /// @return the cycle count at the capture, comparable with cycles()
+    uint32_t _capture_cycles(uint16_t ticks);
+
+    /// @brief  gets the signed distance between two timestamps, correct across rollover
+    ///         as long as they're within about 35 min of each other
+    /// @return a - b, in microseconds
+    inline int32_t time_diff_us(uint32_t a, uint32_t b) {
+        return (int32_t)(a - b);
+    }
+
+    /// @brief  checks whether a deadline has passed, correct across rollover
+    /// @param  now_us      the current time, from micros()
+    /// @param  deadline_us the deadline, from micros() plus some delay
+    /// @return true if now_us is at or after deadline_us
+    inline bool time_reached(uint32_t now_us, uint32_t deadline_us) {
+        return time_diff_us(now_us, deadline_us) >= 0;
+    }
+
 }
 
 #endif // AF_HAL_SYSTEM_HAL_H_
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include "AF_HAL.h"
+#include "twi_hal.h"
+
+static_assert((AF_TWI_QUEUE_LEN & (AF_TWI_QUEUE_LEN - 1)) == 0, "the TWI queue length must be a power of two");
+static_assert(AF_TWI_QUEUE_LEN <= 8, "the TWI queue keeps one chain bit per slot in a byte");
+
+// master status codes, as reported in TWSR (see util/twi.h on the AVR)
+#define TWI_STATUS_START        0x08
+#define TWI_STATUS_REP_START    0x10
+#define TWI_STATUS_MT_SLA_ACK   0x18
+#define TWI_STATUS_MT_SLA_NACK  0x20
+#define TWI_STATUS_MT_DATA_ACK  0x28
+#define TWI_STATUS_MT_DATA_NACK 0x30
+#define TWI_STATUS_MR_SLA_ACK   0x40
+#define TWI_STATUS_MR_SLA_NACK  0x48
+#define TWI_STATUS_MR_DATA_ACK  0x50
+#define TWI_STATUS_MR_DATA_NACK 0x58
+
+/// the queue slot of a free-running index
+#define TWI_SLOT(_i) ((_i) & (AF_TWI_QUEUE_LEN - 1))
+
+namespace AF_HAL {
+
+    namespace twi {
+
+        /// queued transactions, the one at _tail is in progress while _busy is set
+        static AF_TWI_Transaction* _queue[AF_TWI_QUEUE_LEN];
+        /// bit n is set if the transaction in slot n runs straight into the next one
+        static uint8_t _chained = 0;
+        /// free-running index of the next free slot
+        static volatile uint8_t _head = 0;
+        /// free-running index of the transaction in progress
+        static volatile uint8_t _tail = 0;
+        /// whether the bus is owned by a transaction
+        static volatile bool _busy = false;
+        /// whether the peripheral is halted, waiting for update() to recover the bus
+        static volatile bool _recovering = false;
+        /// whether the register address of the current transaction has been sent
+        static bool _reg_sent = false;
+        /// how many data bytes of the current transaction have been moved
+        static uint8_t _idx = 0;
+        /// when the current transaction started, in system microseconds
+        static volatile uint32_t _started_at = 0;
+        /// transactions that failed
+        static volatile uint16_t _errors = 0;
+        /// times the bus has been recovered
+        static volatile uint16_t _recoveries = 0;
+
+        /// @brief resets the per-transaction state for the transaction at _tail
+        static void _begin(void) {
+            _reg_sent = false;
+            _idx = 0;
+            _started_at = AF_HAL::micros();
+        }
+
+        /// @brief pops the transaction in progress and reports its result
+        /// @return whether the transaction was chained to the next one
+        static bool _complete(AF_TWI_Status status) {
+            uint8_t slot = TWI_SLOT(_tail);
+            AF_TWI_Transaction* t = _queue[slot];
+            bool chained = _chained & (1 << slot);
+            // pop before the callback, so it can queue the next transaction
+            _tail++;
+            t->status = status;
+            if (t->callback != nullptr) t->callback(t);
+            return chained;
+        }
+
+        /// @brief finishes the transaction in progress and moves the bus on to the next one
+        static void _finish(AF_TWI_Status status) {
+
+            bool chained = _complete(status);
+
+            if (status == AF_TWI_OK && chained) {
+                // keep the bus for the rest of the burst, which was queued with this transaction
+                _begin();
+                _hw_start();
+                return;
+            }
+
+            if (status != AF_TWI_OK) {
+                if (_errors != 0xFFFF) _errors++;
+                // the rest of the burst depended on this transaction
+                while (chained) chained = _complete(AF_TWI_ABORTED);
+            }
+
+            if (status == AF_TWI_BUS_ERROR || status == AF_TWI_TIMEOUT) {
+                // the queue stays busy until update() has freed the bus
+                _hw_halt();
+                _recovering = true;
+                return;
+            }
+
+            bool more = _tail != _head;
+
+            if (more) {
+                _begin();
+                _hw_stop(true);
+            } else {
+                _hw_stop(false);
+            }
+
+            _busy = more;
+        }
+
+        void init(uint32_t freq_hz) {
+            _hw_init(freq_hz);
+        }
+
+        bool submit(AF_TWI_Transaction* transactions, uint8_t count) {
+            if (count == 0) return false;
+            for (uint8_t i = 0; i < count; i++) {
+                // the device has to send at least one byte after it's addressed for reading
+                if ((transactions[i].flags & AF_TWI_FLAG_READ) && transactions[i].len == 0) return false;
+            }
+
+            bool queued = false;
+            AF_ATOMIC_BLOCK {
+                // queue the whole burst at once, so it's all there when the first transaction finishes
+                if ((uint8_t)(_head - _tail) + count <= AF_TWI_QUEUE_LEN) {
+                    for (uint8_t i = 0; i < count; i++) {
+                        uint8_t slot = TWI_SLOT(_head);
+                        transactions[i].status = AF_TWI_PENDING;
+                        _queue[slot] = &transactions[i];
+                        if (i + 1 < count) _chained |= (1 << slot); else _chained &= ~(1 << slot);
+                        _head++;
+                    }
+                    if (!_busy) {
+                        _busy = true;
+                        _begin();
+                        _hw_start();
+                    }
+                    queued = true;
+                }
+            }
+            return queued;
+        }
+
+        bool is_busy(void) {
+            return _busy;
+        }
+
+        void update(void) {
+            uint32_t now = AF_HAL::micros();
+            bool recover;
+            AF_ATOMIC_BLOCK {
+                if (_busy && !_recovering && (uint32_t)(now - _started_at) > AF_TWI_TIMEOUT_US) _finish(AF_TWI_TIMEOUT);
+                recover = _recovering;
+            }
+            if (!recover) return;
+
+            // the peripheral is halted and _busy keeps submit() off the bus, so nothing else
+            // touches it while it's clocked free with interrupts on
+            _hw_recover();
+
+            AF_ATOMIC_BLOCK {
+                _recovering = false;
+                _recoveries++;
+                if (_tail != _head) {
+                    _begin();
+                    _hw_start();
+                } else {
+                    _busy = false;
+                }
+            }
+        }
+
+        uint16_t get_errors(void) {
+            uint16_t errors;
+            AF_ATOMIC_BLOCK { errors = _errors; }
+            return errors;
+        }
+
+        uint16_t get_recoveries(void) {
+            uint16_t recoveries;
+            AF_ATOMIC_BLOCK { recoveries = _recoveries; }
+            return recoveries;
+        }
+
+        void _on_status(uint8_t status, uint8_t data) {
+            if (!_busy || _recovering) return;
+
+            AF_TWI_Transaction* t = _queue[TWI_SLOT(_tail)];
+            bool read = t->flags & AF_TWI_FLAG_READ;
+            bool has_reg = !(t->flags & AF_TWI_FLAG_NO_REGISTER);
+
+            switch (status) {
+
+                case TWI_STATUS_START:
+                case TWI_STATUS_REP_START:
+                    // address the device for writing until the register has been selected
+                    if (read && (_reg_sent || !has_reg)) {
+                        _hw_write((t->address << 1) | 1);
+                    } else {
+                        _hw_write(t->address << 1);
+                    }
+                    break;
+
+                case TWI_STATUS_MT_SLA_ACK:
+                case TWI_STATUS_MT_DATA_ACK:
+                    if (has_reg && !_reg_sent) {
+                        _reg_sent = true;
+                        _hw_write(t->reg);
+                    } else if (read) {
+                        // turn the bus around to read from the selected register
+                        _hw_start();
+                    } else if (_idx < t->len) {
+                        _hw_write(t->buffer[_idx++]);
+                    } else {
+                        _finish(AF_TWI_OK);
+                    }
+                    break;
+
+                case TWI_STATUS_MR_SLA_ACK:
+                    // acknowledge every byte but the last
+                    _hw_read(t->len > 1);
+                    break;
+
+                case TWI_STATUS_MR_DATA_ACK:
+                    t->buffer[_idx++] = data;
+                    _hw_read(_idx + 1 < t->len);
+                    break;
+
+                case TWI_STATUS_MR_DATA_NACK:
+                    t->buffer[_idx++] = data;
+                    _finish(AF_TWI_OK);
+                    break;
+
+                case TWI_STATUS_MT_SLA_NACK:
+                case TWI_STATUS_MT_DATA_NACK:
+                case TWI_STATUS_MR_SLA_NACK:
+                    _finish(AF_TWI_NACK);
+                    break;
+
+                default:
+                    // bus error, lost arbitration, or anything else a lone master shouldn't see
+                    _finish(AF_TWI_BUS_ERROR);
+                    break;
+            }
+        }
+
+    }
+
+}
@@ -0,0 +1,133 @@
+#ifndef AF_HAL_TWI_HAL_H_
+#define AF_HAL_TWI_HAL_H_
+
+/// @file   twi_hal.h
+/// @brief  provides an interrupt-driven TWI (I2C) master. tasks queue transaction
+///         descriptors and carry on; the TWI interrupt walks each transaction one bus
+///         event at a time and reports back through the descriptor, so a sensor read
+///         never stalls the scheduler.
+///
+/// transactions can be chained into bursts (e.g. read an IMU's FIFO count, then the FIFO),
+/// which hold the bus with repeated starts instead of releasing it between transactions.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/// how many transactions can be queued at once, must be a power of two
+#define AF_TWI_QUEUE_LEN 8
+/// the default bus frequency
+#define AF_TWI_DEFAULT_FREQ_HZ 400000UL
+/// a transaction still going after this long means a device is holding the bus
+#define AF_TWI_TIMEOUT_US 2000UL
+
+/// the transaction reads from the device (otherwise it writes to it)
+#define AF_TWI_FLAG_READ        0x01
+/// the transaction goes straight to the data, without writing a register address first
+#define AF_TWI_FLAG_NO_REGISTER 0x02
+
+/// @brief the state of a transaction
+enum AF_TWI_Status: uint8_t {
+    /// queued or in progress
+    AF_TWI_PENDING = 0,
+    /// finished successfully
+    AF_TWI_OK,
+    /// the device didn't acknowledge its address or a byte
+    AF_TWI_NACK,
+    /// the bus misbehaved (illegal start/stop, lost arbitration), and has been recovered
+    AF_TWI_BUS_ERROR,
+    /// the transaction took longer than AF_TWI_TIMEOUT_US, and the bus has been recovered
+    AF_TWI_TIMEOUT,
+    /// an earlier transaction in the same burst failed, so this one never ran
+    AF_TWI_ABORTED
+};
+
+/// @brief describes one transaction. the descriptor and its buffer belong to the caller
+///        and must stay put until the transaction is no longer pending.
+struct AF_TWI_Transaction {
+    /// the 7-bit device address
+    uint8_t address;
+    /// the register to start at, unless AF_TWI_FLAG_NO_REGISTER is set
+    uint8_t reg;
+    /// how many bytes to read or write
+    uint8_t len;
+    /// AF_TWI_FLAG_* bits
+    uint8_t flags;
+    /// where to read into, or what to write
+    uint8_t* buffer;
+    /// called when the transaction finishes, or nullptr. called from the TWI ISR,
+    /// so keep it short (i.e. mark data ready, or queue the next transaction).
+    void (*callback)(AF_TWI_Transaction* transaction);
+    /// passed through untouched, for the callback's use
+    void* context;
+    /// set when the transaction finishes. poll this instead of using a callback.
+    volatile AF_TWI_Status status;
+};
+
+namespace AF_HAL {
+
+/// @brief namespace containing the TWI (I2C) master
+namespace twi {
+
+    /// @brief sets up the TWI peripheral
+    /// @param freq_hz the bus frequency
+    void init(uint32_t freq_hz = AF_TWI_DEFAULT_FREQ_HZ);
+
+    /// @brief queues transactions. more than one makes a burst, which runs back to back
+    ///        with repeated starts. if one fails, the rest of the burst is aborted.
+    /// @param transactions the transactions, in order
+    /// @param count        how many transactions there are
+    /// @return true if they were all queued, false if there wasn't room (nothing is queued)
+    bool submit(AF_TWI_Transaction* transactions, uint8_t count = 1);
+
+    /// @brief whether any transactions are queued or in progress
+    bool is_busy(void);
+
+    /// @brief times out a hung transaction, and recovers the bus after a bus error or a
+    ///        timeout before moving the queue on. register as a scheduler task; a device
+    ///        holding the bus stops the interrupt, so the ISR can't notice itself, and
+    ///        clocking the bus free takes too long to do in the ISR.
+    void update(void);
+
+    /// @brief gets the number of transactions that failed, rolls over to 0 safely
+    uint16_t get_errors(void);
+
+    /// @brief gets the number of times the bus has been recovered, rolls over to 0 safely
+    uint16_t get_recoveries(void);
+
+    /// @brief advances the transaction in progress after a bus event.
+    ///        called from the TWI ISR (or the simulator's mock bus) only.
+    /// @param status the TWI status code, with the prescaler bits masked off
+    /// @param data   the data register, for received bytes
+    void _on_status(uint8_t status, uint8_t data);
+
+    /// @brief enables the peripheral at a bus frequency. implemented by the platform HAL.
+    void _hw_init(uint32_t freq_hz);
+
+    /// @brief sends a (repeated) start condition. implemented by the platform HAL.
+    void _hw_start(void);
+
+    /// @brief sends an address or data byte. implemented by the platform HAL.
+    void _hw_write(uint8_t byte);
+
+    /// @brief receives a byte. implemented by the platform HAL.
+    /// @param ack whether to acknowledge it (i.e. more bytes are wanted)
+    void _hw_read(bool ack);
+
+    /// @brief sends a stop condition. implemented by the platform HAL.
+    /// @param restart whether to send a start condition straight after
+    void _hw_stop(bool restart);
+
+    /// @brief lets go of the bus and stops the peripheral's interrupt until _hw_recover().
+    ///        called from the TWI ISR. implemented by the platform HAL.
+    void _hw_halt(void);
+
+    /// @brief frees a stuck bus (clocks out a device holding SDA low) and re-enables the
+    ///        peripheral. called from a task with interrupts on, it takes around 100 us.
+    ///        implemented by the platform HAL.
+    void _hw_recover(void);
+
+}
+
+}
+
+#endif // AF_HAL_TWI_HAL_H_
@@ -0,0 +1,143 @@
+#include "AF_Lockstep.h"
+#include <AF_GCS/AF_GCS.h>
+
+AF_Lockstep::AF_Lockstep(uint8_t node, uint8_t nodes) : _node(node), _nodes(nodes) {
+    if (_nodes > AF_LOCKSTEP_MAX_NODES) _nodes = AF_LOCKSTEP_MAX_NODES;
+}
+
+AF_Lockstep::Slot& AF_Lockstep::_slot(uint16_t tick) {
+    Slot& slot = _slots[tick % AF_LOCKSTEP_WINDOW];
+    if (slot.tick != tick) {
+        slot.tick = tick;
+        slot.present = 0;
+    }
+    return slot;
+}
+
+void AF_Lockstep::submit(uint32_t tick, const uint16_t* outputs, uint8_t count, uint8_t* payload) {
+    // the tick goes into the digest, so a controller stuck on an old tick never agrees
+    uint8_t tick_bytes[4] = { (uint8_t)(tick & 0xFF), (uint8_t)((tick >> 8) & 0xFF), (uint8_t)((tick >> 16) & 0xFF), (uint8_t)(tick >> 24) };
+    uint16_t digest = utilcrc::crc16(tick_bytes, 4);
+    for (uint8_t i = 0; i < count; i++) {
+        digest = utilcrc::crc16_update(digest, outputs[i] & 0xFF);
+        digest = utilcrc::crc16_update(digest, outputs[i] >> 8);
+    }
+
+    Slot& slot = _slot((uint16_t)tick);
+    slot.digests[_node] = digest;
+    slot.present |= (1 << _node);
+
+    payload[0] = tick & 0xFF;
+    payload[1] = (tick >> 8) & 0xFF;
+    payload[2] = _node;
+    payload[3] = digest & 0xFF;
+    payload[4] = digest >> 8;
+}
+
+bool AF_Lockstep::submit(uint32_t tick, const uint16_t* outputs, uint8_t count, AF_GCS& link) {
+    uint8_t payload[AF_LOCKSTEP_DIGEST_LEN];
+    submit(tick, outputs, count, payload);
+    return link.send(AF_GCS_MSG_LOCKSTEP, AF_GCS_COMP_SYSTEM, AF_GCS_PRIORITY_CRITICAL, payload, AF_LOCKSTEP_DIGEST_LEN);
+}
+
+void AF_Lockstep::on_digest(const uint8_t* payload, uint8_t len) {
+    if (len < AF_LOCKSTEP_DIGEST_LEN) return;
+    uint8_t node = payload[2];
+    if (node >= _nodes || node == _node) return;
+
+    uint16_t tick = payload[0] | (payload[1] << 8);
+    // don't let a digest for a tick that's already been voted on push out a newer one
+    Slot& current = _slots[tick % AF_LOCKSTEP_WINDOW];
+    if (current.present != 0 && (int16_t)(tick - current.tick) < 0) return;
+
+    Slot& slot = _slot(tick);
+    slot.digests[node] = payload[3] | (payload[4] << 8);
+    slot.present |= (1 << node);
+}
+
+bool AF_Lockstep::is_complete(uint32_t tick) const {
+    const Slot& slot = _slots[(uint16_t)tick % AF_LOCKSTEP_WINDOW];
+    return slot.tick == (uint16_t)tick && slot.present == (1 << _nodes) - 1;
+}
+
+AF_Lockstep_Result AF_Lockstep::vote(uint32_t tick) {
+    Slot& slot = _slot((uint16_t)tick);
+
+    // the digest the most controllers agree on
+    uint8_t best = 0;
+    uint16_t majority = 0;
+    for (uint8_t i = 0; i < _nodes; i++) {
+        if (!(slot.present & (1 << i))) continue;
+        uint8_t count = 0;
+        for (uint8_t j = 0; j < _nodes; j++) {
+            if ((slot.present & (1 << j)) && slot.digests[j] == slot.digests[i]) count++;
+        }
+        if (count > best) {
+            best = count;
+            majority = slot.digests[i];
+        }
+    }
+    bool has_majority = best >= _nodes / 2 + 1;
+
+    AF_Lockstep_Result result = AF_LOCKSTEP_AGREE;
+    for (uint8_t n = 0; n < _nodes; n++) {
+        uint8_t bit = 1 << n;
+        if (!(slot.present & bit)) {
+            // silence is only a fault once it's gone on long enough to not be a late frame
+            _missed[n]++;
+            if (_missed_run[n] < 0xFF) _missed_run[n]++;
+            if (_missed_run[n] >= AF_LOCKSTEP_MAX_MISSED) {
+                _masked |= bit;
+                _agree_run[n] = 0;
+            }
+            result = AF_LOCKSTEP_MASKED;
+            continue;
+        }
+        _missed_run[n] = 0;
+        if (!has_majority) continue;
+
+        if (slot.digests[n] == majority) {
+            if (_agree_run[n] < 0xFF) _agree_run[n]++;
+            if (_agree_run[n] >= AF_LOCKSTEP_RECOVER_TICKS) _masked &= ~bit;
+        } else {
+            _masked |= bit;
+            _agree_run[n] = 0;
+            _faults[n]++;
+            result = AF_LOCKSTEP_MASKED;
+        }
+    }
+
+    if (slot.present == (1 << _node)) {
+        result = AF_LOCKSTEP_ALONE;
+    } else if (!has_majority) {
+        _disagreements++;
+        result = AF_LOCKSTEP_DISAGREE;
+    }
+
+    // two controllers can't tell which of them is cut off, so the primary keeps the outputs
+    // (see AF_Lockstep.h)
+    if (_nodes < 3) {
+        _controller = 0;
+        return result;
+    }
+
+    // the lowest numbered controller that isn't masked drives the outputs. this one only counts
+    // if its own digest is in a majority of those present: one that's cut off would otherwise
+    // mask the others and take over while they carry on without it.
+    bool trusted = has_majority && slot.digests[_node] == majority;
+    uint8_t controller = AF_LOCKSTEP_NO_CONTROLLER;
+    for (uint8_t n = _nodes; n-- > 0;) {
+        if (_masked & (1 << n)) continue;
+        if (n == _node && !trusted) continue;
+        controller = n;
+    }
+    // if every controller is masked, e.g. while they recover, the lowest one in the majority
+    // carries on
+    if (controller == AF_LOCKSTEP_NO_CONTROLLER && has_majority) {
+        for (uint8_t n = _nodes; n-- > 0;) {
+            if ((slot.present & (1 << n)) && slot.digests[n] == majority) controller = n;
+        }
+    }
+    _controller = controller;
+    return result;
+}
@@ -0,0 +1,155 @@
+#ifndef AF_LOCKSTEP_H_
+#define AF_LOCKSTEP_H_
+
+/// @file   AF_Lockstep.h
+/// @brief  runs two or three controller chips in lockstep and votes on their outputs, so a
+///         chip that computes a wrong output is masked before its output is used.
+///
+/// every controller runs the same control tasks on the same inputs for the same control tick.
+/// after a tick, each one sends the others a digest of its outputs (AF_GCS_MSG_LOCKSTEP, at
+/// the highest priority), then votes on the digests it has before the next tick:
+///  - digests that a majority agrees on are right. a controller that disagrees with the
+///    majority is masked, and stays masked until it has agreed for AF_LOCKSTEP_RECOVER_TICKS.
+///  - a controller whose digest doesn't arrive for AF_LOCKSTEP_MAX_MISSED ticks in a row is
+///    masked too, as if it had disagreed
+///  - with no majority (two controllers that disagree, or three that all differ) there's no
+///    way to tell which is wrong, so the masks are left as they are. two controllers can
+///    only detect a fault, it takes three to mask one.
+/// with three controllers, the lowest numbered one that isn't masked drives the outputs
+/// (is_in_control()). a controller only drives them while its own digest is in a majority of
+/// the digests it has, so one that's cut off from the others masks them both but steps down
+/// rather than taking over, and with no majority none of them drives.
+///
+/// with two, a dead peer and a broken link between them look the same from either side, and
+/// each would mask the other and take over. so the primary (controller 0) always drives the
+/// outputs, and the secondary only reports what it sees: a primary that stops has to be
+/// caught by the outputs' own failsafe.
+///
+/// digests arrive through AF_GCS::receive() once the link is given the lockstep with
+/// AF_GCS::set_lockstep(), or can be handed to on_digest() directly.
+///
+/// digest payload: the low 16 bits of the control tick, the sending controller, then the
+/// CRC-16 of the tick and the outputs. 5 bytes, 13 on the wire: at a 400 Hz control loop
+/// that's 5200 bytes/s out of each controller, so the link between them has to run well
+/// above 57600 baud.
+///
+/// outputs are compared as the integers that are driven (i.e. pulse widths), not floats, so
+/// controllers that did the same arithmetic agree bit for bit.
+
+#include <stdint.h>
+#include <AF_GCS/AF_GCS_Protocol.h>
+
+/// the most controllers that can run in lockstep
+#define AF_LOCKSTEP_MAX_NODES 3
+/// the length of a digest payload
+#define AF_LOCKSTEP_DIGEST_LEN 5
+/// how many ticks of digests are kept, so a digest that arrives a little early isn't lost
+#define AF_LOCKSTEP_WINDOW 4
+/// how many ticks in a row a masked controller has to agree before it's trusted again
+#define AF_LOCKSTEP_RECOVER_TICKS 100
+/// how many ticks in a row a controller's digest can go missing before it's masked
+#define AF_LOCKSTEP_MAX_MISSED 3
+/// get_controller() when no controller drives the outputs, as far as this one can tell
+#define AF_LOCKSTEP_NO_CONTROLLER 0xFF
+
+/// @brief the outcome of a vote
+enum AF_Lockstep_Result: uint8_t {
+    /// every controller agreed
+    AF_LOCKSTEP_AGREE = 0,
+    /// a majority agreed, and the rest were masked or missing
+    AF_LOCKSTEP_MASKED,
+    /// there was no majority, so nothing was masked
+    AF_LOCKSTEP_DISAGREE,
+    /// no other controller's digest arrived, so there was nothing to vote on
+    AF_LOCKSTEP_ALONE
+};
+
+class AF_GCS;
+
+/// @brief one controller's side of the lockstep
+class AF_Lockstep {
+
+    public:
+
+        /// @param node  this controller's number, from 0
+        /// @param nodes how many controllers run in lockstep, 2 or 3
+        AF_Lockstep(uint8_t node, uint8_t nodes);
+
+        /// @brief records this controller's outputs for a tick, and builds its digest
+        /// @param tick    the control tick
+        /// @param outputs the outputs, as they're driven
+        /// @param count   the number of outputs
+        /// @param payload set to the digest payload, AF_LOCKSTEP_DIGEST_LEN bytes
+        void submit(uint32_t tick, const uint16_t* outputs, uint8_t count, uint8_t* payload);
+
+        /// @brief see submit(), and sends the digest over a link to the other controllers
+        /// @return true if the digest was queued on the link
+        bool submit(uint32_t tick, const uint16_t* outputs, uint8_t count, AF_GCS& link);
+
+        /// @brief takes a digest from another controller, i.e. the payload of an
+        ///        AF_GCS_MSG_LOCKSTEP frame
+        void on_digest(const uint8_t* payload, uint8_t len);
+
+        /// @brief whether every controller's digest for a tick is in, so it can be voted on
+        ///        without waiting for the end of the control period
+        bool is_complete(uint32_t tick) const;
+
+        /// @brief votes on a tick's digests, and masks the controllers that disagree. call once
+        ///        per tick, after submit(), once is_complete() or the control period is up.
+        AF_Lockstep_Result vote(uint32_t tick);
+
+        /// @brief whether this controller drives the outputs, as of the last vote
+        bool is_in_control(void) const { return _controller == _node; }
+
+        /// @brief gets the controller that drives the outputs, as of the last vote, or
+        ///        AF_LOCKSTEP_NO_CONTROLLER
+        uint8_t get_controller(void) const { return _controller; }
+
+        /// @brief whether a controller is masked
+        bool is_masked(uint8_t node) const { return _masked & (1 << node); }
+
+        /// @brief gets the number of votes a controller lost, rolls over to 0 safely
+        uint16_t get_faults(uint8_t node) const { return _faults[node]; }
+
+        /// @brief gets the number of ticks a controller's digest didn't arrive in time, rolls
+        ///        over to 0 safely
+        uint16_t get_missed(uint8_t node) const { return _missed[node]; }
+
+        /// @brief gets the number of votes with no majority, rolls over to 0 safely
+        uint16_t get_disagreements(void) const { return _disagreements; }
+
+    private:
+
+        /// @brief the digests of one tick
+        struct Slot {
+            /// the low 16 bits of the tick
+            uint16_t tick;
+            /// which controllers' digests are in, a bit each
+            uint8_t present;
+            uint16_t digests[AF_LOCKSTEP_MAX_NODES];
+        };
+
+        /// @brief gets the slot for a tick, cleared if it held an older tick
+        Slot& _slot(uint16_t tick);
+
+        uint8_t _node;
+        uint8_t _nodes;
+
+        Slot _slots[AF_LOCKSTEP_WINDOW] = {};
+
+        /// which controllers are masked, a bit each
+        uint8_t _masked = 0;
+        /// the controller that drives the outputs
+        uint8_t _controller = 0;
+        /// ticks in a row each controller has agreed with the majority
+        uint8_t _agree_run[AF_LOCKSTEP_MAX_NODES] = {};
+        /// ticks in a row each controller's digest has been missing
+        uint8_t _missed_run[AF_LOCKSTEP_MAX_NODES] = {};
+
+        uint16_t _faults[AF_LOCKSTEP_MAX_NODES] = {};
+        uint16_t _missed[AF_LOCKSTEP_MAX_NODES] = {};
+        uint16_t _disagreements = 0;
+
+};
+
+#endif // AF_LOCKSTEP_H_
@@ -1,5 +1,175 @@
 #include "AF_Logger.h"
+#include <AF_GCS/AF_GCS_Protocol.h>
+#include <AF_HAL/AF_HAL.h>
+
+static_assert(AF_LOG_RECORD_HEADER_LEN + AF_LOG_MAX_ARGS_LEN <= AF_GCS_MAX_PAYLOAD, "a record has to fit in one frame");
+static_assert((AF_LOG_RING_LEN & (AF_LOG_RING_LEN - 1)) == 0, "the log ring length must be a power of two");
+// an ISR's record can't land on a record an interrupted task is still copying in
+static_assert(AF_LOG_RING_LEN >= 4 * (2 + AF_LOG_RECORD_HEADER_LEN + AF_LOG_MAX_ARGS_LEN), "the log ring is too short");
+
+/// the position in the ring of a free-running index
+#define LOG_RING_IDX(_i) ((_i) & (AF_LOG_RING_LEN - 1))
+
+// ring entry flags
+/// the destinations the record goes to, AF_LOG_TO_* bits
+#define LOG_FLAG_STREAMS_MASK 0x07
+/// the record's level
+#define LOG_FLAG_LEVEL_SHIFT 4
+#define LOG_FLAG_LEVEL_MASK (0x03 << LOG_FLAG_LEVEL_SHIFT)
+/// set once the record has been copied in, so the consumer doesn't read it half-written
+#define LOG_FLAG_COMMITTED 0x80
 
 AF_Logger *AF_Logger::_instance;
 
-// void AF_Logger::log()
+bool AF_Log_Stream_Sink::write(uint8_t level, const uint8_t* record, uint8_t len) {
+    // encode straight into the stream's buffer, and only commit if the whole frame fit
+    utilbuf::span spans[2];
+    utilbuf::ring_idx_t room = _stream->reserve(spans);
+    AF_GCS_Frame_Writer writer(spans, room);
+
+    AF_GCS_Frame_Header header = { AF_GCS_MSG_LOG, level, _seq, len };
+    writer.put(reinterpret_cast<const uint8_t*>(&header), AF_GCS_HEADER_LEN);
+    writer.put(record, len);
+
+    utilbuf::ring_idx_t n = writer.finish();
+    if (n == 0) return false;
+    _stream->commit(n);
+    _seq++;
+    return true;
+}
+
+void AF_Logger::attach(AF_Logger_Stream stream, AF_Log_Sink* sink, AF_Log_Policy policy) {
+    if (stream == AF_LOGGER_STREAM_ALL) return;
+    uint8_t dest = stream - 1;
+    AF_ATOMIC_BLOCK {
+        _sinks[dest] = sink;
+        _policies[dest] = policy;
+        // start from the next record
+        _tails[dest] = _head;
+    }
+}
+
+void AF_Logger::_copy_out(uint16_t at, uint8_t* dest, uint8_t len) const {
+    for (uint8_t i = 0; i < len; i++) dest[i] = _ring[LOG_RING_IDX(at + i)];
+}
+
+void AF_Logger::_copy_in(uint16_t at, const uint8_t* src, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) _ring[LOG_RING_IDX(at + i)] = src[i];
+}
+
+void AF_Logger::_make_room(uint16_t len) {
+    for (uint8_t d = 0; d < AF_LOGGER_STREAM_COUNT; d++) {
+        if (_sinks[d] == nullptr) continue;
+        // push out this destination's oldest records until the new one fits
+        while ((uint16_t)(_head + len - _tails[d]) > AF_LOG_RING_LEN) {
+            uint16_t tail = _tails[d];
+            if (_ring[LOG_RING_IDX(tail + 1)] & (1 << d)) _dropped[d]++;
+            _tails[d] = tail + 2 + _ring[LOG_RING_IDX(tail)];
+        }
+    }
+}
+
+void AF_Logger::write(uint16_t id, uint8_t level, uint8_t streams, const uint8_t* args, uint8_t len) {
+    uint8_t record[AF_LOG_RECORD_HEADER_LEN + AF_LOG_MAX_ARGS_LEN];
+    uint32_t now = AF_HAL::micros();
+    record[0] = id & 0xFF;
+    record[1] = id >> 8;
+    record[2] = now & 0xFF;
+    record[3] = (now >> 8) & 0xFF;
+    record[4] = (now >> 16) & 0xFF;
+    record[5] = now >> 24;
+    memcpy(record + AF_LOG_RECORD_HEADER_LEN, args, len);
+    len += AF_LOG_RECORD_HEADER_LEN;
+
+    uint8_t flags = (streams & LOG_FLAG_STREAMS_MASK) | ((level << LOG_FLAG_LEVEL_SHIFT) & LOG_FLAG_LEVEL_MASK);
+    bool wanted = false;
+    uint16_t at = 0;
+
+    // claim space with interrupts off, but copy the record in with them back on
+    AF_ATOMIC_BLOCK {
+        for (uint8_t d = 0; d < AF_LOGGER_STREAM_COUNT; d++) {
+            if ((streams & (1 << d)) && _sinks[d] != nullptr) wanted = true;
+        }
+        if (wanted) {
+            _make_room(2 + len);
+            at = _head;
+            _ring[LOG_RING_IDX(at)] = len;
+            _ring[LOG_RING_IDX(at + 1)] = flags;
+            _head = at + 2 + len;
+        }
+    }
+    if (!wanted) return;
+
+    _copy_in(at + 2, record, len);
+    __atomic_store_n(&_ring[LOG_RING_IDX(at + 1)], flags | LOG_FLAG_COMMITTED, __ATOMIC_RELEASE);
+}
+
+void AF_Logger::_drain(uint8_t dest) {
+    AF_Log_Sink* sink = _sinks[dest];
+    uint8_t record[AF_LOG_RECORD_HEADER_LEN + AF_LOG_MAX_ARGS_LEN];
+
+    while (true) {
+        uint16_t tail = 0;
+        uint8_t len = 0;
+        uint8_t flags = 0;
+        bool have = false;
+        AF_ATOMIC_BLOCK {
+            tail = _tails[dest];
+            if (tail != _head) {
+                len = _ring[LOG_RING_IDX(tail)];
+                flags = __atomic_load_n(&_ring[LOG_RING_IDX(tail + 1)], __ATOMIC_ACQUIRE);
+                have = true;
+            }
+        }
+        // records are handed over in order, so stop at one that's still being copied in
+        if (!have || !(flags & LOG_FLAG_COMMITTED)) return;
+
+        bool targeted = flags & (1 << dest);
+        if (targeted) _copy_out(tail + 2, record, len);
+
+        // a writer may have pushed the record out (and reused its space) while it was copied
+        bool intact;
+        AF_ATOMIC_BLOCK { intact = _tails[dest] == tail; }
+        if (!intact) continue;
+
+        bool taken = !targeted || sink->write((flags & LOG_FLAG_LEVEL_MASK) >> LOG_FLAG_LEVEL_SHIFT, record, len);
+        if (!taken && _policies[dest] == AF_LOG_POLICY_RETRY) return;
+
+        AF_ATOMIC_BLOCK {
+            if (_tails[dest] == tail) {
+                _tails[dest] = tail + 2 + len;
+                if (targeted && !taken) _dropped[dest]++;
+            } else if (taken && targeted) {
+                // pushed out after it was copied, but it made it to the sink after all
+                _dropped[dest]--;
+            }
+        }
+        if (taken && targeted) _delivered[dest]++;
+    }
+}
+
+void AF_Logger::update(void) {
+    for (uint8_t d = 0; d < AF_LOGGER_STREAM_COUNT; d++) {
+        if (_sinks[d] != nullptr) _drain(d);
+    }
+}
+
+uint16_t AF_Logger::get_dropped(AF_Logger_Stream stream) const {
+    uint16_t dropped;
+    AF_ATOMIC_BLOCK { dropped = _dropped[stream - 1]; }
+    return dropped;
+}
+
+uint16_t AF_Logger::get_backlog(AF_Logger_Stream stream) const {
+    uint16_t backlog;
+    AF_ATOMIC_BLOCK { backlog = _head - _tails[stream - 1]; }
+    return backlog;
+}
+
+namespace af_logger {
+
+    void update(void) {
+        if (AF_Logger::get_instance() != nullptr) AF_Logger::get_instance()->update();
+    }
+
+}
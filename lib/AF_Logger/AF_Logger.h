@@ -4,6 +4,35 @@
 /// @file   AF_Logger.h
 /// @brief  provides an interface for routing messages to different
 ///         loggers, such as the GCS, SD card, or serial port
+///
+/// formatting is deferred to the host: a log call records the id of its format string, worked
+/// out at compile time, and its arguments as raw bytes. the format strings never reach the
+/// vehicle, and tools/af_log.py turns records back into text. a record costs a few dozen
+/// cycles to build, so logging can stay on in flight.
+///
+/// format strings mark each argument with its type on the wire: {u8}, {i8}, {u16}, {i16},
+/// {u32}, {i32}, {u64}, {i64}, {f32} or {bool} ({{ for a literal brace). arguments are
+/// converted to that type, so records look the same whatever the vehicle's int size, and a
+/// format string that doesn't match its arguments fails to compile:
+///
+///     AF_LOG_WARN(AF_LOGGER_STREAM_ALL, "battery low: {u16} mV, {f32} A", mv, amps);
+///
+/// record (the payload of an AF_GCS_MSG_LOG frame, with the level as the frame's priority):
+/// format id (2 bytes), system clock in microseconds (4 bytes), then the arguments. all little
+/// endian.
+///
+/// levels below AF_LOG_MIN_LEVEL and streams not in AF_LOG_ENABLED_STREAMS are filtered at
+/// compile time, so they cost nothing: no code, no arguments evaluated.
+///
+/// log calls are safe from tasks and ISRs alike, and never wait on a sink: records are
+/// appended to a ring (interrupts are held off only while space is claimed, not while the
+/// record is copied in), and update(), a low priority task, hands them to each sink at the
+/// sink's own pace. every sink has its own place in the ring, so a slow sink (i.e. an SD card
+/// in the middle of a write) only ever loses its own records:
+///  - a sink that refuses a record either drops it or tries it again on the next update, as
+///    set by its AF_Log_Policy
+///  - when the ring is full, a new record pushes out the oldest records of whichever sinks
+///    are furthest behind, and those sinks count the loss
 
 #include <stdint.h>
 #include <util.h>
@@ -13,6 +42,33 @@
 #define AF_LOG_TO_SD (1 << 1)
 #define AF_LOG_TO_SERIAL (1 << 2)
 
+// log levels, in the same order as the GCS priorities
+#define AF_LOG_LEVEL_DEBUG 0
+#define AF_LOG_LEVEL_INFO 1
+#define AF_LOG_LEVEL_WARN 2
+#define AF_LOG_LEVEL_ERROR 3
+
+/// the lowest level that's logged, anything below is compiled out
+#ifndef AF_LOG_MIN_LEVEL
+#define AF_LOG_MIN_LEVEL AF_LOG_LEVEL_INFO
+#endif
+
+/// the destinations that are logged to, anything else is compiled out
+#ifndef AF_LOG_ENABLED_STREAMS
+#define AF_LOG_ENABLED_STREAMS (AF_LOG_TO_TELMETRY | AF_LOG_TO_SD | AF_LOG_TO_SERIAL)
+#endif
+
+/// the length of a record before its arguments: format id and timestamp
+#define AF_LOG_RECORD_HEADER_LEN 6
+/// the most argument bytes a record can carry, so a record fits in one GCS frame
+#define AF_LOG_MAX_ARGS_LEN 42
+/// the most arguments a log call can take
+#define AF_LOG_MAX_ARGS 7
+/// the size of the record ring, in bytes. must be a power of two.
+#ifndef AF_LOG_RING_LEN
+#define AF_LOG_RING_LEN 512
+#endif
+
 enum AF_Logger_Stream: uint8_t {
     AF_LOGGER_STREAM_ALL = 0,
     AF_LOGGER_STREAM_TELMETRY,
@@ -20,6 +76,53 @@ enum AF_Logger_Stream: uint8_t {
     AF_LOGGER_STREAM_SERIAL
 };
 
+/// the number of reserved destinations
+#define AF_LOGGER_STREAM_COUNT 3
+
+/// @brief what a sink does with a record it can't take right now
+enum AF_Log_Policy: uint8_t {
+    /// drop the record, and move on to the next one
+    AF_LOG_POLICY_DROP = 0,
+    /// keep the record and try it again on the next update. the sink still loses its oldest
+    /// records if it falls so far behind that the ring fills up.
+    AF_LOG_POLICY_RETRY
+};
+
+/// @brief somewhere log records go, i.e. the GCS link or a file on the SD card
+class AF_Log_Sink {
+
+    public:
+
+        virtual ~AF_Log_Sink() {};
+
+        /// @brief takes a record. never waits: a record the sink has no room for is dropped.
+        /// @param level  the record's level
+        /// @param record the record
+        /// @param len    the length of the record
+        /// @return true if the record was taken, false if it was dropped
+        virtual bool write(uint8_t level, const uint8_t* record, uint8_t len) = 0;
+
+};
+
+/// @brief writes records to a stream (i.e. a serial port, or a file) as COBS-framed
+///        AF_GCS_MSG_LOG frames, so the same tools read them as the GCS link
+class AF_Log_Stream_Sink: public AF_Log_Sink {
+
+    public:
+
+        /// @param stream the stream to write to
+        AF_Log_Stream_Sink(Stream* stream) : _stream(stream) {}
+
+        bool write(uint8_t level, const uint8_t* record, uint8_t len) override;
+
+    private:
+
+        Stream* _stream;
+        /// the sequence number of the next frame
+        uint8_t _seq = 0;
+
+};
+
 class AF_Logger {
 
     private:
@@ -27,6 +130,34 @@ class AF_Logger {
         /// singleton instance of the logger
         static AF_Logger * _instance;
 
+        /// where each reserved destination's records go, nullptr if nowhere
+        AF_Log_Sink* _sinks[AF_LOGGER_STREAM_COUNT] = {};
+        /// what each destination does with records its sink can't take
+        AF_Log_Policy _policies[AF_LOGGER_STREAM_COUNT] = {};
+        /// records each destination lost
+        uint16_t _dropped[AF_LOGGER_STREAM_COUNT] = {};
+        /// records each destination's sink took
+        uint16_t _delivered[AF_LOGGER_STREAM_COUNT] = {};
+
+        /// the record ring. each entry: the record's length, flags (see AF_Logger.cpp), the record
+        uint8_t _ring[AF_LOG_RING_LEN];
+        /// free-running index where the next record goes
+        uint16_t _head = 0;
+        /// free-running index of each destination's next record
+        uint16_t _tails[AF_LOGGER_STREAM_COUNT] = {};
+
+        /// @brief copies bytes out of the ring, across the wrap
+        void _copy_out(uint16_t at, uint8_t* dest, uint8_t len) const;
+
+        /// @brief copies bytes into the ring, across the wrap
+        void _copy_in(uint16_t at, const uint8_t* src, uint8_t len);
+
+        /// @brief makes room for len bytes, pushing out the oldest records of every destination
+        ///        still holding them. interrupts must be disabled.
+        void _make_room(uint16_t len);
+
+        /// @brief hands a destination's records to its sink until it refuses one or runs out
+        void _drain(uint8_t dest);
 
     public:
 
@@ -35,16 +166,183 @@ class AF_Logger {
             if (_instance != nullptr) {
 
             }
+            _instance = this;
         }
 
-        /// @brief  logs a message to the specified stream
-        /// @param  stream  the stream to log to
-        /// @param  message the message to log
-        void log(Stream* stream, const char * message);
+        static AF_Logger * get_instance(void) {
+            return _instance;
+        }
+
+        /// @brief sends a destination's records to a sink. records logged before it's attached
+        ///        aren't sent.
+        /// @param stream the destination, not AF_LOGGER_STREAM_ALL
+        /// @param sink   the sink, or nullptr to drop the destination's records
+        /// @param policy what to do with records the sink can't take right now
+        void attach(AF_Logger_Stream stream, AF_Log_Sink* sink, AF_Log_Policy policy = AF_LOG_POLICY_DROP);
+
+        /// @brief logs a record. use the AF_LOG macros rather than calling this directly.
+        ///        safe to call from ISRs.
+        /// @param id      the id of the format string
+        /// @param level   the level
+        /// @param streams the destinations, AF_LOG_TO_* bits
+        /// @param args    the arguments, already packed
+        /// @param len     the length of the arguments
+        void write(uint16_t id, uint8_t level, uint8_t streams, const uint8_t* args, uint8_t len);
+
+        /// @brief hands records to the sinks. register as a low priority scheduler task (see
+        ///        af_logger::update()), running often enough that the ring doesn't fill up.
+        void update(void);
+
+        /// @brief gets the number of records a destination lost, rolls over to 0 safely
+        uint16_t get_dropped(AF_Logger_Stream stream) const;
+
+        /// @brief gets the number of records a destination's sink took, rolls over to 0 safely
+        uint16_t get_delivered(AF_Logger_Stream stream) const { return _delivered[stream - 1]; }
+
+        /// @brief gets the number of bytes in the ring a destination has yet to send
+        uint16_t get_backlog(AF_Logger_Stream stream) const;
 };
 
+namespace af_logger {
+
+    /// hands log records to the sinks, register as a low priority scheduler task
+    void update(void);
+
+}
+
+namespace af_log {
+
+    /// types arguments can take on the wire
+    enum wire_type: uint8_t {
+        WIRE_NONE = 0,
+        WIRE_U8, WIRE_I8, WIRE_U16, WIRE_I16, WIRE_U32, WIRE_I32, WIRE_U64, WIRE_I64, WIRE_F32, WIRE_BOOL,
+        /// a placeholder that isn't one of the above
+        WIRE_INVALID = 0xF
+    };
+
+    /// @brief the C type of each wire type
+    template <uint8_t W> struct wire;
+    template <> struct wire<WIRE_U8> { typedef uint8_t type; };
+    template <> struct wire<WIRE_I8> { typedef int8_t type; };
+    template <> struct wire<WIRE_U16> { typedef uint16_t type; };
+    template <> struct wire<WIRE_I16> { typedef int16_t type; };
+    template <> struct wire<WIRE_U32> { typedef uint32_t type; };
+    template <> struct wire<WIRE_I32> { typedef int32_t type; };
+    template <> struct wire<WIRE_U64> { typedef uint64_t type; };
+    template <> struct wire<WIRE_I64> { typedef int64_t type; };
+    template <> struct wire<WIRE_F32> { typedef float type; };
+    template <> struct wire<WIRE_BOOL> { typedef bool type; };
+
+    /// @brief whether the placeholder name starting at at is name, up to the closing brace
+    constexpr bool _is(const char* at, const char* name) {
+        while (*name != '\0' && *at == *name) { at++; name++; }
+        return *name == '\0' && *at == '}';
+    }
+
+    /// @brief the wire type of the placeholder name starting at at
+    constexpr uint8_t _placeholder(const char* at) {
+        return _is(at, "u8") ? WIRE_U8 : _is(at, "i8") ? WIRE_I8
+             : _is(at, "u16") ? WIRE_U16 : _is(at, "i16") ? WIRE_I16
+             : _is(at, "u32") ? WIRE_U32 : _is(at, "i32") ? WIRE_I32
+             : _is(at, "u64") ? WIRE_U64 : _is(at, "i64") ? WIRE_I64
+             : _is(at, "f32") ? WIRE_F32 : _is(at, "bool") ? WIRE_BOOL
+             : WIRE_INVALID;
+    }
+
+    /// @brief works out a format string's signature at compile time: the wire type of each
+    ///        placeholder, 4 bits each from the bottom, and the number of placeholders in the
+    ///        top 4 bits. too many placeholders, or a bad one, gives WIRE_INVALID in the first slot.
+    constexpr uint32_t signature(const char* fmt) {
+        uint32_t sig = 0;
+        uint8_t count = 0;
+        for (const char* c = fmt; *c != '\0'; c++) {
+            if (*c != '{') continue;
+            if (c[1] == '{') { c++; continue; }
+            uint8_t w = _placeholder(c + 1);
+            if (w == WIRE_INVALID || count == AF_LOG_MAX_ARGS) return WIRE_INVALID;
+            sig |= (uint32_t)w << (4 * count++);
+            while (*c != '}') c++;
+        }
+        return sig | ((uint32_t)count << 28);
+    }
+
+    /// @brief the number of arguments a signature takes
+    constexpr uint8_t arg_count(uint32_t sig) { return sig >> 28; }
+
+    /// @brief whether a signature is valid
+    constexpr bool is_valid(uint32_t sig) { return (sig & 0xF) != WIRE_INVALID; }
+
+    /// @brief the size of a wire type, in bytes
+    constexpr uint8_t wire_size(uint8_t w) {
+        return (w == WIRE_U8 || w == WIRE_I8 || w == WIRE_BOOL) ? 1
+             : (w == WIRE_U16 || w == WIRE_I16) ? 2
+             : (w == WIRE_U64 || w == WIRE_I64) ? 8 : 4;
+    }
+
+    /// @brief the size of the arguments a signature takes, in bytes
+    constexpr uint8_t args_len(uint32_t sig) {
+        uint8_t len = 0;
+        for (uint8_t i = 0; i < arg_count(sig); i++) len += wire_size((sig >> (4 * i)) & 0xF);
+        return len;
+    }
+
+    /// @brief packs the arguments, see pack()
+    template <uint32_t SIG, uint8_t I>
+    inline uint8_t* _pack(uint8_t* at) {
+        return at;
+    }
+
+    /// @brief packs the arguments, see pack()
+    template <uint32_t SIG, uint8_t I, typename T, typename... Rest>
+    inline uint8_t* _pack(uint8_t* at, const T& arg, const Rest&... rest) {
+        typename wire<(SIG >> (4 * I)) & 0xF>::type value = arg;
+        memcpy(at, &value, sizeof(value));
+        return _pack<SIG, I + 1>(at + sizeof(value), rest...);
+    }
+
+    /// @brief logs a record, converting each argument to its placeholder's wire type. use the
+    ///        AF_LOG macros rather than calling this directly.
+    template <uint32_t SIG, typename... Args>
+    inline void write(uint16_t id, uint8_t level, uint8_t streams, const Args&... args) {
+        static_assert(arg_count(SIG) == sizeof...(Args), "the number of log arguments doesn't match the format string");
+        static_assert(args_len(SIG) <= AF_LOG_MAX_ARGS_LEN, "the log arguments don't fit in a record");
+        AF_Logger* logger = AF_Logger::get_instance();
+        if (logger == nullptr) return;
+        uint8_t packed[args_len(SIG) + 1];
+        _pack<SIG, 0>(packed, args...);
+        logger->write(id, level, streams, packed, args_len(SIG));
+    }
+
+    /// @brief the destinations a stream is routed to, AF_LOG_TO_* bits
+    constexpr uint8_t destinations(AF_Logger_Stream stream) {
+        return stream == AF_LOGGER_STREAM_ALL ? (AF_LOG_TO_TELMETRY | AF_LOG_TO_SD | AF_LOG_TO_SERIAL)
+                                              : (uint8_t)(1 << (stream - 1));
+    }
+
+};
+
+/// the id of a log format string, worked out at compile time. the string never reaches the vehicle.
+#define AF_LOG_ID(_fmt) (utilintern::constant<utilintern::id("log", _fmt)>::value)
+
+/// macro for logging a record
+/// @param _level  the level, AF_LOG_LEVEL_*
+/// @param _stream where to log to, an AF_Logger_Stream
+/// @param _fmt    the format string, a string literal
+#define AF_LOG(_level, _stream, _fmt, ...) do { \
+        static_assert(af_log::is_valid(af_log::signature(_fmt)), "bad placeholder in log format string"); \
+        if ((_level) >= AF_LOG_MIN_LEVEL && (af_log::destinations(_stream) & AF_LOG_ENABLED_STREAMS) != 0) { \
+            af_log::write<af_log::signature(_fmt)>(AF_LOG_ID(_fmt), (_level), \
+                af_log::destinations(_stream) & AF_LOG_ENABLED_STREAMS, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define AF_LOG_DEBUG(_stream, _fmt, ...) AF_LOG(AF_LOG_LEVEL_DEBUG, _stream, _fmt, ##__VA_ARGS__)
+#define AF_LOG_INFO(_stream, _fmt, ...) AF_LOG(AF_LOG_LEVEL_INFO, _stream, _fmt, ##__VA_ARGS__)
+#define AF_LOG_WARN(_stream, _fmt, ...) AF_LOG(AF_LOG_LEVEL_WARN, _stream, _fmt, ##__VA_ARGS__)
+#define AF_LOG_ERROR(_stream, _fmt, ...) AF_LOG(AF_LOG_LEVEL_ERROR, _stream, _fmt, ##__VA_ARGS__)
+
 /// macro for logging a message to all (open) streams, including unreserved streams.
-/// @param message the message to log
-#define AF_LOG_TO_ALL(message) AF_Logger::log(AF_LOGGER_STREAM_ALL, message)
+/// @param message the message to log, a string literal
+#define AF_LOG_TO_ALL(message) AF_LOG_INFO(AF_LOGGER_STREAM_ALL, message)
 
-#endif
\ No newline at end of file
+#endif
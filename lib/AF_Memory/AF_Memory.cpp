@@ -0,0 +1,154 @@
+#include "AF_Memory.h"
+#include <stdlib.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_Logger/AF_Logger.h>
+#include <AF_Variable/AF_Variable.h>
+
+#if !defined(AF_SIMULATOR)
+#include <avr/io.h>
+
+/// the byte free RAM is painted with
+#define STACK_PAINT 0xC5
+
+// from the linker and avr-libc's malloc
+extern uint8_t __data_start;
+extern uint8_t __heap_start;
+extern char* __brkval;
+
+/// @brief paints the RAM above .bss, where the heap and the stack will grow. runs before
+///        main() and the static constructors (.init3), while nothing is on the stack yet.
+extern "C" void _af_mem_paint(void) __attribute__((naked, used, section(".init3")));
+
+void _af_mem_paint(void) {
+    uint8_t* p = &__heap_start;
+    while (p <= (uint8_t*)RAMEND) *p++ = STACK_PAINT;
+}
+#endif
+
+/// heap bytes allocated by each subsystem, and not freed
+static uint16_t _allocated[AF_MEM_TAG_COUNT] = {};
+/// allocations that failed
+static uint16_t _failed = 0;
+/// the most bytes the heap has taken up
+static uint16_t _heap_max = 0;
+
+#if AF_MEM_PUBLISH_ENABLED
+static AF_UInt16 _var_heap("mem.heap", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+static AF_UInt16 _var_heap_max("mem.heap_max", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+static AF_UInt16 _var_stack_max("mem.stack_max", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+static AF_UInt16 _var_free("mem.free", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+static AF_UInt16 _var_static("mem.static", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+static AF_UInt16 _var_failed("mem.failed", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+// heap bytes per subsystem
+static AF_UInt16 _var_scheduler("mem.sch", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+static AF_UInt16 _var_gcs("mem.gcs", 0, AF_VAR_FLAG_READABLE_BY_GCS);
+#endif
+
+void* operator new(size_t size, AF_Mem_Tag tag) noexcept {
+    return af_mem::alloc(size, tag);
+}
+
+void operator delete(void* ptr, AF_Mem_Tag tag) noexcept {
+    // the size isn't known here, so the bytes stay counted. only reachable if a constructor throws.
+    (void)tag;
+    free(ptr);
+}
+
+namespace af_mem {
+
+    void* alloc(size_t size, AF_Mem_Tag tag) {
+        void* ptr = malloc(size);
+        if (ptr == nullptr) {
+            AF_ATOMIC_BLOCK { _failed++; }
+            AF_LOG_ERROR(AF_LOGGER_STREAM_ALL, "out of memory: {u16} bytes for subsystem {u8}", size, tag);
+            return nullptr;
+        }
+        // vehicle contexts on the host (see AF_Context.h) allocate from several threads
+        AF_ATOMIC_BLOCK {
+            _allocated[tag] += size;
+            // the heap only grows on allocation, so this is the only place to catch its peak
+            uint16_t used = get_heap_used();
+            if (used > _heap_max) _heap_max = used;
+        }
+        return ptr;
+    }
+
+    void release(void* ptr, size_t size, AF_Mem_Tag tag) {
+        if (ptr == nullptr) return;
+        free(ptr);
+        AF_ATOMIC_BLOCK { _allocated[tag] -= size; }
+    }
+
+    uint16_t get_allocated(AF_Mem_Tag tag) {
+        return _allocated[tag];
+    }
+
+    uint16_t get_failed(void) {
+        return _failed;
+    }
+
+#if defined(AF_SIMULATOR)
+
+    // the host's heap and stack say nothing about the AVR's, so only the tagged bytes count
+
+    uint16_t get_heap_used(void) {
+        uint16_t used = 0;
+        for (uint8_t i = 0; i < AF_MEM_TAG_COUNT; i++) used += _allocated[i];
+        return used;
+    }
+
+    uint16_t get_stack_max(void) {
+        return 0;
+    }
+
+    uint16_t get_free(void) {
+        return 0;
+    }
+
+    uint16_t get_static(void) {
+        return 0;
+    }
+
+#else
+
+    uint16_t get_heap_used(void) {
+        // __brkval is 0 until the first allocation
+        return __brkval != nullptr ? (uint16_t)((uint8_t*)__brkval - &__heap_start) : 0;
+    }
+
+    uint16_t get_stack_max(void) {
+        // the heap has painted over the bottom of the painted RAM as it grew, so start above it
+        const uint8_t* p = __brkval != nullptr ? (const uint8_t*)__brkval : &__heap_start;
+        while (p <= (const uint8_t*)RAMEND && *p == STACK_PAINT) p++;
+        return (uint16_t)((const uint8_t*)RAMEND - p + 1);
+    }
+
+    uint16_t get_free(void) {
+        const uint8_t* heap_end = __brkval != nullptr ? (const uint8_t*)__brkval : &__heap_start;
+        return (uint16_t)((const uint8_t*)SP - heap_end);
+    }
+
+    uint16_t get_static(void) {
+        return (uint16_t)(&__heap_start - &__data_start);
+    }
+
+#endif
+
+    uint16_t get_heap_max(void) {
+        return _heap_max;
+    }
+
+    void update(void) {
+#if AF_MEM_PUBLISH_ENABLED
+        _var_heap = get_heap_used();
+        _var_heap_max = _heap_max;
+        _var_stack_max = get_stack_max();
+        _var_free = get_free();
+        _var_static = get_static();
+        _var_failed = _failed;
+        _var_scheduler = _allocated[AF_MEM_TAG_SCHEDULER];
+        _var_gcs = _allocated[AF_MEM_TAG_GCS];
+#endif
+    }
+
+}
@@ -0,0 +1,104 @@
+#ifndef AF_MEMORY_H_
+#define AF_MEMORY_H_
+
+/// @file   AF_Memory.h
+/// @brief  accounts for where the RAM goes: heap bytes allocated by each subsystem, how high
+///         the heap has grown, and how deep the stack has been.
+///
+/// subsystems allocate with a tag, so their bytes are counted against them:
+///
+///     AF_GCS* gcs = new (AF_MEM_TAG_GCS) AF_GCS(port, baud);
+///     if (gcs == nullptr) ...
+///     ...
+///     af_mem::destroy(gcs, AF_MEM_TAG_GCS);
+///
+/// on the AVR, the free RAM between the heap and the stack is painted with a known byte before
+/// anything runs, and the deepest the stack has been is found from how much paint is left.
+/// af_mem::update() publishes everything as GCS-readable variables (mem.*), so the GCS can
+/// watch them, or subscribe them as a telemetry stream.
+///
+/// the tagged counts are the bytes asked for. the heap figures also include the allocator's
+/// own overhead (2 bytes a block on the AVR) and any holes left by freed blocks.
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// set to 0 to leave out the mem.* variables, which cost some RAM of their own
+#ifndef AF_MEM_PUBLISH_ENABLED
+#define AF_MEM_PUBLISH_ENABLED 1
+#endif
+
+/// @brief the subsystems heap bytes are counted against
+enum AF_Mem_Tag: uint8_t {
+    AF_MEM_TAG_SCHEDULER = 0,
+    AF_MEM_TAG_GCS,
+#if defined(AF_SIMULATOR)
+    /// what a vehicle context on the host holds for itself, see AF_Context.h. not published.
+    AF_MEM_TAG_CONTEXT,
+#endif
+    /// the number of tags
+    AF_MEM_TAG_COUNT
+};
+
+/// @brief allocates from the heap, counting the bytes against a subsystem. see af_mem::alloc().
+///        non-throwing, so a new expression checks for nullptr and skips the constructor
+///        when the heap runs out. callers have to check the result.
+void* operator new(size_t size, AF_Mem_Tag tag) noexcept;
+
+/// @brief frees an allocation whose constructor threw, which never happens on the AVR
+void operator delete(void* ptr, AF_Mem_Tag tag) noexcept;
+
+namespace af_mem {
+
+    /// @brief allocates from the heap, counting the bytes against a subsystem
+    /// @param size the number of bytes
+    /// @param tag  the subsystem
+    /// @return the allocation, or nullptr if the heap ran into the stack. failures are
+    ///         counted and logged.
+    void* alloc(size_t size, AF_Mem_Tag tag);
+
+    /// @brief frees an allocation from alloc()
+    /// @param ptr  the allocation
+    /// @param size the number of bytes it was allocated with
+    /// @param tag  the subsystem it was allocated for
+    void release(void* ptr, size_t size, AF_Mem_Tag tag);
+
+    /// @brief destroys an object made with a tagged new
+    /// @param obj the object, may be nullptr
+    /// @param tag the subsystem it was allocated for
+    template <typename T>
+    void destroy(T* obj, AF_Mem_Tag tag) {
+        if (obj == nullptr) return;
+        obj->~T();
+        release(obj, sizeof(T), tag);
+    }
+
+    /// @brief gets the heap bytes a subsystem has allocated and not freed
+    uint16_t get_allocated(AF_Mem_Tag tag);
+
+    /// @brief gets the number of allocations that failed
+    uint16_t get_failed(void);
+
+    /// @brief gets the bytes of RAM the heap takes up now
+    uint16_t get_heap_used(void);
+
+    /// @brief gets the most bytes of RAM the heap has taken up
+    uint16_t get_heap_max(void);
+
+    /// @brief gets the deepest the stack has been, in bytes. 0 on the simulator.
+    uint16_t get_stack_max(void);
+
+    /// @brief gets the bytes free between the heap and the stack right now. 0 on the simulator.
+    uint16_t get_free(void);
+
+    /// @brief gets the bytes of RAM taken by globals and statics (.data and .bss), 0 on the
+    ///        simulator. see the map file or avr-nm for the biggest.
+    uint16_t get_static(void);
+
+    /// @brief publishes the figures to the mem.* variables. register as a low priority task,
+    ///        around 1 Hz: measuring the stack scans the free RAM.
+    void update(void);
+
+}
+
+#endif // AF_MEMORY_H_
@@ -0,0 +1,54 @@
+#include "AF_Profiler.h"
+#include <AF_Logger/AF_Logger.h>
+
+AF_Profile_Point* AF_Profile_Point::_first = nullptr;
+
+AF_Profile_Point::AF_Profile_Point(uint16_t id) : _id(id) {
+    // points are defined at file scope, so this runs before anything is timed
+    _next = _first;
+    _first = this;
+}
+
+void AF_Profile_Point::reset(void) {
+    _calls = 0;
+    _cycles = 0;
+    _min = 0xFFFFFFFFUL;
+    _max = 0;
+}
+
+namespace af_profile {
+
+    /// @brief logs one point's counts
+    static void _report(uint16_t id, uint32_t calls, uint32_t cycles, uint32_t min, uint32_t max) {
+        // tools/af_profile.py looks for this format string, keep them the same
+        AF_LOG_INFO(AF_LOGGER_STREAM_ALL, "profile {u16}: {u32} calls, {u32} cycles, min {u32}, max {u32}",
+                    id, calls, cycles, min, max);
+    }
+
+    void report(void) {
+        // time empty scopes, to measure what timing a scope costs on its own: the window a
+        // scope measures runs from one cycles() returning to the next one reading the counter
+        uint32_t total = 0;
+        uint32_t min = 0xFFFFFFFFUL;
+        uint32_t max = 0;
+        for (uint8_t i = 0; i < 16; i++) {
+            uint32_t start = AF_HAL::cycles();
+            uint32_t cycles = AF_HAL::cycles() - start;
+            total += cycles;
+            if (cycles < min) min = cycles;
+            if (cycles > max) max = cycles;
+        }
+        _report(AF_PROFILE_ID("overhead"), 16, total, min, max);
+
+        for (AF_Profile_Point* point = AF_Profile_Point::get_first(); point != nullptr; point = point->get_next()) {
+            _report(point->get_id(), point->get_calls(), point->get_cycles(), point->get_min(), point->get_max());
+        }
+    }
+
+    void reset(void) {
+        for (AF_Profile_Point* point = AF_Profile_Point::get_first(); point != nullptr; point = point->get_next()) {
+            point->reset();
+        }
+    }
+
+}
@@ -0,0 +1,128 @@
+#ifndef AF_PROFILER_H_
+#define AF_PROFILER_H_
+
+/// @file   AF_Profiler.h
+/// @brief  counts the cpu cycles spent in hot paths, so their cost can be measured on the
+///         vehicle and checked for regressions.
+///
+/// a profile point sums the cycles spent in every scope timed against it:
+///
+///     AF_PROFILE_POINT(_prof_output, "pid.output");
+///
+///     float PID::output(float error) {
+///         AF_PROFILE_SCOPE(_prof_output);
+///         ...
+///     }
+///
+/// af_profile::report() logs every point's counts (with the point's name interned, like the
+/// log format strings), and tools/af_profile.py turns a capture of the log into cycles per
+/// call, and compares it against a baseline. cycles come from AF_HAL::cycles(), so on the AVR,
+/// and on an AVR simulator like simavr running the same firmware, they're exact. on the
+/// simulator HAL they're derived from the host clock, which is good for quick comparisons only:
+/// `make -C test profile` runs the hot paths that way (test/profile_hot_paths.cpp).
+///
+/// points are compiled out unless AF_PROFILE_ENABLED is set, so they cost nothing in flight
+/// builds. points are for task code: don't time scopes in ISRs.
+
+#include <stdint.h>
+#include <util.h>
+#include <AF_HAL/AF_HAL.h>
+
+/// set to 1 to compile in the profile points
+#ifndef AF_PROFILE_ENABLED
+#define AF_PROFILE_ENABLED 0
+#endif
+
+/// @brief the cycle counts of one hot path
+class AF_Profile_Point {
+
+    private:
+
+        /// the first point in the list of every point
+        static AF_Profile_Point* _first;
+        /// the next point in the list
+        AF_Profile_Point* _next;
+
+        /// the interned name, see AF_PROFILE_ID()
+        uint16_t _id;
+        /// times the scope ran, rolls over to 0 safely
+        uint32_t _calls = 0;
+        /// cycles spent in the scope over every call, rolls over to 0 safely
+        uint32_t _cycles = 0;
+        /// the fewest cycles a call took
+        uint32_t _min = 0xFFFFFFFFUL;
+        /// the most cycles a call took
+        uint32_t _max = 0;
+
+    public:
+
+        /// @param id the interned name, see AF_PROFILE_ID()
+        AF_Profile_Point(uint16_t id);
+
+        /// @brief counts a call
+        /// @param cycles the cycles the call took
+        void add(uint32_t cycles) {
+            _calls++;
+            _cycles += cycles;
+            if (cycles < _min) _min = cycles;
+            if (cycles > _max) _max = cycles;
+        }
+
+        /// @brief forgets every call counted so far
+        void reset(void);
+
+        uint16_t get_id(void) const { return _id; }
+        uint32_t get_calls(void) const { return _calls; }
+        uint32_t get_cycles(void) const { return _cycles; }
+        /// @brief gets the fewest cycles a call took, 0 if there were no calls
+        uint32_t get_min(void) const { return _calls > 0 ? _min : 0; }
+        uint32_t get_max(void) const { return _max; }
+
+        /// @brief gets the first point, to walk the list of every point with get_next()
+        static AF_Profile_Point* get_first(void) { return _first; }
+        AF_Profile_Point* get_next(void) const { return _next; }
+
+};
+
+/// @brief times a scope against a profile point, use AF_PROFILE_SCOPE()
+class AF_Profile_Scope {
+
+    private:
+
+        AF_Profile_Point& _point;
+        /// the cycle count when the scope was entered
+        uint32_t _start;
+
+    public:
+
+        AF_Profile_Scope(AF_Profile_Point& point) : _point(point), _start(AF_HAL::cycles()) {}
+
+        ~AF_Profile_Scope() { _point.add(AF_HAL::cycles() - _start); }
+
+};
+
+/// the interned id of a profile point's name, worked out at compile time
+#define AF_PROFILE_ID(_name) (utilintern::constant<utilintern::id("profile", _name)>::value)
+
+#if AF_PROFILE_ENABLED
+/// defines a profile point, at file scope. the name is a string literal.
+#define AF_PROFILE_POINT(_point, _name) static AF_Profile_Point _point(AF_PROFILE_ID(_name))
+/// times the rest of the enclosing scope against a profile point
+#define AF_PROFILE_SCOPE(_point) AF_Profile_Scope _af_profile_scope_##_point(_point)
+#else
+#define AF_PROFILE_POINT(_point, _name) static_assert(true, "")
+#define AF_PROFILE_SCOPE(_point) do { } while (0)
+#endif
+
+namespace af_profile {
+
+    /// @brief logs every point's counts at info level, and the cycles an empty scope takes so
+    ///        they can be taken off. call every few seconds, or at the end of a benchmark run.
+    void report(void);
+
+    /// @brief forgets every call counted so far, i.e. once the vehicle's done booting
+    void reset(void);
+
+}
+
+#endif // AF_PROFILER_H_
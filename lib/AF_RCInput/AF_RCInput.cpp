@@ -0,0 +1,126 @@
+#include "AF_RCInput.h"
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/rcin_hal.h>
+#include <string.h>
+
+/// the first byte of an SBUS frame
+#define SBUS_HEADER 0x0F
+/// the last byte of an SBUS frame
+#define SBUS_FOOTER 0x00
+/// the flags byte of an SBUS frame
+#define SBUS_FLAGS_IDX 23
+/// flag bit set when the receiver has lost the transmitter
+#define SBUS_FLAG_FAILSAFE (1 << 3)
+/// the number of 11-bit proportional channels in an SBUS frame
+#define SBUS_NUM_CHANNELS 16
+
+// --- AF_RCInput ---
+
+bool AF_RCInput::read(AF_RC_Frame& out) const {
+    // decoders only publish from update(), which runs as a task, so a task
+    // reading the frame can never see it half written
+    out = _topic.get();
+    return _topic.get_generation() != 0;
+}
+
+uint32_t AF_RCInput::get_frame_age_us(void) const {
+    if (_topic.get_generation() == 0) return 0xFFFFFFFF;
+    return AF_HAL::micros() - _topic.get().received_at_us;
+}
+
+bool AF_RCInput::in_failsafe(void) const {
+    return _topic.get_generation() == 0 || _topic.get().failsafe || get_frame_age_us() > AF_RC_FAILSAFE_TIMEOUT_US;
+}
+
+void AF_RCInput::_publish(const uint16_t* channels, uint8_t num_channels, bool failsafe) {
+    // written in place, subscribers read the topic's copy
+    AF_RC_Frame& frame = _topic.claim();
+    memcpy(frame.channels, channels, num_channels * sizeof(uint16_t));
+    frame.num_channels = num_channels;
+    frame.failsafe = failsafe;
+    frame.received_at_us = AF_HAL::micros();
+    _topic.publish();
+    _frames_good++;
+}
+
+// --- AF_RCInput_PPM ---
+
+void AF_RCInput_PPM::begin(void) {
+    _work_count = 0xFF;
+    AF_HAL::rcin::ppm_start();
+}
+
+void AF_RCInput_PPM::update(void) {
+
+    uint16_t widths[AF_RCIN_PPM_QUEUE_LEN];
+    uint8_t n = AF_HAL::rcin::ppm_read(widths, AF_RCIN_PPM_QUEUE_LEN);
+
+    for (uint8_t i = 0; i < n; i++) {
+        uint16_t us = widths[i] / AF_RCIN_PPM_TICKS_PER_US;
+
+        // a long gap ends the frame
+        if (us >= AF_RC_PPM_SYNC_US) {
+            if (_work_count != 0xFF) {
+                if (_work_count >= AF_RC_PPM_MIN_CHANNELS) {
+                    _publish(_work, _work_count, false);
+                } else {
+                    _frames_bad++;
+                }
+            }
+            _work_count = 0;
+            continue;
+        }
+
+        // nothing to decode until the first sync gap
+        if (_work_count == 0xFF) continue;
+
+        // a pulse out of range or too many channels means we've lost the frame, so wait for the next sync
+        if (us < AF_RC_PPM_MIN_PULSE_US || us > AF_RC_PPM_MAX_PULSE_US || _work_count >= AF_RC_MAX_CHANNELS) {
+            _frames_bad++;
+            _work_count = 0xFF;
+            continue;
+        }
+
+        _work[_work_count++] = us;
+    }
+}
+
+// --- AF_RCInput_SBUS ---
+
+void AF_RCInput_SBUS::update(void) {
+
+    while (_port->available() >= AF_RC_SBUS_FRAME_LEN) {
+
+        // check the header and footer in place before copying anything. the header byte can
+        // also show up inside a frame, so on a mismatch only skip one byte and look again.
+        if (_port->peek(0) != SBUS_HEADER || _port->peek(AF_RC_SBUS_FRAME_LEN - 1) != SBUS_FOOTER) {
+            _port->consume(1);
+            // one lost frame for the first byte skipped, and another for every frame's worth after it
+            if (_skipped == 0) _frames_bad++;
+            if (++_skipped == AF_RC_SBUS_FRAME_LEN) _skipped = 0;
+            continue;
+        }
+        _skipped = 0;
+
+        uint8_t frame[AF_RC_SBUS_FRAME_LEN];
+        _port->read(AF_RC_SBUS_FRAME_LEN, frame);
+
+        // 16 channels of 11 bits each, packed little-endian into bytes 1-22
+        uint16_t channels[SBUS_NUM_CHANNELS];
+        uint32_t bits = 0;
+        uint8_t num_bits = 0;
+        uint8_t ch = 0;
+        for (uint8_t i = 1; i < SBUS_FLAGS_IDX; i++) {
+            bits |= (uint32_t)frame[i] << num_bits;
+            num_bits += 8;
+            if (num_bits >= 11) {
+                // 172-1811 maps to 988-2012 us
+                channels[ch++] = ((bits & 0x07FF) * 5) / 8 + 880;
+                bits >>= 11;
+                num_bits -= 11;
+            }
+        }
+
+        _publish(channels, SBUS_NUM_CHANNELS, frame[SBUS_FLAGS_IDX] & SBUS_FLAG_FAILSAFE);
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef AF_RCINPUT_H_
+#define AF_RCINPUT_H_
+
+/// @file   AF_RCInput.h
+/// @brief  decodes RC receivers (PPM and SBUS) into a snapshot of channel values that
+///         control tasks can read, with failsafe and frame-age tracking. decoding runs in
+///         a scheduler task through update(), never once per byte or per edge.
+///         every frame is published to the receiver's topic (see AF_Topic.h), so control
+///         tasks can subscribe to new frames instead of polling for them.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <util.h>
+#include <AF_Topic/AF_Topic.h>
+
+/// the most channels any receiver protocol provides
+#define AF_RC_MAX_CHANNELS 16
+/// how old the last good frame can get before the receiver is considered lost
+#define AF_RC_FAILSAFE_TIMEOUT_US 100000UL
+/// the shortest valid PPM channel pulse, in microseconds
+#define AF_RC_PPM_MIN_PULSE_US 700
+/// the longest valid PPM channel pulse, in microseconds
+#define AF_RC_PPM_MAX_PULSE_US 2300
+/// a PPM gap longer than this marks the end of a frame, in microseconds
+#define AF_RC_PPM_SYNC_US 2700
+/// the fewest channels in a valid PPM frame
+#define AF_RC_PPM_MIN_CHANNELS 4
+/// the length of an SBUS frame, in bytes
+#define AF_RC_SBUS_FRAME_LEN 25
+/// the SBUS baud rate (8E2, inverted)
+#define AF_RC_SBUS_BAUD 100000UL
+
+/// @brief a consistent snapshot of the receiver's channels
+struct AF_RC_Frame {
+    /// the channel values, in microseconds
+    uint16_t channels[AF_RC_MAX_CHANNELS];
+    /// how many channels the receiver sent
+    uint8_t num_channels;
+    /// whether the receiver itself reported failsafe
+    bool failsafe;
+    /// when the frame was decoded, in system microseconds
+    uint32_t received_at_us;
+};
+
+/// @brief common interface for receiver decoders
+class AF_RCInput {
+
+    public:
+
+        /// @param topic_id the id of the topic frames are published to, i.e.
+        ///                 AF_TOPIC_ID("rc.frame"). each receiver needs its own.
+        AF_RCInput(uint16_t topic_id) : _topic(topic_id) {}
+
+        virtual ~AF_RCInput() {}
+
+        /// @brief decodes everything the receiver has sent since the last call.
+        ///        register this as a scheduler task.
+        virtual void update(void) = 0;
+
+        /// @brief copies the latest frame
+        /// @param out set to the latest frame
+        /// @return true if a frame has ever been decoded, false otherwise
+        bool read(AF_RC_Frame& out) const;
+
+        /// @brief gets a channel from the latest frame
+        /// @param channel the channel, starting at 0
+        /// @return the channel value in microseconds, or 0 if the receiver didn't send it
+        uint16_t get_channel(uint8_t channel) const {
+            const AF_RC_Frame& frame = _topic.get();
+            return channel < frame.num_channels ? frame.channels[channel] : 0;
+        }
+
+        /// @brief gets the topic every decoded frame is published to, to subscribe to
+        ///        (see AF_Subscriber) or forward to another processor
+        AF_Topic<AF_RC_Frame>& get_topic(void) { return _topic; }
+
+        /// @brief gets how long ago the latest frame was decoded
+        /// @return the age of the latest frame in microseconds, or 0xFFFFFFFF if there's been no frame
+        uint32_t get_frame_age_us(void) const;
+
+        /// @brief whether the receiver reported failsafe, or its frames are too old to trust
+        bool in_failsafe(void) const;
+
+        /// @brief gets the number of frames decoded, rolls over to 0 safely
+        uint16_t get_frames_good(void) const { return _frames_good; }
+
+        /// @brief gets the number of frames thrown away as malformed, rolls over to 0 safely
+        uint16_t get_frames_bad(void) const { return _frames_bad; }
+
+    protected:
+
+        /// @brief stores a decoded frame as the latest snapshot
+        void _publish(const uint16_t* channels, uint8_t num_channels, bool failsafe);
+
+        /// the latest frame, with a generation that goes up with every frame decoded
+        AF_Topic<AF_RC_Frame> _topic;
+        /// the number of frames decoded
+        uint16_t _frames_good = 0;
+        /// the number of frames thrown away as malformed
+        uint16_t _frames_bad = 0;
+
+};
+
+/// @brief decodes PPM from the input capture queue (see AF_HAL/rcin_hal.h)
+class AF_RCInput_PPM: public AF_RCInput {
+
+    public:
+
+        /// @param topic_id the id of the topic frames are published to, see AF_RCInput()
+        AF_RCInput_PPM(uint16_t topic_id) : AF_RCInput(topic_id) {}
+
+        /// @brief starts input capture
+        void begin(void);
+
+        virtual void update(void);
+
+    private:
+
+        /// the channels of the frame being decoded
+        uint16_t _work[AF_RC_MAX_CHANNELS];
+        /// how many channels of the frame being decoded have been seen, or 0xFF until the first sync
+        uint8_t _work_count = 0xFF;
+
+};
+
+/// @brief decodes SBUS frames from a serial port's RX buffer
+class AF_RCInput_SBUS: public AF_RCInput {
+
+    public:
+
+        /// @param port     the serial port the receiver is connected to
+        /// @param topic_id the id of the topic frames are published to, see AF_RCInput()
+        AF_RCInput_SBUS(Stream* port, uint16_t topic_id) : AF_RCInput(topic_id), _port(port) {};
+
+        virtual void update(void);
+
+    private:
+
+        /// the serial port the receiver is connected to
+        Stream* _port;
+        /// how many bytes have been skipped looking for the next frame, so a lost frame
+        /// counts once however many bytes it takes to resync
+        uint8_t _skipped = 0;
+
+};
+
+#endif // AF_RCINPUT_H_
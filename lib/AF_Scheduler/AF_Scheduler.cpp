@@ -1,29 +1,53 @@
 #include "AF_Scheduler.h"
 #include <system.h>
 #include <AF_Logger/AF_Logger.h>
+#include <AF_Profiler/AF_Profiler.h>
+#include <AF_Memory/AF_Memory.h>
 
 #pragma region AF_Scheduler_Variable_Ids
 
-#define SCHEDULER_AVG_LOOP_TIME_MS  sch.altms
+#define SCHEDULER_AVG_LOOP_TIME_US  sch.altus
 
 #pragma endregion
 
+/// the loop time is averaged over about 2^SCHEDULER_LOOP_TIME_SHIFT ticks
+#define SCHEDULER_LOOP_TIME_SHIFT 4
+
 /// the default loop frequency, in hz
 #define DEFAULT_LOOP_FREQ_HZ        1000U
 
+AF_PROFILE_POINT(_prof_tick, "scheduler.tick");
+
+AF_Scheduler* AF_Scheduler::_instance = nullptr;
+
 AF_Scheduler::AF_Scheduler(void) {    
     // set the loop frequency
 #if defined(AF_SCHEDULER_LOOP_FREQ_HZ)
-    _loop_freq_hz = AF_SCHEDULER_LOOP_FREQ_HZ
+    _loop_freq_hz = AF_SCHEDULER_LOOP_FREQ_HZ;
 #else
      _loop_freq_hz = DEFAULT_LOOP_FREQ_HZ;
 #endif
    
 }
 
+AF_Scheduler::~AF_Scheduler() {
+    while (_head != nullptr) remove_task(_head->id);
+}
+
 AF_Scheduler* AF_Scheduler::get_instance(void) {
+#if defined(AF_SIMULATOR)
+    // on the host, each vehicle context has its own, see AF_Context.h
+    AF_Context* context = AF_Context::current();
+    if (context != nullptr) {
+        if (context->_scheduler == nullptr) context->_scheduler = new (AF_MEM_TAG_SCHEDULER) AF_Scheduler();
+        if (context->_scheduler == nullptr) AF_SYSTEM_PANIC();
+        return context->_scheduler;
+    }
+#endif
     if (_instance == nullptr) {
-        _instance = new AF_Scheduler();
+        _instance = new (AF_MEM_TAG_SCHEDULER) AF_Scheduler();
+        // nothing runs without the scheduler, so there's nothing to carry on with
+        if (_instance == nullptr) AF_SYSTEM_PANIC();
     }
     return _instance;
 }
@@ -33,6 +57,7 @@ uint16_t AF_Scheduler::get_loop_time_us(void) const {
 }
 
 void AF_Scheduler::tick(void) {
+    AF_PROFILE_SCOPE(_prof_tick);
     // mark the task runner start time
     uint32_t start = AF_HAL::micros();
     // run tasks
@@ -42,15 +67,74 @@ void AF_Scheduler::tick(void) {
     // increment tick count
     _tick_count++;
     // tell the scheduler how long the loop took to update the running avg
-    _notify_loop_runtime(start - end);
+    _notify_loop_runtime(end - start);
+}
+
+void AF_Scheduler::_run_tasks(uint16_t time_available_us) {
+
+    // keep track of when we started, so we know when to stop
+    uint32_t start = AF_HAL::micros();
+    int16_t time_left = time_available_us;
+
+    while (time_left > 0) {
+        
+        // nothing registered yet
+        if (_read_idx == nullptr) break;
+
+        AF_Scheduler_Task_Node* node = _read_idx;
+        AF_Scheduler_Task* cur_task = node->task;
+        // update the read index first, the task may be removed below
+        _read_idx = node->next;
+        if (_read_idx == nullptr) _read_idx = _head;
+
+        uint32_t now = AF_HAL::micros();
+        // look at the next task in the list, see if we can run it
+        // - due to run AND we have enough time.
+        if (cur_task->is_due(now) && cur_task->get_expected_us() <= time_left) {
+            // run it
+            cur_task->run(now);
+            // is the task one time? if so, remove it.
+            if (!cur_task->is_recurring()) {
+                remove_task(node->id);
+            }
+        }
+        // finally, update the time left. unsigned subtraction keeps the elapsed time right across rollover.
+        time_left = time_available_us - (AF_HAL::micros() - start);
+        
+        // prevent wasting time (i.e. if we don't have any tasks that can fill remaining time,
+        // then we'll be idling in this loop until time_left == 0). this is inefficient.
+        // so quit early if we can't do anything.
+        if (time_left < _min_expected_runtime_us) {
+            _extra_time = time_left;
+            return;
+        }
+
+    }
+
+    _extra_time = 0;
+
+}
+
+void AF_Scheduler::_notify_loop_runtime(uint32_t new_runtime_us) {
+    // an exponential moving average, kept scaled up so steps smaller than the divisor still count
+    if (_tick_count == 1) _loop_time_scaled = new_runtime_us << SCHEDULER_LOOP_TIME_SHIFT;
+    else _loop_time_scaled += new_runtime_us - (_loop_time_scaled >> SCHEDULER_LOOP_TIME_SHIFT);
+    uint32_t average_us = _loop_time_scaled >> SCHEDULER_LOOP_TIME_SHIFT;
+    _average_loop_time_us = average_us > 0xFFFF ? 0xFFFF : average_us;
 }
 
 scheduler_task_id_t AF_Scheduler::register_task(void (*func)(void), uint16_t expected_us, uint16_t freq) {
     // create the task node
-    AF_Scheduler_Task_Node* node = new AF_Scheduler_Task_Node();
+    AF_Scheduler_Task_Node* node = new (AF_MEM_TAG_SCHEDULER) AF_Scheduler_Task_Node();
+    if (node == nullptr) return AF_SCHEDULER_NO_TASK;
     // create the task
-    node->task = new AF_Scheduler_Task(func, expected_us, freq);
-    // set the task id
+    node->task = new (AF_MEM_TAG_SCHEDULER) AF_Scheduler_Task(func, expected_us, freq);
+    if (node->task == nullptr) {
+        af_mem::destroy(node, AF_MEM_TAG_SCHEDULER);
+        return AF_SCHEDULER_NO_TASK;
+    }
+    // set the task id, never the one that means failure
+    if (_next_task_id == AF_SCHEDULER_NO_TASK) _next_task_id = 0;
     node->id = _next_task_id++;
     // place the task into the list
     if (_head == nullptr) {
@@ -60,6 +144,8 @@ scheduler_task_id_t AF_Scheduler::register_task(void (*func)(void), uint16_t exp
         _tail->next = node;
         _tail = node;
     }
+    // start the task runner on the first task
+    if (_read_idx == nullptr) _read_idx = node;
 
     // keep track of the min task time to prevent unused loop time
     if (expected_us < _min_expected_runtime_us) _min_expected_runtime_us = expected_us;
@@ -81,10 +167,13 @@ bool AF_Scheduler::remove_task(scheduler_task_id_t id) {
             } else {
                 prev->next = cur->next;
             }
+            if (_tail == cur) _tail = prev;
+            // don't leave the task runner on the removed task
+            if (_read_idx == cur) _read_idx = cur->next != nullptr ? cur->next : _head;
             // delete the task
-            delete cur->task;
+            af_mem::destroy(cur->task, AF_MEM_TAG_SCHEDULER);
             // delete the node
-            delete cur;
+            af_mem::destroy(cur, AF_MEM_TAG_SCHEDULER);
             return true;
         }
         // update the prev pointer
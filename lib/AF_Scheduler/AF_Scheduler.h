@@ -19,6 +19,9 @@ enum AF_Scheduler_Task_Priority {
 
 typedef uint16_t scheduler_task_id_t;
 
+/// the id register_task() returns when the task couldn't be registered
+#define AF_SCHEDULER_NO_TASK ((scheduler_task_id_t)0xFFFF)
+
 class AF_Scheduler_Task {
 
     protected:
@@ -35,8 +38,9 @@ class AF_Scheduler_Task {
         /// the priority of the task
         // AF_Scheduler_Task_Priority priority;
 
-        // the next time the task should run
-        uint32_t next_run_at = 0;
+        // the next time the task should run, compared with AF_HAL::time_reached() so it
+        // survives micros() rolling over
+        uint32_t next_run_at;
 
     public:
 
@@ -44,12 +48,15 @@ class AF_Scheduler_Task {
             this->func = func;
             this->expected_us = expected_us;
             this->freq = freq;
+            // due straight away. 0 would only be due for the first 35 minutes after boot.
+            this->next_run_at = AF_HAL::micros();
         }
 
         /// @brief runs the task's function
         void run(uint32_t now) {
             func();
-            next_run_at = now + get_period_us();
+            // a one-time task has no period, it's removed once it's run
+            if (is_recurring()) next_run_at = now + get_period_us();
         }
 
         /// @brief gets the expected runtime of the task in microseconds
@@ -70,6 +77,10 @@ class AF_Scheduler_Task {
         /// get the next time the task should run, in system microseconds
         uint32_t get_next_run_at_us() const { return next_run_at; }
 
+        /// @brief whether the task is due to run, correct across micros() rollover
+        /// @param now the current time, in system microseconds
+        inline bool is_due(uint32_t now) const { return AF_HAL::time_reached(now, next_run_at); }
+
         inline bool is_recurring(void) const { return freq > 0; }
 
 
@@ -110,21 +121,28 @@ class AF_Scheduler {
             /// Private constructor
             AF_Scheduler(void);
             
-            /// @brief variable published to the GCS containing the average loop time of the scheduler
-            AF_UInt16 _average_loop_time_ms = AF_UInt16("sch.altms", 0, AF_VAR_FLAG_READABLE_BY_GCS | AF_VAR_FLAG_BLACKBOX_LOGGED);
+            /// the average loop time, in microseconds scaled up by 2^SCHEDULER_LOOP_TIME_SHIFT
+            uint32_t _loop_time_scaled = 0;
+            /// @brief variable published to the GCS containing the average loop time of the scheduler,
+            ///        in microseconds
+            AF_UInt16 _average_loop_time_us = AF_UInt16("sch.altus", 0, AF_VAR_FLAG_READABLE_BY_GCS | AF_VAR_FLAG_BLACKBOX_LOGGED);
 
             /// @brief runs registered tasks for the allotted time
             /// @param time_available_us how much time is available for running tasks in microseconds
             void _run_tasks(uint16_t time_available_us);
 
             /// @brief updates the average runtime of the loop for optimising the scheduler
-            /// @param new_runtime_ms the latest runtime of the loop in microseconds
+            /// @param new_runtime_us the latest runtime of the loop in microseconds
             void _notify_loop_runtime(uint32_t new_runtime_us);
 
     public:
 
-        /// @brief gets the instance of the scheduler
-        AF_Scheduler* get_instance(void);
+        /// @brief removes every task. the scheduler is never destroyed on the AVR, only with
+        ///        its context on the host (see AF_Context.h).
+        ~AF_Scheduler();
+
+        /// @brief gets the instance of the scheduler, or on the host the current context's
+        static AF_Scheduler* get_instance(void);
 
         /// @brief causes the scheduler to run tasks and collect data (+1 tick)
         void tick(void);
@@ -142,6 +160,7 @@ class AF_Scheduler {
         /// @param func the function to call for the task
         /// @param expected_us the expected runtime of the task in microseconds
         /// @param freq the frequency of the task in Hz, or 0 for a one-time task
+        /// @return the id of the task, or AF_SCHEDULER_NO_TASK if the heap ran out
         scheduler_task_id_t register_task(void (*func)(void), uint16_t expected_us, uint16_t freq);
 
         /// @brief removes a task from the scheduler
@@ -151,50 +170,6 @@ class AF_Scheduler {
 
 };
 
-void AF_Scheduler::_run_tasks(uint16_t time_available_us) {
-
-    // keep track of when we started, so we know when to stop
-    uint32_t start = AF_HAL::micros();
-    int16_t time_left = time_available_us;
-
-    while (time_left > 0) {
-        
-        AF_Scheduler_Task* cur_task = _read_idx->task;
-        uint32_t now = AF_HAL::micros();
-        // look at the next task in the list, see if we can run it
-        // - due to run AND we have enough time.
-        if (cur_task->get_next_run_at_us() <= now && cur_task->get_expected_us() <= time_left) {
-            // run it
-            cur_task->run(now);
-            // is the task one time? if so, remove it.
-            if (!cur_task->is_recurring()) {
-                remove_task(_read_idx->id);
-            }
-        }
-        // update the read index
-        _read_idx = _read_idx->next;
-        if (_read_idx == nullptr) _read_idx = _head;
-        // finally, update the time left
-        time_left = time_available_us - (AF_HAL::micros() - start);
-        
-        // prevent wasting time (i.e. if we don't have any tasks that can fill remaining time,
-        // then we'll be idling in this loop until time_left == 0). this is inefficient.
-        // so quit early if we can't do anything.
-        if (time_left < _min_expected_runtime_us) {
-            _extra_time = time_left;
-            return;
-        }
-
-    }
-
-    _extra_time = 0;
-
-}
-
-void AF_Scheduler::_notify_loop_runtime(uint32_t new_runtime_us) {
-    _average_loop_time_ms = _average_loop_time_ms + ( new_runtime_us / _tick_count );
-}
-
 // macro for creating a recurring task
 // @param _func the function to call for the task
 // @param _expected_us the expected runtime of the task in microseconds
@@ -209,10 +184,10 @@ void AF_Scheduler::_notify_loop_runtime(uint32_t new_runtime_us) {
 #define AF_SCHEDULER_ONE_TIME_TASK(_func, _expected_ms) AF_Scheduler::get_instance()->register_task(_func, _expected_ms, 0)
 
 
-namespace AF_Logger {
+namespace af_logger {
 
     /// @brief dump task information to the log
-    void log_scheduler_task_info(void) {
+    inline void log_scheduler_task_info(void) {
         // impl
     }
 
@@ -0,0 +1,223 @@
+#include "AF_TimeSync.h"
+#include <AF_HAL/AF_HAL.h>
+#include <AF_GCS/AF_GCS.h>
+#include <AF_Variable/AF_Variable.h>
+
+/// the payload kinds
+#define TIMESYNC_REQUEST 0
+#define TIMESYNC_REPLY 1
+
+AF_TimeSync::AF_TimeSync(AF_TimeSync_Role role) :
+    _role(role),
+    _var_err_us("sync_err_us", 0xFFFFFFFFUL, AF_VAR_FLAG_READABLE_BY_GCS),
+    _var_offset_us("sync_off_us", 0, AF_VAR_FLAG_READABLE_BY_GCS),
+    _var_drift_ppb("sync_drift_ppb", 0, AF_VAR_FLAG_READABLE_BY_GCS),
+    _var_delay_us("sync_delay_us", 0, AF_VAR_FLAG_READABLE_BY_GCS) {}
+
+static void _put32(uint8_t* out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = value >> 24;
+}
+
+static uint32_t _get32(const uint8_t* in) {
+    return in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+void AF_TimeSync::make_request(uint32_t now, uint8_t* payload) {
+    _seq++;
+    _requested_at = now;
+    _requested = true;
+    _awaiting = true;
+
+    payload[0] = TIMESYNC_REQUEST;
+    payload[1] = _seq;
+    _put32(payload + 2, now);
+    _put32(payload + 6, 0);
+    _put32(payload + 10, 0);
+}
+
+bool AF_TimeSync::on_payload(const uint8_t* payload, uint8_t len, uint32_t now, uint8_t* reply) {
+    if (len < AF_TIMESYNC_PAYLOAD_LEN) return false;
+
+    if (payload[0] == TIMESYNC_REQUEST) {
+        if (_role != AF_TIMESYNC_MASTER) return false;
+        // the reply goes out as soon as the link lets it, and the time it waits counts
+        // towards the delay rather than the offset
+        reply[0] = TIMESYNC_REPLY;
+        reply[1] = payload[1];
+        memcpy(reply + 2, payload + 2, 4);
+        _put32(reply + 6, now);
+        _put32(reply + 10, now);
+        return true;
+    }
+
+    if (payload[0] != TIMESYNC_REPLY || _role != AF_TIMESYNC_CLIENT) return false;
+    uint32_t t1 = _get32(payload + 2);
+    uint32_t t2 = _get32(payload + 6);
+    uint32_t t3 = _get32(payload + 10);
+    uint32_t t4 = now;
+    // only the reply to the last request counts, an older one has waited who knows where
+    if (!_awaiting || payload[1] != _seq || t1 != _requested_at) return false;
+    _awaiting = false;
+
+    int32_t delay = (int32_t)(t4 - t1) - (int32_t)(t3 - t2);
+    if (delay < 0 || delay > AF_TIMESYNC_MAX_DELAY_US) {
+        _rejected++;
+        return false;
+    }
+
+    // the offset can be anything, so add the halves in 64 bits
+    int64_t offset = ((int64_t)(int32_t)(t2 - t1) + (int64_t)(int32_t)(t3 - t4)) / 2;
+
+    Sample& sample = _samples[_next];
+    sample.local = t1 + (t4 - t1) / 2;
+    sample.offset = (int32_t)offset;
+    sample.delay = (uint16_t)delay;
+    _next = (_next + 1) % AF_TIMESYNC_SAMPLES;
+    if (_count < AF_TIMESYNC_SAMPLES) _count++;
+
+    _fit();
+    return false;
+}
+
+void AF_TimeSync::_fit(void) {
+    uint16_t min_delay = 0xFFFF;
+    for (uint8_t i = 0; i < _count; i++) {
+        if (_samples[i].delay < min_delay) min_delay = _samples[i].delay;
+    }
+    uint16_t max_delay = min_delay + AF_TIMESYNC_DELAY_TOLERANCE_US;
+
+    // anchor the line at the newest sample that counts, where it's most accurate
+    const Sample* anchor = nullptr;
+    for (uint8_t n = 1; n <= _count; n++) {
+        const Sample& sample = _samples[(_next + AF_TIMESYNC_SAMPLES - n) % AF_TIMESYNC_SAMPLES];
+        if (sample.delay <= max_delay) {
+            anchor = &sample;
+            break;
+        }
+    }
+    if (anchor == nullptr) return;
+
+    // fit the offsets against the local clock, relative to the anchor
+    float sum_x = 0, sum_y = 0;
+    int32_t min_x = 0;
+    uint8_t n = 0;
+    uint16_t slowest = 0;
+    for (uint8_t i = 0; i < _count; i++) {
+        const Sample& sample = _samples[i];
+        if (sample.delay > max_delay) continue;
+        int32_t x = (int32_t)(sample.local - anchor->local);
+        sum_x += x;
+        sum_y += (float)(sample.offset - anchor->offset);
+        if (x < min_x) min_x = x;
+        if (sample.delay > slowest) slowest = sample.delay;
+        n++;
+    }
+    float mean_x = sum_x / n;
+    float mean_y = sum_y / n;
+
+    float drift;
+    // a line through points close together says little about the drift
+    bool has_line = n >= 2 && -min_x >= (int32_t)(AF_TIMESYNC_INTERVAL_US / 2);
+    if (has_line) {
+        float sxy = 0, sxx = 0;
+        for (uint8_t i = 0; i < _count; i++) {
+            const Sample& sample = _samples[i];
+            if (sample.delay > max_delay) continue;
+            float dx = (int32_t)(sample.local - anchor->local) - mean_x;
+            sxy += dx * ((float)(sample.offset - anchor->offset) - mean_y);
+            sxx += dx * dx;
+        }
+        drift = sxy / sxx;
+    } else {
+        drift = _has_line ? _drift : 0;
+    }
+    float intercept = has_line ? mean_y - drift * mean_x : 0;
+
+    // how far the offsets stray from the line
+    float residual = 0;
+    for (uint8_t i = 0; i < _count; i++) {
+        const Sample& sample = _samples[i];
+        if (sample.delay > max_delay) continue;
+        float x = (int32_t)(sample.local - anchor->local);
+        float r = (float)(sample.offset - anchor->offset) - (intercept + drift * x);
+        if (r < 0) r = -r;
+        if (r > residual) residual = r;
+    }
+
+    _fit_local = anchor->local;
+    _offset = anchor->offset + (int32_t)(intercept + (intercept >= 0 ? 0.5f : -0.5f));
+    _drift = drift;
+    // every offset is within half its delay of the truth, and the line within the residual of
+    // every offset, so the line is within both at the anchor and at the oldest sample. the
+    // slopes can differ by that over the span, twice.
+    _fit_error = (uint32_t)((slowest + 1) / 2 + residual + 1.0f);
+    // without a line, the last line's drift still holds as well as it did
+    if (has_line) {
+        _drift_error = 2.0f * _fit_error / (float)(-min_x);
+    } else if (!_has_line) {
+        _drift_error = AF_TIMESYNC_MAX_DRIFT_PPM * 1e-6f;
+    }
+    _has_line = _has_line || has_line;
+    _fitted = true;
+    _min_delay = min_delay;
+
+    _var_err_us = _fit_error;
+    _var_offset_us = _offset;
+    _var_drift_ppb = get_drift_ppb();
+    _var_delay_us = min_delay;
+}
+
+void AF_TimeSync::update(AF_GCS& link) {
+    if (_role != AF_TIMESYNC_CLIENT) return;
+    uint32_t now = AF_HAL::micros();
+    if (_requested && !AF_HAL::time_reached(now, _requested_at + AF_TIMESYNC_INTERVAL_US)) return;
+
+    uint8_t payload[AF_TIMESYNC_PAYLOAD_LEN];
+    make_request(now, payload);
+    link.send(AF_GCS_MSG_TIMESYNC, AF_GCS_COMP_SYSTEM, AF_GCS_PRIORITY_CRITICAL, payload, AF_TIMESYNC_PAYLOAD_LEN);
+
+    _var_err_us = get_error_us(now);
+}
+
+bool AF_TimeSync::on_frame(AF_GCS& link, const AF_GCS_Decoder& decoder) {
+    const AF_GCS_Frame_Header* header = decoder.get_header();
+    if (header->type != AF_GCS_MSG_TIMESYNC) return false;
+
+    uint8_t reply[AF_TIMESYNC_PAYLOAD_LEN];
+    if (on_payload(decoder.get_payload(), header->len, AF_HAL::micros(), reply)) {
+        link.send(AF_GCS_MSG_TIMESYNC, AF_GCS_COMP_SYSTEM, AF_GCS_PRIORITY_CRITICAL, reply, AF_TIMESYNC_PAYLOAD_LEN);
+    }
+    return true;
+}
+
+uint32_t AF_TimeSync::to_shared(uint32_t local) const {
+    if (_role == AF_TIMESYNC_MASTER) return local;
+    return local + _offset + (int32_t)(_drift * (int32_t)(local - _fit_local));
+}
+
+uint32_t AF_TimeSync::to_local(uint32_t shared) const {
+    if (_role == AF_TIMESYNC_MASTER) return shared;
+    // the drift is tiny, so working it out from the local time less the offset is close enough
+    uint32_t local = shared - _offset;
+    return local - (int32_t)(_drift * (int32_t)(local - _fit_local));
+}
+
+uint32_t AF_TimeSync::shared_micros(void) const {
+    return to_shared(AF_HAL::micros());
+}
+
+bool AF_TimeSync::is_synced(uint32_t now) const {
+    if (_role == AF_TIMESYNC_MASTER) return true;
+    return _fitted && (uint32_t)(now - _fit_local) < AF_TIMESYNC_TIMEOUT_US;
+}
+
+uint32_t AF_TimeSync::get_error_us(uint32_t now) const {
+    if (_role == AF_TIMESYNC_MASTER) return 0;
+    if (!_fitted) return 0xFFFFFFFFUL;
+    int32_t age = (int32_t)(now - _fit_local);
+    if (age < 0) age = -age;
+    return _fit_error + (uint32_t)(_drift_error * age + 1.0f);
+}
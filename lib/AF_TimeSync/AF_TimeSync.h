@@ -0,0 +1,188 @@
+#ifndef AF_TIMESYNC_H_
+#define AF_TIMESYNC_H_
+
+/// @file   AF_TimeSync.h
+/// @brief  gives every processor a shared timebase: the master's (the flight controller's)
+///         clock. each client (i.e. a 328P telemetry endpoint) estimates the offset and drift of
+///         its own micros() against the master's, so samples stamped on different processors
+///         can be compared.
+///
+/// the client asks for the master's time every AF_TIMESYNC_INTERVAL_US, NTP style:
+///  - t1: the client's clock when it sends the request
+///  - t2: the master's clock when the request arrives
+///  - t3: the master's clock when it sends the reply
+///  - t4: the client's clock when the reply arrives
+/// the round trip's delay is (t4 - t1) - (t3 - t2), and the offset is
+/// ((t2 - t1) + (t3 - t4)) / 2. the offset is only wrong by however differently long the two
+/// directions took, which is at most half the delay. so exchanges that waited in a queue or
+/// behind a slow task are thrown out: only the ones within AF_TIMESYNC_DELAY_TOLERANCE_US of
+/// the quickest of the last AF_TIMESYNC_SAMPLES count. a straight line fitted through their
+/// offsets gives the offset and the drift.
+///
+/// get_error_us() is a bound on how far to_shared() can be from the master's clock: half the
+/// slowest delay counted, plus how far the offsets stray from the line, plus the drift's own
+/// uncertainty over the time since the last exchange. it's published as sync_err_us.
+///
+/// each instance registers its own sync_* variables, where it's made: one per processor, or
+/// on the host one per context (see AF_Context.h). variables don't unregister, so an
+/// instance has to live as long as the storage it registered with.
+///
+/// on a GCS link, update() and on_frame() do the exchange. on the SPI link (see spi_hal.h),
+/// hand the payloads to spi::send() and take them from spi::receive() with make_request()
+/// and on_payload(): its fixed-size frames take as long in both directions.
+///
+/// payload (AF_GCS_MSG_TIMESYNC): kind (0 request, 1 reply), sequence number, then t1, t2
+/// and t3 (4 bytes each, low byte first). requests carry zeros for t2 and t3, so both
+/// directions are the same length and take as long on the wire.
+
+#include <stdint.h>
+#include <AF_Variable/AF_Variable.h>
+
+/// how often the client asks for the master's time
+#define AF_TIMESYNC_INTERVAL_US 1000000UL
+/// how many exchanges are kept to filter and fit
+#define AF_TIMESYNC_SAMPLES 8
+/// how much slower than the quickest kept exchange an exchange can be and still count
+#define AF_TIMESYNC_DELAY_TOLERANCE_US 1000
+/// exchanges slower than this are thrown out as soon as they arrive
+#define AF_TIMESYNC_MAX_DELAY_US 50000L
+/// the drift assumed until there's a line to fit, in ppm. covers ceramic resonators.
+#define AF_TIMESYNC_MAX_DRIFT_PPM 5000
+/// how long without a good exchange before the client counts as out of sync
+#define AF_TIMESYNC_TIMEOUT_US 10000000UL
+/// the length of a payload
+#define AF_TIMESYNC_PAYLOAD_LEN 14
+
+/// @brief which end of the sync this processor is
+enum AF_TimeSync_Role: uint8_t {
+    /// its clock is the shared timebase
+    AF_TIMESYNC_MASTER = 0,
+    /// follows the master's clock
+    AF_TIMESYNC_CLIENT
+};
+
+class AF_GCS;
+class AF_GCS_Decoder;
+
+/// @brief one processor's side of the time sync
+class AF_TimeSync {
+
+    public:
+
+        /// @param role whether this processor's clock is the shared timebase
+        AF_TimeSync(AF_TimeSync_Role role);
+
+        /// @brief builds a request for the master's time. client only.
+        /// @param now     the local clock, in microseconds
+        /// @param payload set to the request, AF_TIMESYNC_PAYLOAD_LEN bytes
+        void make_request(uint32_t now, uint8_t* payload);
+
+        /// @brief takes a payload from the other end. the master answers requests, the client
+        ///        takes in replies.
+        /// @param payload the payload
+        /// @param len     the length of the payload
+        /// @param now     the local clock when the payload arrived, in microseconds
+        /// @param reply   set to the reply to send back, AF_TIMESYNC_PAYLOAD_LEN bytes
+        /// @return true if there's a reply to send
+        bool on_payload(const uint8_t* payload, uint8_t len, uint32_t now, uint8_t* reply);
+
+        /// @brief sends a request over a link when one is due. client only, register as a
+        ///        scheduler task.
+        void update(AF_GCS& link);
+
+        /// @brief takes the frame a link just received, if it's a time sync payload, and
+        ///        answers it on the same link. call when AF_GCS::receive() returns true.
+        /// @return true if the frame was a time sync payload
+        bool on_frame(AF_GCS& link, const AF_GCS_Decoder& decoder);
+
+        /// @brief converts a local timestamp to the shared timebase
+        uint32_t to_shared(uint32_t local) const;
+
+        /// @brief converts a shared timestamp to the local clock
+        uint32_t to_local(uint32_t shared) const;
+
+        /// @brief gets the shared clock, in microseconds
+        uint32_t shared_micros(void) const;
+
+        /// @brief whether the shared timebase can be trusted: always on the master, and on a
+        ///        client once an exchange has counted in the last AF_TIMESYNC_TIMEOUT_US
+        bool is_synced(uint32_t now) const;
+
+        /// @brief gets the bound on how far to_shared() is from the master's clock
+        /// @param now the local clock, in microseconds
+        /// @return the bound in microseconds, 0xFFFFFFFF if there's been no exchange
+        uint32_t get_error_us(uint32_t now) const;
+
+        /// @brief gets the shared time less the local time, as of the last fit
+        int32_t get_offset_us(void) const { return _offset; }
+
+        /// @brief gets how much faster the master's clock runs than the local one, in parts per billion
+        int32_t get_drift_ppb(void) const { return (int32_t)(_drift * 1e9f); }
+
+        /// @brief gets the delay of the quickest exchange kept, in microseconds
+        uint16_t get_min_delay_us(void) const { return _min_delay; }
+
+        /// @brief gets the number of exchanges thrown out for being too slow, rolls over to 0 safely
+        uint16_t get_rejected(void) const { return _rejected; }
+
+    private:
+
+        /// @brief an exchange the client has made
+        struct Sample {
+            /// the client's clock halfway through the exchange
+            uint32_t local;
+            /// the master's clock less the client's
+            int32_t offset;
+            /// the round trip's delay, less the time the master held the request
+            uint16_t delay;
+        };
+
+        /// @brief works out the offset, drift and error bound from the samples kept
+        void _fit(void);
+
+        AF_TimeSync_Role _role;
+        /// the sequence number of the last request
+        uint8_t _seq = 0;
+        /// the local clock when the last request went out
+        uint32_t _requested_at = 0;
+        /// whether a request has gone out yet
+        bool _requested = false;
+        /// whether the last request is still waiting for its reply
+        bool _awaiting = false;
+
+        Sample _samples[AF_TIMESYNC_SAMPLES] = {};
+        /// the number of samples kept
+        uint8_t _count = 0;
+        /// where the next sample goes
+        uint8_t _next = 0;
+
+        /// the local time the fit is anchored at
+        uint32_t _fit_local = 0;
+        /// the offset at _fit_local
+        int32_t _offset = 0;
+        /// the drift, in microseconds per microsecond
+        float _drift = 0;
+        /// the error bound at _fit_local
+        uint32_t _fit_error = 0;
+        /// how fast the error bound grows away from _fit_local, in microseconds per microsecond
+        float _drift_error = 0;
+        /// whether there's been a fit
+        bool _fitted = false;
+        /// whether a fit has had a line to give the drift
+        bool _has_line = false;
+
+        uint16_t _min_delay = 0;
+        uint16_t _rejected = 0;
+
+        /// the bound on how far the shared clock can be from the master's, see get_error_us()
+        AF_UInt32 _var_err_us;
+        /// the master's clock less this processor's
+        AF_Int32 _var_offset_us;
+        /// how much faster the master's clock runs than this processor's, in parts per billion
+        AF_Int32 _var_drift_ppb;
+        /// the quickest round trip kept
+        AF_UInt16 _var_delay_us;
+
+};
+
+#endif // AF_TIMESYNC_H_
@@ -0,0 +1,48 @@
+#include "AF_Topic.h"
+#include <AF_HAL/AF_HAL.h>
+#include <AF_Context/AF_Context.h>
+#include <string.h>
+
+AF_Topic_Base* AF_Topic_Base::_first = nullptr;
+
+AF_Topic_Base*& AF_Topic_Base::_list(void) {
+#if defined(AF_SIMULATOR)
+    AF_Context* context = AF_Context::current();
+    if (context != nullptr) return context->_topics;
+#endif
+    return _first;
+}
+
+AF_Topic_Base::AF_Topic_Base(uint16_t id, void* data, uint8_t size) :
+    _id(id), _data(static_cast<uint8_t*>(data)), _size(size) {
+    // topics are defined at file scope or in objects built at boot, before any bridge looks them up
+    AF_Topic_Base*& first = _list();
+    _next = first;
+    first = this;
+}
+
+AF_Topic_Base::~AF_Topic_Base() {
+    for (AF_Topic_Base** link = &_list(); *link != nullptr; link = &(*link)->_next) {
+        if (*link == this) {
+            *link = _next;
+            return;
+        }
+    }
+}
+
+void AF_Topic_Base::_publish(void) {
+    _published_at = AF_HAL::micros();
+    if (++_generation == 0) _generation = 1;
+}
+
+void AF_Topic_Base::publish_bytes(const void* bytes) {
+    memcpy(_data, bytes, _size);
+    _publish();
+}
+
+AF_Topic_Base* AF_Topic_Base::find(uint16_t id) {
+    for (AF_Topic_Base* topic = _list(); topic != nullptr; topic = topic->_next) {
+        if (topic->_id == id) return topic;
+    }
+    return nullptr;
+}
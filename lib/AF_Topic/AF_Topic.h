@@ -0,0 +1,179 @@
+#ifndef AF_TOPIC_H_
+#define AF_TOPIC_H_
+
+/// @file   AF_Topic.h
+/// @brief  a publish/subscribe bus for flight data. a topic holds the latest sample of a
+///         fixed-size struct, and a generation counter that goes up with every publish, so a
+///         subscriber can tell in O(1) whether there's a sample it hasn't read.
+///
+///     AF_Topic<AF_Attitude> attitude_topic(AF_TOPIC_ID("ahrs.attitude"));
+///
+///     // the AHRS task writes the sample in place, nothing is copied
+///     AF_Attitude& att = attitude_topic.claim();
+///     att.roll = ...;
+///     attitude_topic.publish();
+///
+///     // the control task only does work when there's a new sample
+///     static AF_Subscriber<AF_Attitude> attitude(attitude_topic);
+///     if (attitude.updated()) {
+///         const AF_Attitude& att = attitude.read();
+///         ...
+///     }
+///
+/// subscribers read the topic's own copy, so publish and read from tasks, not ISRs: the
+/// scheduler runs one task at a time, so a task never sees a sample half written. an ISR
+/// should hand its data to a task (as the RC decoders do) and let the task publish it.
+///
+/// topics are matched across processors by their interned name, see AF_Topic_Bridge.h.
+
+#include <stdint.h>
+#include <util.h>
+
+/// the interned id of a topic's name, worked out at compile time
+#define AF_TOPIC_ID(_name) (utilintern::constant<utilintern::id("topic", _name)>::value)
+
+/// @brief the part of a topic that doesn't depend on the sample's type, so topics can be
+///        listed and published to from bytes that came over a link
+class AF_Topic_Base {
+
+    private:
+
+        /// the first topic in the list of every topic
+        static AF_Topic_Base* _first;
+        /// @brief gets the head of the list, or on the host the current context's (see AF_Context.h)
+        static AF_Topic_Base*& _list(void);
+        /// the next topic in the list
+        AF_Topic_Base* _next;
+
+        /// the interned name, see AF_TOPIC_ID()
+        uint16_t _id;
+        /// the sample, held by the subclass
+        uint8_t* _data;
+        /// the size of the sample, in bytes
+        uint8_t _size;
+        /// goes up with every publish, 0 until the first
+        uint16_t _generation = 0;
+        /// when the sample was last published, in system microseconds
+        uint32_t _published_at = 0;
+
+    protected:
+
+        AF_Topic_Base(uint16_t id, void* data, uint8_t size);
+
+        /// @brief takes the topic out of the list, so find() no longer returns it. a bridge
+        ///        forwarding it has to stop() first. on the host, destroy it in the context it
+        ///        was made in.
+        ~AF_Topic_Base();
+
+        // the sample belongs to the subclass, a copy would point into the original's
+        AF_Topic_Base(const AF_Topic_Base&) = delete;
+        AF_Topic_Base& operator=(const AF_Topic_Base&) = delete;
+
+        /// @brief marks the sample as new
+        void _publish(void);
+
+    public:
+
+        /// @brief publishes a sample from its bytes, i.e. ones that came over a link
+        /// @param bytes the sample, get_size() bytes as stored in memory
+        void publish_bytes(const void* bytes);
+
+        uint16_t get_id(void) const { return _id; }
+        uint8_t get_size(void) const { return _size; }
+        /// @brief gets the sample's bytes, as stored in memory
+        const uint8_t* get_data(void) const { return _data; }
+
+        /// @brief gets the generation, which goes up with every publish (skipping 0, which
+        ///        means nothing has been published yet), rolls over safely
+        uint16_t get_generation(void) const { return _generation; }
+
+        /// @brief gets when the sample was last published, in system microseconds
+        uint32_t get_published_at(void) const { return _published_at; }
+
+        /// @brief finds a topic by its id
+        /// @return the topic, or nullptr if there's no such topic on this processor
+        static AF_Topic_Base* find(uint16_t id);
+
+        /// @brief gets the first topic, to walk the list of every topic with get_next()
+        static AF_Topic_Base* get_first(void) { return _list(); }
+        AF_Topic_Base* get_next(void) const { return _next; }
+
+};
+
+/// @brief a topic carrying samples of T, a fixed-size struct. define topics at file scope,
+///        or as members of whatever publishes them.
+template <typename T>
+class AF_Topic: public AF_Topic_Base {
+
+    static_assert(sizeof(T) <= 0xFF, "topic samples must fit a byte length");
+
+    private:
+
+        /// the latest sample
+        T _sample = {};
+
+    public:
+
+        /// @param id the interned name, see AF_TOPIC_ID()
+        AF_Topic(uint16_t id) : AF_Topic_Base(id, &_sample, sizeof(T)) {}
+
+        AF_Topic(const AF_Topic&) = delete;
+        AF_Topic& operator=(const AF_Topic&) = delete;
+
+        /// @brief gets the sample to write in place. call publish() once it's written.
+        T& claim(void) { return _sample; }
+
+        /// @brief publishes the sample written through claim()
+        void publish(void) { _publish(); }
+
+        /// @brief copies a sample in and publishes it
+        void publish(const T& sample) {
+            _sample = sample;
+            _publish();
+        }
+
+        /// @brief gets the latest sample, without copying it
+        const T& get(void) const { return _sample; }
+
+};
+
+/// @brief keeps track of which samples of a topic one reader has seen
+template <typename T>
+class AF_Subscriber {
+
+    private:
+
+        const AF_Topic<T>& _topic;
+        /// the generation of the last sample read
+        uint16_t _seen = 0;
+
+    public:
+
+        AF_Subscriber(const AF_Topic<T>& topic) : _topic(topic) {}
+
+        /// @brief whether a sample has been published since the last read()
+        bool updated(void) const { return _topic.get_generation() != _seen; }
+
+        /// @brief whether anything has been published to the topic yet
+        bool has_data(void) const { return _topic.get_generation() != 0; }
+
+        /// @brief gets the latest sample without copying it, and marks it as read
+        const T& read(void) {
+            _seen = _topic.get_generation();
+            return _topic.get();
+        }
+
+        /// @brief gets the number of samples published since the last read()
+        uint16_t get_pending(void) const {
+            uint16_t gen = _topic.get_generation();
+            // the generation skips 0 when it rolls over
+            if (_seen != 0 && gen < _seen) return (uint16_t)(gen - _seen - 1);
+            return (uint16_t)(gen - _seen);
+        }
+
+        /// @brief gets the topic
+        const AF_Topic<T>& get_topic(void) const { return _topic; }
+
+};
+
+#endif // AF_TOPIC_H_
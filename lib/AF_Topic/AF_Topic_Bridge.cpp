@@ -0,0 +1,110 @@
+#include "AF_Topic_Bridge.h"
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/spi_hal.h>
+
+// --- AF_Topic_Bridge ---
+
+bool AF_Topic_Bridge::forward(AF_Topic_Base& topic, uint16_t rate_hz) {
+    if (topic.get_size() > _max_sample) return false;
+
+    Forward* slot = nullptr;
+    for (uint8_t i = 0; i < AF_TOPIC_BRIDGE_MAX; i++) {
+        if (_forwards[i].topic == &topic) {
+            slot = &_forwards[i];
+            break;
+        }
+        if (slot == nullptr && _forwards[i].topic == nullptr) slot = &_forwards[i];
+    }
+    if (slot == nullptr) return false;
+
+    if (slot->topic != &topic) {
+        slot->topic = &topic;
+        // send whatever's been published so far on the first update
+        slot->sent_generation = 0;
+        slot->next_at = AF_HAL::micros();
+    }
+    slot->interval_us = rate_hz > 0 ? 1000000UL / rate_hz : 0;
+    return true;
+}
+
+void AF_Topic_Bridge::stop(AF_Topic_Base& topic) {
+    for (uint8_t i = 0; i < AF_TOPIC_BRIDGE_MAX; i++) {
+        if (_forwards[i].topic == &topic) _forwards[i].topic = nullptr;
+    }
+}
+
+void AF_Topic_Bridge::update(uint32_t now) {
+    uint8_t budget = _max_per_update;
+    for (uint8_t n = 0; n < AF_TOPIC_BRIDGE_MAX && budget > 0; n++) {
+        uint8_t i = (_start + n) % AF_TOPIC_BRIDGE_MAX;
+        Forward& fwd = _forwards[i];
+        if (fwd.topic == nullptr) continue;
+        uint16_t generation = fwd.topic->get_generation();
+        if (generation == fwd.sent_generation || !AF_HAL::time_reached(now, fwd.next_at)) continue;
+
+        uint16_t id = fwd.topic->get_id();
+        uint8_t header[AF_TOPIC_BRIDGE_HEADER_LEN] = { (uint8_t)(id & 0xFF), (uint8_t)(id >> 8) };
+        if (!_send(header, *fwd.topic)) continue;
+
+        fwd.sent_generation = generation;
+        // keep to the topic's rate, but don't try to catch up after a quiet spell
+        fwd.next_at += fwd.interval_us;
+        if (AF_HAL::time_reached(now, fwd.next_at)) fwd.next_at = now + fwd.interval_us;
+        _sent++;
+        budget--;
+        // the next update starts after the last topic sent, so none is starved
+        _start = (i + 1) % AF_TOPIC_BRIDGE_MAX;
+    }
+}
+
+bool AF_Topic_Bridge::on_payload(const uint8_t* payload, uint8_t len) {
+    if (len < AF_TOPIC_BRIDGE_HEADER_LEN) return false;
+    uint16_t id = payload[0] | ((uint16_t)payload[1] << 8);
+    AF_Topic_Base* topic = AF_Topic_Base::find(id);
+    if (topic == nullptr || topic->get_size() != len - AF_TOPIC_BRIDGE_HEADER_LEN) {
+        _rejected++;
+        return false;
+    }
+    topic->publish_bytes(payload + AF_TOPIC_BRIDGE_HEADER_LEN);
+    _received++;
+    return true;
+}
+
+// --- AF_Topic_GCS_Bridge ---
+
+bool AF_Topic_GCS_Bridge::on_frame(const AF_GCS_Decoder& decoder) {
+    const AF_GCS_Frame_Header* header = decoder.get_header();
+    if (header->type != AF_GCS_MSG_TOPIC) return false;
+    on_payload(decoder.get_payload(), header->len);
+    return true;
+}
+
+bool AF_Topic_GCS_Bridge::_send(const uint8_t* header, const AF_Topic_Base& topic) {
+    // the queue gathers the sample straight from the topic
+    AF_GCS_Chunk chunks[2] = {
+        { header, AF_TOPIC_BRIDGE_HEADER_LEN },
+        { topic.get_data(), topic.get_size() }
+    };
+    return _link->send(AF_GCS_MSG_TOPIC, AF_GCS_COMP_TELEMETRY, AF_GCS_PRIORITY_INFO, chunks, 2);
+}
+
+// --- AF_Topic_SPI_Bridge ---
+
+AF_Topic_SPI_Bridge::AF_Topic_SPI_Bridge() :
+    AF_Topic_Bridge(AF_SPI_MAX_PAYLOAD - AF_TOPIC_BRIDGE_HEADER_LEN, 1) {}
+
+void AF_Topic_SPI_Bridge::update(uint32_t now) {
+    uint8_t payload[AF_SPI_MAX_PAYLOAD];
+    uint8_t len;
+    // an empty frame means the other side had nothing new
+    if (AF_HAL::spi::receive(payload, len) && len > 0) on_payload(payload, len);
+    AF_Topic_Bridge::update(now);
+}
+
+bool AF_Topic_SPI_Bridge::_send(const uint8_t* header, const AF_Topic_Base& topic) {
+    // the link takes whole frames, so the sample has to be copied into one
+    uint8_t payload[AF_SPI_MAX_PAYLOAD];
+    memcpy(payload, header, AF_TOPIC_BRIDGE_HEADER_LEN);
+    memcpy(payload + AF_TOPIC_BRIDGE_HEADER_LEN, topic.get_data(), topic.get_size());
+    return AF_HAL::spi::send(payload, AF_TOPIC_BRIDGE_HEADER_LEN + topic.get_size());
+}
@@ -0,0 +1,145 @@
+#ifndef AF_TOPIC_BRIDGE_H_
+#define AF_TOPIC_BRIDGE_H_
+
+/// @file   AF_Topic_Bridge.h
+/// @brief  forwards topics (see AF_Topic.h) to another processor, i.e. from a controller to
+///         a 328P telemetry endpoint, so code there subscribes to them like local topics.
+///
+/// the sending side picks the topics to forward and a rate for each. a topic is only sent
+/// when something new has been published to it, at most at its rate. the receiving side
+/// defines the same topics (same name, same struct) and publishes each sample that arrives
+/// into its own copy, so its subscribers see the generation go up as usual. both ends are
+/// AVRs built from the same headers, so samples go over as their bytes in memory.
+///
+/// payload: the topic id (2 bytes, low byte first), then the sample.
+///
+/// don't forward a topic back the way it came: the two ends would pass it back and forth.
+
+#include <stdint.h>
+#include "AF_Topic.h"
+#include <AF_GCS/AF_GCS.h>
+
+/// how many topics a bridge can forward
+#define AF_TOPIC_BRIDGE_MAX 8
+/// the length of the payload before the sample
+#define AF_TOPIC_BRIDGE_HEADER_LEN 2
+
+/// @brief forwards topics over a link, and publishes the topics that arrive over it
+class AF_Topic_Bridge {
+
+    public:
+
+        /// @brief starts forwarding a topic, or changes its rate
+        /// @param topic   the topic
+        /// @param rate_hz the most often to send it, or 0 to send every sample update() sees
+        /// @return false if the sample doesn't fit the link or every slot is taken
+        bool forward(AF_Topic_Base& topic, uint16_t rate_hz);
+
+        /// @brief stops forwarding a topic
+        void stop(AF_Topic_Base& topic);
+
+        /// @brief sends the topics that have new samples and are due. register as a
+        ///        scheduler task, running at least as often as the fastest topic.
+        /// @param now the system clock, in microseconds
+        virtual void update(uint32_t now);
+
+        /// @brief publishes a sample that arrived over the link into the local topic
+        /// @return true if it was published, false if there's no such topic here or the
+        ///         sample is the wrong size
+        bool on_payload(const uint8_t* payload, uint8_t len);
+
+        /// @brief gets the number of samples sent, rolls over to 0 safely
+        uint16_t get_sent(void) const { return _sent; }
+
+        /// @brief gets the number of samples published from the link, rolls over to 0 safely
+        uint16_t get_received(void) const { return _received; }
+
+        /// @brief gets the number of samples from the link that matched no topic here, rolls
+        ///        over to 0 safely
+        uint16_t get_rejected(void) const { return _rejected; }
+
+    protected:
+
+        /// @param max_sample  the largest sample the link carries
+        /// @param max_per_update how many samples the link takes per update()
+        AF_Topic_Bridge(uint8_t max_sample, uint8_t max_per_update) :
+            _max_sample(max_sample), _max_per_update(max_per_update) {}
+
+        /// @brief sends one sample over the link
+        /// @param header the payload's header, the topic id
+        /// @return true if it went out (or was queued to)
+        virtual bool _send(const uint8_t* header, const AF_Topic_Base& topic) = 0;
+
+    private:
+
+        /// @brief a topic being forwarded
+        struct Forward {
+            /// the topic, nullptr if the slot is free
+            AF_Topic_Base* topic;
+            /// the generation last sent
+            uint16_t sent_generation;
+            /// the least time between samples, in microseconds
+            uint32_t interval_us;
+            /// when the topic can next be sent, in system microseconds
+            uint32_t next_at;
+        };
+
+        Forward _forwards[AF_TOPIC_BRIDGE_MAX] = {};
+        /// the slot update() starts at, so topics take turns on a link that's full
+        uint8_t _start = 0;
+
+        uint8_t _max_sample;
+        uint8_t _max_per_update;
+
+        uint16_t _sent = 0;
+        uint16_t _received = 0;
+        uint16_t _rejected = 0;
+
+};
+
+/// @brief forwards topics over a GCS link (see AF_GCS.h), as AF_GCS_MSG_TOPIC frames at info
+///        priority, so they share the link's budget with everything else on it
+class AF_Topic_GCS_Bridge: public AF_Topic_Bridge {
+
+    public:
+
+        /// @param link the link to send on
+        AF_Topic_GCS_Bridge(AF_GCS* link) :
+            AF_Topic_Bridge(AF_GCS_MAX_PAYLOAD - AF_TOPIC_BRIDGE_HEADER_LEN, AF_TOPIC_BRIDGE_MAX), _link(link) {}
+
+        /// @brief takes the frame the link just received, if it's a topic sample. call when
+        ///        AF_GCS::receive() returns true.
+        /// @return true if the frame was a topic sample
+        bool on_frame(const AF_GCS_Decoder& decoder);
+
+    protected:
+
+        bool _send(const uint8_t* header, const AF_Topic_Base& topic) override;
+
+    private:
+
+        AF_GCS* _link;
+
+};
+
+/// @brief forwards topics over the inter-processor SPI link (see AF_HAL/spi_hal.h), which it
+///        takes over entirely. the link carries one frame per transfer and only the latest
+///        staged frame goes out, so one sample is staged per update(): run it at the link's
+///        transfer rate, and topics take turns.
+class AF_Topic_SPI_Bridge: public AF_Topic_Bridge {
+
+    public:
+
+        AF_Topic_SPI_Bridge();
+
+        /// @brief publishes the sample that arrived in the last transfer, then stages the next
+        ///        one to send
+        void update(uint32_t now) override;
+
+    protected:
+
+        bool _send(const uint8_t* header, const AF_Topic_Base& topic) override;
+
+};
+
+#endif // AF_TOPIC_BRIDGE_H_
@@ -1,6 +1,176 @@
 #include "AF_Variable.h"
 
-#include <lib/AF_Logger/AF_Logger.h>
+#include <AF_Logger/AF_Logger.h>
+#include <AF_Profiler/AF_Profiler.h>
+#include <AF_HAL/eeprom_hal.h>
+
+AF_Variable_Storage AF_Variable_Storage::_instance;
+
+/// marks the start of saved variables in EEPROM, and the format they're saved in
+#define EEPROM_MAGIC 0xAF02
+/// marks the end of saved variables. erased EEPROM reads as this too, so no key is ever this.
+#define EEPROM_END 0xFFFF
+/// the bytes before the first record: the magic, then the CRC of the records
+#define EEPROM_HEADER_LEN 4
+/// the bytes before each saved value: the identifier hash (2 bytes), then the type
+#define EEPROM_RECORD_HEADER_LEN 3
+
+/// @brief gets the hash a variable is saved under in EEPROM, never EEPROM_END
+static uint16_t _eeprom_key(const AF_Variable* var) {
+    uint16_t key = utilintern::id("var", var->get_idfr());
+    // load() would take it for the end of the records
+    return key != EEPROM_END ? key : EEPROM_END - 1;
+}
+
+AF_PROFILE_POINT(_prof_get_by_idfr, "var.get_variable");
+AF_PROFILE_POINT(_prof_get_by_index, "var.get_variable_at");
+
+AF_Variable* AF_Variable_Storage::get_variable(af_var_idfr_t idfr) {
+    AF_PROFILE_SCOPE(_prof_get_by_idfr);
+    /// search the linked list for the variable
+    AF_Variable* var = _head;
+    while (var != nullptr) {
+        if (strcmp(var->get_idfr(), idfr) == 0) {
+            return var;
+        }
+        var = var->_next;
+    }
+    
+    return nullptr;
+}
+
+AF_Variable* AF_Variable_Storage::get_variable_at(uint16_t index) {
+    AF_PROFILE_SCOPE(_prof_get_by_index);
+    // variables are listed in index order
+    AF_Variable* var = _head;
+    for (uint16_t i = 0; var != nullptr && i < index; i++) var = var->_next;
+    return var;
+}
+
+uint16_t AF_Variable_Storage::add_variable(AF_Variable* var) {
+
+    // a variable that shares its identifier, or its EEPROM key, with one already added would
+    // share its record, so it's kept out of EEPROM. this runs before the logger exists, so the
+    // collisions are only counted here, see get_collisions().
+    uint16_t key = var->is_eeprom_stored() ? _eeprom_key(var) : 0;
+    for (AF_Variable* other = _head; other != nullptr; other = other->_next) {
+        bool same_idfr = strcmp(other->get_idfr(), var->get_idfr()) == 0;
+        bool same_key = var->is_eeprom_stored() && other->is_eeprom_stored() && _eeprom_key(other) == key;
+        if (!same_idfr && !same_key) continue;
+        if (_collisions < 0xFFFF) _collisions++;
+        var->_flags &= ~AF_VAR_FLAG_EEPROM_STORED;
+        break;
+    }
+
+    // add the variable to the tail end of the linked list. the list runs through the
+    // variables themselves, so nothing is allocated during static initialization.
+    var->_next = nullptr;
+
+    // if the linked list is empty, set the head to the new variable
+    if (_head == nullptr) {
+        _head = var;
+    } else {
+        // add to the tail
+        _tail->_next = var;
+    }
+    _tail = var;
+
+    return _num_variables++;
+
+}
+
+/// @brief gets the size of a saved value from its type, so records of variables that no
+///        longer exist can be skipped
+/// @return the size in bytes, or 0 if the type is unknown
+static uint8_t _var_type_size(uint8_t type) {
+    switch (type) {
+        case AF_VAR_BOOL:
+        case AF_VAR_INT8:
+        case AF_VAR_UINT8:
+            return 1;
+        case AF_VAR_INT16:
+        case AF_VAR_UINT16:
+            return 2;
+        case AF_VAR_INT32:
+        case AF_VAR_UINT32:
+        case AF_VAR_FLOAT:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+uint16_t AF_Variable_Storage::_load_records(uint16_t addr, bool restore, uint16_t& crc) {
+    uint16_t loaded = 0;
+    uint8_t value[4];
+    uint8_t header[EEPROM_RECORD_HEADER_LEN];
+    crc = utilcrc::CRC16_INIT;
+    while (addr + EEPROM_RECORD_HEADER_LEN <= AF_HAL::eeprom::size()) {
+        AF_HAL::eeprom::read(addr, header, EEPROM_RECORD_HEADER_LEN);
+        uint16_t key = header[0] | (header[1] << 8);
+        uint8_t size = _var_type_size(header[2]);
+        // past the end, or saved by newer firmware
+        if (key == EEPROM_END || size == 0) break;
+        AF_HAL::eeprom::read(addr + EEPROM_RECORD_HEADER_LEN, value, size);
+        crc = utilcrc::crc16(header, EEPROM_RECORD_HEADER_LEN, crc);
+        crc = utilcrc::crc16(value, size, crc);
+        addr += EEPROM_RECORD_HEADER_LEN + size;
+        if (!restore) continue;
+
+        // records are in the order they were saved in, which needn't be today's order
+        for (AF_Variable* var = _head; var != nullptr; var = var->_next) {
+            if (!var->is_eeprom_stored() || _eeprom_key(var) != key) continue;
+            if (var->get_type() == header[2] && var->get_size() == size) {
+                var->restore(value);
+                loaded++;
+            }
+            break;
+        }
+    }
+    return loaded;
+}
+
+uint16_t AF_Variable_Storage::load(uint16_t addr) {
+    uint16_t header[2];
+    AF_HAL::eeprom::read(addr, header, EEPROM_HEADER_LEN);
+    if (header[0] != EEPROM_MAGIC) return 0;
+    addr += EEPROM_HEADER_LEN;
+
+    // a save cut short by a reset leaves records that don't match the CRC, which is written
+    // last. every variable keeps its initial value rather than taking half of a save.
+    uint16_t crc;
+    _load_records(addr, false, crc);
+    if (crc != header[1]) return 0;
+    return _load_records(addr, true, crc);
+}
+
+uint16_t AF_Variable_Storage::save(uint16_t addr) {
+    uint16_t magic = EEPROM_MAGIC;
+    AF_HAL::eeprom::update(addr, &magic, 2);
+    uint16_t crc_addr = addr + 2;
+    addr += EEPROM_HEADER_LEN;
+
+    uint16_t saved = 0;
+    uint16_t crc = utilcrc::CRC16_INIT;
+    for (AF_Variable* var = _head; var != nullptr; var = var->_next) {
+        if (!var->is_eeprom_stored()) continue;
+        // leave room for the end marker
+        if (addr + EEPROM_RECORD_HEADER_LEN + var->get_size() + 2 > AF_HAL::eeprom::size()) break;
+        uint16_t key = _eeprom_key(var);
+        uint8_t header[EEPROM_RECORD_HEADER_LEN] = { (uint8_t)(key & 0xFF), (uint8_t)(key >> 8), (uint8_t)var->get_type() };
+        AF_HAL::eeprom::update(addr, header, EEPROM_RECORD_HEADER_LEN);
+        AF_HAL::eeprom::update(addr + EEPROM_RECORD_HEADER_LEN, var->get_data(), var->get_size());
+        crc = utilcrc::crc16(header, EEPROM_RECORD_HEADER_LEN, crc);
+        crc = utilcrc::crc16(static_cast<const uint8_t*>(var->get_data()), var->get_size(), crc);
+        addr += EEPROM_RECORD_HEADER_LEN + var->get_size();
+        saved++;
+    }
+    uint16_t end = EEPROM_END;
+    AF_HAL::eeprom::update(addr, &end, 2);
+    // last, so the records only count once they're all written
+    AF_HAL::eeprom::update(crc_addr, &crc, 2);
+    return saved;
+}
 
 bool AF_Variable::is_readable_by_gcs(void) const {
     return _flags & AF_VAR_FLAG_READABLE_BY_GCS;
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <AF_Context/AF_Context.h>
 
 /// max length of an `AP_Variable` identifier
 #define AF_VAR_MAX_IDFR_LEN 16
@@ -44,13 +45,15 @@ enum af_var_type {
 
 typedef const char * af_var_idfr_t;
 
-/// linked-list style node for storing AF_Variable instances in AF_Variable_Storage
-struct AF_Variable_Node {
-    AF_Variable_Node* next;
-    AF_Variable* var;
-};
+class AF_Variable;
 
-/// stores AF_Variable instances and provides access to them 
+/// @brief stores AF_Variable instances and provides access to them.
+///
+/// variables are declared at file scope, so they register in static initialization order,
+/// which follows the link order. registering allocates nothing, and the storage itself is
+/// constant-initialized, so it's ready before the first variable registers whatever the order.
+/// variables saved to EEPROM are matched by a hash of their identifier, never by index, so a
+/// change in link order doesn't load values into the wrong variables.
 class AF_Variable_Storage {
 
     public:
@@ -61,65 +64,73 @@ class AF_Variable_Storage {
         /// @brief get a variable by its identifier
         /// @param idfr the identifier of the variable
         /// @return pointer to the variable, or nullptr if the variable does not exist
-        AF_Variable* get_variable(af_var_idfr_t idfr) {
-            /// search the linked list for the variable
-            AF_Variable_Node* node = _head;
-            while (node != nullptr) {
-                if (strcmp(node->var->get_idfr(), idfr) == 0) {
-                    return node->var;
-                }
-                node = node->next;
-            }
-            
-            return nullptr;
-        }
+        AF_Variable* get_variable(af_var_idfr_t idfr);
 
-        /// get the singleton instance
+        /// @brief get a variable by its index, which is the order it was declared in.
+        ///        indices are how the GCS refers to variables on the wire.
+        /// @param index the index of the variable
+        /// @return pointer to the variable, or nullptr if the variable does not exist
+        AF_Variable* get_variable_at(uint16_t index);
+
+        /// get the singleton instance, or on the host the current context's (see AF_Context.h)
         static AF_Variable_Storage* get_instance(void) {
-            if (_instance == nullptr) {
-                _instance = new AF_Variable_Storage();
-            }
-            return _instance;
+#if defined(AF_SIMULATOR)
+            AF_Context* context = AF_Context::current();
+            if (context != nullptr) return context->get_variables();
+#endif
+            return &_instance;
         }
 
-        /// @brief stores a new variable
-        /// @return true if the variable was added successfully, false if the identifier already exists in the storage
-        void add_variable(AF_Variable* var) {
-            
-            // TODO: check if the identifier already exists
-
-            // add the new node to the tail end of the linked list
-            AF_Variable_Node* node = new AF_Variable_Node();
-            node->var = var;
-            node->next = nullptr;
-
-            // if the linked list is empty, set the head to the new node
-            if (_head == nullptr) {
-                _head = node;
-            } else {
-                // add to the tail
-                _tail->next = node;
-                _tail = node;
-            }
-
-            _num_variables++;
-
-        }
+        /// @brief stores a new variable. if its identifier, or the key it's saved to EEPROM
+        ///        under, is already taken, it's still added but never saved or loaded, and
+        ///        counted in get_collisions().
+        /// @return the index of the new variable
+        uint16_t add_variable(AF_Variable* var);
+
+        /// @brief gets the number of variables added with an identifier or EEPROM key that was
+        ///        already taken, saturates at 0xFFFF
+        uint16_t get_collisions(void) const { return _collisions; }
+
+        /// @brief loads the variables flagged AF_VAR_FLAG_EEPROM_STORED from EEPROM. variables
+        ///        that weren't saved, or changed type since, keep their initial values, and so
+        ///        do all of them if the records don't match their CRC (a save was cut short).
+        /// @param addr where in EEPROM the variables were saved
+        /// @return the number of variables loaded
+        uint16_t load(uint16_t addr);
+
+        /// @brief saves the variables flagged AF_VAR_FLAG_EEPROM_STORED to EEPROM. only bytes
+        ///        that changed are written, to spare the EEPROM.
+        /// @param addr where in EEPROM to save the variables
+        /// @return the number of variables saved, which is less than the number flagged if
+        ///         they don't all fit
+        uint16_t save(uint16_t addr);
 
     protected:
 
         /// the number of variables
         uint16_t _num_variables = 0;
-        /// the head of the linked list of variables (the first node)
-        AF_Variable_Node* _head = nullptr;
-        /// the tail of the linked list of variables (the last node)
-        AF_Variable_Node* _tail = nullptr;
+        /// the head of the linked list of variables (the first variable)
+        AF_Variable* _head = nullptr;
+        /// the tail of the linked list of variables (the last variable)
+        AF_Variable* _tail = nullptr;
+        /// variables added with an identifier or EEPROM key that was already taken
+        uint16_t _collisions = 0;
         
     private:
-        /// Private constructor
-        AF_Variable_Storage() {} 
+        /// @brief walks the saved records, working out their CRC, and restores the variables
+        ///        they belong to if asked
+        /// @param addr    where the first record is
+        /// @param restore whether to restore the variables
+        /// @param crc     set to the CRC of the records
+        /// @return the number of variables restored
+        uint16_t _load_records(uint16_t addr, bool restore, uint16_t& crc);
+
+        /// Private constructor, constexpr so the instance is ready before any constructor runs
+        constexpr AF_Variable_Storage() {}
         /// the singleton instance
-        static AF_Variable_Storage* _instance;
+        static AF_Variable_Storage _instance;
+
+        friend class AF_Context;
 };
 
 class AF_Variable {
@@ -129,6 +140,18 @@ class AF_Variable {
         af_var_type get_type(void) const { return _vt; }
         /// get the identifier of the variable
         const char* get_idfr(void) const { return _idfr; }
+        /// get the index of the variable, see AF_Variable_Storage::get_variable_at()
+        uint16_t get_index(void) const { return _index; }
+        /// get the value's bytes, as stored in memory
+        const void* get_data(void) const { return _data; }
+        /// get the size of the value, in bytes
+        uint8_t get_size(void) const { return _size; }
+        /// get the next variable in index order, nullptr after the last
+        AF_Variable* get_next(void) const { return _next; }
+
+        /// @brief overwrites the value's bytes, i.e. with ones loaded from EEPROM
+        /// @param bytes the new value, get_size() bytes as stored in memory
+        void restore(const void* bytes) { memcpy(_data, bytes, _size); }
 
         // flag readers
         
@@ -147,9 +170,19 @@ class AF_Variable {
         /// the type of the variable
         af_var_type _vt;
         /// whether to publish this variable to the GCS
-        bool _publish_to_gcs;
+        bool _publish_to_gcs = false;
 
         uint8_t _flags;
+        /// the index of the variable
+        uint16_t _index;
+        /// the value, set by the subclass that holds it
+        void* _data = nullptr;
+        /// the size of the value, in bytes
+        uint8_t _size = 0;
+        /// the next variable in the storage's list
+        AF_Variable* _next = nullptr;
+
+        friend class AF_Variable_Storage;
 
     public:
         /// constructor
@@ -159,7 +192,7 @@ class AF_Variable {
             _flags = flags;
 
             // add the variable to the storage
-            AF_Variable_Storage::get_instance()->add_variable(this);
+            _index = AF_Variable_Storage::get_instance()->add_variable(this);
         }
         /// get identifier
         const char* get_idfr(void) { return _idfr; }
@@ -173,7 +206,9 @@ class AF_Var_Scalar: public AF_Variable {
     public:
         /// constructor
         AF_Var_Scalar(const char* idfr, const T initial_value, uint8_t flags): AF_Variable(idfr, VT, flags) {
-            val = initial_value;
+            _val = initial_value;
+            _data = &_val;
+            _size = sizeof(T);
         }
 
         /// get value
@@ -190,7 +225,7 @@ class AF_Var_Scalar: public AF_Variable {
 
         /// cast to T
         operator const T &() const {
-            return _value;
+            return _val;
         }
 
         /// assignment operator
@@ -11,6 +11,8 @@ class PID {
 
     private:
 
+        /// the identifiers of the gains: the prefix, then .kp, .ki, .kd and .bias
+        char _idfrs[4][AF_VAR_MAX_IDFR_LEN + 1];
         /// the proportional term
         AF_Float _kp;
         /// the integral term
@@ -45,7 +47,8 @@ class PID {
         /// @param  max_integral    the maximum integral, which the integral will be clamped to
         /// @param  min_integral    the minimum integral, which the integral will be clamped to
         /// @param  var_flags   the flags for the AF_Floats
-        /// @param  prefix  the prefix identifiers for the AF_Floats
+        /// @param  prefix  the prefix of the AF_Floats' identifiers, i.e. "roll" for "roll.kp"
+        ///                 (truncated to AF_VAR_MAX_IDFR_LEN)
         PID(float kp, float ki, float kd, float bias, float max_output, float min_output, float max_integral, float min_integral, uint8_t var_flags, const char* prefix);
 
         /// @brief computes the output of the PID controller
@@ -1,21 +1,37 @@
 #include <control.h>
 #include <AF_Math/AF_Math.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <AF_Profiler/AF_Profiler.h>
 
+AF_PROFILE_POINT(_prof_output, "pid.output");
 
-PID::PID(float kp, float ki, float kd, float bias, float max_output, float min_output, float max_integral, float min_integral, uint8_t var_flags, const char* prefix) {
-
-    _kp = AF_Float("", kp, var_flags); // TODO: add prefix
-    _ki = AF_Float("", ki, var_flags); // TODO: add prefix
-    _kd = AF_Float("", kd, var_flags); // TODO: add prefix
-    _bias = AF_Float("", bias, var_flags);
-    _max_output = max_output;
-    _min_output = min_output;
-    _max_integral = max_integral;
-    _min_integral = min_integral;
+/// @brief builds a gain's identifier from the controller's prefix
+/// @param out    where to build it, AF_VAR_MAX_IDFR_LEN + 1 bytes
+/// @param prefix the controller's prefix
+/// @param term   the gain, i.e. "kp"
+/// @return out
+static const char* _gain_idfr(char* out, const char* prefix, const char* term) {
+    snprintf(out, AF_VAR_MAX_IDFR_LEN + 1, "%s.%s", prefix != nullptr ? prefix : "pid", term);
+    return out;
 }
 
-float PID::output(float error) {    
+// the gains register themselves as variables when they're constructed, so their identifiers
+// are built first, into storage the controller owns (_idfrs comes before them)
+PID::PID(float kp, float ki, float kd, float bias, float max_output, float min_output, float max_integral, float min_integral, uint8_t var_flags, const char* prefix) :
+    _kp(_gain_idfr(_idfrs[0], prefix, "kp"), kp, var_flags),
+    _ki(_gain_idfr(_idfrs[1], prefix, "ki"), ki, var_flags),
+    _kd(_gain_idfr(_idfrs[2], prefix, "kd"), kd, var_flags),
+    _bias(_gain_idfr(_idfrs[3], prefix, "bias"), bias, var_flags),
+    _max_output(max_output),
+    _min_output(min_output),
+    _max_integral(max_integral),
+    _min_integral(min_integral),
+    _last_error(0),
+    _integral(0) {}
+
+float PID::output(float error) {
+    AF_PROFILE_SCOPE(_prof_output);
     // recompute integral
     _integral += error;
     // clamp between [ _min_integral, _max_integral ]
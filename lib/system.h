@@ -4,35 +4,79 @@
 
 /// @file system.h
 /// @brief provides support for initializing autoflight without providing explicit system configurations
+///
+/// af_system::start() boots in stages, and times each one:
+///  1. AF_BOOT_STAGE_HAL: the hardware abstraction layer, which also starts the system clock
+///  2. AF_BOOT_STAGE_CONFIG: variables flagged AF_VAR_FLAG_EEPROM_STORED are loaded from EEPROM
+///     (the variable storage itself needs no setup, see AF_Variable_Storage)
+///  3. AF_BOOT_STAGE_SUBSYSTEMS: the vehicle's init_subsystems(), which brings up only what
+///     flying needs: sensors, the control loop, outputs
+///  4. AF_BOOT_STAGE_HANDOFF: the scheduler takes over, until the control loop reports its
+///     first output with notify_control_output()
+///
+/// the vehicle's init_deferred() then brings up everything else (the GCS link, logging,
+/// telemetry) as a one-time task, so none of it delays the first control output. after a
+/// brown-out reboot in flight (see AF_SYSTEM_PANIC()), the time to the first control output
+/// is how long the aircraft goes uncontrolled, so it's published as boot.first_out_us.
+///
+/// times are from when the system clock starts, early in AF_BOOT_STAGE_HAL. the C runtime and
+/// static constructors run before that, which is why registering variables allocates nothing.
 
 #include <stdlib.h>
 #include <AF_GCS/AF_GCS.h>
 #include <AF_HAL/AF_HAL.h>
 #include <AF_Scheduler/AF_Scheduler.h>
 
+/// where in EEPROM the variables are saved, after the GCS session count (see AF_GCS_Requests.h)
+#ifndef AF_SYSTEM_CONFIG_ADDR
+#define AF_SYSTEM_CONFIG_ADDR (AF_GCS_SESSION_COUNT_ADDR + 2)
+#endif
+
+/// the scheduler's runtime budget for init_deferred(), in microseconds. keep it short, or
+/// have it register more one-time tasks, so it doesn't hold up the control loop.
+#ifndef AF_SYSTEM_DEFERRED_EXPECTED_US
+#define AF_SYSTEM_DEFERRED_EXPECTED_US 500
+#endif
+
+/// @brief the stages of the boot, in order
+enum af_boot_stage: uint8_t {
+    AF_BOOT_STAGE_HAL = 0,
+    AF_BOOT_STAGE_CONFIG,
+    AF_BOOT_STAGE_SUBSYSTEMS,
+    AF_BOOT_STAGE_HANDOFF
+};
+
+/// the number of boot stages
+#define AF_BOOT_STAGE_COUNT (AF_BOOT_STAGE_HANDOFF + 1)
+
 namespace af_system {
 
-    /// load configurations needed for intialization of autoflight
-    void autoflight_load_config();
+    /// @brief load configurations needed for intialization of autoflight
+    /// @return the number of variables loaded from EEPROM
+    uint16_t autoflight_load_config();
 
-    /// autoflight entry point, begins AF initialization and scheduler control
-    void start() {
-        
-        // initialize HAL to allow for hardware access
-        // AF_HAL::init();
+    /// @brief brings up the subsystems flying needs, and registers the control loop.
+    ///        defined by the vehicle, runs before the scheduler takes over.
+    void init_subsystems(void);
 
-        // initialize core components
+    /// @brief brings up everything else. defined by the vehicle, runs as a one-time task
+    ///        once the control loop has made its first output.
+    void init_deferred(void);
+
+    /// autoflight entry point, begins AF initialization and scheduler control
+    void start() __ATTR_NORETURN__;
 
-        // load configurations
-        // af_telemetry::AF_Init_Result init_result = autoflight_load_config();
-        // if (!init_result.ok) {
-            
-        // }
+    /// @brief tells the system the control loop has made an output. the first call finishes
+    ///        the boot, and queues init_deferred(). call it after every output, it's cheap.
+    void notify_control_output(void);
 
-        // give control to the scheduler
-        AF_Scheduler::get_instance()->tick_continually();
+    /// @brief gets how long a boot stage took
+    /// @return the time in microseconds, 0 if the stage hasn't finished
+    uint32_t get_stage_us(af_boot_stage stage);
 
-    }
+    /// @brief gets when the control loop made its first output
+    /// @return microseconds since the system clock started, 0 if it hasn't yet
+    uint32_t get_first_output_us(void);
 
 };
 
@@ -42,4 +86,4 @@ namespace af_system {
 ///          flight control systems and telemetry.
 #define AF_SYSTEM_PANIC() AF_HAL::reset();
 
-#endif
\ No newline at end of file
+#endif
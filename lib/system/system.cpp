@@ -0,0 +1,75 @@
+#include <system.h>
+#include <AF_Logger/AF_Logger.h>
+#include <AF_Variable/AF_Variable.h>
+
+/// when the first control output was made, published so the GCS and the blackbox see it
+static AF_UInt32 _var_first_output_us("boot.first_out_us", 0, AF_VAR_FLAG_READABLE_BY_GCS | AF_VAR_FLAG_BLACKBOX_LOGGED);
+
+namespace af_system {
+
+    /// when each stage finished, in microseconds since the system clock started
+    static uint32_t _stage_end_us[AF_BOOT_STAGE_COUNT] = {};
+    /// which stages have finished, a bit each
+    static uint8_t _stages_done = 0;
+
+    /// @brief marks a stage finished
+    static void _finish_stage(af_boot_stage stage) {
+        _stage_end_us[stage] = AF_HAL::micros();
+        _stages_done |= (1 << stage);
+    }
+
+    /// @brief runs the vehicle's deferred init, then logs how the boot went now that the
+    ///        logger has somewhere to send it
+    static void _run_deferred(void) {
+        init_deferred();
+        for (uint8_t stage = 0; stage < AF_BOOT_STAGE_COUNT; stage++) {
+            AF_LOG_INFO(AF_LOGGER_STREAM_ALL, "boot stage {u8} took {u32} us", stage, get_stage_us((af_boot_stage)stage));
+        }
+        AF_LOG_INFO(AF_LOGGER_STREAM_ALL, "first control output {u32} us after the clock started", get_first_output_us());
+        uint16_t collisions = AF_Variable_Storage::get_instance()->get_collisions();
+        if (collisions > 0) {
+            AF_LOG_ERROR(AF_LOGGER_STREAM_ALL, "{u16} variables share an identifier or EEPROM key, and aren't saved", collisions);
+        }
+    }
+
+    uint16_t autoflight_load_config() {
+        return AF_Variable_Storage::get_instance()->load(AF_SYSTEM_CONFIG_ADDR);
+    }
+
+    void start() {
+
+        // initialize HAL to allow for hardware access. the system clock starts here.
+        AF_HAL::init();
+        _finish_stage(AF_BOOT_STAGE_HAL);
+
+        // load configurations before anything reads them
+        autoflight_load_config();
+        _finish_stage(AF_BOOT_STAGE_CONFIG);
+
+        // initialize core components
+        init_subsystems();
+        _finish_stage(AF_BOOT_STAGE_SUBSYSTEMS);
+
+        // give control to the scheduler. the boot finishes with the first control output.
+        AF_Scheduler::get_instance()->tick_continually();
+
+    }
+
+    void notify_control_output(void) {
+        if (_stages_done & (1 << AF_BOOT_STAGE_HANDOFF)) return;
+        _finish_stage(AF_BOOT_STAGE_HANDOFF);
+        _var_first_output_us = _stage_end_us[AF_BOOT_STAGE_HANDOFF];
+        AF_SCHEDULER_ONE_TIME_TASK(_run_deferred, AF_SYSTEM_DEFERRED_EXPECTED_US);
+    }
+
+    uint32_t get_stage_us(af_boot_stage stage) {
+        if (!(_stages_done & (1 << stage))) return 0;
+        // the clock starts during the first stage, so it's timed from 0
+        return stage == AF_BOOT_STAGE_HAL ? _stage_end_us[stage] : _stage_end_us[stage] - _stage_end_us[stage - 1];
+    }
+
+    uint32_t get_first_output_us(void) {
+        return _stage_end_us[AF_BOOT_STAGE_HANDOFF];
+    }
+
+};
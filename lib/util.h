@@ -1,111 +1,403 @@
 #ifndef UTIL_H_
 #define UTIL_H_
 
-#include "system.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <AF_HAL/system_hal.h>
+#if !defined(AF_SIMULATOR)
+#include <util/crc16.h>
+#endif
 
 namespace utilbuf {
 
-    static uint16_t bytes_dropped = 0;
-
-    struct stream_buffer {
-        uint8_t* buffer = nullptr;
-        size_t size = 4;
-        size_t read_idx = 0;
-        size_t write_idx = 0;
-    } ;
-
-    /// @brief puts a byte into a stream buffer
-    static inline void bufferput(uint8_t c, stream_buffer* sb) {
-        // complete cycle for cyclic buffer
-        if ( sb->write_idx == sb->size ) sb->write_idx = 0;
-        // if the write head is at the read head, the buffer is full, so increment the bytes dropped counter.
-        if ( sb->write_idx == sb->read_idx ) {
-            bytes_dropped += 1;
-            return;
-        };
-        // put the new byte at the write head
-        sb->buffer[sb->write_idx] = c;
-        // advance the write head
-        sb->write_idx += 1;
+    /// @brief index type for ring buffers. a single byte, so loading or storing the
+    ///        head and tail is one instruction on AVR and can't be torn by an ISR.
+    typedef uint8_t ring_idx_t;
+
+    /// @brief a contiguous region of a ring buffer's storage
+    struct span {
+        /// pointer to the first byte of the region
+        uint8_t* data;
+        /// the number of bytes in the region
+        ring_idx_t len;
+    };
+
+    /// @brief single-producer/single-consumer byte ring buffer.
+    ///
+    /// the head and tail are free-running counters that are only masked when
+    /// indexing into the storage, so an empty buffer (head == tail) can never be
+    /// mistaken for a full one (head - tail == capacity). the producer only ever
+    /// writes the head and the consumer only ever writes the tail, so one side may
+    /// run in an ISR without disabling interrupts.
+    ///
+    /// @note use static_ring_buffer<N> to declare a buffer with its own storage.
+    class ring_buffer {
+
+        public:
+
+            /// @brief creates a ring buffer over existing storage
+            /// @param storage pointer to (mask + 1) bytes of storage
+            /// @param mask the capacity of the storage minus one, capacity must be a power of two
+            ring_buffer(uint8_t* storage, ring_idx_t mask) : _buffer(storage), _mask(mask) {};
+
+            /// @brief puts a byte into the buffer (producer side)
+            /// @param c the byte to put
+            /// @return true if the byte was stored, false if the buffer was full and the byte was dropped
+            bool put(uint8_t c) { return _put(c, _mask); }
+
+            /// @brief gets the oldest byte from the buffer (consumer side)
+            /// @param c set to the byte that was read
+            /// @return true if a byte was read, false if the buffer was empty
+            bool get(uint8_t& c) { return _get(c, _mask); }
+
+            /// @brief gets the number of bytes waiting to be read
+            ring_idx_t available(void) const {
+                return __atomic_load_n(&_head, __ATOMIC_ACQUIRE) - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+            }
+
+            /// @brief gets the number of bytes that can be put before the buffer is full
+            ring_idx_t space(void) const { return capacity() - available(); }
+
+            /// @brief gets the capacity of the buffer, in bytes
+            ring_idx_t capacity(void) const { return _mask + 1; }
+
+            /// @brief gets the number of bytes dropped because the buffer was full.
+            ///        saturates at 0xFFFF.
+            uint16_t dropped(void) const {
+                // two bytes on AVR, so the producer could update it halfway through the read
+                uint16_t dropped;
+                AF_ATOMIC_BLOCK { dropped = _dropped; }
+                return dropped;
+            }
+
+            /// @brief gets the highest number of bytes that have been waiting in the buffer at once
+            ring_idx_t high_water(void) const { return _high_water; }
+
+            /// @brief resets the dropped and high-water statistics. the producer owns them, so
+            ///        this holds it off while they're cleared.
+            void reset_stats(void) {
+                AF_ATOMIC_BLOCK {
+                    _dropped = 0;
+                    _high_water = 0;
+                }
+            }
+
+            // --- zero-copy consumer side ---
+
+            /// @brief gets the readable region of the buffer without copying it. the region
+            ///        wraps at most once, so it is described by at most two spans.
+            /// @param spans set to the readable spans, oldest first. unused spans have len 0.
+            /// @return the total number of readable bytes
+            ring_idx_t read_spans(span spans[2]) const {
+                ring_idx_t tail = _tail;
+                ring_idx_t used = __atomic_load_n(&_head, __ATOMIC_ACQUIRE) - tail;
+                _split(tail, used, spans);
+                return used;
+            }
+
+            /// @brief pops bytes that have been read through read_spans() or peek()
+            /// @param n how many bytes to pop, must be no more than available()
+            void consume(ring_idx_t n) {
+                __atomic_store_n(&_tail, (ring_idx_t)(_tail + n), __ATOMIC_RELEASE);
+            }
+
+            /// @brief gets a byte without popping it
+            /// @param offset how far past the oldest byte to look
+            /// @param c set to the byte at the offset
+            /// @return true if there is a byte at the offset, false otherwise
+            bool peek(ring_idx_t offset, uint8_t& c) const {
+                ring_idx_t tail = _tail;
+                if (offset >= (ring_idx_t)(__atomic_load_n(&_head, __ATOMIC_ACQUIRE) - tail)) return false;
+                c = _buffer[(ring_idx_t)(tail + offset) & _mask];
+                return true;
+            }
+
+            /// @brief pops everything in the buffer
+            /// @return the number of bytes that were popped
+            ring_idx_t clear(void) {
+                ring_idx_t head = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+                ring_idx_t used = head - _tail;
+                __atomic_store_n(&_tail, head, __ATOMIC_RELEASE);
+                return used;
+            }
+
+            // --- zero-copy producer side ---
+
+            /// @brief gets the writable region of the buffer, so data can be built in place.
+            ///        nothing is visible to the consumer until commit() is called.
+            /// @param spans set to the writable spans, in order. unused spans have len 0.
+            /// @return the total number of writable bytes
+            ring_idx_t reserve(span spans[2]) const {
+                ring_idx_t head = _head;
+                ring_idx_t room = capacity() - (ring_idx_t)(head - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE));
+                _split(head, room, spans);
+                return room;
+            }
+
+            /// @brief publishes bytes that were written through reserve()
+            /// @param n how many bytes to publish, must be no more than the reserved length
+            void commit(ring_idx_t n) {
+                ring_idx_t used = (ring_idx_t)(_head - _tail) + n;
+                __atomic_store_n(&_head, (ring_idx_t)(_head + n), __ATOMIC_RELEASE);
+                if (used > _high_water) _high_water = used;
+            }
+
+            /// @brief puts as many bytes as there's room for, without waiting. the rest are
+            ///        counted as dropped, like put() does.
+            /// @param bytes the bytes to put
+            /// @param n how many bytes to put
+            /// @return the number of bytes stored
+            ring_idx_t write(const uint8_t* bytes, size_t n) {
+                span spans[2];
+                ring_idx_t room = reserve(spans);
+                ring_idx_t fit = n < room ? n : room;
+                ring_idx_t first = fit < spans[0].len ? fit : spans[0].len;
+                memcpy(spans[0].data, bytes, first);
+                memcpy(spans[1].data, bytes + first, fit - first);
+                commit(fit);
+                if (n > fit) note_dropped(n - fit);
+                return fit;
+            }
+
+            /// @brief counts bytes the producer gave up on without putting them, so they show
+            ///        in dropped() like the ones put() had no room for
+            /// @param n how many bytes were dropped
+            void note_dropped(size_t n) {
+                uint32_t dropped = _dropped + n;
+                _dropped = dropped > 0xFFFF ? 0xFFFF : dropped;
+            }
+
+        protected:
+
+            /// @brief splits len bytes starting at the free-running index idx into spans
+            void _split(ring_idx_t idx, ring_idx_t len, span spans[2]) const {
+                ring_idx_t start = idx & _mask;
+                ring_idx_t first = capacity() - start;
+                if (first > len) first = len;
+                spans[0].data = _buffer + start;
+                spans[0].len = first;
+                spans[1].data = _buffer;
+                spans[1].len = len - first;
+            }
+
+            /// @brief see put(). takes the mask as an argument so callers that know the
+            ///        capacity at compile time can have it folded into the code.
+            inline bool _put(uint8_t c, ring_idx_t mask) {
+                // only the producer writes the head, so a plain load is fine here
+                ring_idx_t head = _head;
+                ring_idx_t used = head - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+                // head - tail == capacity means the buffer is full
+                if (used > mask) {
+                    if (_dropped != 0xFFFF) _dropped++;
+                    return false;
+                }
+                _buffer[head & mask] = c;
+                // publish the byte only after it has been stored
+                __atomic_store_n(&_head, (ring_idx_t)(head + 1), __ATOMIC_RELEASE);
+                if (used >= _high_water) _high_water = used + 1;
+                return true;
+            }
+
+            /// @brief see get()
+            inline bool _get(uint8_t& c, ring_idx_t mask) {
+                // only the consumer writes the tail, so a plain load is fine here
+                ring_idx_t tail = _tail;
+                if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) return false;
+                c = _buffer[tail & mask];
+                // release the slot only after the byte has been read out of it
+                __atomic_store_n(&_tail, (ring_idx_t)(tail + 1), __ATOMIC_RELEASE);
+                return true;
+            }
+
+            /// the storage for the buffer
+            uint8_t* _buffer;
+            /// capacity - 1, used to wrap the free-running indices
+            const ring_idx_t _mask;
+            /// free-running write index, only written by the producer
+            volatile ring_idx_t _head = 0;
+            /// free-running read index, only written by the consumer
+            volatile ring_idx_t _tail = 0;
+            /// bytes dropped because the buffer was full, only written by the producer
+            volatile uint16_t _dropped = 0;
+            /// the most bytes that have been waiting at once, only written by the producer
+            volatile ring_idx_t _high_water = 0;
+
+    };
+
+    /// @brief a ring buffer with N bytes of storage
+    /// @tparam N the capacity, must be a power of two no larger than 128 so that
+    ///           the free-running 8-bit indices can tell a full buffer from an empty one.
+    template <ring_idx_t N>
+    class static_ring_buffer: public ring_buffer {
+
+        static_assert(N > 0 && (N & (N - 1)) == 0, "ring buffer capacity must be a power of two");
+        static_assert(N <= 128, "ring buffer capacity must fit the 8-bit free-running indices");
+
+        public:
+
+            static_ring_buffer() : ring_buffer(_storage, N - 1) {};
+
+            /// @brief see ring_buffer::put(), with the mask known at compile time
+            bool put(uint8_t c) { return _put(c, N - 1); }
+
+            /// @brief see ring_buffer::get(), with the mask known at compile time
+            bool get(uint8_t& c) { return _get(c, N - 1); }
+
+        private:
+
+            uint8_t _storage[N];
+
+    };
+
+}
+
+namespace utilcrc {
+
+    /// the initial value of a CRC-16
+    static const uint16_t CRC16_INIT = 0xFFFF;
+
+    /// @brief adds a byte to a CRC-16/CCITT-FALSE (polynomial 0x1021, not reflected)
+    /// @param crc  the CRC so far, starting at CRC16_INIT
+    /// @param data the byte to add
+    /// @return the updated CRC
+    inline uint16_t crc16_update(uint16_t crc, uint8_t data) {
+#if defined(AF_SIMULATOR)
+        crc ^= (uint16_t)data << 8;
+        for (uint8_t i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        return crc;
+#else
+        // avr-libc's hand-optimized version of the same polynomial
+        return _crc_xmodem_update(crc, data);
+#endif
     }
 
-    static inline uint8_t bufferget(stream_buffer* sb) {
-        // complete cycle for cyclic buffer
-        if ( sb->read_idx == sb->size ) sb->read_idx = 0;
-        // if the read head is at the write head, the buffer is empty, so return 0.
-        if ( sb->read_idx == sb->write_idx ) return 0;
-        // get the byte at the read head
-        uint8_t c = sb->buffer[sb->read_idx];
-        // advance the read head
-        sb->read_idx += 1;
-        return c;
+    /// @brief adds a block of bytes to a CRC-16, see crc16_update()
+    inline uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = CRC16_INIT) {
+        for (size_t i = 0; i < len; i++) crc = crc16_update(crc, data[i]);
+        return crc;
     }
 
 }
 
+namespace utilintern {
+
+    /// @brief works out a 16-bit id for a string at compile time, so the string itself never
+    ///        has to reach the vehicle: FNV-1a over the scope, a zero byte and the string, folded
+    ///        to 16 bits. the host tools in tools/ work out the same ids, so both sides have to
+    ///        change together.
+    /// @param scope what the string belongs to, i.e. a component name
+    /// @param str   the string
+    constexpr uint16_t id(const char* scope, const char* str) {
+        uint32_t hash = 2166136261UL;
+        for (const char* c = scope; *c != '\0'; c++) hash = (hash ^ (uint8_t)*c) * 16777619UL;
+        hash = hash * 16777619UL;
+        for (const char* c = str; *c != '\0'; c++) hash = (hash ^ (uint8_t)*c) * 16777619UL;
+        return (uint16_t)((hash >> 16) ^ (hash & 0xFFFF));
+    }
+
+    /// @brief holds an id as a template argument, so it's always worked out at compile time
+    template <uint16_t ID>
+    struct constant {
+        static constexpr uint16_t value = ID;
+    };
+
+}
+
 /// @brief a simple stream interface, with a buffer that can be read from and written to.
 class Stream {
 
     public:
         /// @brief creates a stream with a buffer of size n
         /// @param size the size of the stream buffer
-        Stream(utilbuf::stream_buffer* buffer) : _buffer(buffer) {};
+        Stream(utilbuf::ring_buffer* buffer) : _buffer(buffer) {};
 
         /// @brief destructor
-        virtual ~Stream();
+        virtual ~Stream() {};
 
         /// @brief gets the next byte in the stream buffer and pops it
-        /// @return the next byte in the stream buffer
-        uint8_t read() { return utilbuf::bufferget(_buffer); };
+        /// @return the next byte in the stream buffer, or -1 if the stream buffer is empty
+        int16_t read() {
+            uint8_t c;
+            return _buffer->get(c) ? c : -1;
+        };
 
-        /// @brief gets the next n bytes in the stream buffer and pops them.
-        ///        if n is greater than the number of bytes in the stream buffer,
-        ///        the remaining bytes will be nullptr.
+        /// @brief gets up to n bytes from the stream buffer and pops them.
         /// @param n how many bytes to read from the stream buffer
         /// @param ap pointer to the start of the array to store the bytes in
-        /// @return the next n bytes in the stream buffer
-        void read(size_t n, uint8_t* ap = nullptr) {
-            for (size_t i = 0; i < n; i++) {
-                ap[i] = utilbuf::bufferget(_buffer);
-            }
+        /// @return the number of bytes read, which is less than n if the stream buffer ran out
+        size_t read(size_t n, uint8_t* ap) {
+            utilbuf::span spans[2];
+            size_t avail = _buffer->read_spans(spans);
+            if (n > avail) n = avail;
+            size_t first = n < spans[0].len ? n : spans[0].len;
+            memcpy(ap, spans[0].data, first);
+            memcpy(ap + first, spans[1].data, n - first);
+            _buffer->consume(n);
+            return n;
         }
 
         /// @brief gets the next byte in the stream buffer without removing it
-        /// @return the next byte in the stream buffer
-        uint8_t peek();
+        /// @param offset how far past the next byte to look
+        /// @return the byte, or -1 if the stream buffer doesn't have that many bytes
+        int16_t peek(utilbuf::ring_idx_t offset = 0) const {
+            uint8_t c;
+            return _buffer->peek(offset, c) ? c : -1;
+        }
+
+        /// @brief exposes the stream buffer's unread bytes in place, so they can be
+        ///        parsed or checked without copying. pop them afterwards with consume().
+        /// @param spans set to the unread bytes, at most two spans, oldest first
+        /// @return the number of unread bytes
+        utilbuf::ring_idx_t read_spans(utilbuf::span spans[2]) const { return _buffer->read_spans(spans); }
+
+        /// @brief pops bytes from the stream buffer that were read in place
+        /// @param n how many bytes to pop, must be no more than available()
+        void consume(utilbuf::ring_idx_t n) { _buffer->consume(n); }
 
         /// @brief clears the stream buffer
         /// @return the number of bytes cleared from the stream buffer
-        size_t flush();
+        size_t flush() { return _buffer->clear(); }
 
         /// @brief writes a byte to the stream
         /// @param byte the byte to write to the stream
-        /// @return 1
+        /// @return 1, or 0 if the byte was dropped
         virtual size_t write(uint8_t byte) = 0;
 
         /// @brief  writes many bytes to the stream
         /// @param bytes pointer to the start of the bytes to write to the stream
         /// @param size how many bytes to write to the stream
-        /// @return the number of bytes written to the stream (arg: size)
+        /// @return the number of bytes written to the stream, less than size if some were dropped
         virtual size_t write(const uint8_t* bytes, size_t size) = 0;
 
+        /// @brief exposes free space in the stream's outbound buffer, so a message can be
+        ///        encoded in place. nothing is sent until commit() is called.
+        /// @param spans set to the free space, at most two spans, in order
+        /// @return the number of bytes of free space
+        virtual utilbuf::ring_idx_t reserve(utilbuf::span spans[2]) = 0;
+
+        /// @brief sends bytes that were written in place through reserve()
+        /// @param n how many bytes to send, must be no more than the reserved length
+        virtual void commit(utilbuf::ring_idx_t n) = 0;
+
         /// @brief gets the number of bytes in the stream buffer
         /// @return the number of bytes in the stream buffer
-        size_t available();
+        size_t available() const { return _buffer->available(); }
 
         /// @brief checks if the stream buffer is empty
         /// @return 0 if the stream buffer is not empty, 1 if it is empty
-        bool empty() { return available() == 0; }
+        bool empty() const { return available() == 0; }
 
         /// @brief  gets the size of the stream buffer
         /// @return the size of the stream buffer
-        size_t size() const { return _buffer->size; }
+        size_t size() const { return _buffer->capacity(); }
+
+        /// @brief  gets the number of bytes dropped because the stream buffer was full
+        uint16_t dropped() const { return _buffer->dropped(); }
 
     protected:
         /// @brief  the buffer
-        utilbuf::stream_buffer* _buffer;
+        utilbuf::ring_buffer* _buffer;
     
 };
 
@@ -0,0 +1,63 @@
+#ifndef AF_TEST_H_
+#define AF_TEST_H_
+
+/// @file   af_test.h
+/// @brief  checks and timing for the host tests and benchmarks. every test is its own
+///         program, main() returns AF_TEST_RESULT() so make sees any failed check.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/// the number of checks that have failed
+static int _af_test_failures __attribute__((unused)) = 0;
+
+/// @brief checks a condition, and reports where it failed without stopping the test
+#define AF_CHECK(_cond) do { \
+        if (!(_cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond); \
+            _af_test_failures++; \
+        } \
+    } while (0)
+
+/// @brief the exit status for main(): 0 if every check passed
+#define AF_TEST_RESULT() (_af_test_failures == 0 ? 0 : 1)
+
+namespace af_test {
+
+    /// @brief gets the host's monotonic clock
+    /// @return nanoseconds from an arbitrary start
+    inline uint64_t now_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    /// @brief prints a benchmark result as time per operation
+    /// @param name what was measured
+    /// @param ops  how many operations ran
+    /// @param ns   how long they took, in nanoseconds
+    inline void report(const char* name, uint32_t ops, uint64_t ns) {
+        printf("%-40s %10.2f ns/op %12.0f op/s\n", name, (double)ns / ops, ops * 1e9 / (ns ? ns : 1));
+    }
+
+    /// @brief a small, fast pseudo-random generator (xorshift32), so runs can be repeated
+    class Rand {
+        public:
+            Rand(uint32_t seed) : _state(seed ? seed : 1) {}
+            /// @brief gets the next 32 random bits
+            uint32_t next(void) {
+                _state ^= _state << 13;
+                _state ^= _state >> 17;
+                _state ^= _state << 5;
+                return _state;
+            }
+            /// @brief gets a random number below n
+            uint32_t below(uint32_t n) { return next() % n; }
+        private:
+            uint32_t _state;
+    };
+
+}
+
+#endif // AF_TEST_H_
@@ -0,0 +1,70 @@
+#ifndef AF_TEST_STREAM_H_
+#define AF_TEST_STREAM_H_
+
+/// @file   af_test_stream.h
+/// @brief  an in-memory Stream for the host tests, standing in for a serial port. bytes
+///         written to it land in its peer's receive buffer, or its own if it has no peer.
+
+#include <af_test.h>
+#include <util.h>
+
+namespace af_test {
+
+    /// @brief a Stream backed by memory, that can be connected to another one like two
+    ///        uarts wired together
+    class Test_Stream: public Stream {
+        public:
+            Test_Stream() : Stream(&_rx) {}
+
+            /// @brief wires this stream's output to another stream's input
+            /// @param peer the stream to deliver to, or nullptr to loop back to this one
+            void connect(Test_Stream* peer) { _peer = peer; }
+
+            /// @brief loses some of what's sent through reserve() and commit(), which senders
+            ///        like AF_GCS use for one whole frame at a time
+            /// @param percent how many commits in a hundred are lost
+            /// @param seed    seeds which ones, so a run can be repeated
+            void set_loss(uint8_t percent, uint32_t seed) {
+                _loss = percent;
+                _rand = Rand(seed);
+            }
+
+            /// @brief gets the number of commits lost
+            uint32_t get_lost(void) const { return _lost; }
+
+            /// @brief queues bytes as if they'd been received
+            /// @return the number of bytes that fit
+            size_t feed(const uint8_t* bytes, size_t size) { return _rx.write(bytes, size); }
+
+            virtual size_t write(uint8_t byte) { return _target()->_rx.put(byte) ? 1 : 0; }
+
+            virtual size_t write(const uint8_t* bytes, size_t size) { return _target()->_rx.write(bytes, size); }
+
+            virtual utilbuf::ring_idx_t reserve(utilbuf::span spans[2]) { return _target()->_rx.reserve(spans); }
+
+            virtual void commit(utilbuf::ring_idx_t n) {
+                if (_loss > 0 && _rand.below(100) < _loss) {
+                    _lost++;
+                    return;
+                }
+                _target()->_rx.commit(n);
+            }
+
+        private:
+            Test_Stream* _target(void) { return _peer != nullptr ? _peer : this; }
+
+            /// the receive buffer, as big as a ring buffer gets
+            utilbuf::static_ring_buffer<128> _rx;
+            /// where written bytes go
+            Test_Stream* _peer = nullptr;
+            /// how many commits in a hundred are lost
+            uint8_t _loss = 0;
+            /// picks the commits that are lost
+            Rand _rand = Rand(1);
+            /// commits lost
+            uint32_t _lost = 0;
+    };
+
+}
+
+#endif // AF_TEST_STREAM_H_
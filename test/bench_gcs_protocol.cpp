@@ -0,0 +1,66 @@
+// Benchmarks for the GCS wire protocol: encoding frames in place, and decoding them a byte at
+// a time and straight out of a stream's buffer, for the smallest and largest payloads.
+
+#include <af_test.h>
+#include <af_test_stream.h>
+#include <AF_GCS/AF_GCS_Protocol.h>
+
+/// how many frames each benchmark moves
+static const uint32_t FRAMES = 2000000;
+
+/// @brief keeps the compiler from optimizing a result away
+static volatile uint8_t _sink;
+
+/// @brief encodes a frame into the stream's buffer
+static utilbuf::ring_idx_t encode(af_test::Test_Stream& wire, const uint8_t* payload, uint8_t len) {
+    utilbuf::span spans[2];
+    AF_GCS_Frame_Writer writer(spans, wire.reserve(spans));
+    AF_GCS_Frame_Header header = { AF_GCS_MSG_STREAM, 0x12, 0, len };
+    writer.put(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    writer.put(payload, len);
+    utilbuf::ring_idx_t n = writer.finish();
+    wire.commit(n);
+    return n;
+}
+
+/// @brief encodes frames and throws them away
+static void bench_encode(const char* name, uint8_t len) {
+    af_test::Test_Stream wire;
+    uint8_t payload[AF_GCS_MAX_PAYLOAD];
+    for (uint8_t i = 0; i < len; i++) payload[i] = i * 37;
+    uint64_t start = af_test::now_ns();
+    for (uint32_t f = 0; f < FRAMES; f++) wire.consume(encode(wire, payload, len));
+    af_test::report(name, FRAMES, af_test::now_ns() - start);
+}
+
+/// @brief decodes frames a byte at a time, or straight out of the stream's buffer
+static void bench_decode(const char* name, uint8_t len, bool in_place) {
+    af_test::Test_Stream wire;
+    uint8_t payload[AF_GCS_MAX_PAYLOAD];
+    for (uint8_t i = 0; i < len; i++) payload[i] = i * 37;
+    uint8_t encoded[AF_GCS_MAX_ENCODED_LEN];
+    uint8_t n = wire.read(encode(wire, payload, len), encoded);
+
+    AF_GCS_Decoder decoder;
+    uint64_t start = af_test::now_ns();
+    for (uint32_t f = 0; f < FRAMES; f++) {
+        if (in_place) {
+            wire.feed(encoded, n);
+            decoder.feed(&wire);
+        } else {
+            for (uint8_t b = 0; b < n; b++) decoder.feed(encoded[b]);
+        }
+    }
+    af_test::report(name, FRAMES, af_test::now_ns() - start);
+    AF_CHECK(decoder.get_frames_good() == (uint16_t)FRAMES);
+    _sink = decoder.get_payload()[0];
+}
+
+int main(void) {
+    bench_encode("encode, 8 byte payload", 8);
+    bench_encode("encode, 48 byte payload", 48);
+    bench_decode("decode by byte, 8 byte payload", 8, false);
+    bench_decode("decode by byte, 48 byte payload", 48, false);
+    bench_decode("decode in place, 48 byte payload", 48, true);
+    return AF_TEST_RESULT();
+}
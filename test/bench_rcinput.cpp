@@ -0,0 +1,84 @@
+// Benchmarks for receiver input: what the capture ISR costs per PPM frame, and what decoding
+// a frame costs the task that runs update(). On the boards the ISR also extends the capture
+// to a cycle count (see rcin_hal.cpp), which the host has no timer for, so only the queueing
+// is measured here.
+
+#include <af_test.h>
+#include <af_test_stream.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/rcin_hal.h>
+#include <AF_HAL/sim_hal.h>
+#include <AF_RCInput/AF_RCInput.h>
+#include <string.h>
+
+/// how many frames each benchmark decodes
+static const uint32_t FRAMES = 1000000;
+
+/// an 8 channel PPM frame and its sync gap, in capture ticks
+static const uint16_t PPM_FRAME[] = {
+    1000 * AF_RCIN_PPM_TICKS_PER_US, 1200 * AF_RCIN_PPM_TICKS_PER_US, 1400 * AF_RCIN_PPM_TICKS_PER_US,
+    1600 * AF_RCIN_PPM_TICKS_PER_US, 1800 * AF_RCIN_PPM_TICKS_PER_US, 2000 * AF_RCIN_PPM_TICKS_PER_US,
+    1500 * AF_RCIN_PPM_TICKS_PER_US, 1500 * AF_RCIN_PPM_TICKS_PER_US, 6000 * AF_RCIN_PPM_TICKS_PER_US
+};
+/// the number of edges in a PPM frame
+static const uint8_t PPM_EDGES = sizeof(PPM_FRAME) / sizeof(PPM_FRAME[0]);
+
+/// @brief the capture ISR's share of a frame: one queued width per edge
+static void bench_ppm_isr(void) {
+    uint16_t widths[AF_RCIN_PPM_QUEUE_LEN];
+    uint64_t spent = 0;
+    uint32_t frames = 0;
+    // as many frames at a time as the queue holds, so the clock isn't read every frame
+    const uint8_t batch = AF_RCIN_PPM_QUEUE_LEN / PPM_EDGES;
+    while (frames < FRAMES) {
+        uint64_t start = af_test::now_ns();
+        for (uint8_t b = 0; b < batch; b++) {
+            for (uint8_t i = 0; i < PPM_EDGES; i++) AF_HAL::rcin::_ppm_push(PPM_FRAME[i]);
+        }
+        spent += af_test::now_ns() - start;
+        AF_HAL::rcin::ppm_read(widths, AF_RCIN_PPM_QUEUE_LEN);
+        frames += batch;
+    }
+    AF_CHECK(AF_HAL::rcin::ppm_overruns() == 0);
+    af_test::report("ppm capture ISR, per frame", frames, spent);
+}
+
+/// @brief decoding queued PPM frames in update()
+static void bench_ppm_decode(void) {
+    AF_RCInput_PPM rc(AF_TOPIC_ID("rc.ppm"));
+    rc.begin();
+    uint64_t spent = 0;
+    for (uint32_t f = 0; f < FRAMES; f++) {
+        for (uint8_t i = 0; i < PPM_EDGES; i++) AF_HAL::rcin::_ppm_push(PPM_FRAME[i]);
+        uint64_t start = af_test::now_ns();
+        rc.update();
+        spent += af_test::now_ns() - start;
+    }
+    AF_CHECK(rc.get_frames_good() == (uint16_t)(FRAMES - 1));
+    af_test::report("ppm decode, per frame", FRAMES, spent);
+}
+
+/// @brief decoding SBUS frames from a port's buffer in update()
+static void bench_sbus_decode(void) {
+    af_test::Test_Stream port;
+    AF_RCInput_SBUS rc(&port, AF_TOPIC_ID("rc.sbus"));
+    uint8_t frame[AF_RC_SBUS_FRAME_LEN] = { 0x0F };
+    for (uint8_t i = 1; i < 23; i++) frame[i] = 0x55;
+    uint64_t spent = 0;
+    for (uint32_t f = 0; f < FRAMES; f++) {
+        port.feed(frame, sizeof(frame));
+        uint64_t start = af_test::now_ns();
+        rc.update();
+        spent += af_test::now_ns() - start;
+    }
+    AF_CHECK(rc.get_frames_good() == (uint16_t)FRAMES);
+    af_test::report("sbus decode, per frame", FRAMES, spent);
+}
+
+int main(void) {
+    AF_HAL::sim::set_clock_mode(AF_HAL::sim::AF_SIM_CLOCK_VIRTUAL, 1);
+    bench_ppm_isr();
+    bench_ppm_decode();
+    bench_sbus_decode();
+    return AF_TEST_RESULT();
+}
@@ -0,0 +1,77 @@
+// Benchmarks for utilbuf::ring_buffer: byte-at-a-time against the span API, with the mask
+// known at compile time and not, and across two threads.
+
+#include <af_test.h>
+#include <util.h>
+#include <thread>
+
+/// how many bytes each benchmark moves
+static const uint32_t BYTES = 20000000;
+
+/// @brief keeps the compiler from optimizing a result away
+static volatile uint8_t _sink;
+
+/// @brief puts and gets one byte at a time, through the base class or the static one
+template <typename RB>
+static void bench_bytes(const char* name, RB& rb) {
+    uint8_t c = 0, sum = 0;
+    uint64_t start = af_test::now_ns();
+    for (uint32_t i = 0; i < BYTES; i += 16) {
+        for (uint8_t j = 0; j < 16; j++) rb.put(j);
+        for (uint8_t j = 0; j < 16; j++) { rb.get(c); sum += c; }
+    }
+    af_test::report(name, BYTES, af_test::now_ns() - start);
+    _sink = sum;
+}
+
+/// @brief moves 16 bytes at a time through reserve()/commit() and read_spans()/consume()
+static void bench_spans(void) {
+    utilbuf::static_ring_buffer<64> rb;
+    static const uint8_t block[16] = { 0 };
+    utilbuf::span spans[2];
+    uint8_t sum = 0;
+    uint64_t start = af_test::now_ns();
+    for (uint32_t i = 0; i < BYTES; i += 16) {
+        rb.reserve(spans);
+        uint8_t first = spans[0].len < 16 ? spans[0].len : 16;
+        memcpy(spans[0].data, block, first);
+        memcpy(spans[1].data, block + first, 16 - first);
+        rb.commit(16);
+        utilbuf::ring_idx_t n = rb.read_spans(spans);
+        sum += spans[0].data[0];
+        rb.consume(n);
+    }
+    af_test::report("spans, 16 byte blocks", BYTES, af_test::now_ns() - start);
+    _sink = sum;
+}
+
+/// @brief a producer thread and a consumer thread, like a UART ISR and the main loop. each
+///        side yields when it can't make progress, so on one core this mostly measures the
+///        host's context switches.
+static void bench_threads(void) {
+    utilbuf::static_ring_buffer<64> rb;
+    uint64_t start = af_test::now_ns();
+    std::thread producer([&rb]() {
+        for (uint32_t sent = 0; sent < BYTES; ) {
+            if (rb.put((uint8_t)sent)) sent++;
+            else std::this_thread::yield();
+        }
+    });
+    uint8_t c, sum = 0;
+    for (uint32_t received = 0; received < BYTES; ) {
+        if (rb.get(c)) { sum += c; received++; }
+        else std::this_thread::yield();
+    }
+    producer.join();
+    af_test::report("put/get across two threads", BYTES, af_test::now_ns() - start);
+    _sink = sum;
+}
+
+int main(void) {
+    utilbuf::static_ring_buffer<64> rb;
+    bench_bytes("put/get, compile-time mask", rb);
+    bench_bytes("put/get, runtime mask", static_cast<utilbuf::ring_buffer&>(rb));
+    bench_spans();
+    bench_threads();
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Runs the profiled hot paths on the simulator HAL and writes af_profile::report() to stdout,
+// framed the way a vehicle's log stream is, for tools/af_profile.py. Built with
+// AF_PROFILE_ENABLED=1 by `make -C test profile`, which also turns the capture into JSON.
+//
+// The cycle counts come from the host clock (see AF_Profiler.h), so they're for comparing one
+// build against another on the same machine, not for what the AVR will take.
+
+#include <af_test.h>
+#include <af_test_stream.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/sim_hal.h>
+#include <AF_HAL/serial_hal.h>
+#include <AF_Logger/AF_Logger.h>
+#include <AF_Profiler/AF_Profiler.h>
+#include <AF_Scheduler/AF_Scheduler.h>
+#include <AF_Variable/AF_Variable.h>
+#include <control.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#if !AF_PROFILE_ENABLED
+#error "build with -DAF_PROFILE_ENABLED=1, see the profile target in test/Makefile"
+#endif
+
+/// how many times the hot paths run outside the scheduler
+static const uint32_t CALLS = 200000;
+/// how many scheduler ticks run, a millisecond each
+static const uint16_t TICKS = 1000;
+
+/// where the port's bytes are read back, so the port never stalls on a full buffer
+#define SERIAL_SOCKET "/tmp/af-profile-serial1"
+
+static AF_Logger logger;
+static PID* _pid;
+/// the other end of the serial port
+static int _serial_fd = -1;
+/// keeps the compiler from optimizing a result away
+static volatile float _sink;
+
+/// @brief reads back whatever the serial port has sent
+static void drain_serial(void) {
+    uint8_t bytes[256];
+    while (_serial_fd >= 0 && read(_serial_fd, bytes, sizeof(bytes)) > 0) {}
+}
+
+/// @brief one pass over the hot paths, like one run of a control task
+static void hot_paths(void) {
+    static const uint8_t telemetry[16] = { 0x55 };
+    static float error = 1.0f;
+    error = -error * 0.99f;
+    _sink = _pid->output(error);
+
+    AF_Variable_Storage* variables = AF_Variable_Storage::get_instance();
+    _sink = variables->get_variable("prof.kp") != nullptr;
+    _sink = variables->get_variable_at(variables->get_num_variables() - 1) != nullptr;
+
+    AF_HAL::hwserial::SerialInterface1.write(telemetry, sizeof(telemetry));
+    drain_serial();
+}
+
+/// @brief opens serial port 1 on a unix socket and connects to it
+static void open_serial(void) {
+    setenv("AF_SIM_SERIAL1", "unix:" SERIAL_SOCKET, 1);
+    AF_HAL::hwserial::SerialInterface1.open(115200, 0);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SERIAL_SOCKET, sizeof(addr.sun_path) - 1);
+    _serial_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    AF_CHECK(_serial_fd >= 0 && connect(_serial_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+}
+
+int main(void) {
+    AF_HAL::sim::set_clock_mode(AF_HAL::sim::AF_SIM_CLOCK_REALTIME, 0);
+    open_serial();
+    PID pid(0.8f, 0.1f, 0.05f, 0.0f, 1.0f, -1.0f, 0.5f, -0.5f, AF_VAR_FLAG_READABLE_BY_GCS, "prof");
+    _pid = &pid;
+
+    for (uint32_t i = 0; i < CALLS; i++) hot_paths();
+
+    AF_Scheduler* scheduler = AF_Scheduler::get_instance();
+    scheduler->register_task(hot_paths, 50, 1000);
+    for (uint16_t i = 0; i < TICKS; i++) scheduler->tick();
+
+    // the report goes out the same way a vehicle's does, then to stdout
+    af_test::Test_Stream log_port;
+    AF_Log_Stream_Sink sink(&log_port);
+    logger.attach(AF_LOGGER_STREAM_SERIAL, &sink, AF_LOG_POLICY_RETRY);
+    af_profile::report();
+    do {
+        logger.update();
+        uint8_t bytes[128];
+        uint8_t n = log_port.read(log_port.available(), bytes);
+        fwrite(bytes, 1, n, stdout);
+    } while (logger.get_backlog(AF_LOGGER_STREAM_SERIAL) > 0 || log_port.available() > 0);
+
+    AF_HAL::hwserial::SerialInterface1.close();
+    if (_serial_fd >= 0) close(_serial_fd);
+    unlink(SERIAL_SOCKET);
+    return AF_TEST_RESULT();
+}
@@ -0,0 +1,172 @@
+// Tests for GCS links over in-memory ports: what the outbound queue drops when it's full, and
+// requests between two links that lose frames, and across a reboot of the sender.
+
+#include <af_test.h>
+#include <af_test_stream.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/eeprom_hal.h>
+#include <AF_HAL/sim_hal.h>
+#include <AF_Context/AF_Context.h>
+#include <AF_GCS/AF_GCS.h>
+
+/// @brief a full queue drops the oldest, least important frame, and counts it without rolling over
+static void test_queue_drops(void) {
+    af_test::Test_Stream port;
+    AF_GCS gcs(&port, 57600);
+    const uint8_t payload[4] = { 1, 2, 3, 4 };
+
+    for (uint8_t i = 0; i < AF_GCS_QUEUE_LEN; i++) {
+        AF_CHECK(gcs.send(AF_GCS_MSG_STREAM, AF_GCS_COMP_SENSOR, AF_GCS_PRIORITY_DEBUG, payload, sizeof(payload)));
+    }
+    AF_CHECK(gcs.get_queued() == AF_GCS_QUEUE_LEN);
+
+    // a warning pushes out a debug frame
+    AF_CHECK(gcs.send(AF_GCS_MSG_STREAM, AF_GCS_COMP_SENSOR, AF_GCS_PRIORITY_WARN, payload, sizeof(payload)));
+    AF_CHECK(gcs.get_frames_dropped(AF_GCS_PRIORITY_DEBUG) == 1);
+    AF_CHECK(gcs.get_queued() == AF_GCS_QUEUE_LEN);
+
+    // once only warnings are left, debug frames are turned away instead
+    for (uint8_t i = 1; i < AF_GCS_QUEUE_LEN; i++) {
+        AF_CHECK(gcs.send(AF_GCS_MSG_STREAM, AF_GCS_COMP_SENSOR, AF_GCS_PRIORITY_WARN, payload, sizeof(payload)));
+    }
+    AF_CHECK(!gcs.send(AF_GCS_MSG_STREAM, AF_GCS_COMP_SENSOR, AF_GCS_PRIORITY_DEBUG, payload, sizeof(payload)));
+    AF_CHECK(gcs.get_frames_dropped(AF_GCS_PRIORITY_DEBUG) == AF_GCS_QUEUE_LEN + 1);
+
+    for (uint32_t i = 0; i < 70000; i++) {
+        gcs.send(AF_GCS_MSG_STREAM, AF_GCS_COMP_SENSOR, AF_GCS_PRIORITY_DEBUG, payload, sizeof(payload));
+    }
+    AF_CHECK(gcs.get_frames_dropped(AF_GCS_PRIORITY_DEBUG) == 0xFFFF);
+    AF_CHECK(gcs.get_frames_dropped(AF_GCS_PRIORITY_WARN) == 0);
+}
+
+/// how many times the receiving end has run each request, by the first byte of its data
+static uint8_t _runs[256];
+
+/// @brief runs a request on the receiving end, responding with its data
+static AF_GCS_Request_Status run_request(uint8_t command, const uint8_t* data, uint8_t len,
+                                         uint8_t* response, uint8_t& response_len) {
+    (void)command;
+    if (len < 1) return AF_GCS_REQUEST_REJECTED;
+    _runs[data[0]]++;
+    response[0] = data[0];
+    response_len = 1;
+    return AF_GCS_REQUEST_OK;
+}
+
+/// @brief the result of one request, filled in by its callback
+struct Result {
+    bool done;
+    AF_GCS_Request_Status status;
+    uint8_t response;
+};
+
+/// @brief stores a request's result
+static void on_result(AF_GCS_Request_Status status, const uint8_t* response, uint8_t len, void* context) {
+    Result* result = static_cast<Result*>(context);
+    result->done = true;
+    result->status = status;
+    result->response = len > 0 ? response[0] : 0;
+}
+
+/// @brief runs both ends of a link for a while, a millisecond at a time
+static void pump(AF_GCS& a, AF_GCS& b, uint32_t us) {
+    for (uint32_t t = 0; t < us; t += 1000) {
+        AF_HAL::sim::advance(1000);
+        a.update();
+        b.update();
+        while (a.receive()) {}
+        while (b.receive()) {}
+    }
+}
+
+/// @brief sends a request and runs the link until it's acked or times out
+static Result request(AF_GCS& a, AF_GCS& b, uint8_t data) {
+    Result result = {};
+    AF_CHECK(a.request(0x10, &data, 1, AF_GCS_PRIORITY_WARN, on_result, &result));
+    for (uint16_t i = 0; i < 100 && !result.done; i++) pump(a, b, 100000);
+    AF_CHECK(result.done);
+    return result;
+}
+
+/// @brief requests and acks both lose a third of their frames. a request may time out, but
+///        none is ever run twice, and every one that's acked was run exactly once.
+static void test_lossy_requests(void) {
+    af_test::Test_Stream vehicle_port, ground_port;
+    vehicle_port.connect(&ground_port);
+    ground_port.connect(&vehicle_port);
+    vehicle_port.set_loss(33, 1);
+    ground_port.set_loss(33, 2);
+    AF_GCS vehicle(&vehicle_port, 57600);
+    AF_GCS ground(&ground_port, 57600);
+    ground.get_requests().set_handler(run_request);
+    memset(_runs, 0, sizeof(_runs));
+
+    uint8_t acked = 0;
+    for (uint16_t i = 0; i < 200; i++) {
+        Result result = request(vehicle, ground, i);
+        AF_CHECK(_runs[i] <= 1);
+        if (result.status == AF_GCS_REQUEST_OK) {
+            acked++;
+            AF_CHECK(_runs[i] == 1 && result.response == i);
+        } else {
+            AF_CHECK(result.status == AF_GCS_REQUEST_TIMEOUT);
+        }
+    }
+    // both directions lost frames, and most requests still made it with retries
+    AF_CHECK(vehicle_port.get_lost() > 0 && ground_port.get_lost() > 0);
+    AF_CHECK(acked > 150);
+}
+
+/// @brief boots the vehicle and sends its first request. every boot runs the same way up to
+///        it, on a board whose clock starts at 0, and only the EEPROM is left from the boot
+///        before.
+static Result first_request(AF_GCS& vehicle, AF_GCS& ground, uint8_t data, uint8_t* eeprom, uint16_t len) {
+    Result result = {};
+    {
+        AF_Context boot;
+        AF_Context_Scope scope(boot);
+        AF_HAL::eeprom::update(0, eeprom, len);
+        AF_CHECK(vehicle.request(0x10, &data, 1, AF_GCS_PRIORITY_WARN, on_result, &result));
+        AF_HAL::eeprom::read(0, eeprom, len);
+    }
+    for (uint16_t i = 0; i < 100 && !result.done; i++) pump(vehicle, ground, 100000);
+    AF_CHECK(result.done);
+    return result;
+}
+
+/// @brief the sender reboots and starts its request ids again, from a boot that runs exactly
+///        as the last one did. its first request reuses an id the receiver remembers, and
+///        still has to run.
+static void test_reboot(void) {
+    af_test::Test_Stream ground_port;
+    AF_GCS ground(&ground_port, 57600);
+    ground.get_requests().set_handler(run_request);
+    memset(_runs, 0, sizeof(_runs));
+    uint8_t eeprom[16];
+    memset(eeprom, 0xFF, sizeof(eeprom));
+
+    {
+        af_test::Test_Stream vehicle_port;
+        vehicle_port.connect(&ground_port);
+        ground_port.connect(&vehicle_port);
+        AF_GCS vehicle(&vehicle_port, 57600);
+        AF_CHECK(first_request(vehicle, ground, 1, eeprom, sizeof(eeprom)).status == AF_GCS_REQUEST_OK);
+        AF_CHECK(request(vehicle, ground, 2).status == AF_GCS_REQUEST_OK);
+    }
+
+    af_test::Test_Stream vehicle_port;
+    vehicle_port.connect(&ground_port);
+    ground_port.connect(&vehicle_port);
+    AF_GCS vehicle(&vehicle_port, 57600);
+    Result result = first_request(vehicle, ground, 3, eeprom, sizeof(eeprom));
+    AF_CHECK(result.status == AF_GCS_REQUEST_OK && result.response == 3);
+    AF_CHECK(_runs[1] == 1 && _runs[2] == 1 && _runs[3] == 1);
+}
+
+int main(void) {
+    AF_HAL::sim::set_clock_mode(AF_HAL::sim::AF_SIM_CLOCK_VIRTUAL, 1);
+    test_queue_drops();
+    test_lossy_requests();
+    test_reboot();
+    return AF_TEST_RESULT();
+}
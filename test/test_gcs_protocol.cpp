@@ -0,0 +1,150 @@
+// Tests for the GCS wire protocol: frames survive the round trip whatever their payload, the
+// decoder never passes a corrupted frame and picks up again at the next delimiter, random
+// noise doesn't upset it, and frames cost what the efficiency table in AF_GCS_Protocol.h says.
+
+#include <af_test.h>
+#include <af_test_stream.h>
+#include <AF_GCS/AF_GCS_Protocol.h>
+#include <string.h>
+
+/// @brief encodes a frame the way AF_GCS sends one
+/// @param out where to store the encoded frame, AF_GCS_MAX_ENCODED_LEN bytes
+/// @return the length of the encoded frame, or 0 if it didn't fit
+static uint8_t encode(uint8_t* out, uint8_t seq, const uint8_t* payload, uint8_t len) {
+    af_test::Test_Stream wire;
+    utilbuf::span spans[2];
+    AF_GCS_Frame_Writer writer(spans, wire.reserve(spans));
+    AF_GCS_Frame_Header header = { AF_GCS_MSG_STREAM, 0x12, seq, len };
+    writer.put(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    writer.put(payload, len);
+    utilbuf::ring_idx_t n = writer.finish();
+    wire.commit(n);
+    return wire.read(n, out);
+}
+
+/// @brief fills a payload with random bytes, biased towards the zeros COBS has to remove
+static void random_payload(af_test::Rand& rand, uint8_t* payload, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) payload[i] = rand.below(4) == 0 ? 0 : rand.next();
+}
+
+/// @brief checks the decoder holds the frame that was sent
+static bool matches(const AF_GCS_Decoder& decoder, uint8_t seq, const uint8_t* payload, uint8_t len) {
+    const AF_GCS_Frame_Header* header = decoder.get_header();
+    return header->type == AF_GCS_MSG_STREAM && header->info == 0x12 && header->seq == seq &&
+        header->len == len && memcmp(decoder.get_payload(), payload, len) == 0;
+}
+
+/// @brief every payload length, and payloads of all zeros and no zeros, through a stream
+static void test_round_trip(void) {
+    af_test::Rand rand(1);
+    af_test::Test_Stream wire;
+    AF_GCS_Decoder decoder;
+    uint8_t payload[AF_GCS_MAX_PAYLOAD];
+    uint8_t encoded[AF_GCS_MAX_ENCODED_LEN];
+
+    for (uint16_t i = 0; i < 3 * (AF_GCS_MAX_PAYLOAD + 1); i++) {
+        uint8_t len = i % (AF_GCS_MAX_PAYLOAD + 1);
+        switch (i / (AF_GCS_MAX_PAYLOAD + 1)) {
+            case 0: random_payload(rand, payload, len); break;
+            case 1: memset(payload, 0, len); break;
+            default: memset(payload, 0xFF, len); break;
+        }
+        uint8_t n = encode(encoded, i, payload, len);
+        // the delimiter is the only zero on the wire
+        AF_CHECK(n == len + AF_GCS_FRAME_OVERHEAD);
+        AF_CHECK(memchr(encoded, 0, n - 1) == nullptr && encoded[n - 1] == AF_GCS_DELIMITER);
+
+        AF_CHECK(wire.feed(encoded, n) == n);
+        AF_CHECK(decoder.feed(&wire));
+        AF_CHECK(matches(decoder, i, payload, len));
+        AF_CHECK(wire.available() == 0);
+    }
+    AF_CHECK(decoder.get_frames_bad() == 0);
+}
+
+/// @brief corrupts one byte in some frames of a long stream. a corrupted frame is never
+///        passed as valid, and every frame that wasn't corrupted still gets through.
+static void test_corruption(void) {
+    static const uint16_t FRAMES = 20000;
+    af_test::Rand rand(2);
+    AF_GCS_Decoder decoder;
+    uint8_t payload[AF_GCS_MAX_PAYLOAD];
+    uint8_t encoded[AF_GCS_MAX_ENCODED_LEN];
+    uint16_t intact = 0, passed = 0, wrong = 0;
+
+    for (uint16_t i = 0; i < FRAMES; i++) {
+        uint8_t len = rand.below(AF_GCS_MAX_PAYLOAD + 1);
+        random_payload(rand, payload, len);
+        uint8_t n = encode(encoded, i, payload, len);
+
+        bool corrupt = rand.below(3) == 0;
+        if (corrupt) {
+            // any byte but the delimiter, to any other value (including a stray delimiter)
+            uint8_t at = rand.below(n - 1);
+            encoded[at] ^= 1 + rand.below(255);
+        } else {
+            intact++;
+        }
+
+        for (uint8_t b = 0; b < n; b++) {
+            if (!decoder.feed(encoded[b])) continue;
+            passed++;
+            if (corrupt || !matches(decoder, i, payload, len)) wrong++;
+        }
+    }
+
+    AF_CHECK(wrong == 0);
+    AF_CHECK(passed == intact);
+    AF_CHECK(decoder.get_frames_good() == intact);
+    AF_CHECK(decoder.get_frames_bad() >= FRAMES - intact);
+}
+
+/// @brief random bytes on the line, then a frame after the next delimiter
+static void test_noise(void) {
+    af_test::Rand rand(3);
+    AF_GCS_Decoder decoder;
+    uint32_t passed = 0;
+    for (uint32_t i = 0; i < 1000000; i++) {
+        if (decoder.feed((uint8_t)rand.next())) passed++;
+    }
+    // a frame out of noise needs a length that agrees with its header and a CRC to match
+    AF_CHECK(passed < 10);
+
+    uint8_t payload[16] = { 1, 2, 3 };
+    uint8_t encoded[AF_GCS_MAX_ENCODED_LEN];
+    uint8_t n = encode(encoded, 7, payload, sizeof(payload));
+    decoder.feed((uint8_t)AF_GCS_DELIMITER);
+    bool ok = false;
+    for (uint8_t b = 0; b < n; b++) ok = decoder.feed(encoded[b]);
+    AF_CHECK(ok && matches(decoder, 7, payload, sizeof(payload)));
+}
+
+/// @brief the efficiency table in AF_GCS_Protocol.h, from frames as they're really encoded
+static void test_efficiency(void) {
+    static const struct { uint8_t payload; uint8_t percent; uint16_t bytes_per_s; } table[] = {
+        { 8, 50, 2880 }, { 16, 67, 3840 }, { 32, 80, 4608 }, { 48, 86, 4937 }
+    };
+    // 57600 baud, 8N1
+    static const uint32_t wire_bytes_per_s = 57600 / 10;
+    af_test::Rand rand(4);
+    uint8_t payload[AF_GCS_MAX_PAYLOAD];
+    uint8_t encoded[AF_GCS_MAX_ENCODED_LEN];
+
+    for (uint8_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        random_payload(rand, payload, table[i].payload);
+        uint8_t n = encode(encoded, 0, payload, table[i].payload);
+        AF_CHECK(n == table[i].payload + AF_GCS_FRAME_OVERHEAD);
+        uint32_t percent = (table[i].payload * 100 + n / 2) / n;
+        uint32_t bytes_per_s = wire_bytes_per_s * table[i].payload / n;
+        AF_CHECK(percent == table[i].percent);
+        AF_CHECK(bytes_per_s == table[i].bytes_per_s);
+    }
+}
+
+int main(void) {
+    test_round_trip();
+    test_corruption();
+    test_noise();
+    test_efficiency();
+    return AF_TEST_RESULT();
+}
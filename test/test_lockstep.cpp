@@ -0,0 +1,123 @@
+// Tests for lockstep over GCS links: digests sent with AF_Lockstep::submit() reach the other
+// controller through AF_GCS::receive(), with two controllers the primary keeps the outputs
+// whichever side goes quiet, and with three one that's cut off never takes them over.
+
+#include <af_test.h>
+#include <af_test_stream.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/sim_hal.h>
+#include <AF_GCS/AF_GCS.h>
+#include <AF_Lockstep/AF_Lockstep.h>
+
+/// @brief two controllers and the link between them
+struct Pair {
+    af_test::Test_Stream ports[2];
+    AF_GCS primary;
+    AF_GCS secondary;
+    AF_Lockstep locksteps[2];
+
+    Pair() : primary(&ports[0], 115200), secondary(&ports[1], 115200), locksteps{ AF_Lockstep(0, 2), AF_Lockstep(1, 2) } {
+        ports[0].connect(&ports[1]);
+        ports[1].connect(&ports[0]);
+        primary.set_lockstep(&locksteps[0]);
+        secondary.set_lockstep(&locksteps[1]);
+    }
+
+    /// @brief runs one control tick. a controller that's quiet computes its outputs but its
+    ///        digest never reaches the link.
+    void tick(uint32_t tick, bool primary_quiet, bool secondary_quiet) {
+        uint16_t outputs[2] = { (uint16_t)(1000 + tick), 1500 };
+        uint8_t payload[AF_LOCKSTEP_DIGEST_LEN];
+        if (primary_quiet) locksteps[0].submit(tick, outputs, 2, payload);
+        else AF_CHECK(locksteps[0].submit(tick, outputs, 2, primary));
+        if (secondary_quiet) locksteps[1].submit(tick, outputs, 2, payload);
+        else AF_CHECK(locksteps[1].submit(tick, outputs, 2, secondary));
+
+        AF_HAL::sim::advance(2500);
+        primary.update();
+        secondary.update();
+        while (primary.receive()) {}
+        while (secondary.receive()) {}
+    }
+};
+
+/// @brief digests travel over the links, and both controllers agree every tick
+static void test_link(void) {
+    Pair pair;
+    for (uint32_t t = 0; t < 20; t++) {
+        pair.tick(t, false, false);
+        AF_CHECK(pair.locksteps[0].is_complete(t) && pair.locksteps[1].is_complete(t));
+        AF_CHECK(pair.locksteps[0].vote(t) == AF_LOCKSTEP_AGREE);
+        AF_CHECK(pair.locksteps[1].vote(t) == AF_LOCKSTEP_AGREE);
+    }
+    AF_CHECK(pair.locksteps[0].is_in_control() && !pair.locksteps[1].is_in_control());
+}
+
+/// @brief the link between two controllers breaks, so each one hears nothing from the other
+///        and masks it. only the primary drives the outputs.
+static void test_two_cut_off(void) {
+    Pair pair;
+    for (uint32_t t = 0; t < 20; t++) {
+        pair.tick(t, t >= 5, t >= 5);
+        pair.locksteps[0].vote(t);
+        pair.locksteps[1].vote(t);
+    }
+    AF_CHECK(pair.locksteps[0].is_masked(1) && pair.locksteps[1].is_masked(0));
+    AF_CHECK(pair.locksteps[0].is_in_control());
+    AF_CHECK(!pair.locksteps[1].is_in_control() && pair.locksteps[1].get_controller() == 0);
+}
+
+/// @brief three controllers still hand over: the one the others stop hearing from is masked,
+///        and the next one takes the outputs
+static void test_three_hand_over(void) {
+    AF_Lockstep locksteps[3] = { AF_Lockstep(0, 3), AF_Lockstep(1, 3), AF_Lockstep(2, 3) };
+    for (uint32_t t = 0; t < 20; t++) {
+        uint16_t outputs[1] = { (uint16_t)t };
+        uint8_t payloads[3][AF_LOCKSTEP_DIGEST_LEN];
+        for (uint8_t n = 0; n < 3; n++) locksteps[n].submit(t, outputs, 1, payloads[n]);
+        for (uint8_t to = 1; to < 3; to++) {
+            for (uint8_t from = 0; from < 3; from++) {
+                // controller 0 goes quiet after tick 5
+                if (from != to && (from != 0 || t < 5)) locksteps[to].on_digest(payloads[from], AF_LOCKSTEP_DIGEST_LEN);
+            }
+            locksteps[to].vote(t);
+        }
+    }
+    AF_CHECK(locksteps[1].is_masked(0) && locksteps[1].is_in_control());
+    AF_CHECK(locksteps[2].get_controller() == 1);
+}
+
+/// @brief three controllers, and controller 2 is cut off from the other two. it masks them
+///        both but steps down, so only controller 0 drives the outputs.
+static void test_three_isolated(void) {
+    AF_Lockstep locksteps[3] = { AF_Lockstep(0, 3), AF_Lockstep(1, 3), AF_Lockstep(2, 3) };
+    for (uint32_t t = 0; t < 20; t++) {
+        uint16_t outputs[1] = { (uint16_t)t };
+        uint8_t payloads[3][AF_LOCKSTEP_DIGEST_LEN];
+        for (uint8_t n = 0; n < 3; n++) locksteps[n].submit(t, outputs, 1, payloads[n]);
+        for (uint8_t to = 0; to < 3; to++) {
+            for (uint8_t from = 0; from < 3; from++) {
+                bool cut = t >= 5 && (from == 2 || to == 2);
+                if (from != to && !cut) locksteps[to].on_digest(payloads[from], AF_LOCKSTEP_DIGEST_LEN);
+            }
+            locksteps[to].vote(t);
+        }
+
+        uint8_t in_control = 0;
+        for (uint8_t n = 0; n < 3; n++) in_control += locksteps[n].is_in_control();
+        AF_CHECK(in_control == 1);
+    }
+    AF_CHECK(locksteps[2].is_masked(0) && locksteps[2].is_masked(1));
+    AF_CHECK(!locksteps[2].is_in_control() && locksteps[2].get_controller() == AF_LOCKSTEP_NO_CONTROLLER);
+    AF_CHECK(locksteps[0].is_masked(2) && locksteps[0].is_in_control());
+    AF_CHECK(locksteps[1].get_controller() == 0);
+}
+
+int main(void) {
+    AF_HAL::sim::set_clock_mode(AF_HAL::sim::AF_SIM_CLOCK_VIRTUAL, 1);
+    test_link();
+    test_two_cut_off();
+    test_three_hand_over();
+    test_three_isolated();
+    return AF_TEST_RESULT();
+}
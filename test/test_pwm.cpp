@@ -0,0 +1,52 @@
+// Tests for the pwm engine on the simulator: awrite() finds the channel behind a pin and
+// only stages it, and the frequency limits hold the longest pulse.
+
+#include <af_test.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/pwm_hal.h>
+#include <AF_HAL/sim_hal.h>
+
+/// @brief awrite() maps pins to channels, and leaves latching to commit()
+static void test_awrite(void) {
+    AF_CHECK(AF_HAL::pwm::init(AF_PWM_MODE_STANDARD, 400));
+    AF_CHECK(AF_HAL::pwm::channel_for_pin(11) == 0);
+    AF_CHECK(AF_HAL::pwm::channel_for_pin(5) == 3);
+    AF_CHECK(AF_HAL::pwm::channel_for_pin(8) == 8);
+    AF_CHECK(AF_HAL::pwm::channel_for_pin(0) == -1);
+
+    // a mixer step staged on channels 0 and 1
+    AF_HAL::pwm::enable(0);
+    AF_HAL::pwm::enable(1);
+    AF_HAL::pwm::set(0, 1500);
+    AF_HAL::pwm::set(1, 1600);
+
+    // D5 is channel 3, not channel 5, and writing it latches nothing
+    AF_HAL::io::awrite(5, 1023);
+    AF_CHECK(AF_HAL::sim::get_pwm(0) == 0);
+    AF_CHECK(AF_HAL::sim::get_pwm(3) == 0);
+    AF_CHECK(AF_HAL::sim::get_pwm(5) == 0);
+
+    // it all goes out together with the next commit
+    AF_CHECK(AF_HAL::pwm::commit());
+    AF_CHECK(AF_HAL::sim::get_pwm(0) == 1500);
+    AF_CHECK(AF_HAL::sim::get_pwm(1) == 1600);
+    AF_CHECK(AF_HAL::sim::get_pwm(3) == AF_HAL::pwm::get_period_us() - 1);
+    AF_CHECK(AF_HAL::sim::get_pwm(5) == 0);
+
+    // pins without a channel are ignored
+    AF_HAL::io::awrite(0, 512);
+    AF_CHECK(AF_HAL::pwm::commit());
+}
+
+/// @brief the fastest frequency still leaves room for the longest pulse
+static void test_freq_limits(void) {
+    AF_CHECK(AF_HAL::pwm::init(AF_PWM_MODE_STANDARD, AF_PWM_MAX_FREQ_HZ));
+    AF_CHECK(AF_HAL::pwm::get_period_us() > AF_PWM_MAX_PULSE_US);
+    AF_CHECK(!AF_HAL::pwm::init(AF_PWM_MODE_STANDARD, AF_PWM_MAX_FREQ_HZ + 1));
+}
+
+int main(void) {
+    test_awrite();
+    test_freq_limits();
+    return AF_TEST_RESULT();
+}
@@ -0,0 +1,121 @@
+// Tests for the receiver decoders, fed recorded streams the way the simulator feeds them: PPM
+// edges through sim::feed_ppm() and SBUS bytes through a stream. A lost frame counts once,
+// however many edges or bytes it takes to find the next one. Each receiver has its own topic,
+// for as long as the receiver exists.
+
+#include <af_test.h>
+#include <af_test_stream.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/sim_hal.h>
+#include <AF_RCInput/AF_RCInput.h>
+#include <string.h>
+
+/// @brief packs 16 channels of 11 bits into an SBUS frame
+/// @param frame    where to store the frame
+/// @param raw      the channel values, 172-1811
+/// @param failsafe whether to set the failsafe flag
+static void sbus_encode(uint8_t frame[AF_RC_SBUS_FRAME_LEN], const uint16_t raw[16], bool failsafe) {
+    memset(frame, 0, AF_RC_SBUS_FRAME_LEN);
+    frame[0] = 0x0F;
+    uint32_t bits = 0;
+    uint8_t num_bits = 0, i = 1;
+    for (uint8_t ch = 0; ch < 16; ch++) {
+        bits |= (uint32_t)(raw[ch] & 0x07FF) << num_bits;
+        num_bits += 11;
+        while (num_bits >= 8) {
+            frame[i++] = bits & 0xFF;
+            bits >>= 8;
+            num_bits -= 8;
+        }
+    }
+    frame[23] = failsafe ? (1 << 3) : 0;
+    frame[24] = 0x00;
+}
+
+/// @brief a recorded PPM stream: a partial frame, two good frames, and a glitched one
+static void test_ppm(void) {
+    AF_RCInput_PPM rc(AF_TOPIC_ID("rc.ppm"));
+    rc.begin();
+
+    // joined part way through a frame, so nothing counts until the first sync gap
+    const uint16_t joined[] = { 1500, 1500, 9000 };
+    AF_HAL::sim::feed_ppm(joined, 3);
+    rc.update();
+    AF_CHECK(rc.get_frames_good() == 0 && rc.get_frames_bad() == 0);
+
+    const uint16_t frames[] = { 1000, 1200, 1400, 1600, 1800, 2000, 9000,
+                                1100, 1100, 1100, 1100, 8000 };
+    AF_HAL::sim::feed_ppm(frames, sizeof(frames) / sizeof(frames[0]));
+    rc.update();
+    AF_CHECK(rc.get_frames_good() == 2);
+    AF_CHECK(rc.get_frames_bad() == 0);
+    AF_RC_Frame frame;
+    AF_CHECK(rc.read(frame));
+    AF_CHECK(frame.num_channels == 4);
+    AF_CHECK(rc.get_channel(0) == 1100);
+    AF_CHECK(rc.get_channel(4) == 0);
+
+    // a glitch loses the rest of its frame, and counts once
+    const uint16_t glitched[] = { 1500, 200, 1500, 1500, 1500, 9000 };
+    AF_HAL::sim::feed_ppm(glitched, sizeof(glitched) / sizeof(glitched[0]));
+    rc.update();
+    AF_CHECK(rc.get_frames_good() == 2);
+    AF_CHECK(rc.get_frames_bad() == 1);
+}
+
+/// @brief a recorded SBUS stream with line noise between frames
+static void test_sbus(void) {
+    af_test::Test_Stream port;
+    AF_RCInput_SBUS rc(&port, AF_TOPIC_ID("rc.sbus"));
+
+    uint16_t raw[16];
+    for (uint8_t ch = 0; ch < 16; ch++) raw[ch] = 172 + ch * 100;
+    uint8_t frame[AF_RC_SBUS_FRAME_LEN];
+    sbus_encode(frame, raw, false);
+
+    AF_CHECK(port.feed(frame, sizeof(frame)) == sizeof(frame));
+    rc.update();
+    AF_CHECK(rc.get_frames_good() == 1 && rc.get_frames_bad() == 0);
+    AF_CHECK(rc.get_channel(0) == 987);
+    AF_CHECK(rc.get_channel(15) == (uint16_t)(((172 + 1500) * 5) / 8 + 880));
+    AF_CHECK(!rc.in_failsafe());
+
+    // the tail of a frame cut short: one lost frame, not one per byte skipped
+    AF_CHECK(port.feed(frame + 15, 10) == 10);
+    sbus_encode(frame, raw, true);
+    AF_CHECK(port.feed(frame, sizeof(frame)) == sizeof(frame));
+    rc.update();
+    AF_CHECK(rc.get_frames_good() == 2);
+    AF_CHECK(rc.get_frames_bad() == 1);
+    AF_CHECK(rc.in_failsafe());
+
+    // a long burst of noise counts a lost frame for every frame's worth of it
+    uint8_t noise[60];
+    memset(noise, 0xAA, sizeof(noise));
+    AF_CHECK(port.feed(noise, sizeof(noise)) == sizeof(noise));
+    AF_CHECK(port.feed(frame, sizeof(frame)) == sizeof(frame));
+    rc.update();
+    AF_CHECK(rc.get_frames_good() == 3);
+    AF_CHECK(rc.get_frames_bad() == 1 + 3);
+}
+
+/// @brief two receivers publish to their own topics, and a receiver's topic goes away with it
+static void test_topics(void) {
+    af_test::Test_Stream port;
+    AF_RCInput_PPM primary(AF_TOPIC_ID("rc.primary"));
+    {
+        AF_RCInput_SBUS backup(&port, AF_TOPIC_ID("rc.backup"));
+        AF_CHECK(AF_Topic_Base::find(AF_TOPIC_ID("rc.primary")) == &primary.get_topic());
+        AF_CHECK(AF_Topic_Base::find(AF_TOPIC_ID("rc.backup")) == &backup.get_topic());
+    }
+    AF_CHECK(AF_Topic_Base::find(AF_TOPIC_ID("rc.backup")) == nullptr);
+    AF_CHECK(AF_Topic_Base::find(AF_TOPIC_ID("rc.primary")) == &primary.get_topic());
+}
+
+int main(void) {
+    AF_HAL::sim::set_clock_mode(AF_HAL::sim::AF_SIM_CLOCK_VIRTUAL, 1);
+    test_ppm();
+    test_sbus();
+    test_topics();
+    return AF_TEST_RESULT();
+}
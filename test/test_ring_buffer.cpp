@@ -0,0 +1,157 @@
+// Tests for utilbuf::ring_buffer: the full/empty edge, wrapping, the span API, the
+// statistics, and a producer and consumer thread hammering one buffer.
+
+#include <af_test.h>
+#include <util.h>
+#include <thread>
+
+/// @brief fills and drains a buffer across the wrap, byte by byte
+static void test_fill_drain(void) {
+    utilbuf::static_ring_buffer<16> rb;
+    uint8_t c;
+    AF_CHECK(rb.available() == 0);
+    AF_CHECK(!rb.get(c));
+    // start part way round, so every pass wraps
+    for (uint16_t pass = 0; pass < 40; pass++) {
+        for (uint8_t i = 0; i < 16; i++) AF_CHECK(rb.put(pass + i));
+        AF_CHECK(rb.available() == 16);
+        AF_CHECK(rb.space() == 0);
+        AF_CHECK(!rb.put(0xAA));
+        for (uint8_t i = 0; i < 11; i++) AF_CHECK(rb.get(c) && c == (uint8_t)(pass + i));
+        for (uint8_t i = 11; i < 16; i++) AF_CHECK(rb.get(c) && c == (uint8_t)(pass + i));
+        AF_CHECK(rb.available() == 0);
+        // leave one byte behind, to move the start
+        AF_CHECK(rb.put(0) && rb.get(c));
+    }
+}
+
+/// @brief writes through reserve()/commit() and reads through read_spans()/consume()
+static void test_spans(void) {
+    utilbuf::static_ring_buffer<8> rb;
+    utilbuf::span spans[2];
+    uint8_t c;
+    // move the indices to 5, so the free space wraps
+    for (uint8_t i = 0; i < 5; i++) { rb.put(i); rb.get(c); }
+
+    AF_CHECK(rb.reserve(spans) == 8);
+    AF_CHECK(spans[0].len == 3 && spans[1].len == 5);
+    uint8_t n = 0;
+    for (uint8_t s = 0; s < 2; s++) for (uint8_t i = 0; i < spans[s].len; i++) spans[s].data[i] = n++;
+    // nothing is visible until it's committed
+    AF_CHECK(rb.available() == 0);
+    rb.commit(6);
+    AF_CHECK(rb.available() == 6);
+    AF_CHECK(rb.high_water() == 6);
+
+    AF_CHECK(rb.read_spans(spans) == 6);
+    AF_CHECK(spans[0].len == 3 && spans[1].len == 3);
+    AF_CHECK(spans[1].data[2] == 5);
+    AF_CHECK(rb.peek(4, c) && c == 4);
+    AF_CHECK(!rb.peek(6, c));
+    rb.consume(4);
+    AF_CHECK(rb.get(c) && c == 4);
+    AF_CHECK(rb.clear() == 1);
+    AF_CHECK(rb.available() == 0);
+}
+
+/// @brief write() stores what fits, across the wrap, and counts the rest as dropped
+static void test_write(void) {
+    utilbuf::static_ring_buffer<8> rb;
+    const uint8_t data[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+    uint8_t c;
+    for (uint8_t i = 0; i < 6; i++) { rb.put(i); rb.get(c); }
+
+    AF_CHECK(rb.write(data, 5) == 5);
+    AF_CHECK(rb.write(data + 5, 7) == 3);
+    AF_CHECK(rb.dropped() == 4);
+    for (uint8_t i = 0; i < 8; i++) AF_CHECK(rb.get(c) && c == i);
+    AF_CHECK(rb.write(data, 0) == 0);
+    AF_CHECK(rb.available() == 0);
+}
+
+/// @brief checks the dropped and high-water counters, and that they reset
+static void test_stats(void) {
+    utilbuf::static_ring_buffer<4> rb;
+    for (uint8_t i = 0; i < 10; i++) rb.put(i);
+    AF_CHECK(rb.dropped() == 6);
+    AF_CHECK(rb.high_water() == 4);
+    rb.reset_stats();
+    AF_CHECK(rb.dropped() == 0);
+    AF_CHECK(rb.high_water() == 0);
+
+    // the dropped count saturates rather than rolling over
+    for (uint32_t i = 0; i < 70000; i++) rb.put(0);
+    AF_CHECK(rb.dropped() == 0xFFFF);
+}
+
+/// @brief one thread puts a counting sequence in while another takes it out. nothing may be
+///        lost, duplicated or reordered, however the two threads interleave. each side gives
+///        up its time slice when it can't make progress, so it also runs on one core.
+static void test_stress(void) {
+    static const uint32_t BYTES = 1000000;
+    utilbuf::static_ring_buffer<32> rb;
+    uint32_t mismatches = 0;
+
+    std::thread producer([&rb]() {
+        af_test::Rand rand(1);
+        uint32_t sent = 0;
+        utilbuf::span spans[2];
+        while (sent < BYTES) {
+            // mix single bytes with in-place writes of random lengths
+            if (rb.space() == 0) {
+                std::this_thread::yield();
+            } else if (rand.below(2)) {
+                if (rb.put((uint8_t)sent)) sent++;
+            } else {
+                utilbuf::ring_idx_t room = rb.reserve(spans);
+                utilbuf::ring_idx_t n = room ? 1 + rand.below(room) : 0;
+                if (n > BYTES - sent) n = BYTES - sent;
+                for (utilbuf::ring_idx_t i = 0; i < n; i++) {
+                    utilbuf::span& s = i < spans[0].len ? spans[0] : spans[1];
+                    s.data[i < spans[0].len ? i : i - spans[0].len] = (uint8_t)(sent + i);
+                }
+                rb.commit(n);
+                sent += n;
+            }
+        }
+    });
+
+    af_test::Rand rand(2);
+    uint32_t received = 0;
+    utilbuf::span spans[2];
+    while (received < BYTES) {
+        if (rb.available() == 0) {
+            std::this_thread::yield();
+        } else if (rand.below(2)) {
+            uint8_t c;
+            if (rb.get(c)) {
+                if (c != (uint8_t)received) mismatches++;
+                received++;
+            }
+        } else {
+            utilbuf::ring_idx_t n = rb.read_spans(spans);
+            for (utilbuf::ring_idx_t i = 0; i < n; i++) {
+                uint8_t c = i < spans[0].len ? spans[0].data[i] : spans[1].data[i - spans[0].len];
+                if (c != (uint8_t)(received + i)) mismatches++;
+            }
+            rb.consume(n);
+            received += n;
+        }
+    }
+    producer.join();
+
+    AF_CHECK(mismatches == 0);
+    AF_CHECK(rb.available() == 0);
+    // the producer only ever put what there was room for
+    AF_CHECK(rb.dropped() == 0);
+    AF_CHECK(rb.high_water() <= rb.capacity());
+}
+
+int main(void) {
+    test_fill_drain();
+    test_spans();
+    test_write();
+    test_stats();
+    test_stress();
+    return AF_TEST_RESULT();
+}
@@ -0,0 +1,97 @@
+// Tests for the simulator's serial interfaces: writes give up after
+// AF_SERIAL_WRITE_TIMEOUT_US when nothing drains the port, what was queued still goes out
+// once a peer attaches, and a pty with nothing attached drops bytes like an unplugged uart.
+
+#include <af_test.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/serial_hal.h>
+#include <AF_HAL/sim_hal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+using AF_HAL::hwserial::SerialInterface1;
+using AF_HAL::hwserial::SerialInterface2;
+
+/// @brief writes into a port nobody is reading, then attaches a reader
+static void test_bounded_write(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/af-test-serial-%d", (int)getpid());
+    char backing[80];
+    snprintf(backing, sizeof(backing), "unix:%s", path);
+    setenv("AF_SIM_SERIAL1", backing, 1);
+    SerialInterface1.open(BAUDR_115200);
+
+    uint8_t data[300];
+    for (uint16_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)i;
+
+    // no peer, so only the outbound buffer's worth fits, and the write still returns
+    uint32_t start = AF_HAL::micros();
+    size_t written = SerialInterface1.write(data, sizeof(data));
+    uint32_t waited = AF_HAL::micros() - start;
+    AF_CHECK(written == SerialInterface1.tx_pending());
+    AF_CHECK(written > 0 && written < sizeof(data));
+    AF_CHECK(waited >= AF_SERIAL_WRITE_TIMEOUT_US);
+    AF_CHECK(SerialInterface1.write((uint8_t)0xAA) == 0);
+
+    // a peer attaches, and the queued bytes go out in order
+    int peer = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    AF_CHECK(connect(peer, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    SerialInterface1._poll();
+    SerialInterface1._poll();
+    AF_CHECK(SerialInterface1.tx_pending() == 0);
+
+    uint8_t got[300];
+    ssize_t n = read(peer, got, sizeof(got));
+    AF_CHECK(n == (ssize_t)written);
+    AF_CHECK(memcmp(got, data, written) == 0);
+
+    // with a reader, a large write makes it all the way through
+    AF_CHECK(SerialInterface1.write(data, sizeof(data)) == sizeof(data));
+
+    close(peer);
+    SerialInterface1.close();
+    unlink(path);
+}
+
+/// @brief writes into a pty nobody has open, then attaches to it
+static void test_pty_unplugged(void) {
+    unsetenv("AF_SIM_SERIAL2");
+    SerialInterface2.open(BAUDR_115200);
+
+    // nothing attached: the bytes are dropped straight away instead of waiting out the timeout
+    uint8_t data[300];
+    memset(data, 0x55, sizeof(data));
+    uint32_t start = AF_HAL::micros();
+    AF_CHECK(SerialInterface2.write(data, sizeof(data)) == sizeof(data));
+    AF_CHECK(AF_HAL::micros() - start < AF_SERIAL_WRITE_TIMEOUT_US);
+    SerialInterface2._poll();
+    AF_CHECK(SerialInterface2.tx_pending() == 0);
+
+    // whoever attaches next sees only what was sent after they did
+    int slave = open("/tmp/autoflight-serial2", O_RDWR | O_NOCTTY | O_NONBLOCK);
+    AF_CHECK(slave >= 0);
+    const uint8_t hello[] = { 'h', 'e', 'l', 'l', 'o' };
+    AF_CHECK(SerialInterface2.write(hello, sizeof(hello)) == sizeof(hello));
+    SerialInterface2._poll();
+    uint8_t got[64];
+    ssize_t n = read(slave, got, sizeof(got));
+    AF_CHECK(n == sizeof(hello));
+    AF_CHECK(memcmp(got, hello, sizeof(hello)) == 0);
+
+    close(slave);
+    SerialInterface2.close();
+}
+
+int main(void) {
+    // the virtual clock moves on every call, so waiting out the timeout is instant
+    AF_HAL::sim::set_clock_mode(AF_HAL::sim::AF_SIM_CLOCK_VIRTUAL, 1);
+    test_bounded_write();
+    test_pty_unplugged();
+    return AF_TEST_RESULT();
+}
@@ -0,0 +1,92 @@
+// Tests for the TWI transaction engine on the simulator's mock bus: a bus error or a hung
+// transaction halts the bus, and the queue only moves on once update() has recovered it.
+
+#include <af_test.h>
+#include <AF_HAL/AF_HAL.h>
+#include <AF_HAL/twi_hal.h>
+#include <AF_HAL/sim_hal.h>
+
+/// @brief runs the mock bus until a transaction is no longer pending, or 10 ms have passed
+static void run(AF_TWI_Transaction& t) {
+    for (uint16_t i = 0; i < 1000 && t.status == AF_TWI_PENDING; i++) AF_HAL::sim::advance(10);
+}
+
+/// @brief makes a register read descriptor
+static AF_TWI_Transaction read_of(uint8_t address, uint8_t reg, uint8_t* buffer, uint8_t len) {
+    AF_TWI_Transaction t = {};
+    t.address = address;
+    t.reg = reg;
+    t.len = len;
+    t.flags = AF_TWI_FLAG_READ;
+    t.buffer = buffer;
+    return t;
+}
+
+/// @brief a bus error leaves the next transaction queued until update() has freed the bus
+static void test_bus_error(void) {
+    AF_HAL::sim::AF_Sim_TWI_Register_Device device(0x68);
+    device.regs[0x3B] = 0x12;
+    device.regs[0x3C] = 0x34;
+    AF_CHECK(AF_HAL::sim::twi_attach(&device));
+    AF_HAL::twi::init();
+
+    uint8_t first[2], second[2];
+    AF_TWI_Transaction a = read_of(0x68, 0x3B, first, 2);
+    AF_TWI_Transaction b = read_of(0x68, 0x3B, second, 2);
+    AF_HAL::sim::twi_inject_fault(AF_HAL::sim::AF_SIM_TWI_FAULT_BUS_ERROR);
+    AF_CHECK(AF_HAL::twi::submit(&a));
+    AF_CHECK(AF_HAL::twi::submit(&b));
+
+    run(a);
+    AF_CHECK(a.status == AF_TWI_BUS_ERROR);
+    // the ISR only halted the bus, nothing moves until the task recovers it
+    run(b);
+    AF_CHECK(b.status == AF_TWI_PENDING);
+    AF_CHECK(AF_HAL::twi::is_busy());
+    AF_CHECK(AF_HAL::twi::get_recoveries() == 0);
+
+    AF_HAL::twi::update();
+    AF_CHECK(AF_HAL::twi::get_recoveries() == 1);
+    run(b);
+    AF_CHECK(b.status == AF_TWI_OK);
+    AF_CHECK(second[0] == 0x12 && second[1] == 0x34);
+    AF_CHECK(!AF_HAL::twi::is_busy());
+
+    AF_HAL::sim::twi_detach(&device);
+}
+
+/// @brief a hung transaction times out in update(), which recovers the bus there and then
+static void test_hang(void) {
+    AF_HAL::sim::AF_Sim_TWI_Register_Device device(0x1E);
+    device.regs[0x03] = 0xAB;
+    AF_CHECK(AF_HAL::sim::twi_attach(&device));
+    AF_HAL::twi::init();
+
+    uint8_t first, second;
+    AF_TWI_Transaction a = read_of(0x1E, 0x03, &first, 1);
+    AF_TWI_Transaction b = read_of(0x1E, 0x03, &second, 1);
+    uint16_t recoveries = AF_HAL::twi::get_recoveries();
+    AF_HAL::sim::twi_inject_fault(AF_HAL::sim::AF_SIM_TWI_FAULT_HANG);
+    AF_CHECK(AF_HAL::twi::submit(&a));
+    AF_CHECK(AF_HAL::twi::submit(&b));
+
+    AF_HAL::sim::advance(AF_TWI_TIMEOUT_US / 2);
+    AF_HAL::twi::update();
+    AF_CHECK(a.status == AF_TWI_PENDING);
+
+    AF_HAL::sim::advance(AF_TWI_TIMEOUT_US);
+    AF_HAL::twi::update();
+    AF_CHECK(a.status == AF_TWI_TIMEOUT);
+    AF_CHECK(AF_HAL::twi::get_recoveries() == recoveries + 1);
+    run(b);
+    AF_CHECK(b.status == AF_TWI_OK && second == 0xAB);
+
+    AF_HAL::sim::twi_detach(&device);
+}
+
+int main(void) {
+    AF_HAL::sim::set_clock_mode(AF_HAL::sim::AF_SIM_CLOCK_VIRTUAL, 1);
+    test_bus_error();
+    test_hang();
+    return AF_TEST_RESULT();
+}
@@ -0,0 +1,117 @@
+// Tests for saving variables to EEPROM: values survive a save and load, a save cut short
+// leaves every variable at its initial value, a key that hashes to the end marker still loads,
+// and variables that would share a record are kept out of EEPROM.
+
+#include <af_test.h>
+#include <AF_Context/AF_Context.h>
+#include <AF_HAL/eeprom_hal.h>
+#include <AF_Variable/AF_Variable.h>
+#include <util.h>
+
+/// where the tests save, away from address 0 to catch offset mistakes
+static const uint16_t ADDR = 16;
+/// the flags of a saved variable
+static const uint8_t STORED = AF_VAR_FLAG_EEPROM_STORED;
+
+/// @brief values saved in one boot load in the next
+static void test_round_trip(void) {
+    AF_Context context;
+    AF_Context_Scope scope(context);
+    AF_Float gain("t.gain", 0.5f, STORED);
+    AF_UInt16 rate("t.rate", 50, STORED);
+    AF_UInt8 mode("t.mode", 1, 0);
+
+    gain = 0.75f;
+    rate = 400;
+    mode = 3;
+    AF_CHECK(AF_Variable_Storage::get_instance()->save(ADDR) == 2);
+
+    gain = 0.5f;
+    rate = 50;
+    mode = 1;
+    AF_CHECK(AF_Variable_Storage::get_instance()->load(ADDR) == 2);
+    AF_CHECK(gain.get() == 0.75f && rate.get() == 400);
+    // not saved, so left alone
+    AF_CHECK(mode.get() == 1);
+}
+
+/// @brief a reset partway through a save: the records changed, but the CRC that's written
+///        last didn't. nothing is loaded rather than a mix of the two saves.
+static void test_cut_short(void) {
+    AF_Context context;
+    AF_Context_Scope scope(context);
+    AF_UInt16 a("t.a", 1, STORED);
+    AF_UInt16 b("t.b", 2, STORED);
+    AF_Variable_Storage* variables = AF_Variable_Storage::get_instance();
+    variables->save(ADDR);
+
+    uint8_t crc[2];
+    AF_HAL::eeprom::read(ADDR + 2, crc, 2);
+    a = 10;
+    b = 20;
+    variables->save(ADDR);
+    AF_HAL::eeprom::update(ADDR + 2, crc, 2);
+
+    a = 1;
+    b = 2;
+    AF_CHECK(variables->load(ADDR) == 0);
+    AF_CHECK(a.get() == 1 && b.get() == 2);
+
+    // finishing the save makes it load
+    variables->save(ADDR);
+    AF_CHECK(variables->load(ADDR) == 2);
+}
+
+/// @brief "t.4610" hashes to 0xFFFF, the end marker, and the variables after it still load
+static void test_end_marker_key(void) {
+    AF_Context context;
+    AF_Context_Scope scope(context);
+    AF_UInt8 first("t.4610", 1, STORED);
+    AF_UInt8 second("t.after", 2, STORED);
+    AF_CHECK(utilintern::id("var", first.get_idfr()) == 0xFFFF);
+
+    first = 5;
+    second = 6;
+    AF_Variable_Storage::get_instance()->save(ADDR);
+    first = 1;
+    second = 2;
+    AF_CHECK(AF_Variable_Storage::get_instance()->load(ADDR) == 2);
+    AF_CHECK(first.get() == 5 && second.get() == 6);
+}
+
+/// @brief a second variable with an identifier or EEPROM key that's taken isn't saved, so it
+///        can't load into the first one's record
+static void test_collisions(void) {
+    AF_Context context;
+    AF_Context_Scope scope(context);
+    AF_Variable_Storage* variables = AF_Variable_Storage::get_instance();
+    AF_UInt16 original("t.dup", 1, STORED);
+    AF_UInt16 duplicate("t.dup", 2, STORED);
+    // the same key, from different identifiers ("t.4610" and "t.72584" both hash to 0xFFFF)
+    AF_UInt8 key_a("t.4610", 3, STORED);
+    AF_UInt8 key_b("t.72584", 4, STORED);
+    // not saved, so only the identifier can collide
+    AF_UInt8 unsaved("t.72584", 5, 0);
+
+    AF_CHECK(variables->get_collisions() == 3);
+    AF_CHECK(original.is_eeprom_stored() && !duplicate.is_eeprom_stored());
+    AF_CHECK(key_a.is_eeprom_stored() && !key_b.is_eeprom_stored());
+    AF_CHECK(variables->save(ADDR) == 2);
+
+    original = 10;
+    duplicate = 20;
+    variables->save(ADDR);
+    original = 1;
+    duplicate = 2;
+    variables->load(ADDR);
+    AF_CHECK(original.get() == 10 && duplicate.get() == 2);
+    (void)unsaved;
+}
+
+int main(void) {
+    test_round_trip();
+    test_cut_short();
+    test_end_marker_key();
+    test_collisions();
+    return AF_TEST_RESULT();
+}
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""Turns AF_Logger records back into text.
+
+The vehicle only sends the id of each log call's format string and the raw arguments (see
+lib/AF_Logger/AF_Logger.h). This finds every AF_LOG call in the source, works out each format
+string's id the same way utilintern::id() does, and formats records read from a capture of a
+log stream (a serial port dump or a log file from the SD card).
+
+usage:
+    tools/af_log.py dict [-o dictionary.json] [source dirs...]
+    tools/af_log.py decode [--dict dictionary.json | --source dir ...] capture.bin
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from gcs_dictionary import SOURCE_EXTENSIONS, _STRING, _in_comment_or_macro, intern, unescape  # noqa: E402
+
+LEVELS = ("DEBUG", "INFO", "WARN", "ERROR")
+LOG_PATTERNS = (
+    re.compile(r"\bAF_LOG\s*\(\s*[^,]+?\s*,\s*[^,]+?\s*,\s*" + _STRING),
+    re.compile(r"\bAF_LOG_(?:DEBUG|INFO|WARN|ERROR)\s*\(\s*[^,]+?\s*,\s*" + _STRING),
+    re.compile(r"\bAF_LOG_TO_ALL\s*\(\s*" + _STRING),
+)
+
+# wire types, see af_log::wire_type
+WIRE_FORMATS = {
+    "u8": "<B", "i8": "<b", "u16": "<H", "i16": "<h", "u32": "<I", "i32": "<i",
+    "u64": "<Q", "i64": "<q", "f32": "<f", "bool": "<?",
+}
+PLACEHOLDER = re.compile(r"\{\{|\{(\w+)\}")
+
+AF_GCS_MSG_LOG = 6
+FRAME_HEADER = struct.Struct("<BBBB")
+RECORD_HEADER = struct.Struct("<HI")
+
+
+def scan(paths):
+    """Builds the dictionary: format id -> {format, sources}."""
+    dictionary = {}
+    collisions = False
+    for root_path in paths:
+        for root, _, files in os.walk(root_path):
+            for name in sorted(files):
+                if not name.endswith(SOURCE_EXTENSIONS):
+                    continue
+                path = os.path.join(root, name)
+                with open(path, encoding="utf-8", errors="replace") as f:
+                    text = f.read()
+                for pattern in LOG_PATTERNS:
+                    for match in pattern.finditer(text):
+                        if _in_comment_or_macro(text, match.start()):
+                            continue
+                        line = text.count("\n", 0, match.start()) + 1
+                        fmt = unescape(match.group(1))
+                        key = "0x%04X" % intern(b"log", fmt)
+                        fmt = fmt.decode("latin-1")
+                        entry = dictionary.setdefault(key, {"format": fmt, "sources": []})
+                        if entry["format"] != fmt:
+                            print("%s:%d: id %s is already used by \"%s\"" % (path, line, key, entry["format"]),
+                                  file=sys.stderr)
+                            collisions = True
+                            continue
+                        entry["sources"].append("%s:%d" % (path, line))
+    return dictionary, collisions
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, see utilcrc::crc16()."""
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def frames(data):
+    """Yields the valid frames in a capture as (header, payload), see AF_GCS_Protocol.h."""
+    for encoded in data.split(b"\x00"):
+        decoded = bytearray()
+        i = 0
+        ok = len(encoded) > 0
+        while ok and i < len(encoded):
+            code = encoded[i]
+            block = encoded[i + 1:i + code]
+            if code == 0 or len(block) != code - 1:
+                ok = False
+                break
+            decoded += block
+            i += code
+            if code != 0xFF and i < len(encoded):
+                decoded.append(0)
+        if not ok or len(decoded) < FRAME_HEADER.size + 2:
+            continue
+        body, crc = decoded[:-2], decoded[-2] | (decoded[-1] << 8)
+        if crc16(body) != crc:
+            continue
+        header = FRAME_HEADER.unpack_from(body)
+        payload = bytes(body[FRAME_HEADER.size:])
+        if header[3] != len(payload):
+            continue
+        yield header, payload
+
+
+def format_record(fmt, args):
+    """Fills in a format string's placeholders from the packed arguments."""
+    out = []
+    pos = 0
+    last = 0
+    for match in PLACEHOLDER.finditer(fmt):
+        out.append(fmt[last:match.start()])
+        last = match.end()
+        if match.group(1) is None:
+            out.append("{")
+            continue
+        wire = struct.Struct(WIRE_FORMATS[match.group(1)])
+        if pos + wire.size > len(args):
+            out.append("<missing>")
+            continue
+        out.append(str(wire.unpack_from(args, pos)[0]))
+        pos += wire.size
+    out.append(fmt[last:])
+    return "".join(out)
+
+
+def decode(capture, dictionary, out):
+    for header, payload in frames(capture):
+        if header[0] != AF_GCS_MSG_LOG or len(payload) < RECORD_HEADER.size:
+            continue
+        fmt_id, timestamp = RECORD_HEADER.unpack_from(payload)
+        level = LEVELS[header[1] & 0x0F] if (header[1] & 0x0F) < len(LEVELS) else "?"
+        entry = dictionary.get("0x%04X" % fmt_id)
+        args = payload[RECORD_HEADER.size:]
+        text = format_record(entry["format"], args) if entry else "<unknown format 0x%04X> %s" % (fmt_id, args.hex())
+        out.write("%10.6f %-5s %s\n" % (timestamp / 1e6, level, text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    dict_parser = sub.add_parser("dict", help="write the format string dictionary")
+    dict_parser.add_argument("paths", nargs="*", default=["lib", "AutoFlight Copter"], help="source directories to scan")
+    dict_parser.add_argument("-o", "--output", help="where to write the dictionary, stdout if not given")
+
+    decode_parser = sub.add_parser("decode", help="format the records in a capture")
+    decode_parser.add_argument("capture", help="the capture, - for stdin")
+    decode_parser.add_argument("--dict", help="a dictionary written by the dict command")
+    decode_parser.add_argument("--source", action="append", help="source directories to scan instead of --dict")
+
+    args = parser.parse_args()
+
+    if args.command == "dict":
+        dictionary, collisions = scan(args.paths)
+        if collisions:
+            return 1
+        output = json.dumps(dict(sorted(dictionary.items())), indent=4)
+        if args.output:
+            with open(args.output, "w") as f:
+                f.write(output + "\n")
+        else:
+            print(output)
+        return 0
+
+    if args.dict:
+        with open(args.dict) as f:
+            dictionary = json.load(f)
+    else:
+        dictionary, _ = scan(args.source or ["lib", "AutoFlight Copter"])
+    if args.capture == "-":
+        capture = sys.stdin.buffer.read()
+    else:
+        with open(args.capture, "rb") as f:
+            capture = f.read()
+    decode(capture, dictionary, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Turns af_profile::report() records into cycles per call, and checks them against a baseline.
+
+The vehicle logs each profile point's counts with the point's name interned (see
+lib/AF_Profiler/AF_Profiler.h). This finds every AF_PROFILE_POINT in the source to name them,
+takes the last report of each point from a capture of a log stream, and writes the results as
+JSON. Given a baseline written the same way, it fails if any point got slower by more than the
+threshold, so a regression is caught before the firmware flies.
+
+`make -C test profile` builds with AF_PROFILE_ENABLED=1, runs the hot paths natively on the
+simulator HAL and runs this on what they report. Those are host timings, good for comparing
+builds on one machine. Exact cycle counts need the firmware on an AVR simulator (i.e. simavr -m
+atmega2560 -f 16000000 firmware.elf, with the UART captured to a file), which needs an AVR build
+the tree doesn't have yet; the capture format is the same either way.
+
+usage:
+    tools/af_profile.py capture.bin [-o results.json] [--baseline baseline.json] [--threshold 5]
+                        [--source dir]...
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from af_log import AF_GCS_MSG_LOG, RECORD_HEADER, frames  # noqa: E402
+from gcs_dictionary import SOURCE_EXTENSIONS, _STRING, _in_comment_or_macro, intern, unescape  # noqa: E402
+
+# see af_profile::report()
+REPORT_FORMAT = b"profile {u16}: {u32} calls, {u32} cycles, min {u32}, max {u32}"
+REPORT_ARGS = struct.Struct("<HIIII")
+POINT_PATTERN = re.compile(r"\bAF_PROFILE_(?:POINT\s*\(\s*[^,]+?\s*,|ID\s*\()\s*" + _STRING)
+
+
+def names(paths):
+    """Maps each profile point's id to its name."""
+    found = {}
+    for root_path in paths:
+        for root, _, files in os.walk(root_path):
+            for name in sorted(files):
+                if not name.endswith(SOURCE_EXTENSIONS):
+                    continue
+                with open(os.path.join(root, name), encoding="utf-8", errors="replace") as f:
+                    text = f.read()
+                for match in POINT_PATTERN.finditer(text):
+                    if _in_comment_or_macro(text, match.start()):
+                        continue
+                    point = unescape(match.group(1))
+                    found[intern(b"profile", point)] = point.decode("latin-1")
+    return found
+
+
+def results(capture, point_names):
+    """Gets the last report of each point, with what timing a scope costs taken off."""
+    report_id = intern(b"log", REPORT_FORMAT)
+    reports = {}
+    for header, payload in frames(capture):
+        if header[0] != AF_GCS_MSG_LOG or len(payload) < RECORD_HEADER.size + REPORT_ARGS.size:
+            continue
+        fmt_id, _ = RECORD_HEADER.unpack_from(payload)
+        if fmt_id != report_id:
+            continue
+        point_id, calls, cycles, low, high = REPORT_ARGS.unpack_from(payload, RECORD_HEADER.size)
+        name = point_names.get(point_id, "0x%04X" % point_id)
+        reports[name] = (calls, cycles, low, high)
+
+    overhead = reports.pop("overhead", (0, 0, 0, 0))[2]
+    out = {}
+    for name, (calls, cycles, low, high) in sorted(reports.items()):
+        if calls == 0:
+            continue
+        out[name] = {
+            "calls": calls,
+            "cycles_per_call": max(cycles / calls - overhead, 0.0),
+            "min": max(low - overhead, 0),
+            "max": max(high - overhead, 0),
+        }
+    return out
+
+
+def regressions(current, baseline, threshold_pct):
+    """Yields a line for every point that's slower than its baseline by more than the threshold."""
+    for name, base in sorted(baseline.items()):
+        now = current.get(name)
+        if now is None:
+            continue
+        limit = base["cycles_per_call"] * (1 + threshold_pct / 100.0)
+        if now["cycles_per_call"] > limit:
+            yield "%s: %.1f cycles per call, was %.1f (+%.1f%%)" % (
+                name, now["cycles_per_call"], base["cycles_per_call"],
+                100.0 * (now["cycles_per_call"] / base["cycles_per_call"] - 1) if base["cycles_per_call"] else 100.0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="the capture, - for stdin")
+    parser.add_argument("-o", "--output", help="where to write the results, stdout if not given")
+    parser.add_argument("--baseline", help="results to compare against")
+    parser.add_argument("--threshold", type=float, default=5.0, help="the slowdown allowed, in percent")
+    parser.add_argument("--source", action="append", help="source directories to scan for point names")
+    args = parser.parse_args()
+
+    if args.capture == "-":
+        capture = sys.stdin.buffer.read()
+    else:
+        with open(args.capture, "rb") as f:
+            capture = f.read()
+    current = results(capture, names(args.source or ["lib", "AutoFlight Copter"]))
+
+    output = json.dumps(current, indent=4)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(output + "\n")
+    else:
+        print(output)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        slower = list(regressions(current, baseline, args.threshold))
+        for line in slower:
+            print(line, file=sys.stderr)
+        if slower:
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
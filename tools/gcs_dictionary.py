@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Builds the dictionary the ground station uses to turn interned GCS message ids back into text.
+
+Finds every GCS_EMIT (and AF_GCS_ID) in the source, works out each message's id the same way
+af_gcs::intern() does in lib/AF_GCS/AF_GCS.h, and writes the dictionary as JSON. Fails if two
+different messages end up with the same id, so reword one of them.
+
+usage: tools/gcs_dictionary.py [-o dictionary.json] [source dirs...]
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+SOURCE_EXTENSIONS = (".h", ".cpp", ".ino")
+
+_STRING = r'"((?:[^"\\]|\\.)*)"'
+EMIT_PATTERN = re.compile(r"GCS_EMIT\s*\(\s*([^,]+?)\s*,\s*" + _STRING + r"\s*,\s*([^,]+?)\s*,\s*" + _STRING)
+ID_PATTERN = re.compile(r"AF_GCS_ID\s*\(\s*" + _STRING + r"\s*,\s*" + _STRING + r"\s*\)")
+
+
+def unescape(literal):
+    """Turns the text of a C string literal into the bytes it stands for."""
+    return literal.encode("latin-1").decode("unicode_escape").encode("latin-1")
+
+
+def intern(comp_name, msg):
+    """See af_gcs::intern()."""
+    h = 2166136261
+    for c in comp_name:
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    h = (h * 16777619) & 0xFFFFFFFF
+    for c in msg:
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return (h >> 16) ^ (h & 0xFFFF)
+
+
+def _in_comment_or_macro(text, pos):
+    """Whether a match is in a line comment or a macro definition, like the examples in AF_GCS.h."""
+    line = text[text.rfind("\n", 0, pos) + 1:pos].lstrip()
+    return line.startswith(("//", "*", "#define"))
+
+
+def scan(paths):
+    """Yields (file, line, group, priority, component, message) for every interned message."""
+    for root_path in paths:
+        for root, _, files in os.walk(root_path):
+            for name in sorted(files):
+                if not name.endswith(SOURCE_EXTENSIONS):
+                    continue
+                path = os.path.join(root, name)
+                with open(path, encoding="utf-8", errors="replace") as f:
+                    text = f.read()
+                for match in EMIT_PATTERN.finditer(text):
+                    if _in_comment_or_macro(text, match.start()):
+                        continue
+                    line = text.count("\n", 0, match.start()) + 1
+                    yield path, line, match.group(1), match.group(3), match.group(2), match.group(4)
+                for match in ID_PATTERN.finditer(text):
+                    if _in_comment_or_macro(text, match.start()):
+                        continue
+                    line = text.count("\n", 0, match.start()) + 1
+                    yield path, line, None, None, match.group(1), match.group(2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("paths", nargs="*", default=["lib", "AutoFlight Copter"], help="source directories to scan")
+    parser.add_argument("-o", "--output", help="where to write the dictionary, stdout if not given")
+    args = parser.parse_args()
+
+    dictionary = {}
+    collisions = False
+    for path, line, group, priority, comp_name, msg in scan(args.paths):
+        comp_text, msg_text = unescape(comp_name), unescape(msg)
+        msg_id = intern(comp_text, msg_text)
+        key = "0x%04X" % msg_id
+        entry = dictionary.get(key)
+        if entry is None:
+            entry = dictionary[key] = {
+                "component": comp_text.decode("latin-1"),
+                "message": msg_text.decode("latin-1"),
+                "group": group,
+                "priority": priority,
+                "sources": [],
+            }
+        elif (entry["component"], entry["message"]) != (comp_text.decode("latin-1"), msg_text.decode("latin-1")):
+            print("%s:%d: id %s is already used by %s: %s" % (path, line, key, entry["component"], entry["message"]),
+                  file=sys.stderr)
+            collisions = True
+            continue
+        entry["sources"].append("%s:%d" % (path, line))
+
+    if collisions:
+        return 1
+
+    output = json.dumps(dict(sorted(dictionary.items())), indent=4)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(output + "\n")
+    else:
+        print(output)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())